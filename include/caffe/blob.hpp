@@ -19,8 +19,8 @@ template <typename Dtype>
 class Blob {
  public:
   Blob()
-       : data_(), diff_(), num_(0), channels_(0), height_(0), width_(0),
-       count_(0), capacity_(0) {}
+       : data_(), diff_(), index_(), num_(0), channels_(0), height_(0), width_(0),
+       count_(0), capacity_(0), has_diff_rows_(false), diff_dropped_(false) {}
   explicit Blob(const int num, const int channels, const int height,
     const int width);
   /**
@@ -89,6 +89,11 @@ class Blob {
     return diff_;
   }
 
+  inline const shared_ptr<SyncedMemory>& index() const {
+    CHECK(index_);
+    return index_;
+  }
+
   const Dtype* cpu_data() const;
   void set_cpu_data(Dtype* data);
   const Dtype* gpu_data() const;
@@ -98,6 +103,20 @@ class Blob {
   Dtype* mutable_gpu_data();
   Dtype* mutable_cpu_diff();
   Dtype* mutable_gpu_diff();
+  /**
+   * @brief Integer storage of count() elements kept beside the data, for
+   *        blobs that carry ids (e.g. the item and user ids produced by
+   *        InteractionDataLayer) rather than values.
+   *
+   * Ids stored as Dtype lose precision above 2^24 for float. The index is
+   * only allocated when first accessed and is shared by ShareData(), so it
+   * follows the data through split layers. Once written, it is copied along
+   * with the data by CopyFrom() and kept by ToProto() and FromProto().
+   */
+  const int* cpu_index() const;
+  const int* gpu_index() const;
+  int* mutable_cpu_index();
+  int* mutable_gpu_index();
   void Update();
   void FromProto(const BlobProto& proto);
   void ToProto(BlobProto* proto, bool write_diff = false) const;
@@ -114,6 +133,7 @@ class Blob {
    *
    * This deallocates the SyncedMemory holding this Blob's data_, as
    * shared_ptr calls its destructor when reset with the "=" operator.
+   * The index is shared along with the data.
    */
   void ShareData(const Blob& other);
   /**
@@ -125,16 +145,64 @@ class Blob {
    * shared_ptr calls its destructor when reset with the "=" operator.
    */
   void ShareDiff(const Blob& other);
+  /**
+   * @brief Exchange the shape and the storage (data, diff and index) of this
+   *        Blob with those of Blob other, without copying any element.
+   *
+   * The prefetching data layers use this to hand a whole batch to their tops.
+   */
+  void Swap(Blob& other);
+  /**
+   * @brief Back the data_ (resp. diff_) of this Blob by a SyncedMemory of at
+   *        least its capacity, which other Blob%s may use as well.
+   *
+   * Net uses this to let blobs that are never alive at the same time share
+   * one buffer. A later Reshape beyond the capacity gives the Blob memory of
+   * its own again. The index is not affected.
+   */
+  void SetDataMemory(const shared_ptr<SyncedMemory>& memory);
+  void SetDiffMemory(const shared_ptr<SyncedMemory>& memory);
+  /**
+   * @brief Free the diff, and never allocate one again, not even on Reshape.
+   *
+   * Net does this to the blobs of nets in inference mode (NetState), so
+   * that only Forward runs. Reading or writing the diff afterwards is an
+   * error; FromProto ignores the diff of the proto, and ToProto writes none.
+   */
+  void DropDiff();
+  inline bool diff_dropped() const { return diff_dropped_; }
+
+  /**
+   * @brief Mark the diff as row-sparse: only the listed rows (runs of width()
+   *        contiguous elements) may hold non-zero values.
+   *
+   * Layers with embedding-style parameters (e.g. MatrixFactorizeLayer) use
+   * this so that Update() and the CPU solvers only touch the rows that were
+   * actually used by the current batch. The caller is responsible for keeping
+   * the diff of every other row at zero, so dense consumers of the diff stay
+   * correct.
+   */
+  void set_diff_rows(const vector<int>& rows);
+  inline void clear_diff_rows() {
+    has_diff_rows_ = false;
+    diff_rows_.clear();
+  }
+  inline bool has_diff_rows() const { return has_diff_rows_; }
+  inline const vector<int>& diff_rows() const { return diff_rows_; }
 
  protected:
   shared_ptr<SyncedMemory> data_;
   shared_ptr<SyncedMemory> diff_;
+  shared_ptr<SyncedMemory> index_;
   int num_;
   int channels_;
   int height_;
   int width_;
   int count_;
   int capacity_;
+  bool has_diff_rows_;
+  vector<int> diff_rows_;
+  bool diff_dropped_;
 
   DISABLE_COPY_AND_ASSIGN(Blob);
 };  // class Blob
@@ -2,6 +2,7 @@
 #define CAFFE_COMMON_HPP_
 
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/tss.hpp>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
@@ -94,8 +95,12 @@ class Caffe {
     shared_ptr<Generator> generator_;
   };
 
-  // Getters for boost rng, curand, and cublas handles
+  // Getters for boost rng, curand, and cublas handles. A thread given a
+  // generator of its own by set_thread_random_seed draws from that one.
   inline static RNG& rng_stream() {
+    if (thread_random_generator_.get()) {
+      return *thread_random_generator_;
+    }
     if (!Get().random_generator_) {
       Get().random_generator_.reset(new RNG());
     }
@@ -122,6 +127,10 @@ class Caffe {
   inline static void set_phase(Phase phase) { Get().phase_ = phase; }
   // Sets the random seed of both boost and curand
   static void set_random_seed(const unsigned int seed);
+  // Gives the calling thread a boost generator of its own, freed when the
+  // thread exits. Threads that run layers at the same time need one each,
+  // as the shared generator is not synchronized.
+  static void set_thread_random_seed(const unsigned int seed);
   // Sets the device. Since we have cublas and curand stuff, set device also
   // requires us to reset those values.
   static void SetDevice(const int device_id);
@@ -134,6 +143,7 @@ class Caffe {
   curandGenerator_t curand_generator_;
 #endif
   shared_ptr<RNG> random_generator_;
+  static boost::thread_specific_ptr<RNG> thread_random_generator_;
 
   Brew mode_;
   Phase phase_;
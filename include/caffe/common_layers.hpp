@@ -4,7 +4,6 @@
 #include <string>
 #include <utility>
 #include <vector>
-#include <map> // for MatrixFactorizeLayer
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
@@ -213,6 +212,8 @@ class FlattenLayer : public Layer<Dtype> {
   }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
+  virtual inline bool TopsShareBottomData() const { return true; }
+  virtual inline bool BottomSharesTopDiff() const { return true; }
 
  protected:
   /**
@@ -249,6 +250,9 @@ class FlattenLayer : public Layer<Dtype> {
  * @brief Also known as a "fully-connected" layer, computes an inner product
  *        with a set of learned weights, and (optionally) adds biases.
  *
+ * With fused_relu set, the ReLU of a fused in-place RELU layer is applied to
+ * the top right after the bias.
+ *
  * TODO(dox): thorough documentation for Forward, Backward, and proto params.
  */
 template <typename Dtype>
@@ -285,14 +289,17 @@ class InnerProductLayer : public Layer<Dtype> {
   int N_; // num_output
   bool bias_term_;
   Blob<Dtype> bias_multiplier_;
+  // fused_relu: the ReLU applied to the top as it is computed
+  bool fused_relu_;
+  Dtype relu_negative_slope_;
 };
 
 /**
  * @brief Matrix factorization layer, computes an inner product
  *        with a set of learned weights, and (optionally) adds biases.
  *        bottom[0]: V
- *        bottom[1]: itact_data
- *        bottom[2]: itact_count
+ *        bottom[1]: itact_data, (itemid, userid) pairs in the blob index
+ *        bottom[2]: itact_count, (offset, size) per item in the blob index
  *
  *        top[0]: itact_label_pred
  *        top[1]: num_ratings
@@ -347,15 +354,48 @@ class MatrixFactorizeLayer : public Layer<Dtype> {
   int max_rating_size_; // MAX input number of rating, bottom[0]->num(); vary each time
   int num_rating_; // actual number of instance, bottom[0]->num(); vary each time
   bool gen_item_diff_; // mark whether we have computed item feature diff
-
-  // hold corresponding itemid, for each userid
-  map<int, vector<int> > user2itemid;
-  // hold a itemid to relative itemid map here.
-  map<int, int> itemid2relative_id;
+  bool sparse_grad_; // only touched rows of user/item diff are maintained
+  int num_threads_; // number of threads for the CPU passes
+  shared_ptr<WorkerPool> workers_; // run the ranges of the CPU passes
+  // item range of each thread, [item_bound_[t], item_bound_[t+1])
+  vector<int> item_bound_;
+  // range of touched_users_ of each thread in the backward pass
+  vector<int> user_bound_;
+
+  // unique userid / real itemid seen in the current batch
+  vector<int> touched_users_;
+  vector<int> touched_items_;
+
+  // CSR index of the current batch: the ratings of touched_users_[u] are
+  // user_rating_idx_[user_rating_start_[u] ... user_rating_start_[u+1]).
+  // All vectors are reused across batches, so no per-rating allocation.
+  vector<int> user_rating_start_;
+  vector<int> user_rating_idx_;
+  // relative itemid of each rating
+  vector<int> rating_item_;
+  // scratch indexed by real userid / itemid, kept at -1 / 0 between batches
+  vector<int> user_slot_;
+  vector<char> item_seen_;
 
  private:
-  // building map item2userid and user2itemid
+  // building the CSR index user -> rating indices
   void Build_map(const vector<Blob<Dtype>*>& bottom);
+  // split the items and the users into num_threads_ ranges with similar
+  // number of ratings
+  void Partition_batch(const vector<Blob<Dtype>*>& bottom);
+  // score the ratings of items [item_begin, item_end)
+  void Forward_items_cpu(const vector<Blob<Dtype>*>& bottom,
+      Dtype* item_feature_buf, Dtype* itact_pred_,
+      const int item_begin, const int item_end);
+  // user diff of touched_users_[user_begin, user_end)
+  void Backward_users_cpu(const Dtype* rating_diff, const Dtype* item_feature,
+      Dtype* user_feature_diff, const int user_begin, const int user_end);
+  // unweighted diff of relative items [item_begin, item_end) into item_diff
+  void Backward_items_cpu(const Dtype* rating_diff, const Dtype* user_feature,
+      const int* itact_data_, const int* itact_count_, Dtype* item_diff,
+      const int item_begin, const int item_end);
+  // zero the diff of blobs_[param_id] before accumulation, row-wise if sparse
+  void Clear_param_diff(const int param_id, const vector<int>& rows);
   void Backward_User_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
   void Backward_User_gpu(const vector<Blob<Dtype>*>& top,
@@ -518,6 +558,7 @@ class SplitLayer : public Layer<Dtype> {
   }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int MinTopBlobs() const { return 1; }
+  virtual inline bool TopsShareBottomData() const { return true; }
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
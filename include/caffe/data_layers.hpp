@@ -17,6 +17,8 @@
 #include "caffe/internal_thread.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/label_table.hpp"
+#include "caffe/util/prefetch_queue.hpp"
 
 #include <hash_map>
 #include <fstream>
@@ -114,13 +116,32 @@ class BasePrefetchingDataLayer :
 
   virtual void CreatePrefetchThread();
   virtual void JoinPrefetchThread();
-  // The thread's function
-  virtual void InternalThreadEntry() {}
+  // The thread's function: loads batches until JoinPrefetchThread
+  virtual void InternalThreadEntry();
+  // Fills the prefetch blobs with the next batch
+  virtual void load_batch() {}
+
+  // The transformer of decode slice i of a batch. Every slice has its own
+  // random stream, so crops do not depend on how the threads are scheduled.
+  DataTransformer<Dtype>* slice_transformer(const int slice) {
+    return slice == 0 ? &this->data_transformer_ :
+        slice_transformers_[slice - 1].get();
+  }
+  int num_decode_slice() const { return slice_transformers_.size() + 1; }
+
+  const PrefetchQueue<Dtype>& prefetch_queue() const {
+    return prefetch_queue_;
+  }
 
  protected:
   Blob<Dtype> prefetch_data_;
   Blob<Dtype> prefetch_label_;
   Blob<Dtype> prefetch_id_;   // for LabelDataLayer
+  vector<Blob<Dtype>*> prefetch_blobs_;  // the blobs load_batch fills
+  PrefetchQueue<Dtype> prefetch_queue_;
+  vector<shared_ptr<DataTransformer<Dtype> > > slice_transformers_;
+  // run the decode slices of every batch
+  shared_ptr<WorkerPool> decode_workers_;
 };
 
 template <typename Dtype>
@@ -140,7 +161,15 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
   virtual inline int MaxTopBlobs() const { return 2; }
 
  protected:
-  virtual void InternalThreadEntry();
+  virtual void load_batch();
+  // Parses and transforms the records [begin, end) of batch_record_.
+  void decode_slice(Dtype* top_data, Dtype* top_label, const int begin,
+      const int end, const int slice);
+
+  // the serialized records of the batch being prefetched, in the LMDB map
+  // or in batch_raw_
+  vector<std::pair<const char*, int> > batch_record_;
+  vector<string> batch_raw_;
 
   // LEVELDB
   shared_ptr<leveldb::DB> db_;
@@ -201,6 +230,8 @@ class BaseLabelDataLayer : public Layer<Dtype> {
   int total_size_;
   __gnu_cxx::hash_map<int, int> ID2Idx_; // write once and read many times, use hash_map
   Blob<Dtype> label_set_; // contain the actual label in order
+  // set instead of ID2Idx_ and label_set_ when data_param.label_table is
+  shared_ptr<LabelTable> label_table_;
 };
 
 template <typename Dtype>
@@ -223,13 +254,32 @@ class BasePrefetchingLabelDataLayer :
 
   virtual void CreatePrefetchThread();
   virtual void JoinPrefetchThread();
-  // The thread's function
-  virtual void InternalThreadEntry() {}
+  // The thread's function: loads batches until JoinPrefetchThread
+  virtual void InternalThreadEntry();
+  // Fills the prefetch blobs with the next batch
+  virtual void load_batch() {}
+
+  // The transformer of decode slice i of a batch. Every slice has its own
+  // random stream, so crops do not depend on how the threads are scheduled.
+  DataTransformer<Dtype>* slice_transformer(const int slice) {
+    return slice == 0 ? &this->data_transformer_ :
+        slice_transformers_[slice - 1].get();
+  }
+  int num_decode_slice() const { return slice_transformers_.size() + 1; }
+
+  const PrefetchQueue<Dtype>& prefetch_queue() const {
+    return prefetch_queue_;
+  }
 
  protected:
   Blob<Dtype> prefetch_data_;
   Blob<Dtype> prefetch_label_;
   Blob<Dtype> prefetch_id_;   // for LabelDataLayer
+  vector<Blob<Dtype>*> prefetch_blobs_;  // the blobs load_batch fills
+  PrefetchQueue<Dtype> prefetch_queue_;
+  vector<shared_ptr<DataTransformer<Dtype> > > slice_transformers_;
+  // run the decode slices of every batch
+  shared_ptr<WorkerPool> decode_workers_;
 };
 
 /**
@@ -254,7 +304,15 @@ class LabelDataLayer : public BasePrefetchingLabelDataLayer<Dtype> {
   virtual inline int MaxTopBlobs() const { return 3; }
 
  protected:
-  virtual void InternalThreadEntry();
+  virtual void load_batch();
+  // Parses and transforms the records [begin, end) of batch_record_.
+  void decode_slice(Dtype* top_data, Dtype* top_label, Dtype* top_id,
+      const int begin, const int end, const int slice);
+
+  // the serialized records of the batch being prefetched, in the LMDB map
+  // or in batch_raw_
+  vector<std::pair<const char*, int> > batch_record_;
+  vector<string> batch_raw_;
 
   // LEVELDB
   shared_ptr<leveldb::DB> db_;
@@ -298,13 +356,36 @@ class MemoryMappingDataLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {}
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
+  // Resolves and gathers on the device, against a copy of the label table
+  // made by the first call.
   virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
-      vector<Blob<Dtype>*>* top) { return Forward_cpu(bottom, top); }
+      vector<Blob<Dtype>*>* top);
+
+  // The label row of id, or -1 if there is none.
+  int FindRow(const int id) const;
+  // Copies the label rows of the batch items [begin, end) to top_label.
+  void GatherSlice(const int* rows, const Dtype* mem_label, Dtype* top_label,
+      const int begin, const int end, const int slice);
+  // Fills device_id_ and, for a label table, device_label_. The table is
+  // converted and uploaded a chunk of rows at a time, so the host never holds
+  // a Dtype copy of all of it; the device holds the whole table.
+  void SetUpDeviceTable();
 
   int label_dim_;
   int total_size_;
   __gnu_cxx::hash_map<int, int> ID2Idx_; // write once and read many times, use hash_map
   Blob<Dtype> label_set_; // contain the actual label in order
+  // set instead of ID2Idx_ and label_set_ when data_param.label_table is
+  shared_ptr<LabelTable> label_table_;
+
+  // index: the label row of every item of the batch
+  Blob<Dtype> batch_row_;
+  // run the gather_threads slices of the copy
+  shared_ptr<WorkerPool> gather_workers_;
+  // for Forward_gpu. index: (id, row) pairs sorted by id
+  Blob<Dtype> device_id_;
+  // the label table converted to Dtype; label_set_ is used directly
+  Blob<Dtype> device_label_;
 };
 
 /**
@@ -448,7 +529,7 @@ class ImageDataLayer : public BasePrefetchingDataLayer<Dtype> {
  protected:
   shared_ptr<Caffe::RNG> prefetch_rng_;
   virtual void ShuffleImages();
-  virtual void InternalThreadEntry();
+  virtual void load_batch();
 
   vector<std::pair<std::string, int> > lines_;
   int lines_id_;
@@ -518,7 +599,7 @@ class WindowDataLayer : public BasePrefetchingDataLayer<Dtype> {
 
  protected:
   virtual unsigned int PrefetchRand();
-  virtual void InternalThreadEntry();
+  virtual void load_batch();
 
   shared_ptr<Caffe::RNG> prefetch_rng_;
   vector<std::pair<std::string, vector<int> > > image_database_;
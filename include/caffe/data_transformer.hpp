@@ -1,8 +1,11 @@
 #ifndef CAFFE_DATA_TRANSFORMER_HPP
 #define CAFFE_DATA_TRANSFORMER_HPP
 
+#include <stdint.h>
+
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/datum_view.hpp"
 
 namespace caffe {
 
@@ -37,6 +40,19 @@ class DataTransformer {
    */
   void Transform(const int batch_item_id, const Datum& datum,
                  const Dtype* mean, Dtype* transformed_data);
+  /**
+   * @brief Same as above for a uint8 image of the given shape that does not
+   *        live in a Datum, e.g. one read from a memory mapped file.
+   */
+  void Transform(const int batch_item_id, const uint8_t* data,
+                 const int channels, const int height, const int width,
+                 const Dtype* mean, Dtype* transformed_data);
+  /**
+   * @brief Same as above for a Datum read in place, so that its pixels are
+   *        read straight from the serialized record.
+   */
+  void Transform(const int batch_item_id, const DatumView& datum,
+                 const Dtype* mean, Dtype* transformed_data);
 
  protected:
   virtual unsigned int Rand();
@@ -17,6 +17,9 @@
 #include "caffe/internal_thread.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/datum_view.hpp"
+#include "caffe/util/interaction_file.hpp"
+#include "caffe/util/prefetch_queue.hpp"
 
 namespace caffe {
 
@@ -87,8 +90,22 @@ class BasePrefetchingInteractionDataLayer :
 
   virtual void CreatePrefetchThread();
   virtual void JoinPrefetchThread();
-  // The thread's function
-  virtual void InternalThreadEntry() {}
+  // The thread's function: loads batches until JoinPrefetchThread
+  virtual void InternalThreadEntry();
+  // Fills the prefetch blobs with the next batch
+  virtual void load_batch() {}
+
+  // The transformer of decode slice i of a batch. Every slice has its own
+  // random stream, so crops do not depend on how the threads are scheduled.
+  DataTransformer<Dtype>* slice_transformer(const int slice) {
+    return slice == 0 ? &this->data_transformer_ :
+        slice_transformers_[slice - 1].get();
+  }
+  int num_decode_slice() const { return slice_transformers_.size() + 1; }
+
+  const PrefetchQueue<Dtype>& prefetch_queue() const {
+    return prefetch_queue_;
+  }
 
  protected:
   Blob<Dtype> prefetch_data_;
@@ -97,6 +114,11 @@ class BasePrefetchingInteractionDataLayer :
   Blob<Dtype> prefetch_itact_data_;
   Blob<Dtype> prefetch_itact_label_;
   Blob<Dtype> prefetch_itact_count_;
+  vector<Blob<Dtype>*> prefetch_blobs_;  // the blobs load_batch fills
+  PrefetchQueue<Dtype> prefetch_queue_;
+  vector<shared_ptr<DataTransformer<Dtype> > > slice_transformers_;
+  // run the decode slices of every batch
+  shared_ptr<WorkerPool> decode_workers_;
 };
 
 template <typename Dtype>
@@ -113,15 +135,75 @@ class InteractionDataLayer : public BasePrefetchingInteractionDataLayer<Dtype> {
   }
   virtual inline int ExactNumBottomBlobs() const { return 0; }
   virtual inline int ExactNumTopBlobs() const { return 5; }
-  // Only 4 blobs are allowed: data, label, interaction, interaction label
+  // The 5 tops are data, label, interaction (itemid, userid), interaction
+  // label (rating) and interaction count (offset, number of ratings) per
+  // item. Interaction and interaction count are stored in the blob index,
+  // and copied to the data for the layers that read Dtype values (exact for
+  // float up to 2^24).
+  // Interaction and interaction label hold exactly the ratings of the batch,
+  // so their num() changes from batch to batch. With single_pass, the batch
+  // at the end of the key range holds fewer than batch_size records.
 
  private:
   void random_skip();
+  // Moves to begin_key, or to the first record of a new epoch.
+  void first_record();
+  void next_record();
+  // Moves to the next record in key order; false at the end of the range.
+  bool step();
+  // Whether the current record is before end_key.
+  bool in_range();
+  // Points record at the current record of the database cursor, copying it
+  // to raw unless raw is NULL; only LevelDB needs the copy.
+  void read_record(std::pair<const char*, int>* record, string* raw);
+  // shuffle INDEX: reads the keys of the range.
+  void build_index();
+  // shuffle INDEX: moves to record index_pos_ of the epoch.
+  void seek_index();
+  // shuffle BUFFER: hands a random record of the buffer to the batch, and
+  // refills its slot with the current record. A buffer holding the whole
+  // range is drawn without replacement instead, one pass at a time.
+  void take_buffered(const int item_id);
 
  protected:
-  virtual void InternalThreadEntry();
+  virtual void load_batch();
+  // Parses the records [begin, end) of batch_record_ into batch_itact_.
+  void parse_slice(const int begin, const int end, const int slice);
+  // Transforms the records [begin, end) and lays out their ratings; a NULL
+  // top_data skips the images, already transformed as they were read.
+  void decode_slice(Dtype* top_data, Dtype* top_label, int* top_data_itact,
+      Dtype* top_label_itact, const int begin, const int end,
+      const int slice);
+
+  // the records of the batch being prefetched, gathered before the ratings
+  // are laid out; for the databases batch_record_, in the LMDB map or in
+  // batch_raw_, parsed in place into batch_itact_, and batch_record_id_ for
+  // COLUMNAR
+  vector<std::pair<const char*, int> > batch_record_;
+  vector<string> batch_raw_;
+  vector<DatumInteractionView> batch_itact_;
+  vector<int64_t> batch_record_id_;
+  // single_pass: the end of the range has been reached
+  bool exhausted_;
 
-  int inact_total_size;
+  // shuffle INDEX: the keys of the range end to end, key i at
+  // [index_offset_[i], index_offset_[i + 1]), and the order of the epoch,
+  // key numbers for the databases and record numbers for COLUMNAR
+  string index_keys_;
+  vector<int64_t> index_offset_;
+  vector<int64_t> index_order_;
+  int64_t index_pos_;
+  // shuffle BUFFER: the records waiting to be drawn, and for a range short
+  // enough to be buffered whole, the slot order of the current pass
+  vector<std::pair<const char*, int> > buffer_record_;
+  vector<string> buffer_raw_;
+  vector<int> buffer_order_;
+  int buffer_pos_;
+  shared_ptr<Caffe::RNG> prefetch_rng_;
+  // the I/O spent, reported when the layer is destroyed
+  int64_t num_read_;
+  int64_t num_step_;
+  int64_t num_seek_;
 
   // LEVELDB
   shared_ptr<leveldb::DB> db_;
@@ -132,6 +214,53 @@ class InteractionDataLayer : public BasePrefetchingInteractionDataLayer<Dtype> {
   MDB_txn* mdb_txn_;
   MDB_cursor* mdb_cursor_;
   MDB_val mdb_key_, mdb_value_;
+  // COLUMNAR
+  shared_ptr<InteractionFile> itact_file_;
+  int64_t record_id_;
+};
+
+/**
+ * @brief Interleaves the records of several interaction sources into one
+ *        batch stream, drawing the source of every record at random with
+ *        probability proportional to its weight.
+ *
+ * Every source of data_param().mix_source() is read by an
+ * InteractionDataLayer of its own, with its own prefetch and decode threads;
+ * this layer's prefetch thread only copies the drawn records into its
+ * batches. The tops are those of InteractionDataLayer.
+ */
+template <typename Dtype>
+class MixedInteractionDataLayer :
+    public BasePrefetchingInteractionDataLayer<Dtype> {
+ public:
+  explicit MixedInteractionDataLayer(const LayerParameter& param)
+      : BasePrefetchingInteractionDataLayer<Dtype>(param) {}
+  virtual ~MixedInteractionDataLayer();
+  virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+  virtual inline LayerParameter_LayerType type() const {
+    return LayerParameter_LayerType_MIXED_DATA_ITACT;
+  }
+  virtual inline int ExactNumBottomBlobs() const { return 0; }
+  virtual inline int ExactNumTopBlobs() const { return 5; }
+
+ protected:
+  virtual void load_batch();
+  // Draws the source of the next record.
+  int draw_source();
+
+  vector<shared_ptr<InteractionDataLayer<Dtype> > > sources_;
+  // the tops of every source, holding its current batch
+  vector<vector<Blob<Dtype>*> > source_tops_;
+  // the records of the current batch of every source taken so far
+  vector<int> source_pos_;
+  // the cumulative weights of the sources
+  vector<float> cumulative_weight_;
+  // the ratings of the batch being mixed, laid out as in the tops
+  vector<int> mix_itact_;
+  vector<Dtype> mix_rating_;
+  shared_ptr<Caffe::RNG> prefetch_rng_;
 };
 
 }  // namespace caffe
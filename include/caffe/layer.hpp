@@ -12,6 +12,10 @@
 
 namespace caffe {
 
+// Worker threads for the CPU passes of a layer, in util/parallel.hpp, which
+// the headers compiled by nvcc do not include.
+class WorkerPool;
+
 /**
  * @brief An interface for the units of computation which can be composed into a
  *        Net.
@@ -31,7 +35,7 @@ class Layer {
    * layer.
    */
   explicit Layer(const LayerParameter& param)
-    : layer_param_(param) {
+    : layer_param_(param), inference_(false) {
       // The only thing we do is to copy blobs if there are any.
       if (layer_param_.blobs_size() > 0) {
         blobs_.resize(layer_param_.blobs_size());
@@ -269,6 +273,20 @@ class Layer {
     return true;
   }
 
+  /**
+   * @brief Returns true if the Forward pass points the tops at the data of
+   *        bottom 0 (see Blob::ShareData) instead of writing their own.
+   *
+   * The memory plan of the Net keeps the data of bottom 0 alive for as long
+   * as any of these tops is read.
+   */
+  virtual inline bool TopsShareBottomData() const { return false; }
+  /**
+   * @brief Returns true if the Backward pass points the diff of bottom 0 at
+   *        the diff of top 0 (see Blob::ShareDiff).
+   */
+  virtual inline bool BottomSharesTopDiff() const { return false; }
+
   /**
    * @brief Specifies whether the layer should compute gradients w.r.t. a
    *        parameter at a particular index given by param_id.
@@ -291,6 +309,14 @@ class Layer {
     param_propagate_down_[param_id] = value;
   }
 
+  /**
+   * @brief Sets whether the layer only runs Forward (see NetState), so that
+   *        SetUp and Reshape may skip the state only Backward uses.
+   *
+   * Must be called before SetUp.
+   */
+  inline void set_inference(const bool value) { inference_ = value; }
+  inline bool inference() const { return inference_; }
 
  protected:
   /** The protobuf that stores the layer parameters */
@@ -303,6 +329,8 @@ class Layer {
   /** The vector that indicates whether each top blob has a non-zero weight in
    *  the objective function. */
   vector<Dtype> loss_;
+  /** Whether the layer only runs Forward. */
+  bool inference_;
 
   /** @brief Using the CPU device, compute the layer output. */
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -4,13 +4,13 @@
 #include <string>
 #include <utility>
 #include <vector>
-#include <fstream> // for dump layer
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/neuron_layers.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/async_writer.hpp"  // for dump layer
 
 namespace caffe {
 
@@ -118,7 +118,7 @@ class DumpColumnLayer : public Layer<Dtype> {
     // }
   }
 
-  std::ofstream out;
+  shared_ptr<AsyncWriter> writer_;
 };
 
 /**
@@ -157,14 +157,14 @@ class DumpLayer : public Layer<Dtype> {
   }
 
   int num_rating_; // actual number of instance, bottom[0]->num(); vary each time
-  std::ofstream out;
+  shared_ptr<AsyncWriter> writer_;
 };
 
 /**
  * @brief Dump bottom blob into a file, along with itemid. Only used with Matrix Factorization Layer.
  *    bottom[0]: feature
- *    bottom[1]: itact_data
- *    bottom[2]: itact_count
+ *    bottom[1]: itact_data, in the blob index
+ *    bottom[2]: itact_count, in the blob index
  */
 template <typename Dtype>
 class DumpFeatureLayer : public Layer<Dtype> {
@@ -194,7 +194,8 @@ class DumpFeatureLayer : public Layer<Dtype> {
       if (propagate_down[i]) { NOT_IMPLEMENTED; }
     }
   }
-  std::ofstream out;
+  shared_ptr<AsyncWriter> writer_;
+  vector<int> row_id_;  // the (item id, 0) columns of the rows
 };
 
 /**
@@ -224,7 +225,7 @@ class SnapshotLayer : public Layer<Dtype> {
       vector<Blob<Dtype>*>* top);
   virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
-  std::ofstream out;
+  shared_ptr<AsyncWriter> writer_;
 };
 
 /**
@@ -517,7 +518,9 @@ class EuclideanWithFixedLossLayer : public LossLayer<Dtype> {
   RMSE layer: euclidean loss layer with variable length
   bottom[0]: pred
   bottom[1]: label
-  bottom[2]: total number of ratings
+  bottom[2]: total number of ratings, optional; without it every element
+             of pred counts, as with the ragged batches of
+             InteractionDataLayer
 */
 template <typename Dtype>
 class RmseLossLayer : public LossLayer<Dtype> {
@@ -531,7 +534,9 @@ class RmseLossLayer : public LossLayer<Dtype> {
     return LayerParameter_LayerType_RMSE_LOSS;
   }
 
-  virtual inline int ExactNumBottomBlobs() const { return 3; }
+  virtual inline int ExactNumBottomBlobs() const { return -1; }
+  virtual inline int MinBottomBlobs() const { return 2; }
+  virtual inline int MaxBottomBlobs() const { return 3; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
 
  protected:
@@ -146,6 +146,8 @@ class Net {
   const shared_ptr<Layer<Dtype> > layer_by_name(const string& layer_name);
 
   void set_debug_info(const bool value) { debug_info_ = value; }
+  /// @brief Whether the net only runs Forward (NetState::inference).
+  inline bool inference() const { return inference_; }
 
   // Helpers for Init.
   /**
@@ -157,6 +159,12 @@ class Net {
   /// @brief return whether NetState state meets NetStateRule rule
   static bool StateMeetsRule(const NetState& state, const NetStateRule& rule,
       const string& layer_name);
+  /**
+   * @brief Drop the in-place RELU layers that follow a CONVOLUTION or
+   *        INNER_PRODUCT layer, setting its fused_relu instead; for nets in
+   *        inference mode, as the fused ReLU has no backward.
+   */
+  static void FuseReLU(const NetParameter& param, NetParameter* param_fused);
 
  protected:
   // Helpers for Init.
@@ -181,6 +189,11 @@ class Net {
 
   /// @brief Get misc parameters, e.g. the LR multiplier and weight decay.
   void GetLearningRateAndWeightDecay();
+  /**
+   * @brief Let the blobs that are not alive at the same time share their
+   *        data (or, for NetParameter::DIFF, their diff) memory.
+   */
+  void PlanMemory(const NetParameter& param);
 
   /// @brief Individual layers in the net
   vector<shared_ptr<Layer<Dtype> > > layers_;
@@ -224,6 +237,8 @@ class Net {
   size_t memory_used_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
+  /// Whether the net only runs Forward, without diffs.
+  bool inference_;
 
   DISABLE_COPY_AND_ASSIGN(Net);
 };
@@ -81,6 +81,15 @@ class SGDSolver : public Solver<Dtype> {
   virtual void PreSolve();
   Dtype GetLearningRate();
   virtual void ComputeUpdateValue();
+  // CPU update of one param, restricted to its touched rows if the diff is
+  // row-sparse (see Blob::set_diff_rows).
+  void ComputeUpdateValueCPU(const int param_id, const Dtype local_rate,
+      const Dtype local_decay);
+  // Apply the update rule to elements [offset, offset + count) of a param.
+  virtual void ComputeUpdateValueRange(const int param_id, const int offset,
+      const int count, const Dtype local_rate, const Dtype local_decay);
+  void RegularizeRange(const int param_id, const int offset, const int count,
+      const Dtype local_decay);
   virtual void SnapshotSolverState(SolverState * state);
   virtual void RestoreSolverState(const SolverState& state);
   // history maintains the historical momentum data.
@@ -102,6 +111,8 @@ class NesterovSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue();
+  virtual void ComputeUpdateValueRange(const int param_id, const int offset,
+      const int count, const Dtype local_rate, const Dtype local_decay);
 
   DISABLE_COPY_AND_ASSIGN(NesterovSolver);
 };
@@ -116,6 +127,8 @@ class AdaGradSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue();
+  virtual void ComputeUpdateValueRange(const int param_id, const int offset,
+      const int count, const Dtype local_rate, const Dtype local_decay);
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with AdaGrad.";
@@ -124,6 +137,47 @@ class AdaGradSolver : public SGDSolver<Dtype> {
   DISABLE_COPY_AND_ASSIGN(AdaGradSolver);
 };
 
+/**
+ * @brief Runs SGD with momentum from num_threads threads at once, Hogwild!
+ *        style: each thread drives its own replica of the train net, the
+ *        replicas share the parameter data, and updates are applied unlocked.
+ *
+ * Meant for CPU training of embedding-heavy nets (e.g. MatrixFactorizeLayer),
+ * where an iteration updates a few rows of large tables and threads rarely
+ * write the same row. Data layers should set rand_skip so that the replicas
+ * read different parts of the source, and use LMDB since a LevelDB can only be
+ * opened once per process. Momentum history is kept per thread and only the
+ * main thread's goes into snapshots. Testing, display and snapshots run with
+ * the other threads stopped. Every other thread draws its random numbers
+ * (dropout, fillers) from a generator of its own, seeded from the main one.
+ */
+template <typename Dtype>
+class HogwildSolver : public SGDSolver<Dtype> {
+ public:
+  explicit HogwildSolver(const SolverParameter& param)
+      : SGDSolver<Dtype>(param) {}
+  explicit HogwildSolver(const string& param_file)
+      : SGDSolver<Dtype>(param_file) {}
+
+  virtual void Solve(const char* resume_file = NULL);
+
+ protected:
+  // Run iterations begin, begin + stride, ... up to end on this replica.
+  void RunIterations(const int begin, const int end, const int stride);
+  // RunIterations on a worker thread, with a random generator of its own.
+  void RunWorker(const int begin, const int end, const int stride,
+      const unsigned int rng_seed);
+  // The first iteration after iter_ at which to display, test or snapshot.
+  int NextStop() const;
+
+  vector<shared_ptr<HogwildSolver<Dtype> > > workers_;
+  // loss and number of ratings of the last RunIterations call
+  Dtype loss_sum_;
+  int64_t num_rating_;
+
+  DISABLE_COPY_AND_ASSIGN(HogwildSolver);
+};
+
 template <typename Dtype>
 Solver<Dtype>* GetSolver(const SolverParameter& param) {
   SolverParameter_SolverType type = param.solver_type();
@@ -135,6 +189,8 @@ Solver<Dtype>* GetSolver(const SolverParameter& param) {
       return new NesterovSolver<Dtype>(param);
   case SolverParameter_SolverType_ADAGRAD:
       return new AdaGradSolver<Dtype>(param);
+  case SolverParameter_SolverType_HOGWILD:
+      return new HogwildSolver<Dtype>(param);
   default:
       LOG(FATAL) << "Unknown SolverType: " << type;
   }
@@ -0,0 +1,95 @@
+#ifndef CAFFE_UTIL_ASYNC_WRITER_HPP_
+#define CAFFE_UTIL_ASYNC_WRITER_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Writes rows of numbers to a file from a background thread.
+ *
+ * The calling thread only copies the columns of its rows into the block
+ * being filled. Full blocks go to the writer thread, which formats them,
+ * optionally gzips them and writes them while the next block fills, so
+ * nothing is formatted or flushed on the calling thread.
+ *
+ * A text file holds one line per row, the columns formatted as an
+ * std::ostream would format them. A binary file holds the blocks as they
+ * were filled: a sequence of entries, each an AsyncWriterEntry followed
+ * by, for rows, num_column AsyncWriterColumns, each followed by its
+ * num * width values, and for a line its length bytes. Every part is padded
+ * to a multiple of 8 bytes, and all values are in host byte order.
+ */
+struct AsyncWriterEntry {
+  enum Kind { ROWS = 0, LINE = 1 };
+  int32_t kind;
+  int32_t num;         // rows; the length of a LINE
+  int32_t num_column;  // column groups of the rows
+  char separator;      // between the columns of a text row
+  char trailing;       // whether the separator also ends a text row
+  char pad[2];
+};
+
+struct AsyncWriterColumn {
+  enum Type { INT32 = 0, FLOAT = 1, DOUBLE = 2 };
+  int32_t type;
+  int32_t width;  // columns in the group
+};
+
+class AsyncWriter {
+ public:
+  // Appends to filename; compress writes gzip members.
+  AsyncWriter(const string& filename, const bool binary, const bool compress,
+      const int block_size);
+  // Writes everything queued and stops the thread.
+  ~AsyncWriter();
+
+  // Starts num rows. Their columns are added by the AddColumns calls that
+  // follow, each with num * width values, row after row.
+  void BeginRows(const int num, const char separator, const bool trailing);
+  void AddColumns(const int* values, const int width);
+  void AddColumns(const float* values, const int width);
+  void AddColumns(const double* values, const int width);
+  // Writes line and a newline.
+  void WriteLine(const string& line);
+  // Blocks until everything queued so far is in the file.
+  void Flush();
+
+  inline const string& filename() const { return filename_; }
+
+ protected:
+  void Append(const void* data, const size_t size);
+  void AddColumnGroup(const int type, const void* values, const size_t size,
+      const int width);
+  // Hands the filled block to the thread, waiting for the previous one.
+  void HandOff();
+  // The thread: formats and writes each block it is handed.
+  void ThreadEntry();
+  void WriteBlock(const vector<char>& block);
+
+  string filename_;
+  bool binary_;
+  size_t block_size_;
+
+  // keeps boost::thread and zlib out of the headers compiled by nvcc
+  class sync;
+  shared_ptr<sync> sync_;
+
+  vector<char> filling_;  // the block the calling thread adds to
+  vector<char> pending_;  // the block the thread writes
+  bool busy_;             // pending_ holds a block
+  bool stopped_;
+  size_t entry_offset_;   // the AsyncWriterEntry of the rows begun last
+  vector<char> text_;     // the thread's formatting buffer
+
+  DISABLE_COPY_AND_ASSIGN(AsyncWriter);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_ASYNC_WRITER_HPP_
@@ -0,0 +1,58 @@
+#ifndef CAFFE_UTIL_DATUM_VIEW_HPP_
+#define CAFFE_UTIL_DATUM_VIEW_HPP_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief The fields of a serialized Datum, read in place.
+ *
+ * Parsing a Datum copies its pixel bytes into a string; the view instead
+ * points data at them, inside the buffer it was parsed from, so they are
+ * only read once, by the transformer. The buffer has to outlive the view.
+ * A Datum holding float_data leaves data NULL; its buffer is then parsed
+ * as a Datum.
+ */
+class DatumView {
+ public:
+  DatumView() { Clear(); }
+
+  // Reads the serialized Datum in buffer; false if it is malformed.
+  bool Parse(const char* buffer, const int size);
+  void Clear();
+
+  int channels;
+  int height;
+  int width;
+  int label;
+  const uint8_t* data;  // channels * height * width pixels, or NULL
+  int data_size;
+  // the serialized Datum
+  const char* buffer;
+  int size;
+};
+
+/**
+ * @brief A serialized DatumInteraction, read in place.
+ *
+ * The datum is a DatumView into the buffer, while the ratings are copied
+ * into the vectors, which keep their memory from record to record.
+ */
+class DatumInteractionView {
+ public:
+  bool Parse(const char* buffer, const int size);
+
+  DatumView datum;
+  vector<int> itemid;
+  vector<int> userid;
+  vector<float> rating;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DATUM_VIEW_HPP_
@@ -9,6 +9,15 @@ void im2col_cpu(const Dtype* data_im, const int channels,
     const int pad_h, const int pad_w, const int stride_h,
     const int stride_w, Dtype* data_col);
 
+// As above, with the rows of the column matrix col_stride values apart
+// instead of height_col * width_col, so that several images can be lowered
+// side by side into one wide column matrix.
+template <typename Dtype>
+void im2col_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int col_stride, Dtype* data_col);
+
 template <typename Dtype>
 void col2im_cpu(const Dtype* data_col, const int channels,
     const int height, const int width, const int patch_h, const int patch_w,
@@ -0,0 +1,117 @@
+#ifndef CAFFE_UTIL_INTERACTION_FILE_HPP_
+#define CAFFE_UTIL_INTERACTION_FILE_HPP_
+
+#include <stdint.h>
+
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Layout of a columnar interaction file, the flat counterpart of a
+ *        database of DatumInteraction records.
+ *
+ * The header is followed by
+ *   uint8   image[num_record][channels * height * width]
+ *   int64   rating_start[num_record + 1]  (8 byte aligned)
+ *   int32   label[num_record]
+ *   int32   itemid[num_rating]
+ *   int32   userid[num_rating]
+ *   float   rating[num_rating]
+ * where the ratings of record r are [rating_start[r], rating_start[r + 1]).
+ * All values are stored in host byte order.
+ */
+struct InteractionFileHeader {
+  char magic[8];
+  int32_t version;
+  int32_t channels;
+  int32_t height;
+  int32_t width;
+  int64_t num_record;
+  int64_t num_rating;
+};
+
+/**
+ * @brief Read-only, memory mapped view of a columnar interaction file.
+ *
+ * Nothing is parsed or copied when reading a record: the accessors point
+ * straight into the mapping, and pages are loaded by the OS as they are used.
+ */
+class InteractionFile {
+ public:
+  explicit InteractionFile(const string& filename);
+  ~InteractionFile();
+
+  inline int64_t num_record() const { return header_->num_record; }
+  inline int64_t num_rating() const { return header_->num_rating; }
+  inline int channels() const { return header_->channels; }
+  inline int height() const { return header_->height; }
+  inline int width() const { return header_->width; }
+  inline int image_size() const { return channels() * height() * width(); }
+
+  inline const uint8_t* image(const int64_t record) const {
+    return image_ + record * image_size();
+  }
+  inline int label(const int64_t record) const { return label_[record]; }
+  inline int64_t rating_start(const int64_t record) const {
+    return rating_start_[record];
+  }
+  inline int num_rating(const int64_t record) const {
+    return rating_start_[record + 1] - rating_start_[record];
+  }
+  inline const int* itemid() const { return itemid_; }
+  inline const int* userid() const { return userid_; }
+  inline const float* rating() const { return rating_; }
+
+ protected:
+  size_t size_;
+  void* map_;
+  const InteractionFileHeader* header_;
+  const uint8_t* image_;
+  const int64_t* rating_start_;
+  const int* label_;
+  const int* itemid_;
+  const int* userid_;
+  const float* rating_;
+
+  DISABLE_COPY_AND_ASSIGN(InteractionFile);
+};
+
+/**
+ * @brief Writes DatumInteraction records to a columnar interaction file.
+ *
+ * Images are streamed to the file as records are added; the rating columns
+ * are kept in memory (12 bytes per rating) and written by Close().
+ */
+class InteractionFileWriter {
+ public:
+  explicit InteractionFileWriter(const string& filename);
+  ~InteractionFileWriter();
+
+  // All records must hold uint8 images of the same shape.
+  void Add(const DatumInteraction& record);
+  void Close();
+
+  inline int64_t num_record() const { return label_.size(); }
+  inline int64_t num_rating() const { return rating_.size(); }
+
+ protected:
+  std::ofstream file_;
+  InteractionFileHeader header_;
+  vector<int64_t> rating_start_;
+  vector<int> label_;
+  vector<int> itemid_;
+  vector<int> userid_;
+  vector<float> rating_;
+
+  DISABLE_COPY_AND_ASSIGN(InteractionFileWriter);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_INTERACTION_FILE_HPP_
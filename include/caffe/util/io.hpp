@@ -16,6 +16,7 @@
 namespace leveldb {
 // Forward declaration for leveldb::Options to be used in GetlevelDBOptions().
 struct Options;
+class DB;
 }
 
 namespace caffe {
@@ -107,6 +108,12 @@ bool ReadImageToDatumWithSameAspectRatio(const string& filename, const int label
 
 leveldb::Options GetLevelDBOptions();
 
+// Opens the existing LevelDB at source, or returns the handle to it already
+// open in this process. LevelDB locks a database to a single handle, which
+// any number of iterators on any threads may read through; the database is
+// closed with the last reference.
+shared_ptr<leveldb::DB> OpenSharedLevelDB(const string& source);
+
 template <typename Dtype>
 void hdf5_load_nd_dataset_helper(
   hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
@@ -0,0 +1,105 @@
+#ifndef CAFFE_UTIL_LABEL_TABLE_HPP_
+#define CAFFE_UTIL_LABEL_TABLE_HPP_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Layout of a binary label table, the compiled counterpart of the
+ *        label_source and label_id text files.
+ *
+ * The header is followed by
+ *   int32   id[num_row]                      (strictly increasing)
+ *   float   label[num_row][label_dim]        (8 byte aligned)
+ * where row r holds the label vector of id[r]. All values are stored in host
+ * byte order.
+ */
+struct LabelTableHeader {
+  char magic[8];
+  int32_t version;
+  int32_t label_dim;
+  int64_t num_row;
+};
+
+/**
+ * @brief Read-only, memory mapped view of a binary label table.
+ *
+ * Opening a table only maps it and checks its header, whatever its size;
+ * processes mapping the same file share its pages. Ids are looked up by
+ * binary search, or by their offset from the first id when the ids are
+ * consecutive.
+ */
+class LabelTable {
+ public:
+  explicit LabelTable(const string& filename);
+  ~LabelTable();
+
+  inline int64_t num_row() const { return header_->num_row; }
+  inline int label_dim() const { return header_->label_dim; }
+  inline const int* id() const { return id_; }
+  inline const float* label(const int64_t row) const {
+    return label_ + row * label_dim();
+  }
+
+  // The row of id, or -1 if the table does not hold it.
+  inline int64_t Find(const int id) const {
+    if (dense_) {
+      const int64_t row = static_cast<int64_t>(id) - id_[0];
+      return row >= 0 && row < num_row() ? row : -1;
+    }
+    const int* it = std::lower_bound(id_, id_ + num_row(), id);
+    return it != id_ + num_row() && *it == id ? it - id_ : -1;
+  }
+
+  // Copies the label vector of row to out, converting it to Dtype.
+  template <typename Dtype>
+  inline void CopyRow(const int64_t row, Dtype* out) const {
+    std::copy(label(row), label(row) + label_dim(), out);
+  }
+
+ protected:
+  size_t size_;
+  void* map_;
+  const LabelTableHeader* header_;
+  const int* id_;
+  const float* label_;
+  bool dense_;  // the ids are id_[0], id_[0] + 1, ...
+
+  DISABLE_COPY_AND_ASSIGN(LabelTable);
+};
+
+/**
+ * @brief Writes a binary label table. The rows are kept in memory and
+ *        sorted by id when the table is closed, so they may be added in
+ *        any order.
+ */
+class LabelTableWriter {
+ public:
+  LabelTableWriter(const string& filename, const int label_dim);
+  ~LabelTableWriter();
+
+  void Add(const int id, const float* label);
+  void Close();
+
+  inline int64_t num_row() const { return id_.size(); }
+
+ protected:
+  string filename_;
+  int label_dim_;
+  vector<int> id_;
+  vector<float> label_;
+  bool closed_;
+
+  DISABLE_COPY_AND_ASSIGN(LabelTableWriter);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_LABEL_TABLE_HPP_
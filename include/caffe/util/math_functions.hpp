@@ -91,6 +91,10 @@ void caffe_exp(const int n, const Dtype* a, Dtype* y);
 template <typename Dtype>
 void caffe_abs(const int n, const Dtype* a, Dtype* y);
 
+// x = max(x, 0) + negative_slope * min(x, 0), in place, as ReLULayer does
+template <typename Dtype>
+void caffe_relu(const int n, const Dtype negative_slope, Dtype* x);
+
 template <typename Dtype>
 Dtype caffe_cpu_dot(const int n, const Dtype* x, const Dtype* y);
 
@@ -205,6 +209,9 @@ void caffe_gpu_div(const int N, const Dtype* a, const Dtype* b, Dtype* y);
 template <typename Dtype>
 void caffe_gpu_abs(const int n, const Dtype* a, Dtype* y);
 
+template <typename Dtype>
+void caffe_gpu_relu(const int n, const Dtype negative_slope, Dtype* x);
+
 template <typename Dtype>
 void caffe_gpu_powx(const int n, const Dtype* a, const Dtype b, Dtype* y);
 
@@ -0,0 +1,68 @@
+#ifndef CAFFE_UTIL_MIPS_INDEX_HPP_
+#define CAFFE_UTIL_MIPS_INDEX_HPP_
+
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Approximate maximum inner product search over item factors, e.g.
+ *        the item table of a MatrixFactorizeLayer (see TopKRecommender).
+ *
+ * Items x are mapped to [x, sqrt(M^2 - |x|^2)], M the largest item norm, and
+ * queries q to [q, 0], so that the item with the largest inner product is the
+ * nearest one in L2. The mapped items are split into num_list lists by
+ * k-means. A query only scores, exactly, the items of the nprobe lists whose
+ * centroids are nearest; nprobe = num_list gives the exact top K.
+ */
+template <typename Dtype>
+class MIPSIndex {
+ public:
+  explicit MIPSIndex(const int num_threads = 1);
+
+  // Cluster item, (num_item, num_latent) in row major, into num_list lists
+  // with num_iter rounds of k-means. bias is added to every score.
+  void Build(const Blob<Dtype>& item, const int num_list, const int num_iter,
+      const Dtype bias = 0);
+  void FromProto(const MIPSIndexProto& proto);
+  void ToProto(MIPSIndexProto* proto) const;
+
+  // For queries[0 ... num_query), (num_query, num_latent) in row major, write
+  // the k best items found in the nprobe nearest lists and their scores,
+  // k per query, best first. Missing results have item -1.
+  void Search(const Dtype* queries, const int num_query, const int k,
+      const int nprobe, vector<int>* top_items,
+      vector<Dtype>* top_scores) const;
+
+  inline int num_item() const { return item_.height(); }
+  inline int num_latent() const { return item_.width(); }
+  inline int num_list() const { return centroid_.height(); }
+
+ protected:
+  void SearchRange(const Dtype* queries, const int k, const int nprobe,
+      int* top_items, Dtype* top_scores, const int query_begin,
+      const int query_end) const;
+
+  int num_threads_;
+  Dtype bias_;
+  // (1, 1, num_list, num_latent), the centroids without the added dimension
+  Blob<Dtype> centroid_;
+  // half the squared norm of each centroid, with the added dimension
+  vector<Dtype> centroid_half_norm_;
+  // items of list l are list_item_[list_start_[l] ... list_start_[l + 1])
+  vector<int> list_start_;
+  vector<int> list_item_;
+  // (1, 1, num_item, num_latent), item factors in list_item_ order
+  Blob<Dtype> item_;
+
+  DISABLE_COPY_AND_ASSIGN(MIPSIndex);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_MIPS_INDEX_HPP_
@@ -0,0 +1,63 @@
+#ifndef CAFFE_UTIL_PARALLEL_HPP_
+#define CAFFE_UTIL_PARALLEL_HPP_
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+#include <vector>
+
+#include "caffe/common.hpp"
+
+// Uses boost::thread directly; include from .cpp files only, not from the
+// headers nvcc compiles. Those declare the pool and hold a shared_ptr to it.
+
+namespace caffe {
+
+/**
+ * @brief Worker threads started once and reused by every parallel run of a
+ *        layer, so the per-batch paths do not create threads.
+ *
+ * Reserve() starts the workers, from the layer setup; they wait between
+ * runs and are joined when the pool is destroyed. Run() is called by one
+ * thread at a time: the owner of the pool, e.g. a prefetch thread.
+ */
+class WorkerPool {
+ public:
+  WorkerPool();
+  ~WorkerPool();
+
+  // Starts the workers missing for num_task tasks to run at once.
+  void Reserve(const int num_task);
+  inline int capacity() const { return workers_.size() + 1; }
+
+  // Runs task(t) for every t in [0, num_task), task 0 on the calling thread
+  // and task t on worker t, and waits for all of them.
+  void Run(const int num_task, const boost::function<void(int)>& task);
+
+  // Runs func(begin, end, slice) on num_slice contiguous slices of [0, n).
+  // Slice t always covers [n * t / num_slice, n * (t + 1) / num_slice), so
+  // per-slice state (e.g. an RNG stream) sees the same items every time.
+  void RunSlices(const int n, const int num_slice,
+      const boost::function<void(int, int, int)>& func);
+
+ protected:
+  void WorkerLoop(const int task_id, int generation);
+
+  boost::mutex mutex_;
+  // signalled when a run starts or the pool stops, and when a task is done
+  boost::condition_variable start_;
+  boost::condition_variable done_;
+  vector<shared_ptr<boost::thread> > workers_;
+  const boost::function<void(int)>* task_;
+  int num_task_;
+  int generation_;  // the number of runs started
+  int pending_;     // the tasks of the current run still working
+  bool stopped_;
+
+  DISABLE_COPY_AND_ASSIGN(WorkerPool);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_PARALLEL_HPP_
@@ -0,0 +1,71 @@
+#ifndef CAFFE_UTIL_PREFETCH_QUEUE_HPP_
+#define CAFFE_UTIL_PREFETCH_QUEUE_HPP_
+
+#include <queue>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A ring of batches passed between a prefetching data layer and its
+ *        thread through a free and a full blocking queue.
+ *
+ * The thread fills its own working blobs and Push() swaps them with a free
+ * batch, which then waits in the full queue. Forward calls Pop(), which swaps
+ * the next full batch into the tops, so batches are never copied. The tops
+ * keep a batch until the next Pop() gives it back to the free queue.
+ */
+template <typename Dtype>
+class PrefetchQueue {
+ public:
+  PrefetchQueue();
+
+  // Allocates num_batch free batches shaped like the working blobs, without
+  // a diff where the working blob has dropped its own.
+  void Init(const vector<Blob<Dtype>*>& working, const int num_batch);
+  // Called by the thread with its filled working blobs. Blocks while no
+  // batch is free, and returns false without queueing anything once Stop()
+  // has been called.
+  bool Push(const vector<Blob<Dtype>*>& working);
+  // Called by Forward. Blocks until a batch is full, then swaps it into the
+  // first top.size() blobs of top.
+  void Pop(const vector<Blob<Dtype>*>& top);
+  // Makes the pending and every later Push() fail, so the thread can exit.
+  void Stop();
+
+  inline int num_batch() const { return batch_.size(); }
+  inline int num_pop() const { return num_pop_; }
+  // number of full batches waiting when Pop() was last called
+  inline int depth() const { return depth_; }
+  // number of Pop() calls that had to wait for the thread, and the total
+  // time they waited in milliseconds
+  inline int num_stall() const { return num_stall_; }
+  inline double stall_time() const { return stall_time_; }
+
+ protected:
+  void SwapBatch(const vector<Blob<Dtype>*>& blobs, const int batch);
+
+  // keeps boost::thread out of the headers compiled by nvcc
+  class sync;
+  shared_ptr<sync> sync_;
+
+  vector<vector<shared_ptr<Blob<Dtype> > > > batch_;
+  std::queue<int> free_;
+  std::queue<int> full_;
+  int current_;  // the batch held by the tops, or -1
+  bool stopped_;
+
+  int num_pop_;
+  int depth_;
+  int num_stall_;
+  double stall_time_;
+
+  DISABLE_COPY_AND_ASSIGN(PrefetchQueue);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_PREFETCH_QUEUE_HPP_
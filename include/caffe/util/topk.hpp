@@ -0,0 +1,66 @@
+#ifndef CAFFE_UTIL_TOPK_HPP_
+#define CAFFE_UTIL_TOPK_HPP_
+
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Finds the K best scoring items of each user from the factors learned
+ *        by MatrixFactorizeLayer.
+ *
+ * The score of (user, item) is the one of the layer's forward pass:
+ * user . (feature_weight * item + img_weight * item_image_feature) + bias.
+ * A block of users is scored against a block of items with one gemm, and each
+ * user keeps its best K items in a min-heap, so the full user x item score
+ * matrix is never built. Blocks of users are spread over num_threads threads.
+ */
+template <typename Dtype>
+class TopKRecommender {
+ public:
+  explicit TopKRecommender(const int num_threads = 1);
+
+  // Copy the factors of the MATRIX_FACT layer named layer_name, or of the
+  // first one if layer_name is empty, from a trained net.
+  void CopyFrom(const NetParameter& param, const string& layer_name = "");
+  // Add img_weight * item_feature to the item factors, item_feature being the
+  // image feature of every item, (num_item, num_latent) in row major.
+  void AddItemFeature(const Blob<Dtype>& item_feature);
+
+  // For users[0 ... num_users), write the k best items and their scores to
+  // top_items / top_scores, k per user, best first.
+  void Recommend(const int* users, const int num_users, const int k,
+      vector<int>* top_items, vector<Dtype>* top_scores);
+
+  inline Blob<Dtype>* user_factor() { return &user_factor_; }
+  inline Blob<Dtype>* item_factor() { return &item_factor_; }
+  inline Dtype bias() const { return bias_; }
+  inline void set_bias(const Dtype bias) { bias_ = bias; }
+  inline int num_user() const { return user_factor_.height(); }
+  inline int num_item() const { return item_factor_.height(); }
+  inline int num_latent() const { return user_factor_.width(); }
+
+ protected:
+  // Score users[user_begin ... user_end) block by block.
+  void RecommendRange(const int* users, const int k, int* top_items,
+      Dtype* top_scores, const int user_begin, const int user_end);
+
+  int num_threads_;
+  Dtype bias_;
+  Dtype img_weight_;
+  // (1, 1, num_user, num_latent) and (1, 1, num_item, num_latent), the item
+  // rows already scaled by feature_weight
+  Blob<Dtype> user_factor_;
+  Blob<Dtype> item_factor_;
+
+  DISABLE_COPY_AND_ASSIGN(TopKRecommender);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_TOPK_HPP_
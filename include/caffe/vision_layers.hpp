@@ -61,8 +61,22 @@ class ConvolutionLayer : public Layer<Dtype> {
    *  first group and input channels 3-4 and output channels 5-8 into the second
    *  group.
    *  - bias_term (\b optional, default true). Whether to have a bias.
-   *  - engine: convolution has CAFFE (matrix multiplication) and CUDNN (library
-   *    kernels + stream parallelism) engines.
+   *  - engine: convolution has CAFFE (matrix multiplication), CUDNN (library
+   *    kernels + stream parallelism) and WINOGRAD (CPU fast 3x3 convolution)
+   *    engines.
+   *  - cpu_threads (\b optional, default 1). The CAFFE engine splits the batch
+   *  into this many slices on the CPU, each convolved on a thread of its own
+   *  with its own column buffer. The weight and bias gradients of the slices
+   *  are summed in slice order, so they do not depend on thread scheduling.
+   *  - col_buffer_mb (\b optional, default 32). On the CPU, 1x1 convolutions
+   *  with stride 1 and no padding multiply the input directly, without
+   *  im2col. Convolutions with small outputs lower as many images side by
+   *  side as fit in col_buffer_mb, so each group is one wide GEMM with the
+   *  bias added in, instead of a GEMM per image and group plus one for the
+   *  bias.
+   *  - fused_relu (\b optional, LayerParameter). A ReLU applied to each image
+   *  of the tops as soon as it is computed, for the in-place RELU layers Net
+   *  fuses in inference mode.
    */
   explicit ConvolutionLayer(const LayerParameter& param)
       : Layer<Dtype>(param) {}
@@ -98,6 +112,9 @@ class ConvolutionLayer : public Layer<Dtype> {
   int num_output_;
   int height_out_, width_out_;
   bool bias_term_;
+  // fused_relu: the ReLU applied to the tops as they are computed
+  bool fused_relu_;
+  Dtype relu_negative_slope_;
 
   /// M_ is the channel dimension of the output for a single group, which is the
   /// leading dimension of the filter matrix.
@@ -110,6 +127,78 @@ class ConvolutionLayer : public Layer<Dtype> {
   int N_;
   Blob<Dtype> col_buffer_;
   Blob<Dtype> bias_multiplier_;
+
+  // cpu_threads: the images [begin, end) of a bottom on slice slice
+  void forward_cpu_slice(const Dtype* bottom_data, Dtype* top_data,
+      const int begin, const int end, const int slice);
+  // col_buffer_mb: the images [begin, end) lowered side by side
+  void forward_cpu_batched(const Dtype* bottom_data, Dtype* top_data,
+      const int begin, const int end, const int slice);
+  void backward_cpu_slice(const Dtype* top_diff, const Dtype* bottom_data,
+      Dtype* bottom_diff, const int begin, const int end, const int slice);
+  Blob<Dtype>* col_buffer(const int slice) {
+    return slice == 0 ? &col_buffer_ : slice_col_buffers_[slice - 1].get();
+  }
+  Blob<Dtype>* top_buffer(const int slice) {
+    return slice == 0 ? &top_buffer_ : slice_top_buffers_[slice - 1].get();
+  }
+  // the input is the column matrix: 1x1 kernel, stride 1, no padding
+  bool is_1x1_;
+  // the images lowered at once by forward_cpu_batched, 1 to lower them one
+  // at a time; the wide results go through top_buffer before the tops
+  int batch_images_;
+  Blob<Dtype> top_buffer_;
+  vector<shared_ptr<Blob<Dtype> > > slice_top_buffers_;
+  int num_slice_;
+  shared_ptr<WorkerPool> slice_workers_;
+  vector<shared_ptr<Blob<Dtype> > > slice_col_buffers_;
+  // the weight and bias gradients of slices 1 to num_slice_ - 1, summed into
+  // the parameter diffs once the slices are done; slice 0 accumulates there
+  vector<shared_ptr<Blob<Dtype> > > slice_weight_diffs_;
+  vector<shared_ptr<Blob<Dtype> > > slice_bias_diffs_;
+};
+
+/**
+ * @brief Winograd F(2x2, 3x3) implementation of ConvolutionLayer on the CPU.
+ *        Fallback to ConvolutionLayer for the GPU and for the convolutions
+ *        it does not cover.
+ *
+ * Each 2x2 output tile is computed from a 4x4 input tile with 16 instead of
+ * 36 multiplies per channel pair: the tiles and the filters are transformed,
+ * multiplied as 16 GEMMs per group, and the products transformed back. This
+ * covers 3x3 filters with stride 1 and a padding of at most 2. The gradient
+ * w.r.t. the bottom is the same transform applied to the top diff with the
+ * flipped filters; the weight and bias gradients use ConvolutionLayer.
+ */
+template <typename Dtype>
+class WinogradConvolutionLayer : public ConvolutionLayer<Dtype> {
+ public:
+  explicit WinogradConvolutionLayer(const LayerParameter& param)
+      : ConvolutionLayer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+
+  // Transforms the filters into filter_transform_: 16 matrices of
+  // out_channels x in_channels / group, flipped for the backward pass.
+  void transform_filters(const bool backward);
+  // The images [begin, end) of input, convolved into output; forward maps
+  // the bottom to the top, backward the top diff to the bottom diff.
+  void winograd_slice(const Dtype* input, Dtype* output, const bool backward,
+      const int begin, const int end, const int slice);
+
+  bool use_winograd_;
+  Blob<Dtype> filter_transform_;
+  // per CPU slice: the transformed input tiles and their products
+  vector<shared_ptr<Blob<Dtype> > > tile_buffers_;
+  vector<shared_ptr<Blob<Dtype> > > product_buffers_;
 };
 
 #ifdef USE_CUDNN
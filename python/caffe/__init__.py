@@ -1,4 +1,4 @@
-from .pycaffe import Net, SGDSolver
+from .pycaffe import Net, SGDSolver, MIPSIndex
 from .classifier import Classifier
 from .detector import Detector
 import io
@@ -5,12 +5,14 @@
 #include <boost/python/suite/indexing/vector_indexing_suite.hpp>
 
 // these need to be included after boost on OS X
+#include <algorithm>  // NOLINT(build/include_order)
 #include <string>  // NOLINT(build/include_order)
 #include <vector>  // NOLINT(build/include_order)
 #include <fstream>  // NOLINT
 
 #include "_caffe.hpp"
 #include "caffe/caffe.hpp"
+#include "caffe/util/upgrade_proto.hpp"
 
 // Temporary solution for numpy < 1.7 versions: old macro, no promises.
 // You're strongly advised to upgrade to >= 1.7.
@@ -58,6 +60,19 @@ bp::object PyBlobWrap::get_diff() {
   return bp::object(h);
 }
 
+// the int32 ids of the blob (Blob::cpu_index), e.g. for a MATRIX_FACT input
+bp::object PyBlobWrap::get_index() {
+  npy_intp dims[] = {num(), channels(), height(), width()};
+
+  PyObject *obj = PyArray_SimpleNewFromData(4, dims, NPY_INT32,
+                                            blob_->mutable_cpu_index());
+  PyArray_SetBaseObject(reinterpret_cast<PyArrayObject *>(obj), self_);
+  Py_INCREF(self_);
+  bp::handle<> h(obj);
+
+  return bp::object(h);
+}
+
 PyNet::PyNet(string param_file, string pretrained_param_file) {
   Init(param_file);
   CheckFile(pretrained_param_file);
@@ -66,7 +81,11 @@ PyNet::PyNet(string param_file, string pretrained_param_file) {
 
 void PyNet::Init(string param_file) {
   CheckFile(param_file);
-  net_.reset(new Net<float>(param_file));
+  NetParameter param;
+  ReadNetParamsFromTextFileOrDie(param_file, &param);
+  // Python reads every blob, so none may share its memory
+  param.set_memory_plan(NetParameter_MemoryPlan_NONE);
+  net_.reset(new Net<float>(param));
 }
 
 void PyNet::check_contiguous_array(PyArrayObject* arr, string name,
@@ -141,6 +160,52 @@ void PySGDSolver::SolveResume(const string& resume_file) {
   return solver_->Solve(resume_file);
 }
 
+PyMIPSIndex::PyMIPSIndex(const string& index_file, int num_threads) {
+  CheckFile(index_file);
+  MIPSIndexProto index_param;
+  ReadProtoFromBinaryFileOrDie(index_file, &index_param);
+  index_.reset(new MIPSIndex<float>(num_threads));
+  index_->FromProto(index_param);
+}
+
+bp::object PyMIPSIndex::Search(bp::object queries_obj, int k, int nprobe) {
+  if (!PyArray_Check(queries_obj.ptr())) {
+    throw std::runtime_error("queries must be a numpy array");
+  }
+  PyArrayObject* queries_arr =
+      reinterpret_cast<PyArrayObject*>(queries_obj.ptr());
+  if (!(PyArray_FLAGS(queries_arr) & NPY_ARRAY_C_CONTIGUOUS)) {
+    throw std::runtime_error("queries must be C contiguous");
+  }
+  if (PyArray_NDIM(queries_arr) != 2) {
+    throw std::runtime_error("queries must be 2-d");
+  }
+  if (PyArray_TYPE(queries_arr) != NPY_FLOAT32) {
+    throw std::runtime_error("queries must be float32");
+  }
+  if (PyArray_DIMS(queries_arr)[1] != index_->num_latent()) {
+    throw std::runtime_error("queries have wrong number of latent factors");
+  }
+  if (k <= 0 || nprobe <= 0) {
+    throw std::runtime_error("k and nprobe must be positive");
+  }
+  const int num_query = PyArray_DIMS(queries_arr)[0];
+  vector<int> top_items;
+  vector<float> top_scores;
+  index_->Search(static_cast<float*>(PyArray_DATA(queries_arr)), num_query,
+      k, nprobe, &top_items, &top_scores);
+
+  npy_intp dims[] = {num_query, k};
+  PyObject* items = PyArray_SimpleNew(2, dims, NPY_INT32);
+  PyObject* scores = PyArray_SimpleNew(2, dims, NPY_FLOAT32);
+  std::copy(top_items.begin(), top_items.end(), static_cast<int*>(
+      PyArray_DATA(reinterpret_cast<PyArrayObject*>(items))));
+  std::copy(top_scores.begin(), top_scores.end(), static_cast<float*>(
+      PyArray_DATA(reinterpret_cast<PyArrayObject*>(scores))));
+  return bp::make_tuple(bp::object(bp::handle<>(items)),
+      bp::object(bp::handle<>(scores)));
+}
+
 BOOST_PYTHON_MODULE(_caffe) {
   // below, we prepend an underscore to methods that will be replaced
   // in Python
@@ -177,7 +242,8 @@ BOOST_PYTHON_MODULE(_caffe) {
       .add_property("count",    &PyBlob<float>::count)
       .def("reshape",           &PyBlob<float>::Reshape)
       .add_property("data",     &PyBlobWrap::get_data)
-      .add_property("diff",     &PyBlobWrap::get_diff);
+      .add_property("diff",     &PyBlobWrap::get_diff)
+      .add_property("index",    &PyBlobWrap::get_index);
 
   bp::class_<PyLayer>(
       "Layer", bp::no_init)
@@ -189,6 +255,13 @@ BOOST_PYTHON_MODULE(_caffe) {
       .def("solve",        &PySGDSolver::Solve)
       .def("solve",        &PySGDSolver::SolveResume);
 
+  bp::class_<PyMIPSIndex, boost::noncopyable>(
+      "MIPSIndex", bp::init<string, bp::optional<int> >())
+      .add_property("num_item",   &PyMIPSIndex::num_item)
+      .add_property("num_latent", &PyMIPSIndex::num_latent)
+      .add_property("num_list",   &PyMIPSIndex::num_list)
+      .def("search",              &PyMIPSIndex::Search);
+
   bp::class_<vector<PyBlob<float> > >("BlobVec")
       .def(bp::vector_indexing_suite<vector<PyBlob<float> >, true>());
 
@@ -54,6 +54,7 @@ class PyBlobWrap : public PyBlob<float> {
 
   bp::object get_data();
   bp::object get_diff();
+  bp::object get_index();
 
  private:
   PyObject *self_;
@@ -173,6 +174,23 @@ class PySGDSolver {
   shared_ptr<SGDSolver<float> > solver_;
 };
 
+// wrap a MIPSIndex saved by tools/build_mips_index
+class PyMIPSIndex {
+ public:
+  explicit PyMIPSIndex(const string& index_file, int num_threads = 1);
+
+  // queries is a C contiguous float32 array of shape (num_query, num_latent);
+  // returns the (num_query, k) int32 items and float32 scores, best first.
+  bp::object Search(bp::object queries_obj, int k, int nprobe);
+
+  int num_item() const { return index_->num_item(); }
+  int num_latent() const { return index_->num_latent(); }
+  int num_list() const { return index_->num_list(); }
+
+ protected:
+  shared_ptr<MIPSIndex<float> > index_;
+};
+
 // Declare the module init function created by boost::python, so that we can
 // use this module from C++ when embedding Python.
 PyMODINIT_FUNC init_caffe(void);
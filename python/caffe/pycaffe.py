@@ -7,7 +7,7 @@ from collections import OrderedDict
 from itertools import izip_longest
 import numpy as np
 
-from ._caffe import Net, SGDSolver
+from ._caffe import Net, SGDSolver, MIPSIndex
 import caffe.io
 
 # We directly update methods from Net here (rather than using composition or
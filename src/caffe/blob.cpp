@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
@@ -17,10 +19,15 @@ void Blob<Dtype>::Reshape(const int num, const int channels, const int height,
   height_ = height;
   width_ = width;
   count_ = num_ * channels_ * height_ * width_;
+  // row indices are meaningless once the shape changes
+  clear_diff_rows();
   if (count_ > capacity_) {
     capacity_ = count_;
     data_.reset(new SyncedMemory(capacity_ * sizeof(Dtype)));
-    diff_.reset(new SyncedMemory(capacity_ * sizeof(Dtype)));
+    if (!diff_dropped_) {
+      diff_.reset(new SyncedMemory(capacity_ * sizeof(Dtype)));
+    }
+    index_.reset(new SyncedMemory(capacity_ * sizeof(int)));
   }
 }
 
@@ -33,7 +40,7 @@ template <typename Dtype>
 Blob<Dtype>::Blob(const int num, const int channels, const int height,
     const int width)
   // capacity_ must be initialized before calling Reshape
-  : capacity_(0) {
+  : capacity_(0), has_diff_rows_(false), diff_dropped_(false) {
   Reshape(num, channels, height, width);
 }
 
@@ -91,10 +98,35 @@ Dtype* Blob<Dtype>::mutable_gpu_diff() {
   return static_cast<Dtype*>(diff_->mutable_gpu_data());
 }
 
+template <typename Dtype>
+const int* Blob<Dtype>::cpu_index() const {
+  CHECK(index_);
+  return (const int*)index_->cpu_data();
+}
+
+template <typename Dtype>
+const int* Blob<Dtype>::gpu_index() const {
+  CHECK(index_);
+  return (const int*)index_->gpu_data();
+}
+
+template <typename Dtype>
+int* Blob<Dtype>::mutable_cpu_index() {
+  CHECK(index_);
+  return static_cast<int*>(index_->mutable_cpu_data());
+}
+
+template <typename Dtype>
+int* Blob<Dtype>::mutable_gpu_index() {
+  CHECK(index_);
+  return static_cast<int*>(index_->mutable_gpu_data());
+}
+
 template <typename Dtype>
 void Blob<Dtype>::ShareData(const Blob& other) {
   CHECK_EQ(count_, other.count());
   data_ = other.data();
+  index_ = other.index();
 }
 
 template <typename Dtype>
@@ -103,21 +135,77 @@ void Blob<Dtype>::ShareDiff(const Blob& other) {
   diff_ = other.diff();
 }
 
+template <typename Dtype>
+void Blob<Dtype>::SetDataMemory(const shared_ptr<SyncedMemory>& memory) {
+  CHECK_GE(memory->size(), capacity_ * sizeof(Dtype));
+  data_ = memory;
+}
+
+template <typename Dtype>
+void Blob<Dtype>::SetDiffMemory(const shared_ptr<SyncedMemory>& memory) {
+  CHECK_GE(memory->size(), capacity_ * sizeof(Dtype));
+  diff_ = memory;
+}
+
+template <typename Dtype>
+void Blob<Dtype>::DropDiff() {
+  diff_.reset();
+  clear_diff_rows();
+  diff_dropped_ = true;
+}
+
+template <typename Dtype>
+void Blob<Dtype>::Swap(Blob& other) {
+  std::swap(data_, other.data_);
+  std::swap(diff_, other.diff_);
+  std::swap(index_, other.index_);
+  std::swap(num_, other.num_);
+  std::swap(channels_, other.channels_);
+  std::swap(height_, other.height_);
+  std::swap(width_, other.width_);
+  std::swap(count_, other.count_);
+  std::swap(capacity_, other.capacity_);
+  std::swap(has_diff_rows_, other.has_diff_rows_);
+  std::swap(diff_dropped_, other.diff_dropped_);
+  diff_rows_.swap(other.diff_rows_);
+}
+
 // The "update" method is used for parameter blobs in a Net, which are stored
 // as Blob<float> or Blob<double> -- hence we do not define it for
 // Blob<int> or Blob<unsigned int>.
 template <> void Blob<unsigned int>::Update() { NOT_IMPLEMENTED; }
 template <> void Blob<int>::Update() { NOT_IMPLEMENTED; }
 
+template <typename Dtype>
+void Blob<Dtype>::set_diff_rows(const vector<int>& rows) {
+  const int rows_total = (width_ > 0) ? count_ / width_ : 0;
+  for (int i = 0; i < rows.size(); ++i) {
+    CHECK_GE(rows[i], 0);
+    CHECK_LT(rows[i], rows_total);
+  }
+  diff_rows_ = rows;
+  has_diff_rows_ = true;
+}
+
 template <typename Dtype>
 void Blob<Dtype>::Update() {
   // We will perform update based on where the data is located.
   switch (data_->head()) {
   case SyncedMemory::HEAD_AT_CPU:
     // perform computation on CPU
-    caffe_axpy<Dtype>(count_, Dtype(-1),
-        static_cast<const Dtype*>(diff_->cpu_data()),
-        static_cast<Dtype*>(data_->mutable_cpu_data()));
+    if (has_diff_rows_) {
+      // row-sparse diff: every other row is known to be zero
+      const Dtype* diff = static_cast<const Dtype*>(diff_->cpu_data());
+      Dtype* data = static_cast<Dtype*>(data_->mutable_cpu_data());
+      for (int i = 0; i < diff_rows_.size(); ++i) {
+        const int offset = diff_rows_[i] * width_;
+        caffe_axpy<Dtype>(width_, Dtype(-1), diff + offset, data + offset);
+      }
+    } else {
+      caffe_axpy<Dtype>(count_, Dtype(-1),
+          static_cast<const Dtype*>(diff_->cpu_data()),
+          static_cast<Dtype*>(data_->mutable_cpu_data()));
+    }
     break;
   case SyncedMemory::HEAD_AT_GPU:
   case SyncedMemory::SYNCED:
@@ -237,6 +325,15 @@ void Blob<Dtype>::CopyFrom(const Blob& source, bool copy_diff, bool reshape) {
   default:
     LOG(FATAL) << "Unknown caffe mode.";
   }
+  // ids travel in the index, next to the data
+  if (!copy_diff && source.index_ && index_ &&
+      source.index_->head() != SyncedMemory::UNINITIALIZED) {
+    if (Caffe::mode() == Caffe::GPU) {
+      caffe_copy(count_, source.gpu_index(), mutable_gpu_index());
+    } else {
+      caffe_copy(count_, source.cpu_index(), mutable_cpu_index());
+    }
+  }
 }
 
 template <typename Dtype>
@@ -247,7 +344,11 @@ void Blob<Dtype>::FromProto(const BlobProto& proto) {
   for (int i = 0; i < count_; ++i) {
     data_vec[i] = proto.data(i);
   }
-  if (proto.diff_size() > 0) {
+  if (proto.index_size() > 0) {
+    CHECK_EQ(proto.index_size(), count_) << "Incorrect index size.";
+    std::copy(proto.index().begin(), proto.index().end(), mutable_cpu_index());
+  }
+  if (proto.diff_size() > 0 && !diff_dropped_) {
     Dtype* diff_vec = mutable_cpu_diff();
     for (int i = 0; i < count_; ++i) {
       diff_vec[i] = proto.diff(i);
@@ -263,11 +364,18 @@ void Blob<Dtype>::ToProto(BlobProto* proto, bool write_diff) const {
   proto->set_width(width_);
   proto->clear_data();
   proto->clear_diff();
+  proto->clear_index();
   const Dtype* data_vec = cpu_data();
   for (int i = 0; i < count_; ++i) {
     proto->add_data(data_vec[i]);
   }
-  if (write_diff) {
+  if (index_ && index_->head() != SyncedMemory::UNINITIALIZED) {
+    const int* index_vec = cpu_index();
+    for (int i = 0; i < count_; ++i) {
+      proto->add_index(index_vec[i]);
+    }
+  }
+  if (write_diff && !diff_dropped_) {
     const Dtype* diff_vec = cpu_diff();
     for (int i = 0; i < count_; ++i) {
       proto->add_diff(diff_vec[i]);
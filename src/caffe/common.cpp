@@ -8,6 +8,11 @@
 namespace caffe {
 
 shared_ptr<Caffe> Caffe::singleton_;
+boost::thread_specific_ptr<Caffe::RNG> Caffe::thread_random_generator_;
+
+void Caffe::set_thread_random_seed(const unsigned int seed) {
+  thread_random_generator_.reset(new RNG(seed));
+}
 
 // random seeding
 int64_t cluster_seedgen(void) {
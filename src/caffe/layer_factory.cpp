@@ -22,6 +22,8 @@ ConvolutionLayer<Dtype>* GetConvolutionLayer(const string& name,
   }
   if (engine == ConvolutionParameter_Engine_CAFFE) {
     return new ConvolutionLayer<Dtype>(param);
+  } else if (engine == ConvolutionParameter_Engine_WINOGRAD) {
+    return new WinogradConvolutionLayer<Dtype>(param);
 #ifdef USE_CUDNN
   } else if (engine == ConvolutionParameter_Engine_CUDNN) {
     return new CuDNNConvolutionLayer<Dtype>(param);
@@ -197,6 +199,8 @@ Layer<Dtype>* GetLayer(const LayerParameter& param) {
     return new DataLayer<Dtype>(param);
   case LayerParameter_LayerType_DATA_ITACT:
     return new InteractionDataLayer<Dtype>(param);
+  case LayerParameter_LayerType_MIXED_DATA_ITACT:
+    return new MixedInteractionDataLayer<Dtype>(param);
   case LayerParameter_LayerType_LABEL_DATA:
     return new LabelDataLayer<Dtype>(param);
   case LayerParameter_LayerType_DROPOUT:
@@ -3,6 +3,7 @@
 
 #include "caffe/data_layers.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/parallel.hpp"
 
 namespace caffe {
 
@@ -61,6 +62,20 @@ void BasePrefetchingLabelDataLayer<Dtype>::LayerSetUp(
   if (this->output_labels_) {
     this->prefetch_label_.mutable_cpu_data();
   }
+  prefetch_blobs_.push_back(&this->prefetch_data_);
+  if (this->output_labels_) {
+    prefetch_blobs_.push_back(&this->prefetch_label_);
+    prefetch_blobs_.push_back(&this->prefetch_id_);
+  }
+  // Pop() swaps whole blobs into the tops, so in inference the batches drop
+  // their diffs too, as Net::Init does for the tops.
+  if (this->inference()) {
+    for (int i = 0; i < prefetch_blobs_.size(); ++i) {
+      prefetch_blobs_[i]->DropDiff();
+    }
+  }
+  prefetch_queue_.Init(prefetch_blobs_,
+      this->layer_param_.data_param().prefetch());
   DLOG(INFO) << "Initializing prefetch";
   this->CreatePrefetchThread();
   DLOG(INFO) << "Prefetch initialized.";
@@ -70,30 +85,43 @@ template <typename Dtype>
 void BasePrefetchingLabelDataLayer<Dtype>::CreatePrefetchThread() {
   this->phase_ = Caffe::phase();
   this->data_transformer_.InitRand();
+  // the first decode slice uses data_transformer_
+  slice_transformers_.clear();
+  for (int i = 1; i < this->layer_param_.data_param().decode_threads(); ++i) {
+    slice_transformers_.push_back(shared_ptr<DataTransformer<Dtype> >(
+        new DataTransformer<Dtype>(this->transform_param_)));
+    slice_transformers_.back()->InitRand();
+  }
+  if (!decode_workers_) {
+    decode_workers_.reset(new WorkerPool());
+  }
+  decode_workers_->Reserve(this->num_decode_slice());
   CHECK(StartInternalThread()) << "Thread execution failed";
 }
 
 template <typename Dtype>
 void BasePrefetchingLabelDataLayer<Dtype>::JoinPrefetchThread() {
+  prefetch_queue_.Stop();
   CHECK(WaitForInternalThreadToExit()) << "Thread joining failed";
+  if (prefetch_queue_.num_pop() > 0) {
+    LOG(INFO) << "Prefetch: " << prefetch_queue_.num_stall() << " of "
+              << prefetch_queue_.num_pop() << " batches waited for, "
+              << prefetch_queue_.stall_time() << " ms in total";
+  }
+}
+
+template <typename Dtype>
+void BasePrefetchingLabelDataLayer<Dtype>::InternalThreadEntry() {
+  do {
+    load_batch();
+  } while (prefetch_queue_.Push(prefetch_blobs_));
 }
 
 template <typename Dtype>
 void BasePrefetchingLabelDataLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
-  // First, join the thread
-  JoinPrefetchThread();
-  // Copy the data
-  caffe_copy(prefetch_data_.count(), prefetch_data_.cpu_data(),
-             (*top)[0]->mutable_cpu_data());
-  if (this->output_labels_) {
-    caffe_copy(prefetch_label_.count(), prefetch_label_.cpu_data(),
-               (*top)[1]->mutable_cpu_data());
-    caffe_copy(prefetch_id_.count(), prefetch_id_.cpu_data(),
-               (*top)[2]->mutable_cpu_data());
-  }
-  // Start a new prefetch thread
-  CreatePrefetchThread();
+  // Hand the next batch to the tops, without copying it
+  prefetch_queue_.Pop(*top);
 }
 
 #ifdef CPU_ONLY
@@ -1,13 +1,22 @@
+#include <stdint.h>
+
+#include <algorithm>
 #include <vector>
 
 #include "caffe/filler.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/im2col.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
 
+// The largest output, height_out * width_out, for which the CPU lowers
+// several images at once. Beyond it a single image makes GEMMs large enough
+// that the call overhead no longer matters.
+static const int kBatchedMaxSpatial = 1024;
+
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
@@ -85,6 +94,11 @@ void ConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   }
   // Propagate gradients to the parameters (as directed by backward pass).
   this->param_propagate_down_.resize(this->blobs_.size(), true);
+  // the fused ReLU is not backpropagated through
+  CHECK(!this->layer_param_.has_fused_relu() || this->inference())
+      << "fused_relu is only supported in inference mode";
+  fused_relu_ = this->layer_param_.has_fused_relu();
+  relu_negative_slope_ = this->layer_param_.fused_relu().negative_slope();
 }
 
 template <typename Dtype>
@@ -129,37 +143,163 @@ void ConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
     bias_multiplier_.Reshape(1, 1, 1, N_);
     caffe_set(N_, Dtype(1), bias_multiplier_.mutable_cpu_data());
   }
+  // Every CPU slice of the batch has its own column buffer and gradients.
+  num_slice_ = std::max(1, std::min<int>(num_,
+      this->layer_param_.convolution_param().cpu_threads()));
+  if (!slice_workers_) {
+    slice_workers_.reset(new WorkerPool());
+  }
+  slice_workers_->Reserve(num_slice_);
+  // Choose how the CPU lowers the images: a 1x1 convolution multiplies the
+  // input as it is, and a small output lowers as many images of a slice at
+  // once as fit in col_buffer_mb, so that the GEMMs are wide enough to be
+  // worth their calls.
+  is_1x1_ = kernel_h_ == 1 && kernel_w_ == 1 && stride_h_ == 1 &&
+      stride_w_ == 1 && pad_h_ == 0 && pad_w_ == 0;
+  batch_images_ = 1;
+  if (Caffe::mode() == Caffe::CPU && !is_1x1_ && N_ <= kBatchedMaxSpatial) {
+    const int64_t image_bytes = static_cast<int64_t>(sizeof(Dtype)) *
+        (channels_ * kernel_h_ * kernel_w_ + num_output_) * N_;
+    const int64_t budget = static_cast<int64_t>(
+        this->layer_param_.convolution_param().col_buffer_mb()) << 20;
+    const int slice_images = (num_ + num_slice_ - 1) / num_slice_;
+    batch_images_ = std::max<int64_t>(1,
+        std::min<int64_t>(slice_images, budget / image_bytes));
+  }
+  if (batch_images_ > 1) {
+    col_buffer_.Reshape(batch_images_, channels_ * kernel_h_ * kernel_w_,
+        height_out_, width_out_);
+    top_buffer_.Reshape(batch_images_, num_output_, height_out_, width_out_);
+  }
+  slice_top_buffers_.resize(batch_images_ > 1 ? num_slice_ - 1 : 0);
+  slice_col_buffers_.resize(num_slice_ - 1);
+  // without backward, the slices have no gradients to keep
+  const int num_slice_diff = this->inference() ? 0 : num_slice_ - 1;
+  slice_weight_diffs_.resize(num_slice_diff);
+  slice_bias_diffs_.resize(bias_term_ ? num_slice_diff : 0);
+  for (int slice = 1; slice < num_slice_; ++slice) {
+    if (!slice_col_buffers_[slice - 1]) {
+      slice_col_buffers_[slice - 1].reset(new Blob<Dtype>());
+    }
+    slice_col_buffers_[slice - 1]->ReshapeLike(col_buffer_);
+    if (batch_images_ > 1) {
+      if (!slice_top_buffers_[slice - 1]) {
+        slice_top_buffers_[slice - 1].reset(new Blob<Dtype>());
+      }
+      slice_top_buffers_[slice - 1]->ReshapeLike(top_buffer_);
+    }
+  }
+  for (int slice = 1; slice <= num_slice_diff; ++slice) {
+    if (!slice_weight_diffs_[slice - 1]) {
+      slice_weight_diffs_[slice - 1].reset(new Blob<Dtype>());
+      if (bias_term_) {
+        slice_bias_diffs_[slice - 1].reset(new Blob<Dtype>());
+      }
+    }
+    slice_weight_diffs_[slice - 1]->ReshapeLike(*this->blobs_[0]);
+    if (bias_term_) {
+      slice_bias_diffs_[slice - 1]->ReshapeLike(*this->blobs_[1]);
+    }
+  }
 }
 
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
+  // Synchronize the parameters before the slices read them concurrently.
+  this->blobs_[0]->cpu_data();
+  if (bias_term_) {
+    this->blobs_[1]->cpu_data();
+  }
   for (int i = 0; i < bottom.size(); ++i) {
-    const Dtype* bottom_data = bottom[i]->cpu_data();
-    Dtype* top_data = (*top)[i]->mutable_cpu_data();
-    Dtype* col_data = col_buffer_.mutable_cpu_data();
-    const Dtype* weight = this->blobs_[0]->cpu_data();
-    int weight_offset = M_ * K_;  // number of filter parameters in a group
-    int col_offset = K_ * N_;  // number of values in an input region / column
-    int top_offset = M_ * N_;  // number of values in an output region / column
-    for (int n = 0; n < num_; ++n) {
-      // im2col transformation: unroll input regions for filtering
-      // into column matrix for multplication.
-      im2col_cpu(bottom_data + bottom[i]->offset(n), channels_, height_,
+    slice_workers_->RunSlices(num_, num_slice_, boost::bind(
+        &ConvolutionLayer<Dtype>::forward_cpu_slice, this,
+        bottom[i]->cpu_data(), (*top)[i]->mutable_cpu_data(), _1, _2, _3));
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::forward_cpu_slice(const Dtype* bottom_data,
+    Dtype* top_data, const int begin, const int end, const int slice) {
+  if (batch_images_ > 1) {
+    forward_cpu_batched(bottom_data, top_data, begin, end, slice);
+    return;
+  }
+  Dtype* col_data = is_1x1_ ? NULL : col_buffer(slice)->mutable_cpu_data();
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  int weight_offset = M_ * K_;  // number of filter parameters in a group
+  int col_offset = K_ * N_;  // number of values in an input region / column
+  int top_offset = M_ * N_;  // number of values in an output region / column
+  const int bottom_dim = channels_ * height_ * width_;
+  const int top_dim = num_output_ * N_;
+  for (int n = begin; n < end; ++n) {
+    // im2col transformation: unroll input regions for filtering
+    // into column matrix for multplication.
+    if (is_1x1_) {
+      col_data = const_cast<Dtype*>(bottom_data) + bottom_dim * n;
+    } else {
+      im2col_cpu(bottom_data + bottom_dim * n, channels_, height_,
           width_, kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_,
           col_data);
-      // Take inner products for groups.
-      for (int g = 0; g < group_; ++g) {
-        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
-          (Dtype)1., weight + weight_offset * g, col_data + col_offset * g,
-          (Dtype)0., top_data + (*top)[i]->offset(n) + top_offset * g);
+    }
+    // Take inner products for groups.
+    for (int g = 0; g < group_; ++g) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
+        (Dtype)1., weight + weight_offset * g, col_data + col_offset * g,
+        (Dtype)0., top_data + top_dim * n + top_offset * g);
+    }
+    // Add bias.
+    if (bias_term_) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
+          N_, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
+          bias_multiplier_.cpu_data(),
+          (Dtype)1., top_data + top_dim * n);
+    }
+    // while the image is still in the cache
+    if (fused_relu_) {
+      caffe_relu(top_dim, relu_negative_slope_, top_data + top_dim * n);
+    }
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::forward_cpu_batched(const Dtype* bottom_data,
+    Dtype* top_data, const int begin, const int end, const int slice) {
+  Dtype* col_data = col_buffer(slice)->mutable_cpu_data();
+  Dtype* wide_top = top_buffer(slice)->mutable_cpu_data();
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  const int bottom_dim = channels_ * height_ * width_;
+  const int top_dim = num_output_ * N_;
+  for (int n0 = begin; n0 < end; n0 += batch_images_) {
+    // Lower the images side by side: the column matrix of each group is
+    // K_ x (images * N_), image i in columns [i * N_, (i + 1) * N_).
+    const int images = std::min(batch_images_, end - n0);
+    const int wide_n = images * N_;
+    for (int i = 0; i < images; ++i) {
+      im2col_cpu(bottom_data + bottom_dim * (n0 + i), channels_, height_,
+          width_, kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_,
+          wide_n, col_data + N_ * i);
+    }
+    // The bias starts the accumulation, so it costs no GEMM of its own.
+    if (bias_term_) {
+      const Dtype* bias = this->blobs_[1]->cpu_data();
+      for (int o = 0; o < num_output_; ++o) {
+        caffe_set(wide_n, bias[o], wide_top + wide_n * o);
       }
-      // Add bias.
-      if (bias_term_) {
-        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
-            N_, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
-            bias_multiplier_.cpu_data(),
-            (Dtype)1., top_data + (*top)[i]->offset(n));
+    }
+    for (int g = 0; g < group_; ++g) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, wide_n, K_,
+          (Dtype)1., weight + M_ * K_ * g, col_data + K_ * wide_n * g,
+          (Dtype)(bias_term_ ? 1. : 0.), wide_top + M_ * wide_n * g);
+    }
+    if (fused_relu_) {
+      caffe_relu(num_output_ * wide_n, relu_negative_slope_, wide_top);
+    }
+    // Scatter the rows of the wide result to the images.
+    for (int i = 0; i < images; ++i) {
+      for (int o = 0; o < num_output_; ++o) {
+        caffe_copy(N_, wide_top + wide_n * o + N_ * i,
+            top_data + top_dim * (n0 + i) + N_ * o);
       }
     }
   }
@@ -168,72 +308,115 @@ void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
-  const Dtype* weight = NULL;
+  // Synchronize the parameters before the slices read them concurrently.
+  this->blobs_[0]->cpu_data();
+  if (this->param_propagate_down_[0]) {
+    caffe_set(this->blobs_[0]->count(), Dtype(0),
+        this->blobs_[0]->mutable_cpu_diff());
+    for (int slice = 1; slice < num_slice_; ++slice) {
+      caffe_set(slice_weight_diffs_[slice - 1]->count(), Dtype(0),
+          slice_weight_diffs_[slice - 1]->mutable_cpu_data());
+    }
+  }
+  if (bias_term_ && this->param_propagate_down_[1]) {
+    caffe_set(this->blobs_[1]->count(), Dtype(0),
+        this->blobs_[1]->mutable_cpu_diff());
+    for (int slice = 1; slice < num_slice_; ++slice) {
+      caffe_set(slice_bias_diffs_[slice - 1]->count(), Dtype(0),
+          slice_bias_diffs_[slice - 1]->mutable_cpu_data());
+    }
+  }
+  for (int i = 0; i < top.size(); ++i) {
+    if (!this->param_propagate_down_[0] && !propagate_down[i] &&
+        !(bias_term_ && this->param_propagate_down_[1])) {
+      continue;
+    }
+    slice_workers_->RunSlices(num_, num_slice_, boost::bind(
+        &ConvolutionLayer<Dtype>::backward_cpu_slice, this,
+        top[i]->cpu_diff(), (*bottom)[i]->cpu_data(),
+        propagate_down[i] ? (*bottom)[i]->mutable_cpu_diff() : NULL,
+        _1, _2, _3));
+  }
+  // Sum the gradients of the slices, always in the same order.
+  for (int slice = 1; slice < num_slice_; ++slice) {
+    if (this->param_propagate_down_[0]) {
+      caffe_axpy(this->blobs_[0]->count(), Dtype(1),
+          slice_weight_diffs_[slice - 1]->cpu_data(),
+          this->blobs_[0]->mutable_cpu_diff());
+    }
+    if (bias_term_ && this->param_propagate_down_[1]) {
+      caffe_axpy(this->blobs_[1]->count(), Dtype(1),
+          slice_bias_diffs_[slice - 1]->cpu_data(),
+          this->blobs_[1]->mutable_cpu_diff());
+    }
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::backward_cpu_slice(const Dtype* top_diff,
+    const Dtype* bottom_data, Dtype* bottom_diff, const int begin,
+    const int end, const int slice) {
+  const Dtype* weight = this->blobs_[0]->cpu_data();
   Dtype* weight_diff = NULL;
   if (this->param_propagate_down_[0]) {
-    weight = this->blobs_[0]->cpu_data();
-    weight_diff = this->blobs_[0]->mutable_cpu_diff();
-    caffe_set(this->blobs_[0]->count(), Dtype(0), weight_diff);
+    weight_diff = slice == 0 ? this->blobs_[0]->mutable_cpu_diff() :
+        slice_weight_diffs_[slice - 1]->mutable_cpu_data();
   }
   Dtype* bias_diff = NULL;
   if (bias_term_ && this->param_propagate_down_[1]) {
-    bias_diff = this->blobs_[1]->mutable_cpu_diff();
-    caffe_set(this->blobs_[1]->count(), Dtype(0), bias_diff);
+    bias_diff = slice == 0 ? this->blobs_[1]->mutable_cpu_diff() :
+        slice_bias_diffs_[slice - 1]->mutable_cpu_data();
   }
+  // a 1x1 convolution reads and writes the images as its column matrix
+  Dtype* col_data = is_1x1_ ? NULL : col_buffer(slice)->mutable_cpu_data();
+  Dtype* col_diff = is_1x1_ ? NULL : col_buffer(slice)->mutable_cpu_diff();
   const int weight_offset = M_ * K_;
   const int col_offset = K_ * N_;
   const int top_offset = M_ * N_;
-  for (int i = 0; i < top.size(); ++i) {
-    const Dtype* top_diff = NULL;
+  const int bottom_dim = channels_ * height_ * width_;
+  const int top_dim = num_output_ * N_;
+  for (int n = begin; n < end; ++n) {
     // Bias gradient, if necessary.
-    if (bias_term_ && this->param_propagate_down_[1]) {
-      top_diff = top[i]->cpu_diff();
-      for (int n = 0; n < num_; ++n) {
-        caffe_cpu_gemv<Dtype>(CblasNoTrans, num_output_, N_,
-            1., top_diff + top[0]->offset(n),
-            bias_multiplier_.cpu_data(), 1.,
-            bias_diff);
-      }
+    if (bias_diff) {
+      caffe_cpu_gemv<Dtype>(CblasNoTrans, num_output_, N_,
+          1., top_diff + top_dim * n,
+          bias_multiplier_.cpu_data(), 1.,
+          bias_diff);
     }
-    if (this->param_propagate_down_[0] || propagate_down[i]) {
-      if (!top_diff) {
-        top_diff = top[i]->cpu_diff();
-      }
-      Dtype* col_data = col_buffer_.mutable_cpu_data();
-      Dtype* col_diff = col_buffer_.mutable_cpu_diff();
-      const Dtype* bottom_data = (*bottom)[i]->cpu_data();
-      Dtype* bottom_diff = (*bottom)[i]->mutable_cpu_diff();
-      for (int n = 0; n < num_; ++n) {
-        // Since we saved memory in the forward pass by not storing all col
-        // data, we will need to recompute them.
-        im2col_cpu(bottom_data + (*bottom)[i]->offset(n), channels_, height_,
+    // gradient w.r.t. weight. Note that we will accumulate diffs.
+    if (weight_diff) {
+      // Since we saved memory in the forward pass by not storing all col
+      // data, we will need to recompute them.
+      if (is_1x1_) {
+        col_data = const_cast<Dtype*>(bottom_data) + bottom_dim * n;
+      } else {
+        im2col_cpu(bottom_data + bottom_dim * n, channels_, height_,
                    width_, kernel_h_, kernel_w_, pad_h_, pad_w_,
                    stride_h_, stride_w_, col_data);
-        // gradient w.r.t. weight. Note that we will accumulate diffs.
-        if (this->param_propagate_down_[0]) {
-          for (int g = 0; g < group_; ++g) {
-            caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
-                (Dtype)1., top_diff + top[i]->offset(n) + top_offset * g,
-                col_data + col_offset * g, (Dtype)1.,
-                weight_diff + weight_offset * g);
-          }
-        }
-        // gradient w.r.t. bottom data, if necessary.
-        if (propagate_down[i]) {
-          if (weight == NULL) {
-            weight = this->blobs_[0]->cpu_data();
-          }
-          for (int g = 0; g < group_; ++g) {
-            caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
-                (Dtype)1., weight + weight_offset * g,
-                top_diff + top[i]->offset(n) + top_offset * g,
-                (Dtype)0., col_diff + col_offset * g);
-          }
-          // col2im back to the data
-          col2im_cpu(col_diff, channels_, height_, width_,
-              kernel_h_, kernel_w_, pad_h_, pad_w_,
-              stride_h_, stride_w_, bottom_diff + (*bottom)[i]->offset(n));
-        }
+      }
+      for (int g = 0; g < group_; ++g) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
+            (Dtype)1., top_diff + top_dim * n + top_offset * g,
+            col_data + col_offset * g, (Dtype)1.,
+            weight_diff + weight_offset * g);
+      }
+    }
+    // gradient w.r.t. bottom data, if necessary.
+    if (bottom_diff) {
+      if (is_1x1_) {
+        col_diff = bottom_diff + bottom_dim * n;
+      }
+      for (int g = 0; g < group_; ++g) {
+        caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
+            (Dtype)1., weight + weight_offset * g,
+            top_diff + top_dim * n + top_offset * g,
+            (Dtype)0., col_diff + col_offset * g);
+      }
+      // col2im back to the data
+      if (!is_1x1_) {
+        col2im_cpu(col_diff, channels_, height_, width_,
+            kernel_h_, kernel_w_, pad_h_, pad_w_,
+            stride_h_, stride_w_, bottom_diff + bottom_dim * n);
       }
     }
   }
@@ -39,6 +39,10 @@ void ConvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
             bias_multiplier_.gpu_data(),
             (Dtype)1., top_data + (*top)[i]->offset(n));
       }
+      if (fused_relu_) {
+        caffe_gpu_relu(M_ * group_ * N_, relu_negative_slope_,
+            top_data + (*top)[i]->offset(n));
+      }
     }
   }
 }
@@ -43,6 +43,10 @@ void CuDNNConvolutionLayer<Dtype>::Forward_gpu(
     // stream, by launching an empty kernel into the default (null) stream.
     // NOLINT_NEXT_LINE(whitespace/operators)
     sync_conv_groups<<<1, 1>>>();
+    if (this->fused_relu_) {
+      caffe_gpu_relu((*top)[i]->count(), this->relu_negative_slope_,
+          top_data);
+    }
   }
 }
 
@@ -2,6 +2,7 @@
 #include <stdint.h>
 
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "caffe/common.hpp"
@@ -10,6 +11,7 @@
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
 #include "caffe/util/rng.hpp"
 
 #include <iostream>
@@ -104,7 +106,7 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   Datum datum;
   switch (this->layer_param_.data_param().backend()) {
   case DataParameter_DB_LEVELDB:
-    datum.ParseFromString(iter_->value().ToString());
+    datum.ParseFromArray(iter_->value().data(), iter_->value().size());
     break;
   case DataParameter_DB_LMDB:
     datum.ParseFromArray(mdb_value_.mv_data, mdb_value_.mv_size);
@@ -143,11 +145,10 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   this->datum_size_ = datum.channels() * datum.height() * datum.width();
 }
 
-// This function is used to create a thread that prefetches the data.
+// This function is called on the prefetch thread to load a batch.
 template <typename Dtype>
-void DataLayer<Dtype>::InternalThreadEntry() {
-  // std::cout << "DataLayer<Dtype>::InternalThreadEntry()" << std::endl;
-  Datum datum;
+void DataLayer<Dtype>::load_batch() {
+  // std::cout << "DataLayer<Dtype>::load_batch()" << std::endl;
   CHECK(this->prefetch_data_.count());
   Dtype* top_data = this->prefetch_data_.mutable_cpu_data();
   Dtype* top_label = NULL;  // suppress warnings about uninitialized variables
@@ -156,32 +157,43 @@ void DataLayer<Dtype>::InternalThreadEntry() {
   }
   const int batch_size = this->layer_param_.data_param().batch_size();
 
+  // The cursor is read in order here; parsing and transforming the records
+  // is left to the decode slices. The records are not copied: an LMDB value
+  // stays in the map while the read transaction is open. A LevelDB value
+  // only lives until the iterator moves, so it is decoded on the spot, or
+  // copied when there are several slices to decode it.
+  const bool decode_in_place = this->num_decode_slice() == 1 &&
+      this->layer_param_.data_param().backend() == DataParameter_DB_LEVELDB;
+  batch_record_.resize(batch_size);
+  batch_raw_.resize(batch_size);
   for (int item_id = 0; item_id < batch_size; ++item_id) {
     // get a blob
     switch (this->layer_param_.data_param().backend()) {
     case DataParameter_DB_LEVELDB:
       CHECK(iter_);
       CHECK(iter_->Valid());
-      datum.ParseFromString(iter_->value().ToString());
+      if (decode_in_place) {
+        batch_record_[item_id] = std::make_pair(iter_->value().data(),
+            static_cast<int>(iter_->value().size()));
+        decode_slice(top_data, top_label, item_id, item_id + 1, 0);
+      } else {
+        batch_raw_[item_id].assign(iter_->value().data(),
+            iter_->value().size());
+        batch_record_[item_id] = std::make_pair(batch_raw_[item_id].data(),
+            static_cast<int>(batch_raw_[item_id].size()));
+      }
       break;
     case DataParameter_DB_LMDB:
       CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_,
               &mdb_value_, MDB_GET_CURRENT), MDB_SUCCESS);
-      datum.ParseFromArray(mdb_value_.mv_data,
-          mdb_value_.mv_size);
+      batch_record_[item_id] = std::make_pair(
+          static_cast<const char*>(mdb_value_.mv_data),
+          static_cast<int>(mdb_value_.mv_size));
       break;
     default:
       LOG(FATAL) << "Unknown database backend";
     }
 
-    // Apply data transformations (mirror, scale, crop...)
-    this->data_transformer_.Transform(item_id, datum, this->mean_, top_data);
-
-    if (this->output_labels_) {
-      top_label[item_id] = datum.label();
-      // std::cout << "itemid " << item_id << " label " << top_label[item_id] << std::endl;
-    }
-
     // go to the next iter
     switch (this->layer_param_.data_param().backend()) {
     case DataParameter_DB_LEVELDB:
@@ -205,6 +217,32 @@ void DataLayer<Dtype>::InternalThreadEntry() {
       LOG(FATAL) << "Unknown database backend";
     }
   }
+
+  if (decode_in_place) {
+    return;
+  }
+  this->decode_workers_->RunSlices(batch_size, this->num_decode_slice(),
+      boost::bind(&DataLayer<Dtype>::decode_slice, this, top_data,
+      top_label, _1, _2, _3));
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::decode_slice(Dtype* top_data, Dtype* top_label,
+    const int begin, const int end, const int slice) {
+  DatumView datum;
+  DataTransformer<Dtype>* transformer = this->slice_transformer(slice);
+  for (int item_id = begin; item_id < end; ++item_id) {
+    CHECK(datum.Parse(batch_record_[item_id].first,
+        batch_record_[item_id].second)) << "Failed to parse datum";
+
+    // Apply data transformations (mirror, scale, crop...)
+    transformer->Transform(item_id, datum, this->mean_, top_data);
+
+    if (this->output_labels_) {
+      top_label[item_id] = datum.label;
+      // std::cout << "itemid " << item_id << " label " << top_label[item_id] << std::endl;
+    }
+  }
 }
 
 INSTANTIATE_CLASS(DataLayer);
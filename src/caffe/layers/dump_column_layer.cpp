@@ -2,9 +2,9 @@
 #include <functional>
 #include <utility>
 #include <vector>
-#include <fstream>
 
 #include "caffe/layer.hpp"
+#include "caffe/util/async_writer.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
@@ -18,14 +18,17 @@ void DumpColumnLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     LOG(FATAL)<<"data dump file do not exist.";
     return;
   }
-  out.open(this->layer_param_.dump_param().dump_file().c_str(),ios::out|ios::app);
-  LOG(INFO)<< "Dumping to " << this->layer_param_.dump_param().dump_file();
+  const DumpParameter& dump_param = this->layer_param_.dump_param();
+  writer_.reset(new AsyncWriter(dump_param.dump_file(), dump_param.binary(),
+      dump_param.compress(), dump_param.block_size()));
+  LOG(INFO)<< "Dumping to " << dump_param.dump_file();
 }
 
 template <typename Dtype>
 DumpColumnLayer<Dtype>::~DumpColumnLayer() {
   LOG(INFO)<< "Closing file " << this->layer_param_.dump_param().dump_file();
-  out.close();
+  // writes the rows still queued
+  writer_.reset();
 }
 
 template <typename Dtype>
@@ -40,12 +43,8 @@ void DumpColumnLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const int num = bottom[0]->num();
   const int dim = bottom[0]->count()/bottom[0]->num();
   const Dtype* bottom_data = bottom[0]->cpu_data();
-  for (int i = 0; i < num; ++i) {
-    for (int j = 0; j < dim; ++j) {
-      out << bottom_data[i*dim + j] << " ";
-    }
-    out << std::endl;
-  }
+  writer_->BeginRows(num, ' ', true);
+  writer_->AddColumns(bottom_data, dim);
 
   (*top)[0]->mutable_cpu_data()[0] = bottom[0]->num();
 }
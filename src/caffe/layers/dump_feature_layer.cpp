@@ -2,9 +2,9 @@
 #include <functional>
 #include <utility>
 #include <vector>
-#include <fstream>
 
 #include "caffe/layer.hpp"
+#include "caffe/util/async_writer.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
@@ -18,14 +18,17 @@ void DumpFeatureLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     LOG(FATAL)<<"data dump file do not exist.";
     return;
   }
-  out.open(this->layer_param_.dump_param().dump_file().c_str(),ios::out|ios::app);
-  LOG(INFO)<< "Dumping to " << this->layer_param_.dump_param().dump_file();
+  const DumpParameter& dump_param = this->layer_param_.dump_param();
+  writer_.reset(new AsyncWriter(dump_param.dump_file(), dump_param.binary(),
+      dump_param.compress(), dump_param.block_size()));
+  LOG(INFO)<< "Dumping to " << dump_param.dump_file();
 }
 
 template <typename Dtype>
 DumpFeatureLayer<Dtype>::~DumpFeatureLayer() {
   LOG(INFO)<< "Closing file " << this->layer_param_.dump_param().dump_file();
-  out.close();
+  // writes the rows still queued
+  writer_.reset();
 }
 
 template <typename Dtype>
@@ -39,23 +42,24 @@ void DumpFeatureLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     vector<Blob<Dtype>*>* top) {
 
   const Dtype* bottom_data = bottom[0]->cpu_data();
-  const Dtype* itact_data_ = bottom[1]->cpu_data();
-  const Dtype* itact_count_ = bottom[2]->cpu_data();
+  const int* itact_data_ = bottom[1]->cpu_index();
+  const int* itact_count_ = bottom[2]->cpu_index();
   int count = bottom[0]->count();
   int num = bottom[0]->num();
   int dim = count/num;
 
   int item_offset = 0, item_real_id = 0;
-  // dumping features
+  // dumping features as "item_real_id,0,feature..." rows
+  row_id_.resize(num*2);
   for (int itemid = 0; itemid < num; ++itemid) {
     item_offset = itact_count_[itemid*2];
     item_real_id = itact_data_[item_offset*2];
-    out << item_real_id << "," << 0;
-    for (int j = 0; j < dim; ++j) {
-      out << "," << bottom_data[itemid*dim + j] ;
-    }
-    out << std::endl;
+    row_id_[itemid*2] = item_real_id;
+    row_id_[itemid*2 + 1] = 0;
   }
+  writer_->BeginRows(num, ',', false);
+  writer_->AddColumns(&row_id_[0], 2);
+  writer_->AddColumns(bottom_data, dim);
 
   (*top)[0]->mutable_cpu_data()[0] = num;
 }
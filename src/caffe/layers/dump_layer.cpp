@@ -2,9 +2,9 @@
 #include <functional>
 #include <utility>
 #include <vector>
-#include <fstream>
 
 #include "caffe/layer.hpp"
+#include "caffe/util/async_writer.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
@@ -18,14 +18,17 @@ void DumpLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     LOG(FATAL)<<"data dump file do not exist.";
     return;
   }
-  out.open(this->layer_param_.dump_param().dump_file().c_str(),ios::out|ios::app);
-  LOG(INFO)<< "Dumping to " << this->layer_param_.dump_param().dump_file();
+  const DumpParameter& dump_param = this->layer_param_.dump_param();
+  writer_.reset(new AsyncWriter(dump_param.dump_file(), dump_param.binary(),
+      dump_param.compress(), dump_param.block_size()));
+  LOG(INFO)<< "Dumping to " << dump_param.dump_file();
 }
 
 template <typename Dtype>
 DumpLayer<Dtype>::~DumpLayer() {
   LOG(INFO)<< "Closing file " << this->layer_param_.dump_param().dump_file();
-  out.close();
+  // writes the rows still queued
+  writer_.reset();
 }
 
 template <typename Dtype>
@@ -58,11 +61,10 @@ void DumpLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   //   return;
   // }
   // out.open(this->layer_param_.dump_param().dump_file().c_str(),ios::out|ios::app);
-  const Dtype* bottom_data = bottom[0]->cpu_data();
-  const Dtype* bottom_label = bottom[1]->cpu_data();
-  for (int i = 0; i < num_rating_; ++i) {
-    out << bottom_data[i] << " " << bottom_label[i] << std::endl;
-  }
+  // "rating label" rows, formatted on the writer thread
+  writer_->BeginRows(num_rating_, ' ', false);
+  writer_->AddColumns(bottom[0]->cpu_data(), 1);
+  writer_->AddColumns(bottom[1]->cpu_data(), 1);
   // out.close();
   (*top)[0]->mutable_cpu_data()[0] = num_rating_;
 }
@@ -41,6 +41,11 @@ void InnerProductLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     }
   }  // parameter initialization
   this->param_propagate_down_.resize(this->blobs_.size(), true);
+  // the fused ReLU is not backpropagated through
+  CHECK(!this->layer_param_.has_fused_relu() || this->inference())
+      << "fused_relu is only supported in inference mode";
+  fused_relu_ = this->layer_param_.has_fused_relu();
+  relu_negative_slope_ = this->layer_param_.fused_relu().negative_slope();
 }
 
 template <typename Dtype>
@@ -62,9 +67,9 @@ template <typename Dtype>
 void InnerProductLayer<Dtype>::Dump(const vector<Blob<Dtype>*>& bottom,
     vector<Blob<Dtype>*>* top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
-  const Dtype* top_data = (*top)[1]->cpu_data();
+  const Dtype* top_data = (*top)[0]->cpu_data();
   const Dtype* weight = this->blobs_[0]->cpu_data();
-  const Dtype* bias = this->blobs_[1]->cpu_data();
+  const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
 
   int num_input = bottom[0]->num();
   int dim_input = bottom[0]->count()/num_input;
@@ -84,7 +89,7 @@ void InnerProductLayer<Dtype>::Dump(const vector<Blob<Dtype>*>& bottom,
     out.close();
   }
 
-  if (this->layer_param_.inner_product_param().has_dump_bias()) {
+  if (this->layer_param_.inner_product_param().has_dump_bias() && bias_term_) {
     LOG(INFO) << "Dumping bias " << N_;
     out.open(this->layer_param_.inner_product_param().dump_bias().c_str(),ios::out);
     for (int i=0; i<N_; i++) {
@@ -132,6 +137,9 @@ void InnerProductLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
         bias_multiplier_.cpu_data(),
         this->blobs_[1]->cpu_data(), (Dtype)1., top_data);
   }
+  if (fused_relu_) {
+    caffe_relu(M_ * N_, relu_negative_slope_, top_data);
+  }
   Dump(bottom, top);
 }
 
@@ -22,6 +22,9 @@ void InnerProductLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
         bias_multiplier_.gpu_data(),
         this->blobs_[1]->gpu_data(), (Dtype)1., top_data);
   }
+  if (fused_relu_) {
+    caffe_gpu_relu(M_ * N_, relu_negative_slope_, top_data);
+  }
   Dump(bottom, top);
 }
 
@@ -1,7 +1,10 @@
 #include <leveldb/db.h>
 #include <stdint.h>
 
+#include <algorithm>
+#include <cstdlib>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "caffe/common.hpp"
@@ -10,6 +13,7 @@
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
 #include "caffe/util/rng.hpp"
 
 namespace caffe {
@@ -17,6 +21,10 @@ namespace caffe {
 template <typename Dtype>
 InteractionDataLayer<Dtype>::~InteractionDataLayer<Dtype>() {
   this->JoinPrefetchThread();
+  if (num_read_ > 0) {
+    LOG(INFO) << "Read " << num_read_ << " records with " << num_step_
+              << " cursor steps and " << num_seek_ << " seeks";
+  }
   // clean up the database resources
   switch (this->layer_param_.data_param().backend()) {
   case DataParameter_DB_LEVELDB:
@@ -27,6 +35,8 @@ InteractionDataLayer<Dtype>::~InteractionDataLayer<Dtype>() {
     mdb_txn_abort(mdb_txn_);
     mdb_env_close(mdb_env_);
     break;
+  case DataParameter_DB_COLUMNAR:
+    break;  // itact_file_ unmaps the file
   default:
     LOG(FATAL) << "Unknown database backend";
   }
@@ -39,20 +49,10 @@ void InteractionDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bot
   // Initialize DB
   switch (this->layer_param_.data_param().backend()) {
   case DataParameter_DB_LEVELDB:
-    {
-    leveldb::DB* db_temp;
-    leveldb::Options options = GetLevelDBOptions();
-    options.create_if_missing = false;
-    LOG(INFO) << "Opening leveldb " << this->layer_param_.data_param().source();
-    leveldb::Status status = leveldb::DB::Open(
-        options, this->layer_param_.data_param().source(), &db_temp);
-    CHECK(status.ok()) << "Failed to open leveldb "
-                       << this->layer_param_.data_param().source() << std::endl
-                       << status.ToString();
-    db_.reset(db_temp);
+    // the layers reading the same source, as the shards of caffe score do,
+    // share its handle and each iterate on their own
+    db_ = OpenSharedLevelDB(this->layer_param_.data_param().source());
     iter_.reset(db_->NewIterator(leveldb::ReadOptions()));
-    iter_->SeekToFirst();
-    }
     break;
   case DataParameter_DB_LMDB:
     CHECK_EQ(mdb_env_create(&mdb_env_), MDB_SUCCESS) << "mdb_env_create failed";
@@ -67,12 +67,78 @@ void InteractionDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bot
     CHECK_EQ(mdb_cursor_open(mdb_txn_, mdb_dbi_, &mdb_cursor_), MDB_SUCCESS)
         << "mdb_cursor_open failed";
     LOG(INFO) << "Opening lmdb " << this->layer_param_.data_param().source();
-    CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_, MDB_FIRST),
-        MDB_SUCCESS) << "mdb_cursor_get failed";
+    break;
+  case DataParameter_DB_COLUMNAR:
+    LOG(INFO) << "Opening interaction file "
+              << this->layer_param_.data_param().source();
+    itact_file_.reset(
+        new InteractionFile(this->layer_param_.data_param().source()));
+    CHECK_GT(itact_file_->num_record(), 0) << "Empty interaction file";
     break;
   default:
     LOG(FATAL) << "Unknown database backend";
   }
+  num_read_ = 0;
+  num_step_ = 0;
+  num_seek_ = 0;
+  first_record();
+  CHECK(in_range()) << "No records from begin_key "
+      << this->layer_param_.data_param().begin_key() << " to end_key "
+      << this->layer_param_.data_param().end_key();
+  exhausted_ = false;
+  const DataParameter_Shuffle shuffle =
+      this->layer_param_.data_param().shuffle();
+  if (this->layer_param_.data_param().single_pass()) {
+    // every record of the range is read exactly once
+    CHECK_EQ(this->layer_param_.data_param().rand_skip(), 0)
+        << "single_pass does not skip records";
+    CHECK_EQ(this->layer_param_.data_param().rand_jump(), 0)
+        << "single_pass does not skip records";
+    CHECK_EQ(shuffle, DataParameter_Shuffle_NONE)
+        << "single_pass reads in key order";
+  }
+  if (shuffle != DataParameter_Shuffle_NONE) {
+    const unsigned int prefetch_rng_seed = caffe_rng_rand();
+    prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
+  }
+  if (shuffle == DataParameter_Shuffle_INDEX) {
+    build_index();
+    first_record();
+  } else if (shuffle == DataParameter_Shuffle_BUFFER) {
+    CHECK_NE(this->layer_param_.data_param().backend(),
+        DataParameter_DB_COLUMNAR) << "COLUMNAR records shuffle by INDEX";
+    const int buffer_size = this->layer_param_.data_param().shuffle_buffer();
+    CHECK_GT(buffer_size, 0);
+    const bool leveldb = this->layer_param_.data_param().backend() ==
+        DataParameter_DB_LEVELDB;
+    buffer_record_.resize(buffer_size);
+    buffer_raw_.resize(leveldb ? buffer_size : 0);
+    // a range shorter than the buffer is buffered once, rather than wrapped
+    // around into duplicates
+    int num_buffered = 0;
+    bool wrapped = false;
+    while (num_buffered < buffer_size && !wrapped) {
+      read_record(&buffer_record_[num_buffered],
+          leveldb ? &buffer_raw_[num_buffered] : NULL);
+      ++num_buffered;
+      if (!step()) {
+        first_record();
+        wrapped = true;
+      }
+    }
+    buffer_record_.resize(num_buffered);
+    buffer_raw_.resize(leveldb ? num_buffered : 0);
+    buffer_order_.clear();
+    if (wrapped) {
+      // the first take shuffles the order of the first pass
+      for (int i = 0; i < num_buffered; ++i) {
+        buffer_order_.push_back(i);
+      }
+      buffer_pos_ = num_buffered;
+    }
+    LOG(INFO) << "Shuffling through a buffer of " << num_buffered
+        << " records";
+  }
 
   // Check if we would need to randomly skip a few data points
   random_skip();
@@ -81,11 +147,17 @@ void InteractionDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bot
   DatumInteraction datumItract;
   switch (this->layer_param_.data_param().backend()) {
   case DataParameter_DB_LEVELDB:
-    datumItract.ParseFromString(iter_->value().ToString());
+    datumItract.ParseFromArray(iter_->value().data(), iter_->value().size());
     break;
   case DataParameter_DB_LMDB:
     datumItract.ParseFromArray(mdb_value_.mv_data, mdb_value_.mv_size);
     break;
+  case DataParameter_DB_COLUMNAR:
+    // only the image shape is needed here
+    datumItract.mutable_datum()->set_channels(itact_file_->channels());
+    datumItract.mutable_datum()->set_height(itact_file_->height());
+    datumItract.mutable_datum()->set_width(itact_file_->width());
+    break;
   default:
     LOG(FATAL) << "Unknown database backend";
   }
@@ -115,19 +187,22 @@ void InteractionDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bot
         1, 1, 1);
   }
 
-  // interaction_data have variable lenth, maybe we just use max length?
-  inact_total_size = this->layer_param_.data_param().batch_size() * this->layer_param_.data_param().itact_size();
-  // LOG(INFO) << "setting up prefetches_data/label batch_size*itact_size " << this->layer_param_.data_param().batch_size()<<"*"<<this->layer_param_.data_param().itact_size();
-
-  (*top)[2]->Reshape(
-      inact_total_size, 2, 1, 1);
-  this->prefetch_itact_data_.Reshape(inact_total_size, 2, 1, 1);
-  (*top)[3]->Reshape(
-      inact_total_size, 1, 1, 1);
-  this->prefetch_itact_label_.Reshape(inact_total_size, 1, 1, 1);
-  (*top)[4]->Reshape(
-      this->layer_param_.data_param().batch_size(), 2, 1, 1);
-  this->prefetch_itact_count_.Reshape(this->layer_param_.data_param().batch_size(), 2, 1, 1);
+  // The interaction tops are resized to the number of ratings of every
+  // batch; itact_size, the expected number of ratings per item, only sets
+  // the initial size.
+  const int batch_size = this->layer_param_.data_param().batch_size();
+  const int itact_total_size = std::max<int>(1,
+      batch_size * this->layer_param_.data_param().itact_size());
+  (*top)[2]->Reshape(itact_total_size, 2, 1, 1);
+  this->prefetch_itact_data_.Reshape(itact_total_size, 2, 1, 1);
+  (*top)[3]->Reshape(itact_total_size, 1, 1, 1);
+  this->prefetch_itact_label_.Reshape(itact_total_size, 1, 1, 1);
+  (*top)[4]->Reshape(batch_size, 2, 1, 1);
+  this->prefetch_itact_count_.Reshape(batch_size, 2, 1, 1);
+  batch_record_.resize(batch_size);
+  batch_raw_.resize(batch_size);
+  batch_itact_.resize(batch_size);
+  batch_record_id_.resize(batch_size);
 
   // datum size
   this->datum_channels_ = datum.channels();
@@ -144,142 +219,419 @@ void InteractionDataLayer<Dtype>::random_skip() {
                         this->layer_param_.data_param().rand_skip();
     // LOG(INFO) << "Skipping first " << skip << " data points.";
     while (skip-- > 0) {
-      switch (this->layer_param_.data_param().backend()) {
-      case DataParameter_DB_LEVELDB:
-        iter_->Next();
-        if (!iter_->Valid()) {
-          iter_->SeekToFirst();
-        }
-        break;
-      case DataParameter_DB_LMDB:
-        if (mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_, MDB_NEXT)
-            != MDB_SUCCESS) {
-          CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_,
-                   MDB_FIRST), MDB_SUCCESS);
-        }
-        break;
-      default:
-        LOG(FATAL) << "Unknown database backend";
-      }
+      next_record();
+    }
+  }
+}
+
+// A record number of the COLUMNAR backend given as a key.
+static int64_t RecordKey(const string& key, const int64_t empty_value) {
+  if (key.empty()) {
+    return empty_value;
+  }
+  char* end;
+  const int64_t record_id = strtoll(key.c_str(), &end, 10);
+  CHECK(*end == '\0' && record_id >= 0) << "Invalid record number " << key;
+  return record_id;
+}
+
+template <typename Dtype>
+void InteractionDataLayer<Dtype>::first_record() {
+  if (!index_order_.empty()) {
+    // a new epoch of shuffle INDEX
+    caffe::rng_t* prefetch_rng =
+        static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+    shuffle(index_order_.begin(), index_order_.end(), prefetch_rng);
+    index_pos_ = 0;
+    seek_index();
+    return;
+  }
+  ++num_seek_;
+  const string& begin_key = this->layer_param_.data_param().begin_key();
+  switch (this->layer_param_.data_param().backend()) {
+  case DataParameter_DB_LEVELDB:
+    if (begin_key.empty()) {
+      iter_->SeekToFirst();
+    } else {
+      iter_->Seek(begin_key);
+    }
+    break;
+  case DataParameter_DB_LMDB:
+    if (begin_key.empty()) {
+      CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_,
+               MDB_FIRST), MDB_SUCCESS) << "mdb_cursor_get failed";
+    } else {
+      mdb_key_.mv_size = begin_key.size();
+      mdb_key_.mv_data = const_cast<char*>(begin_key.data());
+      // the first key not less than begin_key
+      CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_,
+               MDB_SET_RANGE), MDB_SUCCESS) << "No key from " << begin_key;
+    }
+    break;
+  case DataParameter_DB_COLUMNAR:
+    record_id_ = RecordKey(begin_key, 0);
+    break;
+  default:
+    LOG(FATAL) << "Unknown database backend";
+  }
+}
+
+template <typename Dtype>
+bool InteractionDataLayer<Dtype>::in_range() {
+  const string& end_key = this->layer_param_.data_param().end_key();
+  switch (this->layer_param_.data_param().backend()) {
+  case DataParameter_DB_LEVELDB:
+    return iter_->Valid() &&
+        (end_key.empty() || iter_->key().compare(end_key) < 0);
+  case DataParameter_DB_LMDB:
+    // lmdb orders keys as the bytes compare, as std::string does
+    return end_key.empty() || end_key.compare(0, string::npos,
+        static_cast<const char*>(mdb_key_.mv_data), mdb_key_.mv_size) > 0;
+  case DataParameter_DB_COLUMNAR:
+    return record_id_ < RecordKey(end_key, itact_file_->num_record()) &&
+        record_id_ < itact_file_->num_record();
+  default:
+    LOG(FATAL) << "Unknown database backend";
+  }
+  return false;
+}
+
+template <typename Dtype>
+bool InteractionDataLayer<Dtype>::step() {
+  ++num_step_;
+  switch (this->layer_param_.data_param().backend()) {
+  case DataParameter_DB_LEVELDB:
+    iter_->Next();
+    break;
+  case DataParameter_DB_LMDB:
+    if (mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_, MDB_NEXT)
+        != MDB_SUCCESS) {
+      return false;
+    }
+    break;
+  case DataParameter_DB_COLUMNAR:
+    ++record_id_;
+    break;
+  default:
+    LOG(FATAL) << "Unknown database backend";
+  }
+  return in_range();
+}
+
+template <typename Dtype>
+void InteractionDataLayer<Dtype>::next_record() {
+  if (!index_order_.empty()) {
+    if (++index_pos_ == static_cast<int64_t>(index_order_.size())) {
+      first_record();
+    } else {
+      seek_index();
+    }
+    return;
+  }
+  if (!step()) {
+    if (this->layer_param_.data_param().single_pass()) {
+      exhausted_ = true;
+    } else {
+      // We have reached the end. Restart from the first.
+      DLOG(INFO) << "Restarting data prefetching from start.";
+      first_record();
+    }
+  }
+}
+
+template <typename Dtype>
+void InteractionDataLayer<Dtype>::read_record(
+    std::pair<const char*, int>* record, string* raw) {
+  switch (this->layer_param_.data_param().backend()) {
+  case DataParameter_DB_LEVELDB:
+    CHECK(iter_);
+    CHECK(iter_->Valid());
+    if (raw) {
+      raw->assign(iter_->value().data(), iter_->value().size());
+      *record = std::make_pair(raw->data(), static_cast<int>(raw->size()));
+    } else {
+      *record = std::make_pair(iter_->value().data(),
+          static_cast<int>(iter_->value().size()));
+    }
+    break;
+  case DataParameter_DB_LMDB:
+    CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_,
+            &mdb_value_, MDB_GET_CURRENT), MDB_SUCCESS);
+    *record = std::make_pair(static_cast<const char*>(mdb_value_.mv_data),
+        static_cast<int>(mdb_value_.mv_size));
+    break;
+  default:
+    LOG(FATAL) << "Unknown database backend";
+  }
+}
+
+template <typename Dtype>
+void InteractionDataLayer<Dtype>::build_index() {
+  // one scan of the range, from the first record
+  const DataParameter_DB backend = this->layer_param_.data_param().backend();
+  vector<int64_t> order;
+  index_keys_.clear();
+  index_offset_.assign(1, 0);
+  do {
+    switch (backend) {
+    case DataParameter_DB_LEVELDB:
+      index_keys_.append(iter_->key().data(), iter_->key().size());
+      break;
+    case DataParameter_DB_LMDB:
+      index_keys_.append(static_cast<const char*>(mdb_key_.mv_data),
+          mdb_key_.mv_size);
+      break;
+    case DataParameter_DB_COLUMNAR:
+      order.push_back(record_id_);  // the record numbers are the keys
+      break;
+    default:
+      LOG(FATAL) << "Unknown database backend";
+    }
+    if (backend != DataParameter_DB_COLUMNAR) {
+      order.push_back(index_offset_.size() - 1);
+      index_offset_.push_back(index_keys_.size());
+    }
+  } while (step());
+  LOG(INFO) << "Indexed " << order.size() << " records, "
+            << index_keys_.size() << " bytes of keys, for shuffling";
+  index_order_.swap(order);
+}
+
+template <typename Dtype>
+void InteractionDataLayer<Dtype>::seek_index() {
+  ++num_seek_;
+  const int64_t key = index_order_[index_pos_];
+  switch (this->layer_param_.data_param().backend()) {
+  case DataParameter_DB_LEVELDB:
+    iter_->Seek(leveldb::Slice(index_keys_.data() + index_offset_[key],
+        index_offset_[key + 1] - index_offset_[key]));
+    CHECK(iter_->Valid());
+    break;
+  case DataParameter_DB_LMDB:
+    mdb_key_.mv_size = index_offset_[key + 1] - index_offset_[key];
+    mdb_key_.mv_data = &index_keys_[index_offset_[key]];
+    CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_, MDB_SET_KEY),
+        MDB_SUCCESS) << "Indexed key not found";
+    break;
+  case DataParameter_DB_COLUMNAR:
+    record_id_ = key;
+    break;
+  default:
+    LOG(FATAL) << "Unknown database backend";
+  }
+}
+
+template <typename Dtype>
+void InteractionDataLayer<Dtype>::take_buffered(const int item_id) {
+  caffe::rng_t* prefetch_rng =
+      static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+  if (!buffer_order_.empty()) {
+    // the buffer holds the whole range and is never refilled, so a pass
+    // draws each of its records once
+    if (buffer_pos_ == static_cast<int>(buffer_order_.size())) {
+      shuffle(buffer_order_.begin(), buffer_order_.end(), prefetch_rng);
+      buffer_pos_ = 0;
+    }
+    const int slot = buffer_order_[buffer_pos_++];
+    if (buffer_raw_.size()) {
+      batch_raw_[item_id] = buffer_raw_[slot];
+      batch_record_[item_id] = std::make_pair(batch_raw_[item_id].data(),
+          static_cast<int>(batch_raw_[item_id].size()));
+    } else {
+      batch_record_[item_id] = buffer_record_[slot];
     }
+    return;
+  }
+  const int slot = (*prefetch_rng)() % buffer_record_.size();
+  if (buffer_raw_.size()) {
+    // the batch takes the copy over
+    batch_raw_[item_id].swap(buffer_raw_[slot]);
+    batch_record_[item_id] = std::make_pair(batch_raw_[item_id].data(),
+        static_cast<int>(batch_raw_[item_id].size()));
+    read_record(&buffer_record_[slot], &buffer_raw_[slot]);
+  } else {
+    batch_record_[item_id] = buffer_record_[slot];
+    read_record(&buffer_record_[slot], NULL);
   }
+  next_record();
 }
 
-// This function is used to create a thread that prefetches the data.
+// This function is called on the prefetch thread to load a batch.
 template <typename Dtype>
-void InteractionDataLayer<Dtype>::InternalThreadEntry() {
-  // LOG(INFO) << "InternalThreadEntry";
+void InteractionDataLayer<Dtype>::load_batch() {
+  // LOG(INFO) << "load_batch";
 
   // Check if we would need to randomly skip a few data points
   random_skip();
 
-  DatumInteraction datumItract;
-  Datum datum;
-  CHECK(this->prefetch_data_.count());
+  const bool columnar = this->layer_param_.data_param().backend() ==
+      DataParameter_DB_COLUMNAR;
+  // Only a single_pass batch at the end of the range comes out short; the
+  // blobs are reshaped every batch since they cycle through the queue.
+  // Shrinking them below keeps the memory written here.
+  const int max_batch_size = this->layer_param_.data_param().batch_size();
+  this->prefetch_data_.Reshape(max_batch_size, this->prefetch_data_.channels(),
+      this->prefetch_data_.height(), this->prefetch_data_.width());
   Dtype* top_data = this->prefetch_data_.mutable_cpu_data();
   Dtype* top_label = NULL;  // suppress warnings about uninitialized variables
   if (this->output_labels_) {
+    this->prefetch_label_.Reshape(max_batch_size, 1, 1, 1);
     top_label = this->prefetch_label_.mutable_cpu_data();
   }
-  const int batch_size = this->layer_param_.data_param().batch_size();
-
-  Dtype* top_data_itact = this->prefetch_itact_data_.mutable_cpu_data();
-  Dtype* top_label_itact = this->prefetch_itact_label_.mutable_cpu_data();
-  Dtype* top_itact_count = this->prefetch_itact_count_.mutable_cpu_data();
-  // use a variable length vector to hold first?
-  // Hard to know which part of the click data is belong to which, if not fixed length.
-  int itact_offset = 0;
-
-  for (int item_id = 0; item_id < batch_size; ++item_id) {
-    // std::cout << "processing itemid:" << item_id << std::endl; 
 
+  // First gather the records of the batch, so that the interaction blobs can
+  // be sized to the ratings they actually hold. The cursor is read in order
+  // here; parsing and transforming the records is left to the decode slices.
+  // The records are not copied: an LMDB value stays in the map while the
+  // read transaction is open. A LevelDB value only lives until the iterator
+  // moves, so it is parsed and its image transformed on the spot, or it is
+  // copied when there are several slices to decode it or when it waits in
+  // the shuffle buffer.
+  const bool buffered = this->layer_param_.data_param().shuffle() ==
+      DataParameter_Shuffle_BUFFER;
+  const bool decode_in_place = this->num_decode_slice() == 1 && !buffered &&
+      this->layer_param_.data_param().backend() == DataParameter_DB_LEVELDB;
+  int batch_size = 0;
+  for (; batch_size < max_batch_size && !exhausted_; ++batch_size) {
+    const int item_id = batch_size;
     // random skip here makes expontionally many combinations
     if (this->layer_param_.data_param().rand_jump() > 0) {
       const unsigned int rand_max = 1000000;
       unsigned int skip = caffe_rng_rand() % rand_max;
       if (skip <= this->layer_param_.data_param().rand_jump()*rand_max) {
-        // std::cout << "skip:" << skip <<" threshold:" << this->layer_param_.data_param().rand_jump()*rand_max << std::endl;
         random_skip();
       }
     }
+    if (buffered) {
+      take_buffered(item_id);
+      continue;
+    }
 
-
-    // get a blob
     switch (this->layer_param_.data_param().backend()) {
     case DataParameter_DB_LEVELDB:
-      CHECK(iter_);
-      CHECK(iter_->Valid());
-      datumItract.ParseFromString(iter_->value().ToString());
+      read_record(&batch_record_[item_id],
+          decode_in_place ? NULL : &batch_raw_[item_id]);
+      if (decode_in_place) {
+        parse_slice(item_id, item_id + 1, 0);
+        this->data_transformer_.Transform(item_id,
+            batch_itact_[item_id].datum, this->mean_, top_data);
+      }
       break;
     case DataParameter_DB_LMDB:
-      CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_,
-              &mdb_value_, MDB_GET_CURRENT), MDB_SUCCESS);
-      datumItract.ParseFromArray(mdb_value_.mv_data,
-          mdb_value_.mv_size);
+      read_record(&batch_record_[item_id], NULL);
+      break;
+    case DataParameter_DB_COLUMNAR:
+      batch_record_id_[item_id] = record_id_;  // read in place below
       break;
     default:
       LOG(FATAL) << "Unknown database backend";
     }
 
-    datum = datumItract.datum();
-    // LOG(INFO) << "this->data_transformer_.Transform(item_id, datum, this->mean_, top_data);";
-    // Apply data transformations (mirror, scale, crop...)
-    this->data_transformer_.Transform(item_id, datum, this->mean_, top_data);
+    next_record();
+  }
+  num_read_ += batch_size;
 
-    if (this->output_labels_) {
-      top_label[item_id] = datum.label();
-    }
+  // The records are parsed by the decode slices
+  if (!columnar && !decode_in_place) {
+    this->decode_workers_->RunSlices(batch_size, this->num_decode_slice(),
+        boost::bind(&InteractionDataLayer<Dtype>::parse_slice, this,
+        _1, _2, _3));
+  }
+  this->prefetch_data_.Reshape(batch_size, this->prefetch_data_.channels(),
+      this->prefetch_data_.height(), this->prefetch_data_.width());
+  if (this->output_labels_) {
+    this->prefetch_label_.Reshape(batch_size, 1, 1, 1);
+  }
+  this->prefetch_itact_count_.Reshape(batch_size, 2, 1, 1);
+  int* top_itact_count = this->prefetch_itact_count_.mutable_cpu_index();
+  int itact_offset = 0;
+  for (int item_id = 0; item_id < batch_size; ++item_id) {
+    const int num_rating = columnar ?
+        itact_file_->num_rating(batch_record_id_[item_id]) :
+        batch_itact_[item_id].userid.size();
+    top_itact_count[item_id*2] = itact_offset;
+    top_itact_count[item_id*2 + 1] = num_rating;
+    itact_offset += num_rating;
+  }
 
-    // adding interaction datatype
-    CHECK_EQ(datumItract.userid_size(), datumItract.itemid_size()) << "userid and itemid have different length";
-    CHECK_EQ(datumItract.userid_size(), datumItract.rating_size()) << "userid and rating have different length";
-    CHECK_GE(this->prefetch_itact_data_.num(), itact_offset+datumItract.userid_size()) << "Max number of rating exceeded!";
+  // Shrinking a blob keeps its memory, so the buffers only ever grow to the
+  // largest batch seen.
+  this->prefetch_itact_data_.Reshape(itact_offset, 2, 1, 1);
+  this->prefetch_itact_label_.Reshape(itact_offset, 1, 1, 1);
 
-    top_itact_count[item_id*2] = itact_offset;
-    top_itact_count[item_id*2 + 1] = datumItract.userid_size();
-    // Note: leveldb traverse not in first in first out order.
-    // LOG(INFO) << "itemid: "<<item_id << " item_real_id:" << datumItract.itemid(0) <<" offset:" << itact_offset << " rating_size: " << datumItract.userid_size();
-    // setting interaction data
-    for (int itact_id = 0; itact_id < datumItract.userid_size() && itact_offset+itact_id < inact_total_size; ++itact_id) {
-      top_data_itact[(itact_offset + itact_id)*2] = datumItract.itemid(itact_id);
-      top_data_itact[(itact_offset + itact_id)*2 + 1] = datumItract.userid(itact_id);
-      top_label_itact[itact_offset + itact_id] = datumItract.rating(itact_id);
-      // LOG(INFO) << "itemid:" << datumItract.itemid(itact_id) << " userid:" << datumItract.userid(itact_id)
-        // << " rating:" << datumItract.rating(itact_id);
-    }
-    itact_offset += datumItract.userid_size(); // WARNING! ERROR! incase only part of the rating is used. Line 211 ensure this is safe.
+  // ids and offsets are written to the index, so they stay exact
+  int* top_data_itact = this->prefetch_itact_data_.mutable_cpu_index();
+  Dtype* top_label_itact = this->prefetch_itact_label_.mutable_cpu_data();
 
-    // go to the next iter
-    switch (this->layer_param_.data_param().backend()) {
-    case DataParameter_DB_LEVELDB:
-      iter_->Next();
-      if (!iter_->Valid()) {
-        // We have reached the end. Restart from the first.
-        DLOG(INFO) << "Restarting data prefetching from start.";
-        // LOG(INFO) << "Restarting data prefetching from start.";
-        iter_->SeekToFirst();
-      }
-      break;
-    case DataParameter_DB_LMDB:
-      if (mdb_cursor_get(mdb_cursor_, &mdb_key_,
-              &mdb_value_, MDB_NEXT) != MDB_SUCCESS) {
-        // We have reached the end. Restart from the first.
-        DLOG(INFO) << "Restarting data prefetching from start.";
-        CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_,
-                &mdb_value_, MDB_FIRST), MDB_SUCCESS);
+  this->decode_workers_->RunSlices(batch_size, this->num_decode_slice(),
+      boost::bind(&InteractionDataLayer<Dtype>::decode_slice, this,
+      decode_in_place ? NULL : top_data, top_label, top_data_itact,
+      top_label_itact, _1, _2, _3));
+}
+
+template <typename Dtype>
+void InteractionDataLayer<Dtype>::parse_slice(const int begin, const int end,
+    const int slice) {
+  for (int item_id = begin; item_id < end; ++item_id) {
+    DatumInteractionView& datumItract = batch_itact_[item_id];
+    CHECK(datumItract.Parse(batch_record_[item_id].first,
+        batch_record_[item_id].second)) << "Failed to parse record";
+    CHECK_EQ(datumItract.userid.size(), datumItract.itemid.size()) << "userid and itemid have different length";
+    CHECK_EQ(datumItract.userid.size(), datumItract.rating.size()) << "userid and rating have different length";
+  }
+}
+
+template <typename Dtype>
+void InteractionDataLayer<Dtype>::decode_slice(Dtype* top_data,
+    Dtype* top_label, int* top_data_itact, Dtype* top_label_itact,
+    const int begin, const int end, const int slice) {
+  const bool columnar = this->layer_param_.data_param().backend() ==
+      DataParameter_DB_COLUMNAR;
+  DataTransformer<Dtype>* transformer = this->slice_transformer(slice);
+  const int* top_itact_count = this->prefetch_itact_count_.cpu_index();
+  for (int item_id = begin; item_id < end; ++item_id) {
+    int label;
+    const int* itemid;
+    const int* userid;
+    const float* rating;
+    if (columnar) {
+      // the image and the rating columns are read straight from the mapping
+      const int64_t record_id = batch_record_id_[item_id];
+      transformer->Transform(item_id,
+          itact_file_->image(record_id), this->datum_channels_,
+          this->datum_height_, this->datum_width_, this->mean_, top_data);
+      label = itact_file_->label(record_id);
+      const int64_t rating_start = itact_file_->rating_start(record_id);
+      itemid = itact_file_->itemid() + rating_start;
+      userid = itact_file_->userid() + rating_start;
+      rating = itact_file_->rating() + rating_start;
+    } else {
+      const DatumInteractionView& datumItract = batch_itact_[item_id];
+      // Apply data transformations (mirror, scale, crop...), unless the
+      // image was transformed as the record was read
+      if (top_data) {
+        transformer->Transform(item_id, datumItract.datum, this->mean_,
+            top_data);
       }
-      break;
-    default:
-      LOG(FATAL) << "Unknown database backend";
+      label = datumItract.datum.label;
+      itemid = datumItract.itemid.empty() ? NULL : &datumItract.itemid[0];
+      userid = datumItract.userid.empty() ? NULL : &datumItract.userid[0];
+      rating = datumItract.rating.empty() ? NULL : &datumItract.rating[0];
+    }
+
+    if (this->output_labels_) {
+      top_label[item_id] = label;
+    }
+
+    // setting interaction data
+    const int offset = top_itact_count[item_id*2];
+    const int num_rating = top_itact_count[item_id*2 + 1];
+    for (int itact_id = 0; itact_id < num_rating; ++itact_id) {
+      top_data_itact[(offset + itact_id)*2] = itemid[itact_id];
+      top_data_itact[(offset + itact_id)*2 + 1] = userid[itact_id];
+      top_label_itact[offset + itact_id] = rating[itact_id];
     }
   }
-  // set the extra space in top_data_itact and top_label_itact to 0, in cpu version
-  if (itact_offset < this->prefetch_itact_label_.num()) {
-    int extra_length = this->prefetch_itact_label_.num() - itact_offset;
-    caffe_set(extra_length*2, Dtype(0.), top_data_itact + itact_offset*2);
-    caffe_set(extra_length, Dtype(0.), top_label_itact + itact_offset);
-  }
-  // LOG(INFO) << "data fetching completed.";
 }
 
 INSTANTIATE_CLASS(InteractionDataLayer);
@@ -2,6 +2,7 @@
 #include <stdint.h>
 
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "caffe/common.hpp"
@@ -10,6 +11,7 @@
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
 #include "caffe/util/rng.hpp"
 
 #include <hash_map>
@@ -104,7 +106,7 @@ void LabelDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   Datum datum;
   switch (this->layer_param_.data_param().backend()) {
   case DataParameter_DB_LEVELDB:
-    datum.ParseFromString(iter_->value().ToString());
+    datum.ParseFromArray(iter_->value().data(), iter_->value().size());
     break;
   case DataParameter_DB_LMDB:
     datum.ParseFromArray(mdb_value_.mv_data, mdb_value_.mv_size);
@@ -113,69 +115,79 @@ void LabelDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     LOG(FATAL) << "Unknown database backend";
   }
 
-  // TODO: Read in label file. 
-  // __gnu_cxx::hash_map<int, int> ID2Idx;
-  // read in file from 
-  this->label_dim_= this->layer_param_.data_param().label_dim();
-  this->total_size_= this->layer_param_.data_param().total_size();
-  this->label_set_.Reshape(this->total_size_, this->label_dim_, 1, 1);
+  if (this->layer_param_.data_param().has_label_table()) {
+    // mapped, not parsed: nothing is read until a label is looked up
+    LOG(INFO) << "Mapping label table "
+              << this->layer_param_.data_param().label_table();
+    this->label_table_.reset(
+        new LabelTable(this->layer_param_.data_param().label_table()));
+    this->label_dim_ = this->label_table_->label_dim();
+    this->total_size_ = this->label_table_->num_row();
+  } else {
+    // TODO: Read in label file. 
+    // __gnu_cxx::hash_map<int, int> ID2Idx;
+    // read in file from 
+    this->label_dim_= this->layer_param_.data_param().label_dim();
+    this->total_size_= this->layer_param_.data_param().total_size();
+    this->label_set_.Reshape(this->total_size_, this->label_dim_, 1, 1);
 
-  LOG(INFO) << "Reading Label from file";
+    LOG(INFO) << "Reading Label from file";
   
-  LOG(INFO) << this->layer_param_.data_param().label_source();
-  // LOG(INFO) << this->layer_param_.data_param().label_dim();
-  // LOG(INFO) << this->layer_param_.data_param().total_size();
-  Dtype* mem_label = NULL;
-  mem_label = this->label_set_.mutable_cpu_data();
-  Dtype temp = 0;
-  int line_id, col_id;
-  line_id = 0, col_id = 0;
-  std::ifstream infile( this->layer_param_.data_param().label_source().c_str() );
-  while (infile) {
-    string s;
-    if (!getline( infile, s ))
-      break;
-    CHECK_GE(this->total_size_, line_id+1) << "Label line " << line_id << " exceed maximum label size " << this->total_size_;
-    std::istringstream ss( s );
-    col_id = 0;
-    while (ss) {
+    LOG(INFO) << this->layer_param_.data_param().label_source();
+    // LOG(INFO) << this->layer_param_.data_param().label_dim();
+    // LOG(INFO) << this->layer_param_.data_param().total_size();
+    Dtype* mem_label = NULL;
+    mem_label = this->label_set_.mutable_cpu_data();
+    Dtype temp = 0;
+    int line_id, col_id;
+    line_id = 0, col_id = 0;
+    std::ifstream infile( this->layer_param_.data_param().label_source().c_str() );
+    while (infile) {
       string s;
-      if (!getline( ss, s, ',' )) 
+      if (!getline( infile, s ))
         break;
-      std::istringstream sss( s );
-      sss >> temp;
-      // check #dimension consistent
-      CHECK_GE(this->label_dim_, col_id+1) << "Label idx " << col_id << " exceed maximum dimension " << this->label_dim_;
-      // std::cout << temp << " ";
-      // std::cout << line_id << "," << col_id << ":" << temp << std::endl;
-      mem_label[line_id*this->label_dim_ + col_id] = temp;
-      col_id ++;
+      CHECK_GE(this->total_size_, line_id+1) << "Label line " << line_id << " exceed maximum label size " << this->total_size_;
+      std::istringstream ss( s );
+      col_id = 0;
+      while (ss) {
+        string s;
+        if (!getline( ss, s, ',' )) 
+          break;
+        std::istringstream sss( s );
+        sss >> temp;
+        // check #dimension consistent
+        CHECK_GE(this->label_dim_, col_id+1) << "Label idx " << col_id << " exceed maximum dimension " << this->label_dim_;
+        // std::cout << temp << " ";
+        // std::cout << line_id << "," << col_id << ":" << temp << std::endl;
+        mem_label[line_id*this->label_dim_ + col_id] = temp;
+        col_id ++;
+      }
+      CHECK_EQ(this->label_dim_, col_id) << "Label file dimension " << col_id << " not equal to assigned dimension " << this->label_dim_;
+      line_id ++;
+      // std::cout << std::endl;
     }
-    CHECK_EQ(this->label_dim_, col_id) << "Label file dimension " << col_id << " not equal to assigned dimension " << this->label_dim_;
-    line_id ++;
-    // std::cout << std::endl;
-  }
-  int label_vector = line_id;  
+    int label_vector = line_id;  
 
-  // Load all <ID>
-  LOG(INFO) << this->layer_param_.data_param().label_id();
-  int temp_id = 0;
-  line_id = 0;
-  std::ifstream infile2( this->layer_param_.data_param().label_id().c_str() );
-  while (infile2) {
-    string s;
-    if (!getline( infile2, s ))
-      break;
-    std::istringstream ss( s );
-    ss >> temp_id;
-    this->ID2Idx_[temp_id] = line_id;
-    // std::cout << temp_id << "," << line_id << std::endl;
-    line_id ++;
-  }
+    // Load all <ID>
+    LOG(INFO) << this->layer_param_.data_param().label_id();
+    int temp_id = 0;
+    line_id = 0;
+    std::ifstream infile2( this->layer_param_.data_param().label_id().c_str() );
+    while (infile2) {
+      string s;
+      if (!getline( infile2, s ))
+        break;
+      std::istringstream ss( s );
+      ss >> temp_id;
+      this->ID2Idx_[temp_id] = line_id;
+      // std::cout << temp_id << "," << line_id << std::endl;
+      line_id ++;
+    }
 
-  // check #ID = #Label_vector
-  CHECK_EQ(line_id, label_vector)
-      << "#ID and #label dismatch! #ID=" << line_id << " but  #label_vector=" << label_vector;
+    // check #ID = #Label_vector
+    CHECK_EQ(line_id, label_vector)
+        << "#ID and #label dismatch! #ID=" << line_id << " but  #label_vector=" << label_vector;
+  }
   LOG(INFO) << "Label Loading Completed";
 
   // image
@@ -211,64 +223,61 @@ void LabelDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   this->datum_size_ = datum.channels() * datum.height() * datum.width();
 }
 
-// This function is used to create a thread that prefetches the data.
+// This function is called on the prefetch thread to load a batch.
 template <typename Dtype>
-void LabelDataLayer<Dtype>::InternalThreadEntry() {
-  Datum datum;
+void LabelDataLayer<Dtype>::load_batch() {
   CHECK(this->prefetch_data_.count());
   Dtype* top_data = this->prefetch_data_.mutable_cpu_data();
   Dtype* top_label = NULL;  // suppress warnings about uninitialized variables
   Dtype* top_id = NULL;
-  const Dtype* mem_label = this->label_set_.cpu_data();
-  int memID = 0, item_origin_ID = 0;
   if (this->output_labels_) {
     top_label = this->prefetch_label_.mutable_cpu_data();
     top_id = this->prefetch_id_.mutable_cpu_data();
   }
+  // the label table has to be on the host before the slices read it
+  if (!this->label_table_) {
+    this->label_set_.cpu_data();
+  }
   const int batch_size = this->layer_param_.data_param().batch_size();
 
+  // The cursor is read in order here; parsing and transforming the records
+  // is left to the decode slices. The records are not copied: an LMDB value
+  // stays in the map while the read transaction is open. A LevelDB value
+  // only lives until the iterator moves, so it is decoded on the spot, or
+  // copied when there are several slices to decode it.
+  const bool decode_in_place = this->num_decode_slice() == 1 &&
+      this->layer_param_.data_param().backend() == DataParameter_DB_LEVELDB;
+  batch_record_.resize(batch_size);
+  batch_raw_.resize(batch_size);
   for (int item_id = 0; item_id < batch_size; ++item_id) {
     // get a blob
     switch (this->layer_param_.data_param().backend()) {
     case DataParameter_DB_LEVELDB:
       CHECK(iter_);
       CHECK(iter_->Valid());
-      datum.ParseFromString(iter_->value().ToString());
+      if (decode_in_place) {
+        batch_record_[item_id] = std::make_pair(iter_->value().data(),
+            static_cast<int>(iter_->value().size()));
+        decode_slice(top_data, top_label, top_id, item_id, item_id + 1,
+            0);
+      } else {
+        batch_raw_[item_id].assign(iter_->value().data(),
+            iter_->value().size());
+        batch_record_[item_id] = std::make_pair(batch_raw_[item_id].data(),
+            static_cast<int>(batch_raw_[item_id].size()));
+      }
       break;
     case DataParameter_DB_LMDB:
       CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_,
               &mdb_value_, MDB_GET_CURRENT), MDB_SUCCESS);
-      datum.ParseFromArray(mdb_value_.mv_data,
-          mdb_value_.mv_size);
+      batch_record_[item_id] = std::make_pair(
+          static_cast<const char*>(mdb_value_.mv_data),
+          static_cast<int>(mdb_value_.mv_size));
       break;
     default:
       LOG(FATAL) << "Unknown database backend";
     }
 
-    // Apply data transformations (mirror, scale, crop...)
-    this->data_transformer_.Transform(item_id, datum, this->mean_, top_data);
-
-    if (this->output_labels_) {
-      // read hash map and copy
-      // top_label[item_id] = datum.label();
-      item_origin_ID = datum.label();
-
-      // TESTING
-      // item_origin_ID = item_origin_ID%2;
-
-      // check if key exists
-      if (this->ID2Idx_.find(item_origin_ID) == this->ID2Idx_.end()) {
-        LOG(FATAL) << "item_origin_ID " << item_origin_ID << " not found";
-      } else {
-        memID = this->ID2Idx_[item_origin_ID];
-      }      
-      caffe_copy(this->label_dim_, mem_label + memID*this->label_dim_,
-             top_label + item_id*this->label_dim_);
-      
-      top_id[item_id] = item_origin_ID;
-      // LOG(INFO) << "item_origin_ID " << item_origin_ID << " memID " << memID;
-    }
-
     // go to the next iter
     switch (this->layer_param_.data_param().backend()) {
     case DataParameter_DB_LEVELDB:
@@ -292,6 +301,62 @@ void LabelDataLayer<Dtype>::InternalThreadEntry() {
       LOG(FATAL) << "Unknown database backend";
     }
   }
+
+  if (decode_in_place) {
+    return;
+  }
+  this->decode_workers_->RunSlices(batch_size, this->num_decode_slice(),
+      boost::bind(&LabelDataLayer<Dtype>::decode_slice, this, top_data,
+      top_label, top_id, _1, _2, _3));
+}
+
+template <typename Dtype>
+void LabelDataLayer<Dtype>::decode_slice(Dtype* top_data, Dtype* top_label,
+    Dtype* top_id, const int begin, const int end, const int slice) {
+  DatumView datum;
+  DataTransformer<Dtype>* transformer = this->slice_transformer(slice);
+  const Dtype* mem_label =
+      this->label_table_ ? NULL : this->label_set_.cpu_data();
+  int memID = 0, item_origin_ID = 0;
+  for (int item_id = begin; item_id < end; ++item_id) {
+    CHECK(datum.Parse(batch_record_[item_id].first,
+        batch_record_[item_id].second)) << "Failed to parse datum";
+
+    // Apply data transformations (mirror, scale, crop...)
+    transformer->Transform(item_id, datum, this->mean_, top_data);
+
+    if (this->output_labels_) {
+      // read hash map and copy
+      // top_label[item_id] = datum.label;
+      item_origin_ID = datum.label;
+
+      // TESTING
+      // item_origin_ID = item_origin_ID%2;
+
+      if (this->label_table_) {
+        const int64_t row = this->label_table_->Find(item_origin_ID);
+        CHECK_GE(row, 0) << "item_origin_ID " << item_origin_ID
+                         << " not found";
+        this->label_table_->CopyRow(row,
+            top_label + item_id*this->label_dim_);
+      } else {
+        // check if key exists; find() leaves the map untouched, so the
+        // slices can share it
+        __gnu_cxx::hash_map<int, int>::const_iterator it =
+            this->ID2Idx_.find(item_origin_ID);
+        if (it == this->ID2Idx_.end()) {
+          LOG(FATAL) << "item_origin_ID " << item_origin_ID << " not found";
+        } else {
+          memID = it->second;
+        }
+        caffe_copy(this->label_dim_, mem_label + memID*this->label_dim_,
+               top_label + item_id*this->label_dim_);
+      }
+
+      top_id[item_id] = item_origin_ID;
+      // LOG(INFO) << "item_origin_ID " << item_origin_ID << " memID " << memID;
+    }
+  }
 }
 
 INSTANTIATE_CLASS(LabelDataLayer);
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <boost/bind.hpp>
 #include <vector>
 #include <iostream> // add for debug
 
@@ -6,6 +8,7 @@
 #include "caffe/filler.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -27,6 +30,11 @@ void MatrixFactorizeLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   num_item_ = this->layer_param_.matrix_fact_param().num_item();
   img_weight_ = this->layer_param_.matrix_fact_param().img_weight();
   feature_weight_ = this->layer_param_.matrix_fact_param().feature_weight();
+  sparse_grad_ = this->layer_param_.matrix_fact_param().sparse_grad();
+  num_threads_ = this->layer_param_.matrix_fact_param().num_threads();
+  CHECK_GE(num_threads_, 1) << "num_threads should be at least 1";
+  workers_.reset(new WorkerPool());
+  workers_->Reserve(num_threads_);
   num_latent_ = bottom[0]->count() / bottom[0]->num();
 
   // Check if we need to set up the weights
@@ -66,8 +74,12 @@ void MatrixFactorizeLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   max_rating_size_ = bottom[1]->num(); // MAX input number of rating
   // temp space filtering
   this->user_feature_buffer_.Reshape(1, 1, itact_size_, num_latent_);
-  this->item_feature_buffer_.Reshape(1, 1, itact_item_, num_latent_);
   this->item_feature_mixed_.Reshape(1, 1, itact_item_, num_latent_);
+  // the bias multiplier and item feature buffer only serve the backward pass
+  if (this->inference()) {
+    return;
+  }
+  this->item_feature_buffer_.Reshape(1, 1, itact_item_, num_latent_);
   if (bias_term_) {
     bias_multiplier_.Reshape(1, 1, 1, max_rating_size_);
     caffe_set(max_rating_size_, Dtype(1.), bias_multiplier_.mutable_cpu_data());
@@ -100,9 +112,11 @@ void MatrixFactorizeLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   
   (*top)[0]->Reshape(bottom[1]->num(), 1, 1, 1);
   (*top)[1]->Reshape(1, 1, 1, 1);
-  // Set up the bias multiplier
-  if (max_rating_size_ != bottom[1]->num() && bias_term_) {
-    max_rating_size_ = bottom[1]->num();
+  // Set up the bias multiplier; the number of ratings changes every batch
+  // with ragged input, so it only grows
+  max_rating_size_ = bottom[1]->num();
+  if (bias_term_ && !this->inference() &&
+      bias_multiplier_.count() < max_rating_size_) {
     bias_multiplier_.Reshape(1, 1, 1, max_rating_size_);
     caffe_set(max_rating_size_, Dtype(1), bias_multiplier_.mutable_cpu_data());
   }
@@ -115,19 +129,36 @@ void MatrixFactorizeLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
   if (itact_item_ != bottom[0]->num()) {
     itact_item_ = bottom[0]->num(); // number of items/ batch size, batch size may change!
-    this->item_feature_buffer_.Reshape(1, 1, itact_item_, num_latent_);
+    if (!this->inference()) {
+      this->item_feature_buffer_.Reshape(1, 1, itact_item_, num_latent_);
+    }
     this->item_feature_mixed_.Reshape(1, 1, itact_item_, num_latent_);
     LOG(INFO) << "Changed itact_item_ to " << itact_item_;
   }
 
   // actual number of rating in the whole space
-  const Dtype* itact_count_ = bottom[2]->cpu_data();
-  num_rating_ = itact_count_[(itact_item_-1)*2] + itact_count_[(itact_item_-1)*2+1];
+  const int* itact_count_ = bottom[2]->cpu_index();
+  // an empty batch holds no offsets to read the total from
+  num_rating_ = itact_item_ > 0 ?
+      itact_count_[(itact_item_-1)*2] + itact_count_[(itact_item_-1)*2+1] : 0;
+  // the GPU passes gather the users of one item at a time, and a ragged
+  // batch may hold more than itact_size ratings for an item
+  int max_item_rating = itact_size_;
+  for (int i = 0; i < itact_item_; ++i) {
+    max_item_rating = std::max(max_item_rating, itact_count_[i*2+1]);
+  }
+  if (user_feature_buffer_.height() < max_item_rating) {
+    user_feature_buffer_.Reshape(1, 1, max_item_rating, num_latent_);
+  }
 
   // clear computing flags each round.
   gen_item_diff_ = false;
 
-  Build_map(bottom);
+  // the user -> rating index is only read by the backward pass
+  if (!this->inference()) {
+    Build_map(bottom);
+  }
+  Partition_batch(bottom);
 
   // // debug: setting item features
   // std::cout << "debug: setting item features" << std::endl;
@@ -139,177 +170,265 @@ void MatrixFactorizeLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   // }
 }
 
-// building rating map user2itemid and itemid2relative_id
-// need to clear first
+// building the CSR index user -> rating indices, in two passes over the
+// ratings (count, then scatter). Users are numbered in order of first
+// appearance; the ratings of each user keep their batch order.
 template <typename Dtype>
 void MatrixFactorizeLayer<Dtype>::Build_map(const vector<Blob<Dtype>*>& bottom) {
-  // LOG(INFO) << "Build_map";
-  // Setup map for each batch, in cpu model this may be slow.
-  const Dtype* itact_data_ = bottom[1]->cpu_data();
-  const Dtype* itact_count_ = bottom[2]->cpu_data();
+  const int* itact_data_ = bottom[1]->cpu_index();
+  const int* itact_count_ = bottom[2]->cpu_index();
 
-  // LOG(INFO) << "map cleared";
-  itemid2relative_id.clear();
-  user2itemid.clear();
+  if (user_slot_.size() != num_user_) {
+    user_slot_.assign(num_user_, -1);
+  }
+  if (item_seen_.size() != num_item_) {
+    item_seen_.assign(num_item_, 0);
+  }
+  if (rating_item_.size() < num_rating_) {
+    rating_item_.resize(num_rating_);
+    user_rating_idx_.resize(num_rating_);
+  }
+  touched_users_.clear();
+  touched_items_.clear();
+  user_rating_start_.clear();
+  user_rating_start_.push_back(0);
 
   int item_offset = 0, rating_size = 0;
-  int item_real_id = 0, userid = 0, rating_idx = 0;
-  // relative itemid
+  int item_real_id = 0, userid = 0, rating_idx = 0, slot = 0;
+  // first pass: assign user slots and count ratings per user
   for (int itemid = 0; itemid < itact_item_; ++itemid ) {
     item_offset = itact_count_[itemid*2];
     rating_size = itact_count_[itemid*2+1];
     item_real_id = itact_data_[item_offset*2];
-    itemid2relative_id[item_real_id] = itemid; // map real itemid to relative itemid
-
-    // LOG(INFO) << "itemid:" << itemid << " item_real_id:" << item_real_id << " offset:" << item_offset << " rating_size: " << rating_size;
-
+    CHECK_GE(item_real_id, 0) << "itemid out of range";
+    CHECK_LT(item_real_id, num_item_) << "itemid out of range";
+    if (!item_seen_[item_real_id]) {
+      item_seen_[item_real_id] = 1;
+      touched_items_.push_back(item_real_id);
+    }
     for (int rating_cnt = 0; rating_cnt < rating_size; ++rating_cnt) {
       rating_idx = item_offset + rating_cnt;
-      userid = static_cast<int>(itact_data_[rating_idx*2+1]);
-      // LOG(INFO) << "itemid:" << itemid << " item_real_id:" << item_real_id << " userid:" << userid;
-      // check if userid exist
-      if (user2itemid.find(userid) == user2itemid.end()) {
-        // LOG(INFO) << "new userid " << userid << " with rating_idx " << rating_idx;
-        vector<int> temp;
-        temp.push_back(rating_idx);
-        user2itemid[userid] = temp;
-      } else {
-        vector<int>& temp = user2itemid[userid];
-        // LOG(INFO) << "existing userid " << userid << " with " << temp.size() << " ratings.";
-        // for (int i = 0; i < temp.size(); i++) {
-        //   LOG(INFO) << i << " " << temp[i];
-        // }
-        temp.push_back(rating_idx); // duplicated <itemid,userid> will not cause error.
-        user2itemid[userid] = temp;
+      userid = itact_data_[rating_idx*2+1];
+      CHECK_GE(userid, 0) << "userid out of range";
+      CHECK_LT(userid, num_user_) << "userid out of range";
+      rating_item_[rating_idx] = itemid;
+      slot = user_slot_[userid];
+      if (slot < 0) {
+        slot = touched_users_.size();
+        user_slot_[userid] = slot;
+        touched_users_.push_back(userid);
+        user_rating_start_.push_back(0);
       }
+      ++user_rating_start_[slot + 1];
+    }
+  }
+  // prefix sum into row starts
+  for (int u = 0; u < touched_users_.size(); ++u) {
+    user_rating_start_[u + 1] += user_rating_start_[u];
+  }
+  // second pass: scatter rating indices, using the slot of each user as its
+  // write cursor. Duplicated <itemid,userid> will not cause error.
+  for (int itemid = 0; itemid < itact_item_; ++itemid ) {
+    item_offset = itact_count_[itemid*2];
+    rating_size = itact_count_[itemid*2+1];
+    for (int rating_cnt = 0; rating_cnt < rating_size; ++rating_cnt) {
+      rating_idx = item_offset + rating_cnt;
+      userid = itact_data_[rating_idx*2+1];
+      slot = user_slot_[userid];
+      user_rating_idx_[user_rating_start_[slot]++] = rating_idx;
     }
   }
+  // the cursors ended on the next row's start: shift back, reset scratch
+  for (int u = touched_users_.size(); u > 0; --u) {
+    user_rating_start_[u] = user_rating_start_[u - 1];
+  }
+  user_rating_start_[0] = 0;
+  for (int u = 0; u < touched_users_.size(); ++u) {
+    user_slot_[touched_users_[u]] = -1;
+  }
+  for (int i = 0; i < touched_items_.size(); ++i) {
+    item_seen_[touched_items_[i]] = 0;
+  }
+}
 
-  // LOG(INFO) << "Checking user2itemid";
-  // // check user2itemid
-  // int itemid = 0;
-  // map<int, vector<int> >::iterator iter;
-  // for (iter=user2itemid.begin(); iter!=user2itemid.end(); ++iter) {
-  //   userid = iter->first;
-  //   vector<int>& ratingset = iter->second;
-  //   LOG(INFO) << "Userid:" << userid << " ratingset_size:" << ratingset.size();
-  //   for (int j = 0; j < ratingset.size(); ++j) {
-  //     rating_idx = ratingset[j];
-  //     item_real_id = static_cast<int>(itact_data_[rating_idx*2]);
-  //     itemid = itemid2relative_id[item_real_id];
-  //     LOG(INFO) << "itemid_real:" << item_real_id << " itemid:" << itemid;
-  //   }
-  // }
+// Inner product of two latent rows. The rows are short, so an inline loop
+// with independent partial sums beats a BLAS call per rating.
+template <typename Dtype>
+inline Dtype row_dot(const int n, const Dtype* x, const Dtype* y) {
+  Dtype sum[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    for (int j = 0; j < 8; ++j) {
+      sum[j] += x[i+j] * y[i+j];
+    }
+  }
+  for (; i < n; ++i) {
+    sum[0] += x[i] * y[i];
+  }
+  return ((sum[0] + sum[1]) + (sum[2] + sum[3])) +
+      ((sum[4] + sum[5]) + (sum[6] + sum[7]));
+}
+
+// User rows are scattered over a large table, so request the row of the
+// rating kPrefetchDistance ahead while the current one is scored.
+static const int kPrefetchDistance = 4;
+
+template <typename Dtype>
+inline void prefetch_row(const int n, const Dtype* x) {
+#if defined(__GNUC__)
+  for (int i = 0; i < n; i += 64 / sizeof(Dtype)) {
+    __builtin_prefetch(x + i);
+  }
+#endif
+}
+
+static void run_range(const vector<int>* bound,
+    const boost::function<void(int, int)>* func, const int t) {
+  (*func)((*bound)[t], (*bound)[t+1]);
+}
+
+// Run func(bound[t], bound[t+1]) for every range t, range 0 on the calling
+// thread and the others on the workers.
+static void run_ranges(WorkerPool* workers, const vector<int>& bound,
+    const boost::function<void(int, int)>& func) {
+  workers->Run(bound.size() - 1, boost::bind(&run_range, &bound, &func, _1));
+}
+
+// Do not bother to start threads for fewer ratings than this per thread.
+static const int kMinRatingsPerThread = 1024;
+
+// Items are contiguous in the ratings, so cutting the item sequence where the
+// running rating count crosses multiples of num_rating_/#threads balances the
+// work per thread. Users are split the same way along the CSR index.
+template <typename Dtype>
+void MatrixFactorizeLayer<Dtype>::Partition_batch(
+    const vector<Blob<Dtype>*>& bottom) {
+  const int* itact_count_ = bottom[2]->cpu_index();
+  const int num_part = std::max(1, std::min(num_threads_,
+      num_rating_ / kMinRatingsPerThread));
+  item_bound_.clear();
+  item_bound_.push_back(0);
+  int rating_cnt = 0;
+  for (int itemid = 0; itemid < itact_item_ - 1; ++itemid) {
+    rating_cnt += itact_count_[itemid*2+1];
+    if (rating_cnt * static_cast<int64_t>(num_part) >=
+        num_rating_ * static_cast<int64_t>(item_bound_.size())) {
+      item_bound_.push_back(itemid + 1);
+    }
+  }
+  item_bound_.push_back(itact_item_);
+  if (this->inference()) {
+    return;
+  }
+
+  const int num_user_batch = touched_users_.size();
+  user_bound_.clear();
+  user_bound_.push_back(0);
+  for (int u = 1; u < num_user_batch; ++u) {
+    if (user_rating_start_[u] * static_cast<int64_t>(num_part) >=
+        num_rating_ * static_cast<int64_t>(user_bound_.size())) {
+      user_bound_.push_back(u);
+    }
+  }
+  user_bound_.push_back(num_user_batch);
+}
+
+/*  In dense mode the whole diff is cleared. In sparse mode the diff is kept
+    zero outside the rows listed by blobs_[param_id]->diff_rows(), so only
+    those rows and the ones about to be written need clearing. If the rows
+    were dropped (e.g. a dense GPU/shared update ran), fall back to a full clear.
+*/
+template <typename Dtype>
+void MatrixFactorizeLayer<Dtype>::Clear_param_diff(const int param_id,
+    const vector<int>& rows) {
+  Blob<Dtype>* param = this->blobs_[param_id].get();
+  Dtype* param_diff = param->mutable_cpu_diff();
+  if (!sparse_grad_ || !param->has_diff_rows()) {
+    caffe_set(param->count(), Dtype(0.), param_diff);
+  } else {
+    const vector<int>& last_rows = param->diff_rows();
+    for (int i = 0; i < last_rows.size(); ++i) {
+      caffe_set(num_latent_, Dtype(0.), param_diff + last_rows[i]*num_latent_);
+    }
+    for (int i = 0; i < rows.size(); ++i) {
+      caffe_set(num_latent_, Dtype(0.), param_diff + rows[i]*num_latent_);
+    }
+  }
+  if (sparse_grad_) {
+    param->set_diff_rows(rows);
+  }
 }
 
 /*  
     for each item,
-      fill user feature buffer
-      pred in block wise manner
+      mix item feature with img feature
+      dot each rating's user row with it, reading the row in place
     Add global bias if necessary
+    The items are split into ranges scored by separate threads; ranges write
+    disjoint parts of item_feature_mixed_ and the prediction.
 */
 template <typename Dtype>
 void MatrixFactorizeLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     vector<Blob<Dtype>*>* top) {
   // LOG(INFO) << "Forward_cpu";
   (*top)[1]->mutable_cpu_data()[0] = num_rating_;
-  const Dtype* user_feature = this->blobs_[0]->cpu_data();
-  const Dtype* item_feature = this->blobs_[1]->cpu_data();
-  const Dtype* item_feature_img = bottom[0]->cpu_data();
-  const Dtype* itact_data_ = bottom[1]->cpu_data();
-  const Dtype* itact_count_ = bottom[2]->cpu_data();
   const Dtype* global_bias = this->blobs_[2]->cpu_data();
-  // user feature buffer
-  Dtype* user_feature_buf = user_feature_buffer_.mutable_cpu_data();
   Dtype* item_feature_buf = item_feature_mixed_.mutable_cpu_data();
   Dtype* itact_pred_ = (*top)[0]->mutable_cpu_data();
+  // make sure every input is on the cpu before the workers read it
+  this->blobs_[0]->cpu_data();
+  this->blobs_[1]->cpu_data();
+  for (int i = 0; i < bottom.size(); ++i) {
+    bottom[i]->cpu_data();
+  }
+
+  run_ranges(workers_.get(), item_bound_, boost::bind(
+      &MatrixFactorizeLayer<Dtype>::Forward_items_cpu, this,
+      boost::cref(bottom), item_feature_buf, itact_pred_, _1, _2));
+
+  if (bias_term_) {
+    caffe_add_scalar(num_rating_, global_bias[0], itact_pred_);
+  }
+  // set the extra space in itact_pred_ to 0, for inputs padded to a fixed
+  // size; ragged batches have none
+  if (num_rating_ < max_rating_size_) {
+    int extra_length = max_rating_size_ - num_rating_;
+    caffe_set(extra_length, Dtype(0.), itact_pred_ + num_rating_);
+  }
+}
+
+template <typename Dtype>
+void MatrixFactorizeLayer<Dtype>::Forward_items_cpu(
+    const vector<Blob<Dtype>*>& bottom, Dtype* item_feature_buf,
+    Dtype* itact_pred_, const int item_begin, const int item_end) {
+  const Dtype* user_feature = this->blobs_[0]->cpu_data();
+  const Dtype* item_feature = this->blobs_[1]->cpu_data();
+  const Dtype* item_feature_img = bottom[0]->cpu_data();
+  const int* itact_data_ = bottom[1]->cpu_index();
+  const int* itact_count_ = bottom[2]->cpu_index();
 
   int item_offset = 0, rating_size = 0;
   int item_real_id = 0, userid = 0, rating_idx = 0;
   // relative itemid_version
-  for (int itemid = 0; itemid < itact_item_; ++itemid ) {
+  for (int itemid = item_begin; itemid < item_end; ++itemid ) {
     item_offset = itact_count_[itemid*2];
     rating_size = itact_count_[itemid*2+1];
     item_real_id = itact_data_[item_offset*2];
-    caffe_copy(num_latent_, item_feature + item_real_id*num_latent_, item_feature_buf + itemid*num_latent_);
-    caffe_cpu_axpby(num_latent_, img_weight_, item_feature_img + itemid*num_latent_, feature_weight_, item_feature_buf + itemid*num_latent_);
+    Dtype* item_mixed = item_feature_buf + itemid*num_latent_;
+    caffe_copy(num_latent_, item_feature + item_real_id*num_latent_, item_mixed);
+    caffe_cpu_axpby(num_latent_, img_weight_, item_feature_img + itemid*num_latent_, feature_weight_, item_mixed);
 
-    // std::cout << "itemid:" << itemid <<" item_real_id:" << item_real_id << std::endl;
-
-    // LOG(INFO) << "itemid:" << itemid << " offset:" << item_offset << " rating_size: " << rating_size;
     for (int rating_cnt = 0; rating_cnt < rating_size; ++rating_cnt) {
       rating_idx = item_offset + rating_cnt;
-      userid = static_cast<int>(itact_data_[rating_idx*2+1]);
-      caffe_copy(num_latent_, user_feature + userid*num_latent_, user_feature_buf + rating_cnt*num_latent_);
-      // std::cout << "item_real_id:" << item_real_id << " userid:" << userid << std::endl;
+      if (rating_cnt + kPrefetchDistance < rating_size) {
+        prefetch_row(num_latent_, user_feature + num_latent_ *
+            itact_data_[(rating_idx+kPrefetchDistance)*2+1]);
+      }
+      userid = itact_data_[rating_idx*2+1];
+      itact_pred_[rating_idx] = row_dot(num_latent_,
+          user_feature + userid*num_latent_, item_mixed);
     }
-
-    caffe_cpu_gemv(CblasNoTrans, rating_size, num_latent_,
-      Dtype(1.0), user_feature_buf, item_feature_buf + itemid*num_latent_, Dtype(0.),
-      itact_pred_ + item_offset);
-
-    // checking user_feature_buf
-    // LOG(INFO) << "checking user_feature_buf";
-    // for (int i = 0; i < rating_size; i++) {
-    //   for (int j = 0; j < num_latent_; j++) {
-    //     std::cout << user_feature_buf[i*num_latent_+j] << "\t";
-    //   }
-    //   std::cout << std::endl;
-    // }
-
-    // std::cout << "############################" << std::endl;
-    // std::cout << "item_feature " << feature_weight_ << std::endl;
-    // for (int j = 0; j < num_latent_; j++) {
-    //   std::cout << item_feature[item_real_id*num_latent_+j] << "\t";
-    // } 
-    // std::cout << std::endl;
-
-    // std::cout << "item_feature_img " << img_weight_ << std::endl;
-    // for (int j = 0; j < num_latent_; j++) {
-    //   std::cout << item_feature_img[itemid*num_latent_+j] << "\t";
-    // } 
-    // std::cout << std::endl;
-
-    // std::cout << "item_feature_buf" << std::endl;
-    // for (int j = 0; j < num_latent_; j++) {
-    //   std::cout << item_feature_buf[itemid*num_latent_+j] << "\t";
-    // } 
-    // std::cout << std::endl;
-    // std::cout << std::endl;
-
-    // checking prediction
-    // std::cout << "Rating prediction" << std::endl;
-    // for (int j = 0; j < rating_size; j++) {
-    //   std::cout << itact_pred_[item_offset+j] << "\t";
-    // } 
-    // std::cout << std::endl;
-
-    // checking prediction
-    // if (item_real_id==1) {
-    //   std::cout << "Rating prediction after adding bias, offset:" << item_offset << " rating size:" << rating_size << std::endl;
-    //   for (int j = 0; j < rating_size; j++) {
-    //     rating_idx = item_offset + j;
-    //     userid = static_cast<int>(itact_data_[rating_idx*2+1]);
-    //     std::cout << item_real_id << " " << userid << " " << itact_pred_[item_offset+j]+global_bias[0] << std::endl;
-    //   }
-    // }
-  }
-  if (bias_term_) {
-    caffe_add_scalar(num_rating_, global_bias[0], itact_pred_);
   }
-  // set the extra space in itact_pred_ to 0
-  if (num_rating_ < max_rating_size_) {
-    int extra_length = max_rating_size_ - num_rating_;
-    caffe_set(extra_length, Dtype(0.), itact_pred_ + num_rating_);
-  }
-  // checking prediction
-  // LOG(INFO) << "Rating prediction after adding bias " << global_bias[0];
-  // LOG(INFO) << "Global bias " << global_bias[0];
-  // std::cout << "Rating prediction" << std::endl;
-  // for (int j = 0; j < num_rating_; j++) {
-  //   std::cout << itact_pred_[j] << "\t";
-  // } 
-  // std::cout << std::endl;
 }
 
 /*  given error for each <itemid, userid, error>
@@ -349,316 +468,163 @@ void MatrixFactorizeLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
 }
 
 /*  Traverse each userid,
-      find corresponding rating loss, itemid 
-      fill item_feature_buf
-      gemv and normalize
+      accumulate rating loss * mixed item feature of its ratings
+    The users are split into ranges handled by separate threads. Every user
+    row is written by one thread only, in rating order, so the result does
+    not depend on the number of threads.
 */
 template <typename Dtype>
 void MatrixFactorizeLayer<Dtype>::Backward_User_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
-  // LOG(INFO) << "Backward_User_cpu";
   // bp diff to user feature in blob_[0]
   if (this->param_propagate_down_[0]) {
     const Dtype* rating_diff = top[0]->cpu_diff();
+    Clear_param_diff(0, touched_users_); // clearing target diff
     Dtype* user_feature_diff = this->blobs_[0]->mutable_cpu_diff(); // Target
-    caffe_set(this->blobs_[0]->count(), Dtype(0.), user_feature_diff); // clearing target diff
     const Dtype* item_feature = item_feature_mixed_.cpu_data(); // feature already combined with img feature
-    const Dtype* itact_data_ = (*bottom)[1]->cpu_data();
-    Dtype* item_feature_buf = item_feature_buffer_.mutable_cpu_data();
-
-    int userid = 0, itemid = 0, rating_idx = 0, rating_size = 0;
-    Dtype loss = 0;
-    // traverse each user, #user gemv
-    map<int, vector<int> >::iterator iter;
-    for (iter = user2itemid.begin(); iter!=user2itemid.end(); ++iter) {
-      userid = iter->first;
-      vector<int>& ratingset = iter->second;
-      rating_size = ratingset.size();
-      rating_buffer_.Reshape(1,1,1,rating_size);
-      Dtype* rating_buf = rating_buffer_.mutable_cpu_data();
-
-      // std::cout << "userid:" << userid << " rating_size:" << rating_size << std::endl;
-      for (int i = 0; i < rating_size; ++i) {
-        rating_idx = ratingset[i];
-        itemid = itemid2relative_id[static_cast<int>(itact_data_[rating_idx*2])]; // relative itemid
-        // fill buffer
-        loss = rating_diff[rating_idx];
-        rating_buf[i] = loss;
-        caffe_copy(num_latent_, item_feature + itemid*num_latent_, item_feature_buf + i*num_latent_);
-        // std::cout << "rating_idx:" << rating_idx << " itemid:" << itemid << " loss:" << loss << std::endl;
-      }
-      // id may speard in multiple datum, so b cannot be set 0
-      caffe_cpu_gemv(CblasTrans, rating_size, num_latent_,
-        Dtype(1.0), item_feature_buf, rating_buf, Dtype(1.), 
-        user_feature_diff + userid*num_latent_);
-
-      // LOG(INFO) << "item_feature_buf";
-      // for (int i = 0; i < rating_size; ++i) {
-      //   for (int j = 0; j < num_latent_; ++j) {
-      //     std::cout << item_feature_buf[i*num_latent_ + j] << "\t";
-      //   }
-      //   std::cout << std::endl;
-      // }
-
-      // LOG(INFO) << "loss";
-      // for (int i = 0; i < rating_size; i++) {
-      //   std::cout << rating_buf[i] << "\t";
-      // }
-      // std::cout << std::endl;
-
-      // std::cout << "user_feature_diff:" << userid << std::endl;
-      // for (int i = 0; i < num_latent_; i++) {
-      //   std::cout << user_feature_diff[userid*num_latent_ + i] << "\t";
-      // }
-      // std::cout << std::endl;
-
-      // LOG(INFO) << "user_feature";
-      // std::cout << "user_feature" << std::endl;
-      // const Dtype* user_feature = this->blobs_[0]->cpu_data();
-      // for (int i = 0; i < num_latent_; i++) {
-      //   std::cout << user_feature[userid*num_latent_ + i] << "\t";
-      // }
-      // std::cout << std::endl;
-    } // ~ for each userid
+    run_ranges(workers_.get(), user_bound_, boost::bind(
+        &MatrixFactorizeLayer<Dtype>::Backward_users_cpu, this,
+        rating_diff, item_feature, user_feature_diff, _1, _2));
+  }
+}
+
+template <typename Dtype>
+void MatrixFactorizeLayer<Dtype>::Backward_users_cpu(const Dtype* rating_diff,
+    const Dtype* item_feature, Dtype* user_feature_diff,
+    const int user_begin, const int user_end) {
+  int rating_idx = 0;
+  for (int u = user_begin; u < user_end; ++u) {
+    Dtype* user_diff = user_feature_diff + touched_users_[u]*num_latent_;
+    // id may speard in multiple datum, so the diff accumulates
+    for (int i = user_rating_start_[u]; i < user_rating_start_[u+1]; ++i) {
+      rating_idx = user_rating_idx_[i];
+      caffe_axpy(num_latent_, rating_diff[rating_idx],
+          item_feature + rating_item_[rating_idx]*num_latent_, user_diff);
+    }
+  }
+}
+
+/*  For each itemid (relative) in [item_begin, item_end),
+      item_diff[itemid] = sum(rating loss * user feature) of its ratings
+    Each relative item is written by one thread only.
+*/
+template <typename Dtype>
+void MatrixFactorizeLayer<Dtype>::Backward_items_cpu(const Dtype* rating_diff,
+    const Dtype* user_feature, const int* itact_data_,
+    const int* itact_count_, Dtype* item_diff,
+    const int item_begin, const int item_end) {
+  int item_offset = 0, rating_size = 0, userid = 0, rating_idx = 0;
+  for (int itemid = item_begin; itemid < item_end; ++itemid ) {
+    item_offset = itact_count_[itemid*2];
+    rating_size = itact_count_[itemid*2+1];
+    Dtype* diff = item_diff + itemid*num_latent_;
+    caffe_set(num_latent_, Dtype(0.), diff);
+    for (int rating_cnt = 0; rating_cnt < rating_size; ++rating_cnt) {
+      rating_idx = item_offset + rating_cnt;
+      userid = itact_data_[rating_idx*2+1];
+      caffe_axpy(num_latent_, rating_diff[rating_idx],
+          user_feature + userid*num_latent_, diff);
+    }
   }
 }
 
 /*  
     For each itemid,
       find associated rating loss, userid
-      fill user_feature_buf
-      gemv and normalize
+      accumulate loss * user feature
+    The relative items are computed in parallel into item_feature_buffer_,
+    then added to the real item rows in order, as the same real item may
+    appear more than once in a batch.
 */
 template <typename Dtype>
 void MatrixFactorizeLayer<Dtype>::Backward_Item_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
-  // LOG(INFO) << "Backward_Item_cpu";
   // bp diff to item feature in blobs_[1]
   if (this->param_propagate_down_[1]) {
-    // LOG(INFO) << "Backward_Item_cpu begin";
     if (feature_weight_ <= 0)
       return;
     if (!gen_item_diff_) {
-      // LOG(INFO) << "Calculating";
       const Dtype* rating_diff = top[0]->cpu_diff();
+      Clear_param_diff(1, touched_items_); // clearing target diff
       Dtype* item_feature_diff = this->blobs_[1]->mutable_cpu_diff(); // Target
-      caffe_set(this->blobs_[1]->count(), Dtype(0.), item_feature_diff); // clearing target diff
       const Dtype* user_feature = this->blobs_[0]->cpu_data(); 
-      const Dtype* itact_data_ = (*bottom)[1]->cpu_data();
-      const Dtype* itact_count_ = (*bottom)[2]->cpu_data();
-      Dtype* user_feature_buf = user_feature_buffer_.mutable_cpu_data();
+      const int* itact_data_ = (*bottom)[1]->cpu_index();
+      const int* itact_count_ = (*bottom)[2]->cpu_index();
+      Dtype* item_diff_buf = item_feature_buffer_.mutable_cpu_data();
+      run_ranges(workers_.get(), item_bound_, boost::bind(
+          &MatrixFactorizeLayer<Dtype>::Backward_items_cpu, this,
+          rating_diff, user_feature, itact_data_, itact_count_,
+          item_diff_buf, _1, _2));
 
-      int item_offset = 0, rating_size = 0;
-      int item_real_id = 0, userid = 0, rating_idx = 0;
-      // relative itemid_version
+      int item_offset = 0, item_real_id = 0;
       for (int itemid = 0; itemid < itact_item_; ++itemid ) {
         item_offset = itact_count_[itemid*2];
-        rating_size = itact_count_[itemid*2+1];
         item_real_id = itact_data_[item_offset*2];
-        // loss is inherently continuous
-        // int item_real_id = static_cast<int>(itact_data_[item_offset*2]);
-        // std::cout << "itemid:" << itemid << " item_real_id:" << item_real_id << " offset:" << item_offset << " rating_size: " << rating_size << std::endl;;
-        for (int rating_cnt = 0; rating_cnt < rating_size; ++rating_cnt) {
-          rating_idx = item_offset + rating_cnt; // simple mapping
-          userid = static_cast<int>(itact_data_[rating_idx*2+1]);
-          caffe_copy(num_latent_, user_feature + userid*num_latent_, user_feature_buf + rating_cnt*num_latent_);
-          // std::cout << "rating_idx:" << rating_idx  << " itemid:" << itemid << " userid:" << userid << std::endl;
-        }
-
-        // if (item_real_id==1) {
-        //   std::cout << "item_feature_diff before adding" << std::endl;
-        //   for (int i = 0; i < num_latent_; i++) {
-        //     std::cout << item_feature_diff[item_real_id*num_latent_ + i] << "\t";
-        //   }
-        //   std::cout << std::endl;
-        // }
-
-        // id may speard in multiple datum, so b cannot be set 0
-        caffe_cpu_gemv(CblasTrans, rating_size, num_latent_,
-          feature_weight_, user_feature_buf, rating_diff + item_offset, Dtype(1.), 
-          item_feature_diff + item_real_id*num_latent_);
-
-        gen_item_diff_ = true; // indicate we have computed item diff
-
-        // if (item_real_id==1) {
-        //   std::cout << "item_feature_diff after adding" << std::endl;
-        //   for (int i = 0; i < num_latent_; i++) {
-        //     std::cout << item_feature_diff[item_real_id*num_latent_ + i] << "\t";
-        //   }
-        //   std::cout << std::endl;
-        // }
-
-        // LOG(INFO) << "user_feature_buf";
-        // for (int i = 0; i < rating_size; ++i) {
-        //   for (int j = 0; j < num_latent_; ++j) {
-        //     std::cout << user_feature_buf[i*num_latent_ + j] << "\t";
-        //   }
-        //   std::cout << std::endl;
-        // }
-
-        // std::cout << "loss" << std::endl;;
-        // for (int i = 0; i < rating_size; i++) {
-        //   std::cout << rating_diff[item_offset+i] << "\t";
-        // }
-        // std::cout << std::endl;
-
-        // std::cout << "item_feature_diff:" << item_real_id << std::endl;
-        // for (int i = 0; i < num_latent_; i++) {
-        //   std::cout << item_feature_diff[item_real_id*num_latent_ + i] << "\t";
-        // }
-        // std::cout << std::endl;
-
-        // std::cout << "item_feature" << std::endl;
-        // const Dtype* item_feature = this->blobs_[1]->cpu_data(); // Target
-        // for (int i = 0; i < num_latent_; i++) {
-        //   std::cout << item_feature[item_real_id*num_latent_ + i] << "\t";
-        // }
-        // std::cout << std::endl;
-
-        // if (item_real_id==1) {
-        //   std::cout << "loss, offset:" << item_offset << " rating size:" << rating_size << std::endl;
-        //   for (int j = 0; j < rating_size; j++) {
-        //     rating_idx = item_offset + j;
-        //     userid = static_cast<int>(itact_data_[rating_idx*2+1]);
-        //     std::cout << item_real_id << " " << userid << " " << rating_diff[item_offset + j] << std::endl;
-        //   }
-        // }
+        // id may speard in multiple datum, so the diff accumulates
+        caffe_axpy(num_latent_, feature_weight_,
+            item_diff_buf + itemid*num_latent_,
+            item_feature_diff + item_real_id*num_latent_);
       }
+      gen_item_diff_ = true; // indicate we have computed item diff
     } else {
-      // LOG(INFO) << "copying";
       // the diff is already calculated in bottom[0]->cpu_diff()
       const Dtype* item_feature_diff_source = (*bottom)[0]->cpu_diff();
+      if (sparse_grad_) {
+        Clear_param_diff(1, touched_items_);
+      }
       Dtype* item_feature_diff = this->blobs_[1]->mutable_cpu_diff(); // Target
-      const Dtype* itact_data_ = (*bottom)[1]->cpu_data();
-      const Dtype* itact_count_ = (*bottom)[2]->cpu_data();
+      const int* itact_data_ = (*bottom)[1]->cpu_index();
+      const int* itact_count_ = (*bottom)[2]->cpu_index();
       int item_offset = 0, item_real_id = 0;
       for (int itemid = 0; itemid < itact_item_; ++itemid ) {
         item_offset = itact_count_[itemid*2];
         item_real_id = itact_data_[item_offset*2];
         caffe_cpu_scale(num_latent_, feature_weight_/img_weight_, item_feature_diff_source + itemid*num_latent_, item_feature_diff + item_real_id*num_latent_);
-
-        // std::cout << "item_feature_diff:" << item_real_id << std::endl;
-        // for (int i = 0; i < num_latent_; i++) {
-        //   std::cout << item_feature_diff[item_real_id*num_latent_ + i] << "\t";
-        // }
-        // std::cout << std::endl;
-
-        // std::cout << "item_feature" << std::endl;
-        // const Dtype* item_feature = this->blobs_[1]->cpu_data(); // Target
-        // for (int i = 0; i < num_latent_; i++) {
-        //   std::cout << item_feature[item_real_id*num_latent_ + i] << "\t";
-        // }
-        // std::cout << std::endl;
       } // ~ for
     } // ~ if (!gen_item_diff_)
   } // ~ if (this->param_propagate_down_[1])
-  // LOG(INFO) << "done";
 }
 
 /*  
     For each itemid,
       find associated rating loss, userid
-      fill user_feature_buf
-      gemv and normalize
+      accumulate loss * user feature
+    bottom[0] is indexed by relative itemid, so the items are computed in
+    parallel straight into its diff.
 */
 template <typename Dtype>
 void MatrixFactorizeLayer<Dtype>::Backward_Item_img_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
-  // LOG(INFO) << "Backward_Item_img_cpu";
   // bp diff to item feature in bottom[0]
   if (propagate_down[0]) {
-    // LOG(INFO) << "Backward_Item_img_cpu begin";
     if (img_weight_ <= 0)
       return;
     if (!gen_item_diff_) {
-      // LOG(INFO) << "Calculating";
       const Dtype* rating_diff = top[0]->cpu_diff();
       Dtype* item_feature_diff = (*bottom)[0]->mutable_cpu_diff(); // Target
-      caffe_set((*bottom)[0]->count(), Dtype(0.), item_feature_diff); // clearing target diff
       const Dtype* user_feature = this->blobs_[0]->cpu_data(); 
-      const Dtype* itact_data_ = (*bottom)[1]->cpu_data();
-      const Dtype* itact_count_ = (*bottom)[2]->cpu_data();
-      Dtype* user_feature_buf = user_feature_buffer_.mutable_cpu_data();
-
-      int item_offset = 0, rating_size = 0;
-      int item_real_id = 0, userid = 0, rating_idx = 0;
-      // relative itemid_version
-      for (int itemid = 0; itemid < itact_item_; ++itemid ) {
-        item_offset = itact_count_[itemid*2];
-        rating_size = itact_count_[itemid*2+1];
-        item_real_id = itact_data_[item_offset*2];
-        // loss is inherently continuous
-        // int item_real_id = static_cast<int>(itact_data_[item_offset*2]);
-        // std::cout << "itemid:" << itemid << " item_real_id:" << item_real_id << " offset:" << item_offset << " rating_size: " << rating_size << std::endl;;
-        for (int rating_cnt = 0; rating_cnt < rating_size; ++rating_cnt) {
-          rating_idx = item_offset + rating_cnt; // simple mapping
-          userid = static_cast<int>(itact_data_[rating_idx*2+1]);
-          caffe_copy(num_latent_, user_feature + userid*num_latent_, user_feature_buf + rating_cnt*num_latent_);
-          // std::cout << "rating_idx:" << rating_idx  << " itemid:" << itemid << " userid:" << userid << std::endl;
-        }
-        // id may speard in multiple datum, so b cannot be set 0
-        caffe_cpu_gemv(CblasTrans, rating_size, num_latent_,
-          img_weight_, user_feature_buf, rating_diff + item_offset, Dtype(1.),
-          item_feature_diff + itemid*num_latent_);
-
-        gen_item_diff_ = true; // indicate we have computed item diff
-
-        // LOG(INFO) << "user_feature_buf";
-        // for (int i = 0; i < rating_size; ++i) {
-        //   for (int j = 0; j < num_latent_; ++j) {
-        //     std::cout << user_feature_buf[i*num_latent_ + j] << "\t";
-        //   }
-        //   std::cout << std::endl;
-        // }
-
-        // std::cout << "loss" << std::endl;
-        // for (int i = 0; i < rating_size; i++) {
-        //   std::cout << rating_diff[item_offset+i] << "\t";
-        // }
-        // std::cout << std::endl;
-
-        // std::cout << "item_feature_diff:" << item_real_id << std::endl;
-        // for (int i = 0; i < num_latent_; i++) {
-        //   std::cout << item_feature_diff[itemid*num_latent_ + i] << "\t";
-        // }
-        // std::cout << std::endl;
-
-        // std::cout << "item_feature" << std::endl;
-        // const Dtype* item_feature = (*bottom)[0]->cpu_data(); // Target
-        // for (int i = 0; i < num_latent_; i++) {
-        //   std::cout << item_feature[itemid*num_latent_ + i] << "\t";
-        // }
-        // std::cout << std::endl;
-      }
+      const int* itact_data_ = (*bottom)[1]->cpu_index();
+      const int* itact_count_ = (*bottom)[2]->cpu_index();
+      run_ranges(workers_.get(), item_bound_, boost::bind(
+          &MatrixFactorizeLayer<Dtype>::Backward_items_cpu, this,
+          rating_diff, user_feature, itact_data_, itact_count_,
+          item_feature_diff, _1, _2));
+      caffe_scal(itact_item_*num_latent_, img_weight_, item_feature_diff);
+      gen_item_diff_ = true; // indicate we have computed item diff
     } else {
-      // LOG(INFO) << "copying";
       // the diff is already calculated in blobs_[1]->cpu_diff()
       const Dtype* item_feature_diff_source = this->blobs_[1]->cpu_diff(); 
       Dtype* item_feature_diff = (*bottom)[0]->mutable_cpu_diff(); // Target
-      const Dtype* itact_data_ = (*bottom)[1]->cpu_data();
-      const Dtype* itact_count_ = (*bottom)[2]->cpu_data();
+      const int* itact_data_ = (*bottom)[1]->cpu_index();
+      const int* itact_count_ = (*bottom)[2]->cpu_index();
       int item_offset = 0, item_real_id = 0;
       for (int itemid = 0; itemid < itact_item_; ++itemid ) {
         item_offset = itact_count_[itemid*2];
         item_real_id = itact_data_[item_offset*2];
         caffe_cpu_scale(num_latent_, img_weight_/feature_weight_, item_feature_diff_source + item_real_id*num_latent_, item_feature_diff + itemid*num_latent_);
-
-        // std::cout << "item_feature_diff:" << item_real_id << std::endl;
-        // for (int i = 0; i < num_latent_; i++) {
-        //   std::cout << item_feature_diff[itemid*num_latent_ + i] << "\t";
-        // }
-        // std::cout << std::endl;
-
-        // std::cout << "item_feature" << std::endl;
-        // const Dtype* item_feature = (*bottom)[0]->cpu_data(); // Target
-        // for (int i = 0; i < num_latent_; i++) {
-        //   std::cout << item_feature[itemid*num_latent_ + i] << "\t";
-        // }
-        // std::cout << std::endl;
       } // ~ for
     } // ~ if (!gen_item_diff_)
   } // ~ if (propagate_down[0])
-  // LOG(INFO) << "done";
 }
 
 #ifdef CPU_ONLY
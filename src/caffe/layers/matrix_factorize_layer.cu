@@ -21,8 +21,8 @@ void MatrixFactorizeLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom
   const Dtype* user_feature = this->blobs_[0]->gpu_data();
   const Dtype* item_feature = this->blobs_[1]->gpu_data();
   const Dtype* item_feature_img = bottom[0]->gpu_data();
-  const Dtype* itact_data_ = bottom[1]->cpu_data();				// must use cpu
-  const Dtype* itact_count_ = bottom[2]->cpu_data();			// must use cpu
+  const int* itact_data_ = bottom[1]->cpu_index();				// must use cpu
+  const int* itact_count_ = bottom[2]->cpu_index();			// must use cpu
   const Dtype* global_bias = this->blobs_[2]->cpu_data(); // must use cpu
   // user feature buffer
   Dtype* user_feature_buf = user_feature_buffer_.mutable_gpu_data();
@@ -42,7 +42,7 @@ void MatrixFactorizeLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom
     // LOG(INFO) << "itemid:" << itemid << " offset:" << item_offset << " rating_size: " << rating_size;
     for (int rating_cnt = 0; rating_cnt < rating_size; ++rating_cnt) {
       rating_idx = item_offset + rating_cnt;
-      userid = static_cast<int>(itact_data_[rating_idx*2+1]);
+      userid = itact_data_[rating_idx*2+1];
       caffe_copy(num_latent_, user_feature + userid*num_latent_, user_feature_buf + rating_cnt*num_latent_);
       // LOG(INFO) << "itemid:" << itemid << " userid:" << userid;
     }
@@ -53,7 +53,8 @@ void MatrixFactorizeLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom
   if (bias_term_) {
     caffe_gpu_add_scalar(num_rating_, global_bias[0], itact_pred_);
   }
-  // set the extra space in itact_pred_ to 0
+  // set the extra space in itact_pred_ to 0, for inputs padded to a fixed
+  // size; ragged batches have none
   if (num_rating_ < max_rating_size_) {
     int extra_length = max_rating_size_ - num_rating_;
     caffe_gpu_set(extra_length, Dtype(0.), itact_pred_ + num_rating_);
@@ -115,24 +116,22 @@ void MatrixFactorizeLayer<Dtype>::Backward_User_gpu(const vector<Blob<Dtype>*>&
     Dtype* user_feature_diff = this->blobs_[0]->mutable_gpu_diff(); // Target
     caffe_gpu_set(this->blobs_[0]->count(), Dtype(0.), user_feature_diff); // clearing target diff
     const Dtype* item_feature = item_feature_mixed_.gpu_data();
-    const Dtype* itact_data_ = (*bottom)[1]->cpu_data();  // must be cpu
     Dtype* item_feature_buf = item_feature_buffer_.mutable_gpu_data();
 
     int userid = 0, itemid = 0, rating_idx = 0, rating_size = 0;
     Dtype loss = 0;
     // traverse each user, #user gemv
-    map<int, vector<int> >::iterator iter;
-    for (iter = user2itemid.begin(); iter!=user2itemid.end(); ++iter) {
-      userid = iter->first;
-      vector<int>& ratingset = iter->second;
-      rating_size = ratingset.size();
+    for (int u = 0; u < touched_users_.size(); ++u) {
+      userid = touched_users_[u];
+      const int* ratingset = &user_rating_idx_[user_rating_start_[u]];
+      rating_size = user_rating_start_[u+1] - user_rating_start_[u];
       rating_buffer_.Reshape(1,1,1,rating_size);
       Dtype* rating_buf = rating_buffer_.mutable_cpu_data();
 
       // std::cout << "userid:" << userid << " rating_size:" << rating_size << std::endl;
       for (int i = 0; i < rating_size; ++i) {
         rating_idx = ratingset[i];
-        itemid = itemid2relative_id[static_cast<int>(itact_data_[rating_idx*2])]; // relative itemid
+        itemid = rating_item_[rating_idx]; // relative itemid
         // fill buffer
         loss = rating_diff[rating_idx];
         rating_buf[i] = loss;
@@ -183,8 +182,8 @@ void MatrixFactorizeLayer<Dtype>::Backward_Item_gpu(const vector<Blob<Dtype>*>&
       Dtype* item_feature_diff = this->blobs_[1]->mutable_gpu_diff(); // Target
       caffe_gpu_set(this->blobs_[1]->count(), Dtype(0.), item_feature_diff); // clearing target diff
       const Dtype* user_feature = this->blobs_[0]->gpu_data(); 
-      const Dtype* itact_data_ = (*bottom)[1]->cpu_data();  // must be cpu
-      const Dtype* itact_count_ = (*bottom)[2]->cpu_data(); // must be cpu
+      const int* itact_data_ = (*bottom)[1]->cpu_index();  // must be cpu
+      const int* itact_count_ = (*bottom)[2]->cpu_index(); // must be cpu
       Dtype* user_feature_buf = user_feature_buffer_.mutable_gpu_data();
 
       int item_offset = 0, rating_size = 0;
@@ -195,11 +194,11 @@ void MatrixFactorizeLayer<Dtype>::Backward_Item_gpu(const vector<Blob<Dtype>*>&
         rating_size = itact_count_[itemid*2+1];
         item_real_id = itact_data_[item_offset*2];
         // loss is inherently continuous
-        // int item_real_id = static_cast<int>(itact_data_[item_offset*2]);
+        // int item_real_id = itact_data_[item_offset*2];
         // std::cout << "itemid:" << itemid << " item_real_id:" << item_real_id << " offset:" << item_offset << " rating_size: " << rating_size << std::endl;;
         for (int rating_cnt = 0; rating_cnt < rating_size; ++rating_cnt) {
           rating_idx = item_offset + rating_cnt; // simple mapping
-          userid = static_cast<int>(itact_data_[rating_idx*2+1]);
+          userid = itact_data_[rating_idx*2+1];
           caffe_copy(num_latent_, user_feature + userid*num_latent_, user_feature_buf + rating_cnt*num_latent_);
           // std::cout << "rating_idx:" << rating_idx  << " itemid:" << itemid << " userid:" << userid << std::endl;
         }
@@ -235,8 +234,8 @@ void MatrixFactorizeLayer<Dtype>::Backward_Item_gpu(const vector<Blob<Dtype>*>&
       // the diff is already calculated in bottom[0]->gpu_diff()
       const Dtype* item_feature_diff_source = (*bottom)[0]->gpu_diff();
       Dtype* item_feature_diff = this->blobs_[1]->mutable_gpu_diff(); // Target
-      const Dtype* itact_data_ = (*bottom)[1]->cpu_data();
-      const Dtype* itact_count_ = (*bottom)[2]->cpu_data();
+      const int* itact_data_ = (*bottom)[1]->cpu_index();
+      const int* itact_count_ = (*bottom)[2]->cpu_index();
       int item_offset = 0, item_real_id = 0;
       for (int itemid = 0; itemid < itact_item_; ++itemid ) {
         item_offset = itact_count_[itemid*2];
@@ -264,8 +263,8 @@ void MatrixFactorizeLayer<Dtype>::Backward_Item_img_gpu(const vector<Blob<Dtype>
       Dtype* item_feature_diff = (*bottom)[0]->mutable_gpu_diff(); // Target
       caffe_gpu_set((*bottom)[0]->count(), Dtype(0.), item_feature_diff); // clearing target diff
       const Dtype* user_feature = this->blobs_[0]->gpu_data(); 
-      const Dtype* itact_data_ = (*bottom)[1]->cpu_data();  // must be cpu
-      const Dtype* itact_count_ = (*bottom)[2]->cpu_data(); // must be cpu
+      const int* itact_data_ = (*bottom)[1]->cpu_index();  // must be cpu
+      const int* itact_count_ = (*bottom)[2]->cpu_index(); // must be cpu
       Dtype* user_feature_buf = user_feature_buffer_.mutable_gpu_data();
 
       int item_offset = 0, rating_size = 0;
@@ -276,11 +275,11 @@ void MatrixFactorizeLayer<Dtype>::Backward_Item_img_gpu(const vector<Blob<Dtype>
         rating_size = itact_count_[itemid*2+1];
         item_real_id = itact_data_[item_offset*2];
         // loss is inherently continuous
-        // int item_real_id = static_cast<int>(itact_data_[item_offset*2]);
+        // int item_real_id = itact_data_[item_offset*2];
         // std::cout << "itemid:" << itemid << " item_real_id:" << item_real_id << " offset:" << item_offset << " rating_size: " << rating_size << std::endl;;
         for (int rating_cnt = 0; rating_cnt < rating_size; ++rating_cnt) {
           rating_idx = item_offset + rating_cnt; // simple mapping
-          userid = static_cast<int>(itact_data_[rating_idx*2+1]);
+          userid = itact_data_[rating_idx*2+1];
           caffe_copy(num_latent_, user_feature + userid*num_latent_, user_feature_buf + rating_cnt*num_latent_);
           // std::cout << "rating_idx:" << rating_idx  << " itemid:" << itemid << " userid:" << userid << std::endl;
         }
@@ -316,8 +315,8 @@ void MatrixFactorizeLayer<Dtype>::Backward_Item_img_gpu(const vector<Blob<Dtype>
       // the diff is already calculated in blobs_[1]->gpu_diff()
       const Dtype* item_feature_diff_source = this->blobs_[1]->gpu_diff(); 
       Dtype* item_feature_diff = (*bottom)[0]->mutable_gpu_diff(); // Target
-      const Dtype* itact_data_ = (*bottom)[1]->cpu_data();
-      const Dtype* itact_count_ = (*bottom)[2]->cpu_data();
+      const int* itact_data_ = (*bottom)[1]->cpu_index();
+      const int* itact_count_ = (*bottom)[2]->cpu_index();
       int item_offset = 0, item_real_id = 0;
       for (int itemid = 0; itemid < itact_item_; ++itemid ) {
         item_offset = itact_count_[itemid*2];
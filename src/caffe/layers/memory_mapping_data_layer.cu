@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <climits>
+#include <utility>
+#include <vector>
+
+#include "caffe/data_layers.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// Looks every id up by binary search over the (id, row) pairs, sorted by id.
+template <typename Dtype>
+__global__ void ResolveRows(const int n, const Dtype* bottom_id,
+    const int* id_row, const int num_id, int* rows) {
+  CUDA_KERNEL_LOOP(index, n) {
+    const int id = bottom_id[index];
+    int lo = 0, hi = num_id;
+    while (lo < hi) {
+      const int mid = (lo + hi) / 2;
+      if (id_row[mid * 2] < id) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    rows[index] = lo < num_id && id_row[lo * 2] == id ? id_row[lo * 2 + 1] : -1;
+  }
+}
+
+template <typename Dtype>
+__global__ void GatherRows(const int n, const int label_dim, const int* rows,
+    const Dtype* label, Dtype* top_label) {
+  CUDA_KERNEL_LOOP(index, n) {
+    const int row = rows[index / label_dim];
+    top_label[index] = row < 0 ? Dtype(0) :
+        label[row * label_dim + index % label_dim];
+  }
+}
+
+// The host memory used to convert a label table for the device: the table
+// stays mapped, and only this much of it is held as Dtype at a time.
+static const size_t kUploadChunkBytes = 64 << 20;
+
+template <typename Dtype>
+void MemoryMappingDataLayer<Dtype>::SetUpDeviceTable() {
+  if (this->label_table_) {
+    // the ids of a table are already sorted
+    const LabelTable& table = *this->label_table_;
+    CHECK_GT(table.num_row(), 0) << "No labels to look up";
+    CHECK_LE(table.num_row() * this->label_dim_, INT_MAX)
+        << "Label table too large for a blob";
+    const int num_row = table.num_row();
+    device_id_.Reshape(num_row, 2, 1, 1);
+    device_label_.Reshape(num_row, this->label_dim_, 1, 1);
+    int* id = device_id_.mutable_gpu_index();
+    Dtype* label = device_label_.mutable_gpu_data();
+    const int chunk_row = std::max<int>(1,
+        kUploadChunkBytes / (this->label_dim_ * sizeof(Dtype)));
+    vector<int> chunk_id(std::min(chunk_row, num_row) * 2);
+    vector<Dtype> chunk_label(std::min(chunk_row, num_row) * this->label_dim_);
+    for (int begin = 0; begin < num_row; begin += chunk_row) {
+      const int end = std::min(begin + chunk_row, num_row);
+      for (int row = begin; row < end; ++row) {
+        chunk_id[(row - begin) * 2] = table.id()[row];
+        chunk_id[(row - begin) * 2 + 1] = row;
+        table.CopyRow(row, &chunk_label[(row - begin) * this->label_dim_]);
+      }
+      caffe_gpu_memcpy((end - begin) * 2 * sizeof(int), &chunk_id[0],
+          id + begin * 2);
+      caffe_gpu_memcpy((end - begin) * this->label_dim_ * sizeof(Dtype),
+          &chunk_label[0], label + begin * this->label_dim_);
+    }
+    return;
+  }
+  vector<std::pair<int, int> > id_row(this->ID2Idx_.begin(),
+      this->ID2Idx_.end());
+  std::sort(id_row.begin(), id_row.end());
+  CHECK_GT(id_row.size(), 0) << "No labels to look up";
+  device_id_.Reshape(id_row.size(), 2, 1, 1);
+  int* id = device_id_.mutable_cpu_index();
+  for (int i = 0; i < id_row.size(); ++i) {
+    id[i*2] = id_row[i].first;
+    id[i*2 + 1] = id_row[i].second;
+  }
+}
+
+template <typename Dtype>
+void MemoryMappingDataLayer<Dtype>::Forward_gpu(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  if (device_id_.count() == 0) {
+    SetUpDeviceTable();
+  }
+  const Dtype* label = this->label_table_ ?
+      device_label_.gpu_data() : this->label_set_.gpu_data();
+  const int batch_size = this->layer_param_.data_param().batch_size();
+  batch_row_.Reshape(batch_size, 1, 1, 1);
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  ResolveRows<Dtype><<<CAFFE_GET_BLOCKS(batch_size), CAFFE_CUDA_NUM_THREADS>>>(
+      batch_size, bottom[0]->gpu_data(), device_id_.gpu_index(),
+      device_id_.num(), batch_row_.mutable_gpu_index());
+  CUDA_POST_KERNEL_CHECK;
+  const int count = batch_size * this->label_dim_;
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  GatherRows<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
+      count, this->label_dim_, batch_row_.gpu_index(), label,
+      (*top)[0]->mutable_gpu_data());
+  CUDA_POST_KERNEL_CHECK;
+  // Only the rows come back to the host, to fail on unknown ids as
+  // Forward_cpu does.
+  const int* rows = batch_row_.cpu_index();
+  for (int item_id = 0; item_id < batch_size; ++item_id) {
+    CHECK_GE(rows[item_id], 0) << "item_origin_ID "
+        << static_cast<int>(bottom[0]->cpu_data()[item_id]) << " not found";
+  }
+}
+
+INSTANTIATE_CLASS(MemoryMappingDataLayer);
+
+}  // namespace caffe
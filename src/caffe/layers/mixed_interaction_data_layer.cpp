@@ -0,0 +1,186 @@
+#include <stdint.h>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "boost/random/uniform_real.hpp"
+#include "boost/random/variate_generator.hpp"
+
+#include "caffe/common.hpp"
+#include "caffe/interaction_data_layers.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+MixedInteractionDataLayer<Dtype>::~MixedInteractionDataLayer<Dtype>() {
+  // stop taking batches from the sources before they are destroyed
+  this->JoinPrefetchThread();
+  for (int i = 0; i < source_tops_.size(); ++i) {
+    for (int j = 0; j < source_tops_[i].size(); ++j) {
+      delete source_tops_[i][j];
+    }
+  }
+}
+
+template <typename Dtype>
+void MixedInteractionDataLayer<Dtype>::DataLayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  const DataParameter& data_param = this->layer_param_.data_param();
+  const int num_source = data_param.mix_source_size();
+  CHECK_GT(num_source, 0) << "MixedInteractionDataLayer needs a mix_source";
+  CHECK(data_param.mix_weight_size() == 0 ||
+      data_param.mix_weight_size() == num_source)
+      << "Give no mix_weight, or one per mix_source";
+
+  // Every source is an InteractionDataLayer of its own, with the parameters
+  // of this layer overridden by those of the source
+  vector<Blob<Dtype>*> source_bottom;
+  float total_weight = 0;
+  for (int i = 0; i < num_source; ++i) {
+    LayerParameter source_param(this->layer_param_);
+    ostringstream source_name;
+    source_name << this->layer_param_.name() << "_mix" << i;
+    source_param.set_name(source_name.str());
+    source_param.set_type(LayerParameter_LayerType_DATA_ITACT);
+    DataParameter* source_data_param = source_param.mutable_data_param();
+    source_data_param->clear_mix_source();
+    source_data_param->clear_mix_weight();
+    source_data_param->MergeFrom(data_param.mix_source(i));
+    CHECK(!source_data_param->single_pass())
+        << "A mixed source is read forever, single_pass is not supported";
+    LOG(INFO) << "Mixing source " << source_data_param->source();
+
+    sources_.push_back(shared_ptr<InteractionDataLayer<Dtype> >(
+        new InteractionDataLayer<Dtype>(source_param)));
+    source_tops_.push_back(vector<Blob<Dtype>*>());
+    for (int j = 0; j < 5; ++j) {
+      source_tops_.back().push_back(new Blob<Dtype>());
+    }
+    sources_.back()->SetUp(source_bottom, &source_tops_.back());
+    const Blob<Dtype>& data = *source_tops_.back()[0];
+    const Blob<Dtype>& first_data = *source_tops_[0][0];
+    CHECK(data.channels() == first_data.channels() &&
+        data.height() == first_data.height() &&
+        data.width() == first_data.width())
+        << "The sources of " << this->layer_param_.name()
+        << " have different image shapes";
+
+    const float weight = data_param.mix_weight_size() ?
+        data_param.mix_weight(i) : 1;
+    CHECK_GE(weight, 0) << "mix_weight can not be negative";
+    total_weight += weight;
+    cumulative_weight_.push_back(total_weight);
+  }
+  CHECK_GT(total_weight, 0) << "Every mix_weight is 0";
+  // the first draw takes a fresh batch from its source
+  source_pos_.resize(num_source);
+  for (int i = 0; i < num_source; ++i) {
+    source_pos_[i] = source_tops_[i][0]->num();
+  }
+  const unsigned int prefetch_rng_seed = caffe_rng_rand();
+  prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
+
+  // The sources transform the images, so this layer has no mean to load
+  this->transform_param_.clear_mean_file();
+
+  const int batch_size = data_param.batch_size();
+  const Blob<Dtype>& data = *source_tops_[0][0];
+  (*top)[0]->Reshape(batch_size, data.channels(), data.height(),
+      data.width());
+  this->prefetch_data_.Reshape(batch_size, data.channels(), data.height(),
+      data.width());
+  LOG(INFO) << "output data size: " << (*top)[0]->num() << ","
+      << (*top)[0]->channels() << "," << (*top)[0]->height() << ","
+      << (*top)[0]->width();
+  (*top)[1]->Reshape(batch_size, 1, 1, 1);
+  this->prefetch_label_.Reshape(batch_size, 1, 1, 1);
+  const int itact_total_size = std::max<int>(1,
+      batch_size * data_param.itact_size());
+  (*top)[2]->Reshape(itact_total_size, 2, 1, 1);
+  this->prefetch_itact_data_.Reshape(itact_total_size, 2, 1, 1);
+  (*top)[3]->Reshape(itact_total_size, 1, 1, 1);
+  this->prefetch_itact_label_.Reshape(itact_total_size, 1, 1, 1);
+  (*top)[4]->Reshape(batch_size, 2, 1, 1);
+  this->prefetch_itact_count_.Reshape(batch_size, 2, 1, 1);
+
+  // datum size
+  this->datum_channels_ = sources_[0]->datum_channels();
+  this->datum_height_ = sources_[0]->datum_height();
+  this->datum_width_ = sources_[0]->datum_width();
+  this->datum_size_ = sources_[0]->datum_size();
+}
+
+template <typename Dtype>
+int MixedInteractionDataLayer<Dtype>::draw_source() {
+  caffe::rng_t* prefetch_rng =
+      static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+  boost::uniform_real<float> random_distribution(0,
+      cumulative_weight_.back());
+  boost::variate_generator<caffe::rng_t*, boost::uniform_real<float> >
+      variate_generator(prefetch_rng, random_distribution);
+  const float draw = variate_generator();
+  // a source of weight 0 is never drawn
+  const int source = std::upper_bound(cumulative_weight_.begin(),
+      cumulative_weight_.end(), draw) - cumulative_weight_.begin();
+  return std::min<int>(source, cumulative_weight_.size() - 1);
+}
+
+// This function is called on the prefetch thread to load a batch.
+template <typename Dtype>
+void MixedInteractionDataLayer<Dtype>::load_batch() {
+  const int batch_size = this->layer_param_.data_param().batch_size();
+  const int image_size = this->prefetch_data_.count() / batch_size;
+  Dtype* top_data = this->prefetch_data_.mutable_cpu_data();
+  Dtype* top_label = this->prefetch_label_.mutable_cpu_data();
+  int* top_itact_count = this->prefetch_itact_count_.mutable_cpu_index();
+  // The ratings are staged, as a source may replace its batch before the
+  // mixed batch is complete
+  mix_itact_.clear();
+  mix_rating_.clear();
+  const vector<Blob<Dtype>*> no_bottom;
+  for (int item_id = 0; item_id < batch_size; ++item_id) {
+    const int source = draw_source();
+    vector<Blob<Dtype>*>& tops = source_tops_[source];
+    if (source_pos_[source] == tops[0]->num()) {
+      // on the CPU: the source hands over a batch its own thread prefetched
+      sources_[source]->Forward_cpu(no_bottom, &tops);
+      source_pos_[source] = 0;
+    }
+    const int pos = source_pos_[source]++;
+    // std::copy, as caffe_copy would go through CUDA in GPU mode
+    const Dtype* image = tops[0]->cpu_data() + tops[0]->offset(pos);
+    std::copy(image, image + image_size,
+        top_data + this->prefetch_data_.offset(item_id));
+    top_label[item_id] = tops[1]->cpu_data()[pos];
+
+    const int* count = tops[4]->cpu_index();
+    const int offset = count[pos * 2];
+    const int num_rating = count[pos * 2 + 1];
+    top_itact_count[item_id * 2] = mix_rating_.size();
+    top_itact_count[item_id * 2 + 1] = num_rating;
+    const int* itact = tops[2]->cpu_index() + offset * 2;
+    mix_itact_.insert(mix_itact_.end(), itact, itact + num_rating * 2);
+    const Dtype* rating = tops[3]->cpu_data() + offset;
+    mix_rating_.insert(mix_rating_.end(), rating, rating + num_rating);
+  }
+
+  const int itact_total_size = mix_rating_.size();
+  this->prefetch_itact_data_.Reshape(itact_total_size, 2, 1, 1);
+  this->prefetch_itact_label_.Reshape(itact_total_size, 1, 1, 1);
+  if (itact_total_size > 0) {
+    std::copy(mix_itact_.begin(), mix_itact_.end(),
+        this->prefetch_itact_data_.mutable_cpu_index());
+    std::copy(mix_rating_.begin(), mix_rating_.end(),
+        this->prefetch_itact_label_.mutable_cpu_data());
+  }
+}
+
+INSTANTIATE_CLASS(MixedInteractionDataLayer);
+
+}  // namespace caffe
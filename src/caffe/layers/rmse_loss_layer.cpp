@@ -23,7 +23,8 @@ void RmseLossLayer<Dtype>::Reshape(
 template <typename Dtype>
 void RmseLossLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     vector<Blob<Dtype>*>* top) {
-  num_rating_ = bottom[2]->cpu_data()[0];
+  num_rating_ = bottom.size() > 2 ?
+      static_cast<int>(bottom[2]->cpu_data()[0]) : bottom[0]->count();
   int count = bottom[0]->count();
   CHECK_LE(num_rating_, count) << "assigned rating length exceed boundary.";
 
@@ -2,9 +2,9 @@
 #include <functional>
 #include <utility>
 #include <vector>
-#include <fstream>
 
 #include "caffe/layer.hpp"
+#include "caffe/util/async_writer.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
@@ -18,14 +18,17 @@ void SnapshotLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     LOG(FATAL)<<"data dump file do not exist.";
     return;
   }
-  out.open(this->layer_param_.snapshot_param().dump_file().c_str(),ios::out|ios::app);
-  LOG(INFO)<< "Dumping to " << this->layer_param_.snapshot_param().dump_file();
+  const SnapshotParameter& dump_param = this->layer_param_.snapshot_param();
+  writer_.reset(new AsyncWriter(dump_param.dump_file(), dump_param.binary(),
+      dump_param.compress(), dump_param.block_size()));
+  LOG(INFO)<< "Dumping to " << dump_param.dump_file();
 }
 
 template <typename Dtype>
 SnapshotLayer<Dtype>::~SnapshotLayer() {
   LOG(INFO)<< "Closing file " << this->layer_param_.snapshot_param().dump_file();
-  out.close();
+  // writes the rows still queued
+  writer_.reset();
 }
 
 template <typename Dtype>
@@ -47,13 +50,9 @@ void SnapshotLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     top_data[i] = bottom_data[i];
   }
   // dumping to file
-  out << "forward" << std::endl;
-  for (int i = 0; i < num; ++i) {
-    for (int j = 0; j < dim; ++j) {
-      out << bottom_data[i*dim + j] << " ";
-    }
-    out << std::endl;
-  }
+  writer_->WriteLine("forward");
+  writer_->BeginRows(num, ' ', true);
+  writer_->AddColumns(bottom_data, dim);
 }
 
 template <typename Dtype>
@@ -69,13 +68,9 @@ void SnapshotLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       bottom_diff[i] = top_diff[i];
     }
     // dumping to file
-    out << "backward" << std::endl;
-    for (int i = 0; i < num; ++i) {
-      for (int j = 0; j < dim; ++j) {
-        out << top_diff[i*dim + j] << " ";
-      }
-      out << std::endl;
-    }
+    writer_->WriteLine("backward");
+    writer_->BeginRows(num, ' ', true);
+    writer_->AddColumns(top_diff, dim);
   }
 }
 
@@ -0,0 +1,271 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+// The transforms of F(2x2, 3x3), as in Lavin and Gray, "Fast Algorithms for
+// Convolutional Neural Networks": the filter g becomes G g G^T, the input
+// tile d becomes B^T d B, and the elementwise product m becomes A^T m A.
+
+// u = G g G^T, with G = [1 0 0; 1/2 1/2 1/2; 1/2 -1/2 1/2; 0 0 1]
+template <typename Dtype>
+static void TransformFilter(const Dtype g[3][3], Dtype u[4][4]) {
+  Dtype t[4][3];
+  for (int j = 0; j < 3; ++j) {
+    t[0][j] = g[0][j];
+    t[1][j] = (g[0][j] + g[1][j] + g[2][j]) / 2;
+    t[2][j] = (g[0][j] - g[1][j] + g[2][j]) / 2;
+    t[3][j] = g[2][j];
+  }
+  for (int i = 0; i < 4; ++i) {
+    u[i][0] = t[i][0];
+    u[i][1] = (t[i][0] + t[i][1] + t[i][2]) / 2;
+    u[i][2] = (t[i][0] - t[i][1] + t[i][2]) / 2;
+    u[i][3] = t[i][2];
+  }
+}
+
+// v = B^T d B, with B^T = [1 0 -1 0; 0 1 1 0; 0 -1 1 0; 0 1 0 -1]
+template <typename Dtype>
+static void TransformTile(const Dtype d[4][4], Dtype v[4][4]) {
+  Dtype t[4][4];
+  for (int j = 0; j < 4; ++j) {
+    t[0][j] = d[0][j] - d[2][j];
+    t[1][j] = d[1][j] + d[2][j];
+    t[2][j] = d[2][j] - d[1][j];
+    t[3][j] = d[1][j] - d[3][j];
+  }
+  for (int i = 0; i < 4; ++i) {
+    v[i][0] = t[i][0] - t[i][2];
+    v[i][1] = t[i][1] + t[i][2];
+    v[i][2] = t[i][2] - t[i][1];
+    v[i][3] = t[i][1] - t[i][3];
+  }
+}
+
+// y = A^T m A, with A^T = [1 1 1 0; 0 1 -1 -1]
+template <typename Dtype>
+static void TransformProduct(const Dtype m[4][4], Dtype y[2][2]) {
+  Dtype t[2][4];
+  for (int j = 0; j < 4; ++j) {
+    t[0][j] = m[0][j] + m[1][j] + m[2][j];
+    t[1][j] = m[1][j] - m[2][j] - m[3][j];
+  }
+  for (int i = 0; i < 2; ++i) {
+    y[i][0] = t[i][0] + t[i][1] + t[i][2];
+    y[i][1] = t[i][1] - t[i][2] - t[i][3];
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  ConvolutionLayer<Dtype>::LayerSetUp(bottom, top);
+  // The backward pass pads the top diff by 2 - pad.
+  use_winograd_ = this->kernel_h_ == 3 && this->kernel_w_ == 3 &&
+      this->stride_h_ == 1 && this->stride_w_ == 1 &&
+      this->pad_h_ <= 2 && this->pad_w_ <= 2;
+  if (!use_winograd_) {
+    LOG(INFO) << "Layer " << this->layer_param_.name() << ": Winograd "
+              << "covers 3x3 filters with stride 1 and pad at most 2, "
+              << "falling back to the CAFFE engine";
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Reshape(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  ConvolutionLayer<Dtype>::Reshape(bottom, top);
+  if (!use_winograd_) {
+    return;
+  }
+  filter_transform_.Reshape(16, this->num_output_,
+      this->channels_ / this->group_, 1);
+  // 2x2 output tiles of the top going forward, of the bottom going backward
+  const int forward_tiles =
+      ((this->height_out_ + 1) / 2) * ((this->width_out_ + 1) / 2);
+  const int backward_tiles =
+      ((this->height_ + 1) / 2) * ((this->width_ + 1) / 2);
+  const int tile_size = 16 * std::max(this->channels_ * forward_tiles,
+      this->num_output_ * backward_tiles);
+  const int product_size = 16 * std::max(this->num_output_ * forward_tiles,
+      this->channels_ * backward_tiles);
+  tile_buffers_.resize(this->num_slice_);
+  product_buffers_.resize(this->num_slice_);
+  for (int slice = 0; slice < this->num_slice_; ++slice) {
+    if (!tile_buffers_[slice]) {
+      tile_buffers_[slice].reset(new Blob<Dtype>());
+      product_buffers_[slice].reset(new Blob<Dtype>());
+    }
+    tile_buffers_[slice]->Reshape(1, 1, 1, tile_size);
+    product_buffers_[slice]->Reshape(1, 1, 1, product_size);
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::transform_filters(const bool backward) {
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  Dtype* filter_transform = filter_transform_.mutable_cpu_data();
+  const int channels_g = this->channels_ / this->group_;
+  // Forward, output o reads input c of its group: U[xi][o][c]. Backward,
+  // the roles swap and the filter is flipped: U[xi][c][o % M_].
+  const int out_channels = backward ? this->channels_ : this->num_output_;
+  const int in_channels_g = backward ? this->M_ : channels_g;
+  for (int o = 0; o < this->num_output_; ++o) {
+    for (int c = 0; c < channels_g; ++c) {
+      const Dtype* w = weight + (o * channels_g + c) * 9;
+      Dtype g[3][3];
+      for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+          g[i][j] = backward ? w[(2 - i) * 3 + 2 - j] : w[i * 3 + j];
+        }
+      }
+      Dtype u[4][4];
+      TransformFilter(g, u);
+      const int row = backward ? (o / this->M_) * channels_g + c : o;
+      const int col = backward ? o % this->M_ : c;
+      for (int xi = 0; xi < 16; ++xi) {
+        filter_transform[(xi * out_channels + row) * in_channels_g + col] =
+            u[xi / 4][xi % 4];
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::winograd_slice(const Dtype* input,
+    Dtype* output, const bool backward, const int begin, const int end,
+    const int slice) {
+  const int in_channels = backward ? this->num_output_ : this->channels_;
+  const int in_h = backward ? this->height_out_ : this->height_;
+  const int in_w = backward ? this->width_out_ : this->width_;
+  const int out_channels = backward ? this->channels_ : this->num_output_;
+  const int out_h = backward ? this->height_ : this->height_out_;
+  const int out_w = backward ? this->width_ : this->width_out_;
+  // the full correlation of the top diff with the flipped filters
+  const int pad_h = backward ? 2 - this->pad_h_ : this->pad_h_;
+  const int pad_w = backward ? 2 - this->pad_w_ : this->pad_w_;
+  const Dtype* bias = !backward && this->bias_term_ ?
+      this->blobs_[1]->cpu_data() : NULL;
+  const bool relu = !backward && this->fused_relu_;
+  const int in_g = in_channels / this->group_;
+  const int out_g = out_channels / this->group_;
+  const int tiles_w = (out_w + 1) / 2;
+  const int num_tile = ((out_h + 1) / 2) * tiles_w;
+  const Dtype* filter_transform = filter_transform_.cpu_data();
+  Dtype* tiles = tile_buffers_[slice]->mutable_cpu_data();
+  Dtype* products = product_buffers_[slice]->mutable_cpu_data();
+  for (int n = begin; n < end; ++n) {
+    // Transform the 4x4 input tiles, which overlap by 2.
+    const Dtype* image = input + n * in_channels * in_h * in_w;
+    for (int c = 0; c < in_channels; ++c) {
+      const Dtype* channel = image + c * in_h * in_w;
+      for (int t = 0; t < num_tile; ++t) {
+        const int h0 = (t / tiles_w) * 2 - pad_h;
+        const int w0 = (t % tiles_w) * 2 - pad_w;
+        Dtype d[4][4];
+        for (int i = 0; i < 4; ++i) {
+          for (int j = 0; j < 4; ++j) {
+            const int h = h0 + i, w = w0 + j;
+            d[i][j] = h >= 0 && h < in_h && w >= 0 && w < in_w ?
+                channel[h * in_w + w] : 0;
+          }
+        }
+        Dtype v[4][4];
+        TransformTile(d, v);
+        for (int xi = 0; xi < 16; ++xi) {
+          tiles[(xi * in_channels + c) * num_tile + t] = v[xi / 4][xi % 4];
+        }
+      }
+    }
+    // One GEMM per tile element and group sums over the input channels.
+    for (int xi = 0; xi < 16; ++xi) {
+      for (int g = 0; g < this->group_; ++g) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, out_g, num_tile,
+            in_g, (Dtype)1.,
+            filter_transform + (xi * out_channels + g * out_g) * in_g,
+            tiles + (xi * in_channels + g * in_g) * num_tile, (Dtype)0.,
+            products + (xi * out_channels + g * out_g) * num_tile);
+      }
+    }
+    // Transform the products back into 2x2 output tiles.
+    Dtype* out_image = output + n * out_channels * out_h * out_w;
+    for (int o = 0; o < out_channels; ++o) {
+      Dtype* channel = out_image + o * out_h * out_w;
+      const Dtype b = bias ? bias[o] : 0;
+      for (int t = 0; t < num_tile; ++t) {
+        Dtype m[4][4];
+        for (int xi = 0; xi < 16; ++xi) {
+          m[xi / 4][xi % 4] = products[(xi * out_channels + o) * num_tile + t];
+        }
+        Dtype y[2][2];
+        TransformProduct(m, y);
+        const int h0 = (t / tiles_w) * 2;
+        const int w0 = (t % tiles_w) * 2;
+        for (int i = 0; i < 2 && h0 + i < out_h; ++i) {
+          for (int j = 0; j < 2 && w0 + j < out_w; ++j) {
+            const Dtype value = y[i][j] + b;
+            channel[(h0 + i) * out_w + w0 + j] = relu && value < 0 ?
+                value * this->relu_negative_slope_ : value;
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  if (!use_winograd_) {
+    ConvolutionLayer<Dtype>::Forward_cpu(bottom, top);
+    return;
+  }
+  transform_filters(false);
+  // Synchronize the parameters before the slices read them concurrently.
+  if (this->bias_term_) {
+    this->blobs_[1]->cpu_data();
+  }
+  for (int i = 0; i < bottom.size(); ++i) {
+    this->slice_workers_->RunSlices(this->num_, this->num_slice_,
+        boost::bind(&WinogradConvolutionLayer<Dtype>::winograd_slice, this,
+        bottom[i]->cpu_data(), (*top)[i]->mutable_cpu_data(), false,
+        _1, _2, _3));
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Backward_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    vector<Blob<Dtype>*>* bottom) {
+  if (!use_winograd_) {
+    ConvolutionLayer<Dtype>::Backward_cpu(top, propagate_down, bottom);
+    return;
+  }
+  // The weight and bias gradients, by im2col and GEMM.
+  ConvolutionLayer<Dtype>::Backward_cpu(top,
+      vector<bool>(propagate_down.size(), false), bottom);
+  bool transformed = false;
+  for (int i = 0; i < top.size(); ++i) {
+    if (!propagate_down[i]) {
+      continue;
+    }
+    if (!transformed) {
+      transform_filters(true);
+      transformed = true;
+    }
+    this->slice_workers_->RunSlices(this->num_, this->num_slice_,
+        boost::bind(&WinogradConvolutionLayer<Dtype>::winograd_slice, this,
+        top[i]->cpu_diff(), (*bottom)[i]->mutable_cpu_diff(), true,
+        _1, _2, _3));
+  }
+}
+
+INSTANTIATE_CLASS(WinogradConvolutionLayer);
+
+}  // namespace caffe
@@ -38,9 +38,20 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   FilterNet(in_param, &filtered_param);
   LOG(INFO) << "Initializing net from parameters: " << std::endl
             << filtered_param.DebugString();
-  // Create a copy of filtered_param with splits added where necessary.
+  // Create a copy of filtered_param with splits added where necessary. A net
+  // that runs no backward needs no splits, as the split tops only keep the
+  // diffs of several consumers apart; instead its in-place ReLUs are fused.
+  inference_ = filtered_param.state().inference();
   NetParameter param;
-  InsertSplits(filtered_param, &param);
+  if (inference_) {
+    CHECK(!filtered_param.force_backward())
+        << "force_backward is not supported in inference mode";
+    CHECK_NE(filtered_param.memory_plan(), NetParameter_MemoryPlan_DIFF)
+        << "Nets in inference mode have no diffs to share";
+    FuseReLU(filtered_param, &param);
+  } else {
+    InsertSplits(filtered_param, &param);
+  }
   // Basically, build all the layers and set up its connections.
   name_ = param.name();
   map<string, int> blob_name_to_idx;
@@ -94,6 +105,7 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     }
     // After this layer is connected, set it up.
     LOG(INFO) << "Setting up " << layer_names_[layer_id];
+    layers_[layer_id]->set_inference(inference_);
     layers_[layer_id]->SetUp(bottom_vecs_[layer_id], &top_vecs_[layer_id]);
     for (int top_id = 0; top_id < top_vecs_[layer_id].size(); ++top_id) {
       if (blob_loss_weights_.size() <= top_id_vecs_[layer_id][top_id]) {
@@ -116,7 +128,12 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     CHECK(blobs_lr_size == num_param_blobs || blobs_lr_size == 0)
         << "Incorrect blobs lr size: should be either 0 "
         << "or the same as the number of the layer's parameter blobs.";
-    if (blobs_lr_size) {
+    if (inference_) {
+      need_backward = false;
+      for (int param_id = 0; param_id < num_param_blobs; ++param_id) {
+        layers_[layer_id]->set_param_propagate_down(param_id, false);
+      }
+    } else if (blobs_lr_size) {
       // Check if this layer needs backward operation itself
       for (int param_id = 0; param_id < blobs_lr_size; ++param_id) {
         const bool param_need_backward = layer_param.blobs_lr(param_id) > 0;
@@ -216,6 +233,38 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     layer_names_index_[layer_names_[layer_id]] = layer_id;
   }
   GetLearningRateAndWeightDecay();
+  PlanMemory(param);
+  if (inference_) {
+    // Only the loss layers read diffs in Forward: the loss weights of their
+    // tops, and e.g. HINGE_LOSS its bottom as scratch.
+    vector<bool> keep_diff(blobs_.size(), false);
+    for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+      bool has_loss = false;
+      for (int top_id = 0; top_id < top_vecs_[layer_id].size(); ++top_id) {
+        if (layers_[layer_id]->loss(top_id)) {
+          keep_diff[top_id_vecs_[layer_id][top_id]] = true;
+          has_loss = true;
+        }
+      }
+      for (int bottom_id = 0; has_loss &&
+           bottom_id < bottom_id_vecs_[layer_id].size(); ++bottom_id) {
+        keep_diff[bottom_id_vecs_[layer_id][bottom_id]] = true;
+      }
+    }
+    size_t diff_freed = 0;
+    for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+      if (!keep_diff[blob_id]) {
+        diff_freed += blobs_[blob_id]->count();
+        blobs_[blob_id]->DropDiff();
+      }
+    }
+    for (int param_id = 0; param_id < params_.size(); ++param_id) {
+      diff_freed += params_[param_id]->count();
+      params_[param_id]->DropDiff();
+    }
+    LOG(INFO) << "Inference mode: freed " << diff_freed * sizeof(Dtype)
+              << " bytes of diffs";
+  }
   LOG(INFO) << "Network initialization done.";
   LOG(INFO) << "Memory required for data: " << memory_used_ * sizeof(Dtype);
   // Don't display debug info by default.
@@ -266,6 +315,33 @@ void Net<Dtype>::FilterNet(const NetParameter& param,
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::FuseReLU(const NetParameter& param,
+    NetParameter* param_fused) {
+  param_fused->CopyFrom(param);
+  param_fused->clear_layers();
+  for (int i = 0; i < param.layers_size(); ++i) {
+    const LayerParameter& layer_param = param.layers(i);
+    const int num_kept = param_fused->layers_size();
+    if (num_kept > 0 && layer_param.type() == LayerParameter_LayerType_RELU &&
+        layer_param.bottom_size() == 1 && layer_param.top_size() == 1 &&
+        layer_param.top(0) == layer_param.bottom(0)) {
+      LayerParameter* previous = param_fused->mutable_layers(num_kept - 1);
+      if ((previous->type() == LayerParameter_LayerType_CONVOLUTION ||
+           previous->type() == LayerParameter_LayerType_INNER_PRODUCT) &&
+          previous->top_size() == 1 &&
+          previous->top(0) == layer_param.bottom(0) &&
+          !previous->has_fused_relu()) {
+        LOG(INFO) << "Fusing " << layer_param.name() << " into "
+                  << previous->name();
+        previous->mutable_fused_relu()->CopyFrom(layer_param.relu_param());
+        continue;
+      }
+    }
+    param_fused->add_layers()->CopyFrom(layer_param);
+  }
+}
+
 template <typename Dtype>
 bool Net<Dtype>::StateMeetsRule(const NetState& state,
     const NetStateRule& rule, const string& layer_name) {
@@ -386,7 +462,9 @@ int Net<Dtype>::AppendBottom(const NetParameter& param,
     set<string>* available_blobs, map<string, int>* blob_name_to_idx) {
   const LayerParameter& layer_param = param.layers(layer_id);
   const string& blob_name = layer_param.bottom(bottom_id);
-  if (available_blobs->find(blob_name) == available_blobs->end()) {
+  // Without splits (inference mode), a blob may feed several layers.
+  if (available_blobs->find(blob_name) == available_blobs->end() &&
+      !(inference_ && blob_name_to_idx->count(blob_name))) {
     LOG(FATAL) << "Unknown blob input " << blob_name
                << " (at index " << bottom_id << ") to layer " << layer_id;
   }
@@ -497,6 +575,175 @@ void Net<Dtype>::GetLearningRateAndWeightDecay() {
   }
 }
 
+// Helper for Net::PlanMemory: the blob whose memory blob_id shares.
+static int FindMemoryRoot(vector<int>* root, const int blob_id) {
+  int id = blob_id;
+  while ((*root)[id] != id) { id = (*root)[id]; }
+  (*root)[blob_id] = id;
+  return id;
+}
+
+template <typename Dtype>
+void Net<Dtype>::PlanMemory(const NetParameter& param) {
+  bool share_diff = false;
+  switch (param.memory_plan()) {
+  case NetParameter_MemoryPlan_AUTO:
+    // only nets without backward share their data
+    for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+      if (layer_need_backward_[layer_id]) { return; }
+    }
+    break;
+  case NetParameter_MemoryPlan_NONE:
+    return;
+  case NetParameter_MemoryPlan_DIFF:
+    share_diff = true;
+    break;
+  default:
+    LOG(FATAL) << "Unknown memory plan: " << param.memory_plan();
+  }
+  // Blobs one layer points at the memory of another (ShareData, ShareDiff)
+  // live in the memory of their root blob.
+  const int num_blob = blobs_.size();
+  vector<int> root(num_blob);
+  for (int blob_id = 0; blob_id < num_blob; ++blob_id) {
+    root[blob_id] = blob_id;
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const Layer<Dtype>& layer = *layers_[layer_id];
+    const vector<int>& bottom_ids = bottom_id_vecs_[layer_id];
+    const vector<int>& top_ids = top_id_vecs_[layer_id];
+    if (!share_diff && layer.TopsShareBottomData()) {
+      for (int top_id = 0; top_id < top_ids.size(); ++top_id) {
+        root[FindMemoryRoot(&root, top_ids[top_id])] =
+            FindMemoryRoot(&root, bottom_ids[0]);
+      }
+    }
+    if (share_diff && layer.BottomSharesTopDiff()) {
+      root[FindMemoryRoot(&root, bottom_ids[0])] =
+          FindMemoryRoot(&root, top_ids[0]);
+    }
+  }
+  // A blob is alive from the first to the last layer using it. The backward
+  // pass visits the layers in reverse, so the same intervals, mirrored, tell
+  // which diffs are alive at once.
+  vector<int> first_use(num_blob, layers_.size());
+  vector<int> last_use(num_blob, -1);
+  vector<size_t> size(num_blob, 0);
+  vector<bool> pinned(num_blob, false);
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    vector<int> blob_ids(bottom_id_vecs_[layer_id]);
+    blob_ids.insert(blob_ids.end(), top_id_vecs_[layer_id].begin(),
+        top_id_vecs_[layer_id].end());
+    for (int i = 0; i < blob_ids.size(); ++i) {
+      const int blob_root = FindMemoryRoot(&root, blob_ids[i]);
+      first_use[blob_root] = std::min(first_use[blob_root], layer_id);
+      last_use[blob_root] = std::max(last_use[blob_root], layer_id);
+    }
+    // the data layers hand their tops batches of their own (Blob::Swap)
+    if (bottom_id_vecs_[layer_id].size() == 0) {
+      for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+        pinned[FindMemoryRoot(&root, top_id_vecs_[layer_id][i])] = true;
+      }
+    }
+  }
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    pinned[FindMemoryRoot(&root, net_input_blob_indices_[i])] = true;
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    pinned[FindMemoryRoot(&root, net_output_blob_indices_[i])] = true;
+  }
+  for (int i = 0; i < param.keep_blob_size(); ++i) {
+    CHECK(has_blob(param.keep_blob(i))) << "Unknown keep_blob "
+        << param.keep_blob(i);
+    pinned[FindMemoryRoot(&root, blob_names_index_[param.keep_blob(i)])] =
+        true;
+  }
+  // Loss layers write their bottom diffs in Forward (e.g. HINGE_LOSS uses
+  // them as scratch), before the backward pass they are planned for.
+  for (int layer_id = 0; share_diff && layer_id < layers_.size(); ++layer_id) {
+    bool has_loss = false;
+    for (int top_id = 0; top_id < top_vecs_[layer_id].size(); ++top_id) {
+      has_loss = has_loss || layers_[layer_id]->loss(top_id);
+    }
+    for (int bottom_id = 0; has_loss &&
+         bottom_id < bottom_id_vecs_[layer_id].size(); ++bottom_id) {
+      pinned[FindMemoryRoot(&root, bottom_id_vecs_[layer_id][bottom_id])] =
+          true;
+    }
+  }
+  for (int blob_id = 0; blob_id < num_blob; ++blob_id) {
+    const int blob_root = FindMemoryRoot(&root, blob_id);
+    if (blob_id < blob_loss_weights_.size() && blob_loss_weights_[blob_id]) {
+      pinned[blob_root] = true;
+    }
+    const Blob<Dtype>& blob = *blobs_[blob_id];
+    size[blob_root] = std::max(size[blob_root],
+        share_diff ? blob.diff()->size() : blob.data()->size());
+  }
+
+  // Hand the roots, in the order they are first used, the smallest free
+  // buffer that holds them, or else grow the largest free one.
+  vector<size_t> buffer_size;
+  vector<int> buffer_last_use;
+  vector<int> buffer_of(num_blob, -1);
+  size_t memory_before = 0, memory_after = 0;
+  // (blobs no layer uses come last)
+  for (int layer_id = 0; layer_id <= layers_.size(); ++layer_id) {
+    for (int blob_id = 0; blob_id < num_blob; ++blob_id) {
+      if (root[blob_id] != blob_id || first_use[blob_id] != layer_id) {
+        continue;
+      }
+      memory_before += size[blob_id];
+      if (pinned[blob_id] || size[blob_id] == 0) {
+        memory_after += size[blob_id];
+        continue;
+      }
+      int best = -1;
+      for (int b = 0; b < buffer_size.size(); ++b) {
+        if (buffer_last_use[b] >= layer_id) { continue; }
+        if (best < 0) {
+          best = b;
+        } else if (buffer_size[best] >= size[blob_id]) {
+          if (buffer_size[b] >= size[blob_id] &&
+              buffer_size[b] < buffer_size[best]) {
+            best = b;
+          }
+        } else if (buffer_size[b] > buffer_size[best]) {
+          best = b;
+        }
+      }
+      if (best < 0) {
+        best = buffer_size.size();
+        buffer_size.push_back(0);
+        buffer_last_use.push_back(-1);
+      }
+      buffer_size[best] = std::max(buffer_size[best], size[blob_id]);
+      buffer_last_use[best] = last_use[blob_id];
+      buffer_of[blob_id] = best;
+    }
+  }
+  vector<shared_ptr<SyncedMemory> > buffers(buffer_size.size());
+  for (int b = 0; b < buffer_size.size(); ++b) {
+    buffers[b].reset(new SyncedMemory(buffer_size[b]));
+    memory_after += buffer_size[b];
+  }
+  int num_shared = 0;
+  for (int blob_id = 0; blob_id < num_blob; ++blob_id) {
+    const int buffer = buffer_of[FindMemoryRoot(&root, blob_id)];
+    if (buffer < 0) { continue; }
+    if (share_diff) {
+      blobs_[blob_id]->SetDiffMemory(buffers[buffer]);
+    } else {
+      blobs_[blob_id]->SetDataMemory(buffers[buffer]);
+    }
+    ++num_shared;
+  }
+  LOG(INFO) << "Memory plan: " << num_shared << " blobs share "
+      << buffers.size() << " buffers for their " << (share_diff ? "diff" :
+      "data") << ", " << memory_after << " bytes instead of "
+      << memory_before;
+}
+
 template <typename Dtype>
 Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
   CHECK_GE(start, 0);
@@ -565,6 +812,7 @@ string Net<Dtype>::Forward(const string& input_blob_protos, Dtype* loss) {
 
 template <typename Dtype>
 void Net<Dtype>::BackwardFromTo(int start, int end) {
+  CHECK(!inference_) << "Backward of a net in inference mode";
   CHECK_GE(end, 0);
   CHECK_LT(start, layers_.size());
   for (int i = start; i >= end; --i) {
@@ -774,6 +1022,8 @@ void Net<Dtype>::Update() {
     default:
       LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
     }
+    // the accumulated diff is no longer limited to the owner's sparse rows
+    params_[param_owners_[i]]->clear_diff_rows();
   }
   // Now, update the owned parameters.
   for (int i = 0; i < params_.size(); ++i) {
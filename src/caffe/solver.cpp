@@ -5,9 +5,13 @@
 #include <vector>
 #include <iostream> // for debug
 
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/solver.hpp"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/upgrade_proto.hpp"
@@ -403,7 +407,6 @@ void SGDSolver<Dtype>::ComputeUpdateValue() {
   if (this->param_.display() && this->iter_ % this->param_.display() == 0) {
     LOG(INFO) << "Iteration " << this->iter_ << ", lr = " << rate;
   }
-  Dtype momentum = this->param_.momentum();
   Dtype weight_decay = this->param_.weight_decay();
   string regularization_type = this->param_.regularization_type();
   switch (Caffe::mode()) {
@@ -412,87 +415,7 @@ void SGDSolver<Dtype>::ComputeUpdateValue() {
       // Compute the value to history, and then copy them to the blob's diff.
       Dtype local_rate = rate * net_params_lr[param_id];
       Dtype local_decay = weight_decay * net_params_weight_decay[param_id];
-      // LOG(INFO) << "local_rate:" << local_rate << " local_decay:" << local_decay;
-
-      if (local_decay) {
-        if (regularization_type == "L2") {
-          // add weight decay
-          caffe_axpy(net_params[param_id]->count(),
-              local_decay,
-              net_params[param_id]->cpu_data(),
-              net_params[param_id]->mutable_cpu_diff());
-        } else if (regularization_type == "L1") {
-          caffe_cpu_sign(net_params[param_id]->count(),
-              net_params[param_id]->cpu_data(),
-              temp_[param_id]->mutable_cpu_data());
-          caffe_axpy(net_params[param_id]->count(),
-              local_decay,
-              temp_[param_id]->cpu_data(),
-              net_params[param_id]->mutable_cpu_diff());
-        } else {
-          LOG(FATAL) << "Unknown regularization type: " << regularization_type;
-        }
-      }
-
-      // peeking the item feature diff
-      // if (param_id==3) {
-      //   LOG(INFO) << "local_rate:" << local_rate << " local_decay:" << local_decay;
-      //   std::cout << "net_params[param_id]->cpu_diff()" << std::endl;
-      //   for (int i = 1; i < 3; i++) {
-      //     for (int j = 0; j < 10; j++) {
-      //       std::cout << net_params[param_id]->cpu_diff()[i*10+j] << "\t";
-      //     }
-      //     std::cout << std::endl;
-      //   }
-      //   std::cout << std::endl;
-        // std::cout << "history_[param_id]->cpu_data()" << std::endl;
-        // for (int i = 1; i < 3; i++) {
-        //   for (int j = 0; j < 10; j++) {
-        //     std::cout << history_[param_id]->cpu_data()[i*10+j] << "\t";
-        //   }
-        //   std::cout << std::endl;
-        // }
-        // std::cout << std::endl;
-        // std::cout << "net_params[param_id]->cpu_data()" << std::endl;
-        // for (int i = 1; i < 3; i++) {
-        //   for (int j = 0; j < 10; j++) {
-        //     std::cout << net_params[param_id]->cpu_data()[i*10+j] << "\t";
-        //   }
-        //   std::cout << std::endl;
-        // }
-        // std::cout << std::endl;
-      // }
-
-      caffe_cpu_axpby(net_params[param_id]->count(), local_rate,
-                net_params[param_id]->cpu_diff(), momentum,
-                history_[param_id]->mutable_cpu_data());
-
-      // if (param_id==3) {
-      //   std::cout << "history_[param_id]->cpu_data()" << std::endl;
-      //   for (int i = 1; i < 3; i++) {
-      //     for (int j = 0; j < 10; j++) {
-      //       std::cout << history_[param_id]->cpu_data()[i*10+j] << "\t";
-      //     }
-      //     std::cout << std::endl;
-      //   }
-      //   std::cout << std::endl;
-      // }
-
-      // copy
-      caffe_copy(net_params[param_id]->count(),
-          history_[param_id]->cpu_data(),
-          net_params[param_id]->mutable_cpu_diff());
-
-      // if (param_id==3) {
-      //   std::cout << "net_params[param_id]->cpu_diff()" << std::endl;
-      //   for (int i = 1; i < 3; i++) {
-      //     for (int j = 0; j < 10; j++) {
-      //       std::cout << net_params[param_id]->cpu_diff()[i*10+j] << "\t";
-      //     }
-      //     std::cout << std::endl;
-      //   }
-      //   std::cout << std::endl;
-      // }
+      ComputeUpdateValueCPU(param_id, local_rate, local_decay);
     }
     break;
   case Caffe::GPU:
@@ -501,6 +424,7 @@ void SGDSolver<Dtype>::ComputeUpdateValue() {
       // Compute the value to history, and then copy them to the blob's diff.
       Dtype local_rate = rate * net_params_lr[param_id];
       Dtype local_decay = weight_decay * net_params_weight_decay[param_id];
+      const Dtype momentum = this->param_.momentum();
       // LOG(INFO) << "local_rate:" << local_rate << " local_decay:" << local_decay;
 
       if (local_decay) {
@@ -530,6 +454,8 @@ void SGDSolver<Dtype>::ComputeUpdateValue() {
       caffe_copy(net_params[param_id]->count(),
           history_[param_id]->gpu_data(),
           net_params[param_id]->mutable_gpu_diff());
+      // the dense update may have written outside of the sparse diff rows
+      net_params[param_id]->clear_diff_rows();
     }
 #else
     NO_GPU;
@@ -540,6 +466,66 @@ void SGDSolver<Dtype>::ComputeUpdateValue() {
   }
 }
 
+// Run the CPU update rule on the whole param, or only on the rows listed by
+// the param's diff_rows() when its diff is row-sparse. Rows that are skipped
+// keep their history untouched until the next time they show up, i.e.
+// momentum, weight decay and accumulated gradients are applied lazily.
+template <typename Dtype>
+void SGDSolver<Dtype>::ComputeUpdateValueCPU(const int param_id,
+    const Dtype local_rate, const Dtype local_decay) {
+  const Blob<Dtype>* net_param = this->net_->params()[param_id].get();
+  if (net_param->has_diff_rows()) {
+    const vector<int>& rows = net_param->diff_rows();
+    const int row_dim = net_param->width();
+    for (int i = 0; i < rows.size(); ++i) {
+      ComputeUpdateValueRange(param_id, rows[i] * row_dim, row_dim,
+          local_rate, local_decay);
+    }
+  } else {
+    ComputeUpdateValueRange(param_id, 0, net_param->count(),
+        local_rate, local_decay);
+  }
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::RegularizeRange(const int param_id, const int offset,
+    const int count, const Dtype local_decay) {
+  if (!local_decay) {
+    return;
+  }
+  Blob<Dtype>* net_param = this->net_->params()[param_id].get();
+  const string& regularization_type = this->param_.regularization_type();
+  if (regularization_type == "L2") {
+    // add weight decay
+    caffe_axpy(count, local_decay,
+        net_param->cpu_data() + offset,
+        net_param->mutable_cpu_diff() + offset);
+  } else if (regularization_type == "L1") {
+    caffe_cpu_sign(count, net_param->cpu_data() + offset,
+        temp_[param_id]->mutable_cpu_data() + offset);
+    caffe_axpy(count, local_decay,
+        temp_[param_id]->cpu_data() + offset,
+        net_param->mutable_cpu_diff() + offset);
+  } else {
+    LOG(FATAL) << "Unknown regularization type: " << regularization_type;
+  }
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::ComputeUpdateValueRange(const int param_id,
+    const int offset, const int count,
+    const Dtype local_rate, const Dtype local_decay) {
+  Blob<Dtype>* net_param = this->net_->params()[param_id].get();
+  const Dtype momentum = this->param_.momentum();
+  RegularizeRange(param_id, offset, count, local_decay);
+  caffe_cpu_axpby(count, local_rate,
+      net_param->cpu_diff() + offset, momentum,
+      history_[param_id]->mutable_cpu_data() + offset);
+  // copy
+  caffe_copy(count, history_[param_id]->cpu_data() + offset,
+      net_param->mutable_cpu_diff() + offset);
+}
+
 template <typename Dtype>
 void SGDSolver<Dtype>::SnapshotSolverState(SolverState* state) {
   state->clear_history();
@@ -570,54 +556,14 @@ void NesterovSolver<Dtype>::ComputeUpdateValue() {
   if (this->param_.display() && this->iter_ % this->param_.display() == 0) {
     LOG(INFO) << "Iteration " << this->iter_ << ", lr = " << rate;
   }
-  Dtype momentum = this->param_.momentum();
   Dtype weight_decay = this->param_.weight_decay();
   string regularization_type = this->param_.regularization_type();
   switch (Caffe::mode()) {
   case Caffe::CPU:
     for (int param_id = 0; param_id < net_params.size(); ++param_id) {
-      // save history momentum for stepping back
-      caffe_copy(net_params[param_id]->count(),
-          this->history_[param_id]->cpu_data(),
-          this->update_[param_id]->mutable_cpu_data());
-
       Dtype local_rate = rate * net_params_lr[param_id];
       Dtype local_decay = weight_decay * net_params_weight_decay[param_id];
-
-      if (local_decay) {
-        if (regularization_type == "L2") {
-          // add weight decay
-          caffe_axpy(net_params[param_id]->count(),
-              local_decay,
-              net_params[param_id]->cpu_data(),
-              net_params[param_id]->mutable_cpu_diff());
-        } else if (regularization_type == "L1") {
-          caffe_cpu_sign(net_params[param_id]->count(),
-              net_params[param_id]->cpu_data(),
-              this->temp_[param_id]->mutable_cpu_data());
-          caffe_axpy(net_params[param_id]->count(),
-              local_decay,
-              this->temp_[param_id]->cpu_data(),
-              net_params[param_id]->mutable_cpu_diff());
-        } else {
-          LOG(FATAL) << "Unknown regularization type: " << regularization_type;
-        }
-      }
-
-      // update history
-      caffe_cpu_axpby(net_params[param_id]->count(), local_rate,
-                net_params[param_id]->cpu_diff(), momentum,
-                this->history_[param_id]->mutable_cpu_data());
-
-      // compute udpate: step back then over step
-      caffe_cpu_axpby(net_params[param_id]->count(), Dtype(1) + momentum,
-          this->history_[param_id]->cpu_data(), -momentum,
-          this->update_[param_id]->mutable_cpu_data());
-
-      // copy
-      caffe_copy(net_params[param_id]->count(),
-          this->update_[param_id]->cpu_data(),
-          net_params[param_id]->mutable_cpu_diff());
+      this->ComputeUpdateValueCPU(param_id, local_rate, local_decay);
     }
     break;
   case Caffe::GPU:
@@ -630,6 +576,7 @@ void NesterovSolver<Dtype>::ComputeUpdateValue() {
 
       Dtype local_rate = rate * net_params_lr[param_id];
       Dtype local_decay = weight_decay * net_params_weight_decay[param_id];
+      const Dtype momentum = this->param_.momentum();
 
       if (local_decay) {
         if (regularization_type == "L2") {
@@ -665,6 +612,8 @@ void NesterovSolver<Dtype>::ComputeUpdateValue() {
       caffe_copy(net_params[param_id]->count(),
           this->update_[param_id]->gpu_data(),
           net_params[param_id]->mutable_gpu_diff());
+      // the dense update may have written outside of the sparse diff rows
+      net_params[param_id]->clear_diff_rows();
     }
 #else
     NO_GPU;
@@ -675,6 +624,31 @@ void NesterovSolver<Dtype>::ComputeUpdateValue() {
   }
 }
 
+template <typename Dtype>
+void NesterovSolver<Dtype>::ComputeUpdateValueRange(const int param_id,
+    const int offset, const int count,
+    const Dtype local_rate, const Dtype local_decay) {
+  Blob<Dtype>* net_param = this->net_->params()[param_id].get();
+  const Dtype momentum = this->param_.momentum();
+  Dtype* update = this->update_[param_id]->mutable_cpu_data() + offset;
+  // save history momentum for stepping back
+  caffe_copy(count, this->history_[param_id]->cpu_data() + offset, update);
+
+  this->RegularizeRange(param_id, offset, count, local_decay);
+
+  // update history
+  caffe_cpu_axpby(count, local_rate,
+      net_param->cpu_diff() + offset, momentum,
+      this->history_[param_id]->mutable_cpu_data() + offset);
+
+  // compute udpate: step back then over step
+  caffe_cpu_axpby(count, Dtype(1) + momentum,
+      this->history_[param_id]->cpu_data() + offset, -momentum, update);
+
+  // copy
+  caffe_copy(count, update, net_param->mutable_cpu_diff() + offset);
+}
+
 template <typename Dtype>
 void AdaGradSolver<Dtype>::ComputeUpdateValue() {
   vector<shared_ptr<Blob<Dtype> > >& net_params = this->net_->params();
@@ -682,7 +656,6 @@ void AdaGradSolver<Dtype>::ComputeUpdateValue() {
   vector<float>& net_params_weight_decay = this->net_->params_weight_decay();
   // get the learning rate
   Dtype rate = this->GetLearningRate();
-  Dtype delta = this->param_.delta();
   if (this->param_.display() && this->iter_ % this->param_.display() == 0) {
     LOG(INFO) << "Iteration " << this->iter_ << ", lr = " << rate;
   }
@@ -693,55 +666,7 @@ void AdaGradSolver<Dtype>::ComputeUpdateValue() {
     for (int param_id = 0; param_id < net_params.size(); ++param_id) {
       Dtype local_rate = rate * net_params_lr[param_id];
       Dtype local_decay = weight_decay * net_params_weight_decay[param_id];
-
-      if (local_decay) {
-        if (regularization_type == "L2") {
-          // add weight decay
-          caffe_axpy(net_params[param_id]->count(),
-              local_decay,
-              net_params[param_id]->cpu_data(),
-              net_params[param_id]->mutable_cpu_diff());
-        } else if (regularization_type == "L1") {
-          caffe_cpu_sign(net_params[param_id]->count(),
-              net_params[param_id]->cpu_data(),
-              this->temp_[param_id]->mutable_cpu_data());
-          caffe_axpy(net_params[param_id]->count(),
-              local_decay,
-              this->temp_[param_id]->cpu_data(),
-              net_params[param_id]->mutable_cpu_diff());
-        } else {
-          LOG(FATAL) << "Unknown regularization type: " << regularization_type;
-        }
-      }
-
-      // compute square of gradient in update
-      caffe_powx(net_params[param_id]->count(),
-          net_params[param_id]->cpu_diff(), Dtype(2),
-          this->update_[param_id]->mutable_cpu_data());
-
-      // update history
-      caffe_add(net_params[param_id]->count(),
-          this->update_[param_id]->cpu_data(),
-          this->history_[param_id]->cpu_data(),
-          this->history_[param_id]->mutable_cpu_data());
-
-      // prepare update
-      caffe_powx(net_params[param_id]->count(),
-                this->history_[param_id]->cpu_data(), Dtype(0.5),
-                this->update_[param_id]->mutable_cpu_data());
-
-      caffe_add_scalar(net_params[param_id]->count(),
-                delta, this->update_[param_id]->mutable_cpu_data());
-
-      caffe_div(net_params[param_id]->count(),
-                net_params[param_id]->cpu_diff(),
-                this->update_[param_id]->cpu_data(),
-                this->update_[param_id]->mutable_cpu_data());
-
-      // scale and copy
-      caffe_cpu_axpby(net_params[param_id]->count(), local_rate,
-          this->update_[param_id]->cpu_data(), Dtype(0),
-          net_params[param_id]->mutable_cpu_diff());
+      this->ComputeUpdateValueCPU(param_id, local_rate, local_decay);
     }
     break;
   case Caffe::GPU:
@@ -749,6 +674,7 @@ void AdaGradSolver<Dtype>::ComputeUpdateValue() {
     for (int param_id = 0; param_id < net_params.size(); ++param_id) {
       Dtype local_rate = rate * net_params_lr[param_id];
       Dtype local_decay = weight_decay * net_params_weight_decay[param_id];
+      const Dtype delta = this->param_.delta();
 
       if (local_decay) {
         if (regularization_type == "L2") {
@@ -798,6 +724,8 @@ void AdaGradSolver<Dtype>::ComputeUpdateValue() {
       caffe_gpu_axpby(net_params[param_id]->count(), local_rate,
           this->update_[param_id]->gpu_data(), Dtype(0),
           net_params[param_id]->mutable_gpu_diff());
+      // the dense update may have written outside of the sparse diff rows
+      net_params[param_id]->clear_diff_rows();
     }
 #else
     NO_GPU;
@@ -808,9 +736,190 @@ void AdaGradSolver<Dtype>::ComputeUpdateValue() {
   }
 }
 
+template <typename Dtype>
+void AdaGradSolver<Dtype>::ComputeUpdateValueRange(const int param_id,
+    const int offset, const int count,
+    const Dtype local_rate, const Dtype local_decay) {
+  Blob<Dtype>* net_param = this->net_->params()[param_id].get();
+  const Dtype delta = this->param_.delta();
+  Dtype* update = this->update_[param_id]->mutable_cpu_data() + offset;
+  Dtype* history = this->history_[param_id]->mutable_cpu_data() + offset;
+
+  this->RegularizeRange(param_id, offset, count, local_decay);
+
+  // compute square of gradient in update
+  caffe_powx(count, net_param->cpu_diff() + offset, Dtype(2), update);
+
+  // update history
+  caffe_add(count, update, history, history);
+
+  // prepare update
+  caffe_powx(count, history, Dtype(0.5), update);
+
+  caffe_add_scalar(count, delta, update);
+
+  caffe_div(count, net_param->cpu_diff() + offset, update, update);
+
+  // scale and copy
+  caffe_cpu_axpby(count, local_rate, update, Dtype(0),
+      net_param->mutable_cpu_diff() + offset);
+}
+
+template <typename Dtype>
+void HogwildSolver<Dtype>::Solve(const char* resume_file) {
+  CHECK(Caffe::mode() == Caffe::CPU) << "HogwildSolver only runs on the CPU.";
+  const int num_threads = this->param_.num_threads();
+  CHECK_GE(num_threads, 1);
+  Caffe::set_phase(Caffe::TRAIN);
+  LOG(INFO) << "Solving " << this->net_->name() << " with " << num_threads
+            << " threads";
+  this->PreSolve();
+
+  this->iter_ = 0;
+  if (resume_file) {
+    LOG(INFO) << "Restoring previous solver status from " << resume_file;
+    this->Restore(resume_file);
+  }
+  const int start_iter = this->iter_;
+
+  // The other threads only train: their replicas get no test nets, never
+  // display or snapshot, and keep the global RNG state as it is so that their
+  // data layers skip to different positions.
+  SolverParameter worker_param(this->param_);
+  worker_param.clear_test_net_param();
+  worker_param.clear_test_net();
+  worker_param.clear_test_iter();
+  worker_param.clear_test_state();
+  worker_param.clear_display();
+  worker_param.clear_snapshot();
+  worker_param.clear_random_seed();
+  worker_param.set_snapshot_after_train(false);
+  workers_.clear();
+  for (int i = 1; i < num_threads; ++i) {
+    workers_.push_back(shared_ptr<HogwildSolver<Dtype> >(
+        new HogwildSolver<Dtype>(worker_param)));
+    workers_.back()->net()->ShareTrainedLayersWith(this->net_.get());
+    workers_.back()->PreSolve();
+  }
+
+  Dtype display_loss = 0;
+  int64_t display_rating = 0;
+  int display_iter = 0;
+  float display_seconds = 0;
+  Timer timer;
+  while (this->iter_ < this->param_.max_iter()) {
+    if (this->param_.snapshot() && this->iter_ > start_iter &&
+        this->iter_ % this->param_.snapshot() == 0) {
+      this->Snapshot();
+    }
+    if (this->param_.test_interval() &&
+        this->iter_ % this->param_.test_interval() == 0 &&
+        (this->iter_ > 0 || this->param_.test_initialization())) {
+      this->TestAll();
+    }
+
+    // Thread k runs iterations iter_ + k, iter_ + k + num_threads, ... until
+    // the next stop.
+    const int begin = this->iter_;
+    const int end = NextStop();
+    timer.Start();
+    boost::thread_group threads;
+    for (int i = 0; i < workers_.size(); ++i) {
+      threads.create_thread(boost::bind(&HogwildSolver<Dtype>::RunWorker,
+          workers_[i].get(), begin + i + 1, end, num_threads,
+          caffe_rng_rand()));
+    }
+    RunIterations(begin, end, num_threads);
+    threads.join_all();
+    display_seconds += timer.Seconds();
+    display_loss += loss_sum_;
+    display_rating += num_rating_;
+    for (int i = 0; i < workers_.size(); ++i) {
+      display_loss += workers_[i]->loss_sum_;
+      display_rating += workers_[i]->num_rating_;
+    }
+    display_iter += end - begin;
+    this->iter_ = end;
+
+    if (this->param_.display() && this->iter_ % this->param_.display() == 0) {
+      LOG(INFO) << "Iteration " << this->iter_ << ", loss = "
+                << display_loss / display_iter;
+      if (display_rating) {
+        LOG(INFO) << "    " << display_rating / display_seconds
+                  << " ratings/s";
+      } else {
+        LOG(INFO) << "    " << display_iter / display_seconds
+                  << " iterations/s";
+      }
+      display_loss = 0;
+      display_rating = 0;
+      display_iter = 0;
+      display_seconds = 0;
+    }
+  }
+  workers_.clear();
+  if (this->param_.snapshot_after_train()) { this->Snapshot(); }
+  if (this->param_.display() && this->iter_ % this->param_.display() == 0) {
+    vector<Blob<Dtype>*> bottom_vec;
+    Dtype loss;
+    this->net_->Forward(bottom_vec, &loss);
+    LOG(INFO) << "Iteration " << this->iter_ << ", loss = " << loss;
+  }
+  if (this->param_.test_interval() &&
+      this->iter_ % this->param_.test_interval() == 0) {
+    this->TestAll();
+  }
+  LOG(INFO) << "Optimization Done.";
+}
+
+template <typename Dtype>
+int HogwildSolver<Dtype>::NextStop() const {
+  int stop = this->param_.max_iter();
+  const int intervals[] = { this->param_.display(),
+      this->param_.test_interval(), this->param_.snapshot() };
+  for (int i = 0; i < 3; ++i) {
+    if (intervals[i] > 0) {
+      stop = std::min(stop, (this->iter_ / intervals[i] + 1) * intervals[i]);
+    }
+  }
+  return stop;
+}
+
+template <typename Dtype>
+void HogwildSolver<Dtype>::RunWorker(const int begin, const int end,
+    const int stride, const unsigned int rng_seed) {
+  // dropout, fillers and the like must not draw from the main thread's
+  // generator at the same time
+  Caffe::set_thread_random_seed(rng_seed);
+  RunIterations(begin, end, stride);
+}
+
+template <typename Dtype>
+void HogwildSolver<Dtype>::RunIterations(const int begin, const int end,
+    const int stride) {
+  const vector<shared_ptr<Layer<Dtype> > >& layers = this->net_->layers();
+  vector<Blob<Dtype>*> bottom_vec;
+  loss_sum_ = 0;
+  num_rating_ = 0;
+  for (int iter = begin; iter < end; iter += stride) {
+    // the learning rate follows the global iteration count
+    this->iter_ = iter;
+    loss_sum_ += this->net_->ForwardBackward(bottom_vec);
+    for (int i = 0; i < layers.size(); ++i) {
+      if (layers[i]->layer_param().type() ==
+          LayerParameter_LayerType_MATRIX_FACT) {
+        num_rating_ += this->net_->top_vecs()[i][1]->cpu_data()[0];
+      }
+    }
+    this->ComputeUpdateValue();
+    this->net_->Update();
+  }
+}
+
 INSTANTIATE_CLASS(Solver);
 INSTANTIATE_CLASS(SGDSolver);
 INSTANTIATE_CLASS(NesterovSolver);
 INSTANTIATE_CLASS(AdaGradSolver);
+INSTANTIATE_CLASS(HogwildSolver);
 
 }  // namespace caffe
@@ -0,0 +1,142 @@
+#include <zlib.h>
+
+#include <cstring>
+#include <fstream>  // NOLINT(readability/streams)
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/async_writer.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class AsyncWriterTest : public ::testing::Test {
+ protected:
+  AsyncWriterTest() : num_(7), dim_(3) {}
+
+  virtual void SetUp() {
+    MakeTempFilename(&filename_);
+    for (int i = 0; i < num_; ++i) {
+      id_.push_back(1000000 + i);
+      for (int j = 0; j < dim_; ++j) {
+        value_.push_back(Dtype(i - 3.25) / (j + 3));
+      }
+    }
+  }
+
+  // Writes a line and the rows num_ times, as the dump layers would.
+  void Write(const bool binary, const bool compress, const int block_size) {
+    AsyncWriter writer(filename_, binary, compress, block_size);
+    for (int iter = 0; iter < num_; ++iter) {
+      writer.WriteLine("forward");
+      writer.BeginRows(num_, ',', false);
+      writer.AddColumns(&id_[0], 1);
+      writer.AddColumns(&value_[0], dim_);
+    }
+  }
+
+  // The same output through an std::ofstream.
+  string Expected() {
+    std::ostringstream out;
+    for (int iter = 0; iter < num_; ++iter) {
+      out << "forward" << std::endl;
+      for (int i = 0; i < num_; ++i) {
+        out << id_[i];
+        for (int j = 0; j < dim_; ++j) {
+          out << "," << value_[i * dim_ + j];
+        }
+        out << std::endl;
+      }
+    }
+    return out.str();
+  }
+
+  string ReadFile() {
+    std::ifstream in(filename_.c_str(), std::ios::in | std::ios::binary);
+    std::ostringstream content;
+    content << in.rdbuf();
+    return content.str();
+  }
+
+  int num_, dim_;
+  string filename_;
+  vector<int> id_;
+  vector<Dtype> value_;
+};
+
+TYPED_TEST_CASE(AsyncWriterTest, TestDtypes);
+
+TYPED_TEST(AsyncWriterTest, TestText) {
+  // small blocks, so the rows go through many hand offs
+  this->Write(false, false, 64);
+  EXPECT_EQ(this->Expected(), this->ReadFile());
+}
+
+TYPED_TEST(AsyncWriterTest, TestAppend) {
+  this->Write(false, false, 1 << 20);
+  this->Write(false, false, 1 << 20);
+  EXPECT_EQ(this->Expected() + this->Expected(), this->ReadFile());
+}
+
+TYPED_TEST(AsyncWriterTest, TestCompress) {
+  this->Write(false, true, 64);
+  gzFile file = gzopen(this->filename_.c_str(), "rb");
+  ASSERT_TRUE(file != NULL);
+  string content;
+  char buffer[256];
+  int length;
+  while ((length = gzread(file, buffer, sizeof(buffer))) > 0) {
+    content.append(buffer, length);
+  }
+  gzclose(file);
+  EXPECT_EQ(this->Expected(), content);
+}
+
+TYPED_TEST(AsyncWriterTest, TestBinary) {
+  this->Write(true, false, 64);
+  const string content = this->ReadFile();
+  const char* data = content.data();
+  size_t offset = 0;
+  int num_entry = 0;
+  while (offset < content.size()) {
+    AsyncWriterEntry entry;
+    memcpy(&entry, data + offset, sizeof(entry));
+    offset += sizeof(entry);
+    if (num_entry++ % 2 == 0) {
+      ASSERT_EQ(AsyncWriterEntry::LINE, entry.kind);
+      EXPECT_EQ("forward", string(data + offset, entry.num));
+      offset += (entry.num + 7) / 8 * 8;
+      continue;
+    }
+    ASSERT_EQ(AsyncWriterEntry::ROWS, entry.kind);
+    ASSERT_EQ(this->num_, entry.num);
+    ASSERT_EQ(2, entry.num_column);
+    AsyncWriterColumn column;
+    memcpy(&column, data + offset, sizeof(column));
+    offset += sizeof(column);
+    EXPECT_EQ(AsyncWriterColumn::INT32, column.type);
+    EXPECT_EQ(1, column.width);
+    EXPECT_EQ(0, memcmp(data + offset, &this->id_[0],
+        this->num_ * sizeof(int)));
+    offset += (this->num_ * sizeof(int) + 7) / 8 * 8;
+    memcpy(&column, data + offset, sizeof(column));
+    offset += sizeof(column);
+    EXPECT_EQ(sizeof(TypeParam) == sizeof(float) ?
+        AsyncWriterColumn::FLOAT : AsyncWriterColumn::DOUBLE, column.type);
+    EXPECT_EQ(this->dim_, column.width);
+    const size_t size = this->num_ * this->dim_ * sizeof(TypeParam);
+    EXPECT_EQ(0, memcmp(data + offset, &this->value_[0], size));
+    offset += (size + 7) / 8 * 8;
+  }
+  EXPECT_EQ(content.size(), offset);
+  EXPECT_EQ(this->num_ * 2, num_entry);
+}
+
+}  // namespace caffe
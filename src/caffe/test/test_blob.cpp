@@ -54,4 +54,55 @@ TYPED_TEST(BlobSimpleTest, TestReshape) {
   EXPECT_EQ(this->blob_->count(), 120);
 }
 
+TYPED_TEST(BlobSimpleTest, TestIndex) {
+  // ids past 2^24 stay exact in the index, and ShareData shares it
+  int* index = this->blob_preshaped_->mutable_cpu_index();
+  for (int i = 0; i < this->blob_preshaped_->count(); ++i) {
+    index[i] = (1 << 24) + 1 + i;
+  }
+  this->blob_->Reshape(2, 3, 4, 5);
+  this->blob_->ShareData(*this->blob_preshaped_);
+  EXPECT_EQ(this->blob_->cpu_index(), this->blob_preshaped_->cpu_index());
+  for (int i = 0; i < this->blob_->count(); ++i) {
+    EXPECT_EQ((1 << 24) + 1 + i, this->blob_->cpu_index()[i]);
+  }
+}
+
+TYPED_TEST(BlobSimpleTest, TestCopyIndex) {
+  // the index goes with the data through CopyFrom and the proto
+  int* index = this->blob_preshaped_->mutable_cpu_index();
+  for (int i = 0; i < this->blob_preshaped_->count(); ++i) {
+    index[i] = (1 << 24) + 1 + i;
+  }
+  this->blob_->CopyFrom(*this->blob_preshaped_, false, true);
+  for (int i = 0; i < this->blob_->count(); ++i) {
+    EXPECT_EQ((1 << 24) + 1 + i, this->blob_->cpu_index()[i]);
+  }
+  BlobProto proto;
+  this->blob_preshaped_->ToProto(&proto);
+  EXPECT_EQ(this->blob_preshaped_->count(), proto.index_size());
+  Blob<TypeParam> blob;
+  blob.FromProto(proto);
+  for (int i = 0; i < blob.count(); ++i) {
+    EXPECT_EQ((1 << 24) + 1 + i, blob.cpu_index()[i]);
+  }
+  // a blob whose index was never written serializes none
+  Blob<TypeParam> plain(1, 2, 3, 4);
+  plain.ToProto(&proto);
+  EXPECT_EQ(0, proto.index_size());
+}
+
+TYPED_TEST(BlobSimpleTest, TestSwap) {
+  this->blob_->Reshape(1, 2, 1, 1);
+  const TypeParam* data = this->blob_->cpu_data();
+  const TypeParam* preshaped_data = this->blob_preshaped_->cpu_data();
+  this->blob_->Swap(*this->blob_preshaped_);
+  EXPECT_EQ(2, this->blob_->num());
+  EXPECT_EQ(120, this->blob_->count());
+  EXPECT_EQ(preshaped_data, this->blob_->cpu_data());
+  EXPECT_EQ(1, this->blob_preshaped_->num());
+  EXPECT_EQ(2, this->blob_preshaped_->count());
+  EXPECT_EQ(data, this->blob_preshaped_->cpu_data());
+}
+
 }  // namespace caffe
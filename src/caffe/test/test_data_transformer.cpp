@@ -0,0 +1,120 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/data_transformer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class DataTransformerTest : public ::testing::Test {
+ protected:
+  // the crop is not a multiple of the vector width, so rows have a tail
+  DataTransformerTest()
+      : channels_(3), height_(24), width_(37), crop_size_(21) {}
+
+  virtual void SetUp() {
+    Caffe::set_phase(Caffe::TEST);
+    const int size = channels_ * height_ * width_;
+    data_.resize(size);
+    mean_.resize(size);
+    for (int i = 0; i < size; ++i) {
+      data_[i] = static_cast<uint8_t>(i * 7 % 256);
+      mean_[i] = i % 11 * Dtype(0.5);
+    }
+  }
+  virtual void TearDown() { Caffe::set_phase(Caffe::TRAIN); }
+
+  // The element the crop at (h_off, w_off) puts at (c, h, w) of the output.
+  Dtype Expected(const Dtype scale, const int h_off, const int w_off,
+      const bool mirror, const int c, const int h, const int w) {
+    const int src_w = mirror ? crop_size_ - 1 - w : w;
+    const int index = (c * height_ + h + h_off) * width_ + src_w + w_off;
+    return (data_[index] - mean_[index]) * scale;
+  }
+
+  // Checks item batch_item_id of output against the centered crop.
+  bool IsCenterCrop(const Dtype* output, const int batch_item_id,
+      const Dtype scale, const bool mirror) {
+    const int h_off = (height_ - crop_size_) / 2;
+    const int w_off = (width_ - crop_size_) / 2;
+    for (int c = 0; c < channels_; ++c) {
+      for (int h = 0; h < crop_size_; ++h) {
+        for (int w = 0; w < crop_size_; ++w) {
+          const int index = ((batch_item_id * channels_ + c) * crop_size_ + h)
+              * crop_size_ + w;
+          if (output[index] != Expected(scale, h_off, w_off, mirror, c, h, w)) {
+            return false;
+          }
+        }
+      }
+    }
+    return true;
+  }
+
+  int channels_, height_, width_, crop_size_;
+  vector<uint8_t> data_;
+  vector<Dtype> mean_;
+};
+
+TYPED_TEST_CASE(DataTransformerTest, TestDtypes);
+
+TYPED_TEST(DataTransformerTest, TestNoCrop) {
+  TransformationParameter param;
+  param.set_scale(0.25);
+  DataTransformer<TypeParam> transformer(param);
+  transformer.InitRand();
+  const int size = this->channels_ * this->height_ * this->width_;
+  vector<TypeParam> output(2 * size);
+  transformer.Transform(1, &this->data_[0], this->channels_, this->height_,
+      this->width_, &this->mean_[0], &output[0]);
+  for (int i = 0; i < size; ++i) {
+    EXPECT_EQ((this->data_[i] - this->mean_[i]) * TypeParam(0.25),
+        output[size + i]);
+  }
+}
+
+TYPED_TEST(DataTransformerTest, TestCenterCrop) {
+  TransformationParameter param;
+  param.set_scale(0.5);
+  param.set_crop_size(this->crop_size_);
+  DataTransformer<TypeParam> transformer(param);
+  transformer.InitRand();
+  const int crop_count = this->channels_ * this->crop_size_ * this->crop_size_;
+  vector<TypeParam> output(2 * crop_count);
+  transformer.Transform(1, &this->data_[0], this->channels_, this->height_,
+      this->width_, &this->mean_[0], &output[0]);
+  EXPECT_TRUE(this->IsCenterCrop(&output[0], 1, TypeParam(0.5), false));
+}
+
+TYPED_TEST(DataTransformerTest, TestMirror) {
+  Caffe::set_phase(Caffe::TRAIN);
+  Caffe::set_random_seed(1701);
+  TransformationParameter param;
+  param.set_crop_size(this->crop_size_);
+  param.set_mirror(true);
+  param.set_random_crop(false);
+  DataTransformer<TypeParam> transformer(param);
+  transformer.InitRand();
+  const int crop_count = this->channels_ * this->crop_size_ * this->crop_size_;
+  vector<TypeParam> output(crop_count);
+  int num_mirrored = 0;
+  const int num_iter = 20;
+  for (int iter = 0; iter < num_iter; ++iter) {
+    transformer.Transform(0, &this->data_[0], this->channels_, this->height_,
+        this->width_, &this->mean_[0], &output[0]);
+    if (this->IsCenterCrop(&output[0], 0, TypeParam(1), true)) {
+      ++num_mirrored;
+    } else {
+      EXPECT_TRUE(this->IsCenterCrop(&output[0], 0, TypeParam(1), false));
+    }
+  }
+  EXPECT_GT(num_mirrored, 0);
+  EXPECT_LT(num_mirrored, num_iter);
+}
+
+}  // namespace caffe
@@ -0,0 +1,110 @@
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/data_transformer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/datum_view.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class DatumViewTest : public ::testing::Test {
+ protected:
+  DatumViewTest() : channels_(3), height_(4), width_(5) {}
+
+  void FillDatum(Datum* datum) {
+    datum->set_channels(channels_);
+    datum->set_height(height_);
+    datum->set_width(width_);
+    datum->set_label(-7);
+    string* data = datum->mutable_data();
+    for (int i = 0; i < channels_ * height_ * width_; ++i) {
+      data->push_back(static_cast<char>(i * 13));
+    }
+  }
+
+  int channels_, height_, width_;
+};
+
+TEST_F(DatumViewTest, TestDatum) {
+  Datum datum;
+  FillDatum(&datum);
+  string serialized;
+  datum.SerializeToString(&serialized);
+  DatumView view;
+  ASSERT_TRUE(view.Parse(serialized.data(), serialized.size()));
+  EXPECT_EQ(channels_, view.channels);
+  EXPECT_EQ(height_, view.height);
+  EXPECT_EQ(width_, view.width);
+  EXPECT_EQ(-7, view.label);
+  ASSERT_EQ(datum.data().size(), view.data_size);
+  // the pixels are read in place
+  EXPECT_GE(reinterpret_cast<const char*>(view.data), serialized.data());
+  EXPECT_LT(reinterpret_cast<const char*>(view.data),
+      serialized.data() + serialized.size());
+  EXPECT_EQ(datum.data(), string(reinterpret_cast<const char*>(view.data),
+      view.data_size));
+}
+
+TEST_F(DatumViewTest, TestFloatData) {
+  Datum datum;
+  datum.set_channels(1);
+  datum.set_height(1);
+  datum.set_width(3);
+  datum.set_label(2);
+  for (int i = 0; i < 3; ++i) {
+    datum.add_float_data(i + 0.5);
+  }
+  string serialized;
+  datum.SerializeToString(&serialized);
+  DatumView view;
+  ASSERT_TRUE(view.Parse(serialized.data(), serialized.size()));
+  EXPECT_EQ(2, view.label);
+  EXPECT_TRUE(view.data == NULL);
+  // the transformer falls back to the parsed Datum
+  TransformationParameter param;
+  DataTransformer<float> transformer(param);
+  const float mean[3] = {0, 0, 0};
+  float transformed[3];
+  transformer.Transform(0, view, mean, transformed);
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(i + 0.5, transformed[i]);
+  }
+}
+
+TEST_F(DatumViewTest, TestDatumInteraction) {
+  DatumInteraction record;
+  FillDatum(record.mutable_datum());
+  for (int i = 0; i < 4; ++i) {
+    record.add_itemid(i - 2);
+    record.add_userid((1 << 30) + i);
+    record.add_rating(i / 4.);
+  }
+  string serialized;
+  record.SerializeToString(&serialized);
+  DatumInteractionView view;
+  // twice, the vectors are reused
+  for (int pass = 0; pass < 2; ++pass) {
+    ASSERT_TRUE(view.Parse(serialized.data(), serialized.size()));
+    EXPECT_EQ(channels_, view.datum.channels);
+    EXPECT_EQ(-7, view.datum.label);
+    EXPECT_EQ(record.datum().data(), string(reinterpret_cast<const char*>(
+        view.datum.data), view.datum.data_size));
+    ASSERT_EQ(4, view.itemid.size());
+    ASSERT_EQ(4, view.userid.size());
+    ASSERT_EQ(4, view.rating.size());
+    for (int i = 0; i < 4; ++i) {
+      EXPECT_EQ(record.itemid(i), view.itemid[i]);
+      EXPECT_EQ(record.userid(i), view.userid[i]);
+      EXPECT_EQ(record.rating(i), view.rating[i]);
+    }
+  }
+  // a truncated record
+  EXPECT_FALSE(view.Parse(serialized.data(), serialized.size() - 3));
+}
+
+}  // namespace caffe
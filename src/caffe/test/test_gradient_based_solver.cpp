@@ -303,6 +303,142 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     // Check that the solver's solution matches ours.
     CheckLeastSquaresUpdate(updated_params);
   }
+
+  // Train a MATRIX_FACT layer on a fixed batch that rates items 0 and 2 by
+  // users 1, 3 and 4 out of kNumUser x kNumItem, and copy its user and item
+  // factors before and after training into initial_params and params.
+  void RunMatrixFactorizeSolver(const bool sparse_grad,
+      const Dtype learning_rate, const Dtype weight_decay,
+      const Dtype momentum, const int num_iters,
+      vector<shared_ptr<Blob<Dtype> > >* initial_params,
+      vector<shared_ptr<Blob<Dtype> > >* params) {
+    ostringstream proto;
+    proto <<
+       "max_iter: " << num_iters << " "
+       "base_lr: " << learning_rate << " "
+       "lr_policy: 'fixed' "
+       "net_param { "
+       "  name: 'TestNetwork' "
+       "  input: 'item' "
+       "  input_dim: 2 "
+       "  input_dim: " << kNumLatent << " "
+       "  input_dim: 1 "
+       "  input_dim: 1 "
+       "  input: 'itact' "
+       "  input_dim: 4 "
+       "  input_dim: 2 "
+       "  input_dim: 1 "
+       "  input_dim: 1 "
+       "  input: 'count' "
+       "  input_dim: 2 "
+       "  input_dim: 2 "
+       "  input_dim: 1 "
+       "  input_dim: 1 "
+       "  input: 'rating' "
+       "  input_dim: 4 "
+       "  input_dim: 1 "
+       "  input_dim: 1 "
+       "  input_dim: 1 "
+       "  layers: { "
+       "    name: 'mf' "
+       "    type: MATRIX_FACT "
+       "    matrix_fact_param { "
+       "      num_user: " << kNumUser << " "
+       "      num_item: " << kNumItem << " "
+       "      itact_size: 3 "
+       "      sparse_grad: " << (sparse_grad ? "true" : "false") << " "
+       "      weight_filler { "
+       "        type: 'gaussian' "
+       "        std: 1.0 "
+       "      } "
+       "    } "
+       "    bottom: 'item' "
+       "    bottom: 'itact' "
+       "    bottom: 'count' "
+       "    top: 'pred' "
+       "    top: 'num_rating' "
+       "  } "
+       "  layers: { "
+       "    name: 'loss' "
+       "    type: EUCLIDEAN_LOSS "
+       "    bottom: 'pred' "
+       "    bottom: 'rating' "
+       "  } "
+       "} ";
+    if (weight_decay != 0) {
+      proto << "weight_decay: " << weight_decay << " ";
+    }
+    if (momentum != 0) {
+      proto << "momentum: " << momentum << " ";
+    }
+    Caffe::set_random_seed(this->seed_);
+    this->InitSolverFromProtoString(proto.str());
+    const vector<Blob<Dtype>*>& input_blobs =
+        this->solver_->net()->input_blobs();
+    for (int i = 0; i < input_blobs[0]->count(); ++i) {
+      input_blobs[0]->mutable_cpu_data()[i] = Dtype(i % 3) - 1;
+    }
+    // item 0 is rated by users 1 and 3, item 2 by users 3 and 4
+    const int itact[] = {0, 1, 0, 3, 2, 3, 2, 4};
+    const int count[] = {0, 2, 2, 2};
+    std::copy(itact, itact + 8, input_blobs[1]->mutable_cpu_index());
+    std::copy(count, count + 4, input_blobs[2]->mutable_cpu_index());
+    for (int i = 0; i < input_blobs[3]->count(); ++i) {
+      input_blobs[3]->mutable_cpu_data()[i] = Dtype(i + 1) / 2;
+    }
+    CopyMatrixFactorizeParams(initial_params);
+    this->solver_->Solve();
+    CopyMatrixFactorizeParams(params);
+  }
+
+  void CopyMatrixFactorizeParams(vector<shared_ptr<Blob<Dtype> > >* params) {
+    const vector<shared_ptr<Blob<Dtype> > >& net_params =
+        this->solver_->net()->params();
+    params->resize(2);
+    for (int i = 0; i < 2; ++i) {
+      (*params)[i].reset(new Blob<Dtype>());
+      (*params)[i]->CopyFrom(*net_params[i], false, true);
+    }
+  }
+
+  // The lazy update of a row-sparse diff has to match the dense update on
+  // the rows the batch touches, and leave every other row alone.
+  void TestMatrixFactorizeSparseUpdate(const Dtype learning_rate,
+      const Dtype weight_decay, const Dtype momentum, const int num_iters) {
+    // the GPU solvers always run the dense update
+    if (Caffe::mode() != Caffe::CPU) {
+      LOG(ERROR) << "Skipping test: the sparse update is CPU only.";
+      return;
+    }
+    vector<shared_ptr<Blob<Dtype> > > initial_params, dense_params;
+    RunMatrixFactorizeSolver(false, learning_rate, weight_decay, momentum,
+        num_iters, &initial_params, &dense_params);
+    vector<shared_ptr<Blob<Dtype> > > sparse_params;
+    RunMatrixFactorizeSolver(true, learning_rate, weight_decay, momentum,
+        num_iters, &initial_params, &sparse_params);
+    const int num_rows[] = {kNumUser, kNumItem};
+    for (int i = 0; i < 2; ++i) {
+      for (int row = 0; row < num_rows[i]; ++row) {
+        const bool touched = (i == 0) ?
+            (row == 1 || row == 3 || row == 4) : (row == 0 || row == 2);
+        const Blob<Dtype>& expected =
+            touched ? *dense_params[i] : *initial_params[i];
+        for (int j = row * kNumLatent; j < (row + 1) * kNumLatent; ++j) {
+          EXPECT_NEAR(expected.cpu_data()[j], sparse_params[i]->cpu_data()[j],
+              1e-5) << "param " << i << ", row " << row;
+        }
+        if (touched) {
+          // and the update did move the row
+          EXPECT_NE(initial_params[i]->cpu_data()[row * kNumLatent],
+              sparse_params[i]->cpu_data()[row * kNumLatent]);
+        }
+      }
+    }
+  }
+
+  static const int kNumUser = 6;
+  static const int kNumItem = 4;
+  static const int kNumLatent = 3;
 };
 
 
@@ -373,6 +509,16 @@ TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverything) {
   }
 }
 
+TYPED_TEST(SGDSolverTest, TestSparseUpdateMatchesDense) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.1;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 3;
+  this->TestMatrixFactorizeSparseUpdate(kLearningRate, kWeightDecay, kMomentum,
+      kNumIters);
+}
+
 
 template <typename TypeParam>
 class AdaGradSolverTest : public GradientBasedSolverTest<TypeParam> {
@@ -418,6 +564,16 @@ TYPED_TEST(AdaGradSolverTest, TestAdaGradLeastSquaresUpdateWithEverything) {
   }
 }
 
+TYPED_TEST(AdaGradSolverTest, TestAdaGradSparseUpdateMatchesDense) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.1;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.0;
+  const int kNumIters = 3;
+  this->TestMatrixFactorizeSparseUpdate(kLearningRate, kWeightDecay, kMomentum,
+      kNumIters);
+}
+
 
 template <typename TypeParam>
 class NesterovSolverTest : public GradientBasedSolverTest<TypeParam> {
@@ -485,4 +641,141 @@ TYPED_TEST(NesterovSolverTest, TestNesterovLeastSquaresUpdateWithEverything) {
   }
 }
 
+TYPED_TEST(NesterovSolverTest, TestNesterovSparseUpdateMatchesDense) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.1;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 3;
+  this->TestMatrixFactorizeSparseUpdate(kLearningRate, kWeightDecay, kMomentum,
+      kNumIters);
+}
+
+
+typedef ::testing::Types<FloatCPU, DoubleCPU> TestDtypesCPU;
+
+template <typename TypeParam>
+class HogwildSolverTest : public GradientBasedSolverTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  HogwildSolverTest() : num_threads_(1) {}
+
+  virtual void InitSolver(const SolverParameter& param) {
+    SolverParameter hogwild_param(param);
+    hogwild_param.set_num_threads(num_threads_);
+    this->solver_.reset(new HogwildSolver<Dtype>(hogwild_param));
+  }
+  virtual SolverParameter_SolverType solver_type() {
+    return SolverParameter_SolverType_SGD;
+  }
+
+  // Fit w^T x + b = 1 and return the final loss: for the all-ones x, or with
+  // random_data for a fresh gaussian x every iteration, which the threads
+  // draw at the same time.
+  Dtype SolveConstantProblem(const int num_iters,
+      const bool random_data = false) {
+    ostringstream proto;
+    proto <<
+       "max_iter: " << num_iters << " "
+       "base_lr: " << (random_data ? 0.01 : 0.002) << " "
+       "lr_policy: 'fixed' "
+       "momentum: 0.5 "
+       "net_param { "
+       "  name: 'TestNetwork' "
+       "  layers: { "
+       "    name: 'data' "
+       "    type: DUMMY_DATA "
+       "    dummy_data_param { "
+       "      num: " << this->num_ << " "
+       "      channels: " << this->channels_ << " "
+       "      height: " << this->height_ << " "
+       "      width: " << this->width_ << " "
+       "      channels: 1 "
+       "      height: 1 "
+       "      width: 1 "
+       "      data_filler { "
+       "        type: '" << (random_data ? "gaussian" : "constant") << "' "
+       "        value: 1.0 "
+       "      } "
+       "      data_filler { "
+       "        type: 'constant' "
+       "        value: 1.0 "
+       "      } "
+       "    } "
+       "    top: 'data' "
+       "    top: 'targets' "
+       "  } "
+       "  layers: { "
+       "    name: 'innerprod' "
+       "    type: INNER_PRODUCT "
+       "    inner_product_param { "
+       "      num_output: 1 "
+       "      weight_filler { "
+       "        type: 'gaussian' "
+       "        std: 0.1 "
+       "      } "
+       "    } "
+       "    bottom: 'data' "
+       "    top: 'innerprod' "
+       "  } "
+       "  layers: { "
+       "    name: 'loss' "
+       "    type: EUCLIDEAN_LOSS "
+       "    bottom: 'innerprod' "
+       "    bottom: 'targets' "
+       "  } "
+       "} ";
+    Caffe::set_random_seed(this->seed_);
+    this->InitSolverFromProtoString(proto.str());
+    this->solver_->Solve();
+    vector<Blob<Dtype>*> empty_bottom_vec;
+    Dtype loss;
+    this->solver_->net()->Forward(empty_bottom_vec, &loss);
+    return loss;
+  }
+
+  int num_threads_;
+};
+
+TYPED_TEST_CASE(HogwildSolverTest, TestDtypesCPU);
+
+TYPED_TEST(HogwildSolverTest, TestLeastSquaresUpdateOneThread) {
+  this->TestLeastSquaresUpdate();
+}
+
+TYPED_TEST(HogwildSolverTest, TestLeastSquaresUpdateOneThreadWithEverything) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
+TYPED_TEST(HogwildSolverTest, TestMultiThreadConverges) {
+  typedef typename TypeParam::Dtype Dtype;
+  const int kNumIters = 200;
+  const Dtype serial_loss = this->SolveConstantProblem(kNumIters);
+  this->num_threads_ = 4;
+  const Dtype hogwild_loss = this->SolveConstantProblem(kNumIters);
+  EXPECT_LT(serial_loss, 1e-6);
+  EXPECT_LT(hogwild_loss, 1e-6);
+}
+
+TYPED_TEST(HogwildSolverTest, TestMultiThreadConvergesLikeSerial) {
+  typedef typename TypeParam::Dtype Dtype;
+  const int kNumIters = 1000;
+  const Dtype serial_loss = this->SolveConstantProblem(kNumIters, true);
+  this->num_threads_ = 4;
+  const Dtype hogwild_loss = this->SolveConstantProblem(kNumIters, true);
+  LOG(INFO) << "Final loss: serial " << serial_loss << ", "
+            << this->num_threads_ << " threads " << hogwild_loss;
+  // the unlocked updates land a little later, but on the same fit
+  EXPECT_LT(serial_loss, 1e-3);
+  EXPECT_LT(hogwild_loss, 1e-3);
+}
+
 }  // namespace caffe
@@ -0,0 +1,476 @@
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/interaction_data_layers.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/interaction_file.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class InteractionDataLayerTest : public ::testing::Test {
+ protected:
+  InteractionDataLayerTest()
+      : num_record_(5), channels_(2), height_(3), width_(4) {}
+
+  // Record i holds an image of pixels i, label 100 + i and i % 3 + 1
+  // ratings: item i, user UserId(i, j), rating j / 2.
+  virtual void SetUp() {
+    Caffe::set_mode(Caffe::CPU);
+    MakeTempFilename(&filename_);
+    InteractionFileWriter writer(filename_);
+    for (int i = 0; i < num_record_; ++i) {
+      writer.Add(MakeRecord(i));
+    }
+    writer.Close();
+  }
+
+  DatumInteraction MakeRecord(const int i) {
+    DatumInteraction record;
+    Datum* datum = record.mutable_datum();
+    datum->set_channels(channels_);
+    datum->set_height(height_);
+    datum->set_width(width_);
+    datum->set_label(100 + i);
+    datum->mutable_data()->assign(channels_ * height_ * width_,
+        static_cast<char>(i));
+    for (int j = 0; j < NumRating(i); ++j) {
+      record.add_itemid(i);
+      record.add_userid(UserId(i, j));
+      record.add_rating(j / 2.);
+    }
+    return record;
+  }
+
+  // Writes the same records to a LevelDB or LMDB at db_name_, keyed "0" to
+  // "4".
+  void FillDB(const DataParameter_DB backend) {
+    MakeTempDir(&db_name_);
+    db_name_ += "/db";
+    if (backend == DataParameter_DB_LEVELDB) {
+      leveldb::DB* db;
+      leveldb::Options options;
+      options.error_if_exists = true;
+      options.create_if_missing = true;
+      CHECK(leveldb::DB::Open(options, db_name_, &db).ok());
+      for (int i = 0; i < num_record_; ++i) {
+        std::ostringstream key;
+        key << i;
+        db->Put(leveldb::WriteOptions(), key.str(),
+            MakeRecord(i).SerializeAsString());
+      }
+      delete db;
+      return;
+    }
+    CHECK_EQ(mkdir(db_name_.c_str(), 0744), 0) << "mkdir " << db_name_
+                                               << " failed";
+    MDB_env* env;
+    MDB_dbi dbi;
+    MDB_txn* txn;
+    CHECK_EQ(mdb_env_create(&env), MDB_SUCCESS) << "mdb_env_create failed";
+    CHECK_EQ(mdb_env_set_mapsize(env, 1099511627776), MDB_SUCCESS)  // 1TB
+        << "mdb_env_set_mapsize failed";
+    CHECK_EQ(mdb_env_open(env, db_name_.c_str(), 0, 0664), MDB_SUCCESS)
+        << "mdb_env_open failed";
+    CHECK_EQ(mdb_txn_begin(env, NULL, 0, &txn), MDB_SUCCESS)
+        << "mdb_txn_begin failed";
+    CHECK_EQ(mdb_open(txn, NULL, 0, &dbi), MDB_SUCCESS) << "mdb_open failed";
+    for (int i = 0; i < num_record_; ++i) {
+      std::ostringstream key;
+      key << i;
+      string keystr = key.str();
+      string value = MakeRecord(i).SerializeAsString();
+      MDB_val mdbkey, mdbdata;
+      mdbkey.mv_size = keystr.size();
+      mdbkey.mv_data = reinterpret_cast<void*>(&keystr[0]);
+      mdbdata.mv_size = value.size();
+      mdbdata.mv_data = reinterpret_cast<void*>(&value[0]);
+      CHECK_EQ(mdb_put(txn, dbi, &mdbkey, &mdbdata, 0), MDB_SUCCESS)
+          << "mdb_put failed";
+    }
+    CHECK_EQ(mdb_txn_commit(txn), MDB_SUCCESS) << "mdb_txn_commit failed";
+    mdb_close(env, dbi);
+    mdb_env_close(env);
+  }
+
+  // A range shorter than the shuffle buffer is buffered whole, and every
+  // pass through the buffer draws each of its records exactly once.
+  void TestShuffleBufferShortRange(const DataParameter_DB backend) {
+    Caffe::set_random_seed(1701);
+    FillDB(backend);
+    // records 1 to 3, a pass per batch
+    const int batch_size = 3;
+    LayerParameter param;
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(batch_size);
+    data_param->set_source(db_name_.c_str());
+    data_param->set_backend(backend);
+    data_param->set_begin_key("1");
+    data_param->set_end_key("4");
+    data_param->set_shuffle(DataParameter_Shuffle_BUFFER);
+    data_param->set_shuffle_buffer(8);
+    vector<Blob<Dtype>*> blob_bottom_vec;
+    vector<Blob<Dtype>*> blob_top_vec;
+    for (int i = 0; i < 5; ++i) {
+      blob_top_vec.push_back(new Blob<Dtype>());
+    }
+    {
+      InteractionDataLayer<Dtype> layer(param);
+      layer.SetUp(blob_bottom_vec, &blob_top_vec);
+      bool shuffled = false;
+      for (int iter = 0; iter < 6; ++iter) {
+        layer.Forward(blob_bottom_vec, &blob_top_vec);
+        const Dtype* label = blob_top_vec[1]->cpu_data();
+        const int* count = blob_top_vec[4]->cpu_index();
+        vector<int> seen(num_record_, 0);
+        for (int n = 0; n < batch_size; ++n) {
+          const int record = static_cast<int>(label[n]) - 100;
+          ASSERT_GE(record, 1);
+          ASSERT_LT(record, 4);
+          ++seen[record];
+          shuffled |= record != n + 1;
+          EXPECT_EQ(NumRating(record), count[n * 2 + 1]);
+        }
+        for (int record = 1; record < 4; ++record) {
+          EXPECT_EQ(1, seen[record]) << "record " << record;
+        }
+      }
+      EXPECT_TRUE(shuffled);
+    }
+    for (int i = 0; i < 5; ++i) {
+      delete blob_top_vec[i];
+    }
+  }
+
+  int NumRating(const int record) { return record % 3 + 1; }
+  // above 2^24, where float can no longer hold every integer
+  int UserId(const int record, const int j) {
+    return (1 << 25) + 10 * record + j;
+  }
+
+  void TestReadColumnar(const int decode_threads) {
+    const int batch_size = 3;
+    LayerParameter param;
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(batch_size);
+    // fewer than the records hold, so the interaction blobs have to grow
+    data_param->set_itact_size(1);
+    data_param->set_source(filename_.c_str());
+    data_param->set_backend(DataParameter_DB_COLUMNAR);
+    data_param->set_decode_threads(decode_threads);
+    vector<Blob<Dtype>*> blob_bottom_vec;
+    vector<Blob<Dtype>*> blob_top_vec;
+    for (int i = 0; i < 5; ++i) {
+      blob_top_vec.push_back(new Blob<Dtype>());
+    }
+    {
+      InteractionDataLayer<Dtype> layer(param);
+      layer.SetUp(blob_bottom_vec, &blob_top_vec);
+      EXPECT_EQ(batch_size, blob_top_vec[0]->num());
+      EXPECT_EQ(channels_, blob_top_vec[0]->channels());
+      EXPECT_EQ(height_, blob_top_vec[0]->height());
+      EXPECT_EQ(width_, blob_top_vec[0]->width());
+      EXPECT_EQ(batch_size, blob_top_vec[2]->num());
+      EXPECT_EQ(2, blob_top_vec[2]->channels());
+
+      // two batches: records 0, 1, 2 then 3, 4, 0
+      int record = 0;
+      for (int iter = 0; iter < 2; ++iter) {
+        layer.Forward(blob_bottom_vec, &blob_top_vec);
+        const Dtype* data = blob_top_vec[0]->cpu_data();
+        const Dtype* label = blob_top_vec[1]->cpu_data();
+        const int* itact = blob_top_vec[2]->cpu_index();
+        const Dtype* rating = blob_top_vec[3]->cpu_data();
+        const int* count = blob_top_vec[4]->cpu_index();
+        int offset = 0;
+        for (int n = 0; n < batch_size; ++n, record = (record + 1) % 5) {
+          EXPECT_EQ(100 + record, label[n]);
+          for (int k = 0; k < blob_top_vec[0]->count() / batch_size; ++k) {
+            EXPECT_EQ(record, data[blob_top_vec[0]->offset(n) + k]);
+          }
+          EXPECT_EQ(offset, count[n * 2]);
+          EXPECT_EQ(NumRating(record), count[n * 2 + 1]);
+          for (int j = 0; j < NumRating(record); ++j, ++offset) {
+            EXPECT_EQ(record, itact[offset * 2]);
+            EXPECT_EQ(UserId(record, j), itact[offset * 2 + 1]);
+            EXPECT_EQ(j / 2., rating[offset]);
+          }
+        }
+        // the interaction tops hold exactly the ratings of the batch
+        EXPECT_EQ(offset, blob_top_vec[2]->num());
+        EXPECT_EQ(offset, blob_top_vec[3]->num());
+        // and the data mirrors the index for the Dtype consumers
+        for (int i = 0; i < blob_top_vec[2]->count(); ++i) {
+          EXPECT_EQ(itact[i], blob_top_vec[2]->cpu_data()[i]);
+        }
+        for (int i = 0; i < blob_top_vec[4]->count(); ++i) {
+          EXPECT_EQ(count[i], blob_top_vec[4]->cpu_data()[i]);
+        }
+      }
+    }
+    for (int i = 0; i < 5; ++i) {
+      delete blob_top_vec[i];
+    }
+  }
+
+  int num_record_, channels_, height_, width_;
+  string filename_;
+  string db_name_;
+};
+
+TYPED_TEST_CASE(InteractionDataLayerTest, TestDtypes);
+
+TYPED_TEST(InteractionDataLayerTest, TestFileRoundTrip) {
+  InteractionFile file(this->filename_);
+  EXPECT_EQ(this->num_record_, file.num_record());
+  EXPECT_EQ(9, file.num_rating());
+  EXPECT_EQ(this->channels_, file.channels());
+  EXPECT_EQ(this->height_, file.height());
+  EXPECT_EQ(this->width_, file.width());
+  for (int i = 0; i < this->num_record_; ++i) {
+    EXPECT_EQ(100 + i, file.label(i));
+    for (int k = 0; k < file.image_size(); ++k) {
+      EXPECT_EQ(i, file.image(i)[k]);
+    }
+    ASSERT_EQ(this->NumRating(i), file.num_rating(i));
+    const int64_t start = file.rating_start(i);
+    for (int j = 0; j < file.num_rating(i); ++j) {
+      EXPECT_EQ(i, file.itemid()[start + j]);
+      EXPECT_EQ(this->UserId(i, j), file.userid()[start + j]);
+      EXPECT_EQ(j / 2., file.rating()[start + j]);
+    }
+  }
+}
+
+TYPED_TEST(InteractionDataLayerTest, TestReadColumnar) {
+  this->TestReadColumnar(1);
+}
+
+TYPED_TEST(InteractionDataLayerTest, TestReadColumnarDecodeThreads) {
+  // the slices split the batch unevenly, the result must not change
+  this->TestReadColumnar(2);
+}
+
+TYPED_TEST(InteractionDataLayerTest, TestShuffleIndex) {
+  typedef TypeParam Dtype;
+  Caffe::set_random_seed(1701);
+  // a batch is an epoch of the range, records 1 to 4
+  const int batch_size = 4;
+  LayerParameter param;
+  DataParameter* data_param = param.mutable_data_param();
+  data_param->set_batch_size(batch_size);
+  data_param->set_source(this->filename_.c_str());
+  data_param->set_backend(DataParameter_DB_COLUMNAR);
+  data_param->set_begin_key("1");
+  data_param->set_shuffle(DataParameter_Shuffle_INDEX);
+  vector<Blob<Dtype>*> blob_bottom_vec;
+  vector<Blob<Dtype>*> blob_top_vec;
+  for (int i = 0; i < 5; ++i) {
+    blob_top_vec.push_back(new Blob<Dtype>());
+  }
+  {
+    InteractionDataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec, &blob_top_vec);
+    bool shuffled = false;
+    for (int iter = 0; iter < 5; ++iter) {
+      layer.Forward(blob_bottom_vec, &blob_top_vec);
+      const Dtype* label = blob_top_vec[1]->cpu_data();
+      const int* count = blob_top_vec[4]->cpu_index();
+      vector<bool> seen(this->num_record_, false);
+      for (int n = 0; n < batch_size; ++n) {
+        const int record = static_cast<int>(label[n]) - 100;
+        ASSERT_GE(record, 1);
+        ASSERT_LT(record, this->num_record_);
+        EXPECT_FALSE(seen[record]);
+        seen[record] = true;
+        shuffled |= record != n + 1;
+        // the ratings go with their record
+        EXPECT_EQ(this->NumRating(record), count[n * 2 + 1]);
+      }
+    }
+    EXPECT_TRUE(shuffled);
+  }
+  for (int i = 0; i < 5; ++i) {
+    delete blob_top_vec[i];
+  }
+}
+
+TYPED_TEST(InteractionDataLayerTest, TestShuffleBufferShortRangeLevelDB) {
+  this->TestShuffleBufferShortRange(DataParameter_DB_LEVELDB);
+}
+
+TYPED_TEST(InteractionDataLayerTest, TestShuffleBufferShortRangeLMDB) {
+  this->TestShuffleBufferShortRange(DataParameter_DB_LMDB);
+}
+
+TYPED_TEST(InteractionDataLayerTest, TestShareLevelDB) {
+  typedef TypeParam Dtype;
+  // two shards of one LevelDB, read at once as caffe score does
+  this->FillDB(DataParameter_DB_LEVELDB);
+  const int batch_size = 2;
+  const char* begin_key[2] = {"0", "2"};
+  shared_ptr<InteractionDataLayer<Dtype> > layer[2];
+  vector<Blob<Dtype>*> blob_bottom_vec;
+  vector<Blob<Dtype>*> blob_top_vec[2];
+  for (int shard = 0; shard < 2; ++shard) {
+    LayerParameter param;
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(batch_size);
+    data_param->set_source(this->db_name_.c_str());
+    data_param->set_backend(DataParameter_DB_LEVELDB);
+    data_param->set_begin_key(begin_key[shard]);
+    if (shard == 0) {
+      data_param->set_end_key(begin_key[1]);
+    }
+    data_param->set_single_pass(true);
+    for (int i = 0; i < 5; ++i) {
+      blob_top_vec[shard].push_back(new Blob<Dtype>());
+    }
+    layer[shard].reset(new InteractionDataLayer<Dtype>(param));
+    layer[shard]->SetUp(blob_bottom_vec, &blob_top_vec[shard]);
+  }
+  // records 0, 1 and 2, 3, 4, each read by its own iterator
+  int record[2] = {0, 2};
+  const int end_record[2] = {2, 5};
+  for (int iter = 0; iter < 2; ++iter) {
+    for (int shard = 0; shard < 2; ++shard) {
+      layer[shard]->Forward(blob_bottom_vec, &blob_top_vec[shard]);
+      const Dtype* label = blob_top_vec[shard][1]->cpu_data();
+      for (int n = 0; n < blob_top_vec[shard][1]->num(); ++n) {
+        EXPECT_EQ(100 + record[shard]++, label[n]);
+      }
+    }
+  }
+  for (int shard = 0; shard < 2; ++shard) {
+    EXPECT_EQ(end_record[shard], record[shard]);
+    layer[shard].reset();
+    for (int i = 0; i < 5; ++i) {
+      delete blob_top_vec[shard][i];
+    }
+  }
+}
+
+TYPED_TEST(InteractionDataLayerTest, TestReadRangeSinglePass) {
+  typedef TypeParam Dtype;
+  const int batch_size = 3;
+  LayerParameter param;
+  DataParameter* data_param = param.mutable_data_param();
+  data_param->set_batch_size(batch_size);
+  data_param->set_source(this->filename_.c_str());
+  data_param->set_backend(DataParameter_DB_COLUMNAR);
+  data_param->set_begin_key("1");
+  data_param->set_end_key("5");
+  data_param->set_single_pass(true);
+  vector<Blob<Dtype>*> blob_bottom_vec;
+  vector<Blob<Dtype>*> blob_top_vec;
+  for (int i = 0; i < 5; ++i) {
+    blob_top_vec.push_back(new Blob<Dtype>());
+  }
+  {
+    InteractionDataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec, &blob_top_vec);
+    // records 1, 2, 3, then 4 alone, then nothing
+    const int expected_num[3] = {3, 1, 0};
+    int record = 1;
+    for (int iter = 0; iter < 3; ++iter) {
+      layer.Forward(blob_bottom_vec, &blob_top_vec);
+      const int num = expected_num[iter];
+      ASSERT_EQ(num, blob_top_vec[0]->num());
+      ASSERT_EQ(num, blob_top_vec[1]->num());
+      ASSERT_EQ(num, blob_top_vec[4]->num());
+      const Dtype* label = blob_top_vec[1]->cpu_data();
+      const int* count = blob_top_vec[4]->cpu_index();
+      int num_rating = 0;
+      for (int n = 0; n < num; ++n, ++record) {
+        EXPECT_EQ(100 + record, label[n]);
+        EXPECT_EQ(this->NumRating(record), count[n * 2 + 1]);
+        num_rating += this->NumRating(record);
+      }
+      EXPECT_EQ(num_rating, blob_top_vec[2]->num());
+      EXPECT_EQ(num_rating, blob_top_vec[3]->num());
+    }
+  }
+  for (int i = 0; i < 5; ++i) {
+    delete blob_top_vec[i];
+  }
+}
+
+TYPED_TEST(InteractionDataLayerTest, TestMixSources) {
+  typedef TypeParam Dtype;
+  Caffe::set_random_seed(1701);
+  const int batch_size = 4;
+  LayerParameter param;
+  DataParameter* data_param = param.mutable_data_param();
+  data_param->set_batch_size(batch_size);
+  data_param->set_itact_size(1);
+  data_param->set_source(this->filename_.c_str());
+  data_param->set_backend(DataParameter_DB_COLUMNAR);
+  // records 0, 1 and records 2, 3, 4, read in batches of their own size
+  DataParameter* first = data_param->add_mix_source();
+  first->set_end_key("2");
+  first->set_batch_size(2);
+  DataParameter* second = data_param->add_mix_source();
+  second->set_begin_key("2");
+  second->set_batch_size(3);
+  data_param->add_mix_weight(1);
+  data_param->add_mix_weight(3);
+  vector<Blob<Dtype>*> blob_bottom_vec;
+  vector<Blob<Dtype>*> blob_top_vec;
+  for (int i = 0; i < 5; ++i) {
+    blob_top_vec.push_back(new Blob<Dtype>());
+  }
+  {
+    MixedInteractionDataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec, &blob_top_vec);
+    EXPECT_EQ(batch_size, blob_top_vec[0]->num());
+    EXPECT_EQ(this->channels_, blob_top_vec[0]->channels());
+    // each source still reads its records in order
+    int next_record[2] = {0, 2};
+    int num_drawn[2] = {0, 0};
+    for (int iter = 0; iter < 25; ++iter) {
+      layer.Forward(blob_bottom_vec, &blob_top_vec);
+      const Dtype* data = blob_top_vec[0]->cpu_data();
+      const Dtype* label = blob_top_vec[1]->cpu_data();
+      const int* itact = blob_top_vec[2]->cpu_index();
+      const Dtype* rating = blob_top_vec[3]->cpu_data();
+      const int* count = blob_top_vec[4]->cpu_index();
+      int offset = 0;
+      for (int n = 0; n < batch_size; ++n) {
+        const int record = static_cast<int>(label[n]) - 100;
+        const int source = record < 2 ? 0 : 1;
+        ASSERT_EQ(next_record[source], record);
+        next_record[source] = source == 0 ? (record + 1) % 2 :
+            (record - 1) % 3 + 2;
+        ++num_drawn[source];
+        for (int k = 0; k < blob_top_vec[0]->count() / batch_size; ++k) {
+          EXPECT_EQ(record, data[blob_top_vec[0]->offset(n) + k]);
+        }
+        EXPECT_EQ(offset, count[n * 2]);
+        ASSERT_EQ(this->NumRating(record), count[n * 2 + 1]);
+        for (int j = 0; j < this->NumRating(record); ++j, ++offset) {
+          EXPECT_EQ(record, itact[offset * 2]);
+          EXPECT_EQ(this->UserId(record, j), itact[offset * 2 + 1]);
+          EXPECT_EQ(j / 2., rating[offset]);
+        }
+      }
+      EXPECT_EQ(offset, blob_top_vec[2]->num());
+      EXPECT_EQ(offset, blob_top_vec[3]->num());
+    }
+    // 100 records drawn 1:3
+    EXPECT_GT(num_drawn[0], 10);
+    EXPECT_LT(num_drawn[0], 40);
+  }
+  for (int i = 0; i < 5; ++i) {
+    delete blob_top_vec[i];
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,143 @@
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/data_layers.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include "caffe/util/label_table.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class LabelTableTest : public ::testing::Test {
+ protected:
+  LabelTableTest() : label_dim_(3) {}
+
+  // Writes the labels of ids, added in the given order; id i has the label
+  // vector (i, i + 0.5, i + 1).
+  void WriteTable(const vector<int>& ids) {
+    MakeTempFilename(&filename_);
+    LabelTableWriter writer(filename_, label_dim_);
+    for (int i = 0; i < ids.size(); ++i) {
+      const float label[3] =
+          {static_cast<float>(ids[i]), ids[i] + 0.5f, ids[i] + 1.f};
+      writer.Add(ids[i], label);
+    }
+    writer.Close();
+  }
+
+  void CheckTable(const vector<int>& ids) {
+    LabelTable table(filename_);
+    EXPECT_EQ(ids.size(), table.num_row());
+    EXPECT_EQ(label_dim_, table.label_dim());
+    for (int i = 0; i < table.num_row() - 1; ++i) {
+      EXPECT_LT(table.id()[i], table.id()[i + 1]);
+    }
+    vector<Dtype> label(label_dim_);
+    for (int i = 0; i < ids.size(); ++i) {
+      const int64_t row = table.Find(ids[i]);
+      ASSERT_GE(row, 0);
+      EXPECT_EQ(ids[i], table.id()[row]);
+      table.CopyRow(row, &label[0]);
+      EXPECT_EQ(ids[i], label[0]);
+      EXPECT_EQ(ids[i] + 0.5, label[1]);
+      EXPECT_EQ(ids[i] + 1, label[2]);
+    }
+  }
+
+  void TestMemoryMappingDataLayer(const int gather_threads,
+      const Caffe::Brew mode = Caffe::CPU) {
+    Caffe::set_mode(mode);
+    vector<int> ids;
+    ids.push_back(8);
+    ids.push_back(3);
+    ids.push_back(42);
+    WriteTable(ids);
+    const int batch_size = 4;
+    LayerParameter param;
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(batch_size);
+    data_param->set_label_table(filename_);
+    data_param->set_gather_threads(gather_threads);
+    Blob<Dtype> bottom_id(batch_size, 1, 1, 1);
+    Blob<Dtype> top_label;
+    vector<Blob<Dtype>*> bottom_vec(1, &bottom_id);
+    vector<Blob<Dtype>*> top_vec(1, &top_label);
+    const int batch_ids[batch_size] = {42, 3, 3, 8};
+    MemoryMappingDataLayer<Dtype> layer(param);
+    layer.SetUp(bottom_vec, &top_vec);
+    EXPECT_EQ(batch_size, top_label.num());
+    EXPECT_EQ(label_dim_, top_label.channels());
+    // the second batch reuses what the first one set up
+    for (int batch = 0; batch < 2; ++batch) {
+      for (int i = 0; i < batch_size; ++i) {
+        bottom_id.mutable_cpu_data()[i] =
+            batch_ids[batch ? batch_size - 1 - i : i];
+      }
+      layer.Forward(bottom_vec, &top_vec);
+      for (int i = 0; i < batch_size; ++i) {
+        const int id = batch_ids[batch ? batch_size - 1 - i : i];
+        EXPECT_EQ(id, top_label.cpu_data()[i * 3]);
+        EXPECT_EQ(id + 0.5, top_label.cpu_data()[i * 3 + 1]);
+        EXPECT_EQ(id + 1, top_label.cpu_data()[i * 3 + 2]);
+      }
+    }
+    Caffe::set_mode(Caffe::CPU);
+  }
+
+  int label_dim_;
+  string filename_;
+};
+
+TYPED_TEST_CASE(LabelTableTest, TestDtypes);
+
+TYPED_TEST(LabelTableTest, TestSparseIds) {
+  vector<int> ids;
+  ids.push_back(70);
+  ids.push_back(-5);
+  ids.push_back(12);
+  ids.push_back(1000000);
+  this->WriteTable(ids);
+  this->CheckTable(ids);
+  LabelTable table(this->filename_);
+  EXPECT_EQ(-1, table.Find(0));
+  EXPECT_EQ(-1, table.Find(13));
+  EXPECT_EQ(-1, table.Find(2000000));
+}
+
+TYPED_TEST(LabelTableTest, TestDenseIds) {
+  vector<int> ids;
+  for (int i = 9; i >= 0; --i) {
+    ids.push_back(100 + i);
+  }
+  this->WriteTable(ids);
+  this->CheckTable(ids);
+  LabelTable table(this->filename_);
+  EXPECT_EQ(0, table.Find(100));
+  EXPECT_EQ(-1, table.Find(99));
+  EXPECT_EQ(-1, table.Find(110));
+}
+
+TYPED_TEST(LabelTableTest, TestMemoryMappingDataLayer) {
+  this->TestMemoryMappingDataLayer(1);
+}
+
+TYPED_TEST(LabelTableTest, TestMemoryMappingDataLayerGatherThreads) {
+  this->TestMemoryMappingDataLayer(3);
+}
+
+#ifndef CPU_ONLY
+
+TYPED_TEST(LabelTableTest, TestMemoryMappingDataLayerGPU) {
+  this->TestMemoryMappingDataLayer(1, Caffe::GPU);
+}
+
+#endif
+
+}  // namespace caffe
@@ -0,0 +1,332 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/common_layers.hpp"
+#include "caffe/filler.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class MatrixFactorizeLayerTest : public ::testing::Test {
+ protected:
+  MatrixFactorizeLayerTest()
+      : blob_bottom_item_(new Blob<Dtype>()),
+        blob_bottom_itact_data_(new Blob<Dtype>()),
+        blob_bottom_itact_count_(new Blob<Dtype>()),
+        blob_top_pred_(new Blob<Dtype>()),
+        blob_top_num_(new Blob<Dtype>()) {
+    Caffe::set_mode(Caffe::CPU);
+    blob_bottom_vec_.push_back(blob_bottom_item_);
+    blob_bottom_vec_.push_back(blob_bottom_itact_data_);
+    blob_bottom_vec_.push_back(blob_bottom_itact_count_);
+    blob_top_vec_.push_back(blob_top_pred_);
+    blob_top_vec_.push_back(blob_top_num_);
+  }
+  virtual ~MatrixFactorizeLayerTest() {
+    delete blob_bottom_item_;
+    delete blob_bottom_itact_data_;
+    delete blob_bottom_itact_count_;
+    delete blob_top_pred_;
+    delete blob_top_num_;
+  }
+
+  // Fill the bottoms with a batch of items; interactions of item i are the
+  // users listed in users[i], and item i has real id item_ids[i].
+  void FillBatch(const vector<int>& item_ids,
+      const vector<vector<int> >& users) {
+    const int num_items = item_ids.size();
+    int num_rating = 0;
+    for (int i = 0; i < num_items; ++i) {
+      num_rating += users[i].size();
+    }
+    blob_bottom_item_->Reshape(num_items, kNumLatent, 1, 1);
+    FillerParameter filler_param;
+    filler_param.set_std(1);
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_bottom_item_);
+    blob_bottom_itact_data_->Reshape(num_rating, 2, 1, 1);
+    blob_bottom_itact_count_->Reshape(num_items, 2, 1, 1);
+    int* itact_data = blob_bottom_itact_data_->mutable_cpu_index();
+    int* itact_count = blob_bottom_itact_count_->mutable_cpu_index();
+    int offset = 0;
+    for (int i = 0; i < num_items; ++i) {
+      itact_count[i * 2] = offset;
+      itact_count[i * 2 + 1] = users[i].size();
+      for (int j = 0; j < users[i].size(); ++j) {
+        itact_data[(offset + j) * 2] = item_ids[i];
+        itact_data[(offset + j) * 2 + 1] = users[i][j];
+      }
+      offset += users[i].size();
+    }
+  }
+
+  void FillDefaultBatch() {
+    vector<int> item_ids;
+    vector<vector<int> > users(3);
+    item_ids.push_back(1);
+    users[0].push_back(0);
+    users[0].push_back(2);
+    item_ids.push_back(3);
+    users[1].push_back(2);
+    users[1].push_back(5);
+    users[1].push_back(6);
+    item_ids.push_back(4);
+    users[2].push_back(1);
+    FillBatch(item_ids, users);
+  }
+
+  void FillOtherBatch() {
+    vector<int> item_ids;
+    vector<vector<int> > users(2);
+    item_ids.push_back(0);
+    users[0].push_back(3);
+    item_ids.push_back(2);
+    users[1].push_back(4);
+    users[1].push_back(6);
+    FillBatch(item_ids, users);
+  }
+
+  void SetLayerParam(LayerParameter* layer_param, bool sparse_grad) {
+    MatrixFactorizeParameter* mf_param =
+        layer_param->mutable_matrix_fact_param();
+    mf_param->set_num_user(kNumUser);
+    mf_param->set_num_item(kNumItem);
+    mf_param->set_itact_size(3);
+    mf_param->set_img_weight(0.5);
+    mf_param->set_feature_weight(1);
+    mf_param->set_sparse_grad(sparse_grad);
+    mf_param->mutable_weight_filler()->set_type("gaussian");
+    mf_param->mutable_bias_filler()->set_type("constant");
+    mf_param->mutable_bias_filler()->set_value(0.25);
+  }
+
+  void FillTopDiff() {
+    FillerParameter filler_param;
+    filler_param.set_std(1);
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_top_pred_);
+    caffe_copy(blob_top_pred_->count(), blob_top_pred_->cpu_data(),
+        blob_top_pred_->mutable_cpu_diff());
+  }
+
+  static const int kNumUser = 7;
+  static const int kNumItem = 5;
+  static const int kNumLatent = 4;
+
+  Blob<Dtype>* const blob_bottom_item_;
+  Blob<Dtype>* const blob_bottom_itact_data_;
+  Blob<Dtype>* const blob_bottom_itact_count_;
+  Blob<Dtype>* const blob_top_pred_;
+  Blob<Dtype>* const blob_top_num_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(MatrixFactorizeLayerTest, TestDtypes);
+
+TYPED_TEST(MatrixFactorizeLayerTest, TestForward) {
+  LayerParameter layer_param;
+  this->SetLayerParam(&layer_param, false);
+  this->FillDefaultBatch();
+  MatrixFactorizeLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  EXPECT_EQ(this->blob_top_pred_->num(), 6);
+  EXPECT_EQ(this->blob_top_num_->cpu_data()[0], 6);
+  const int dim = this->kNumLatent;
+  const TypeParam* user = layer.blobs()[0]->cpu_data();
+  const TypeParam* item = layer.blobs()[1]->cpu_data();
+  const TypeParam* img = this->blob_bottom_item_->cpu_data();
+  const int* itact_data = this->blob_bottom_itact_data_->cpu_index();
+  const int* itact_count = this->blob_bottom_itact_count_->cpu_index();
+  const TypeParam* pred = this->blob_top_pred_->cpu_data();
+  for (int i = 0; i < this->blob_bottom_item_->num(); ++i) {
+    const int offset = itact_count[i * 2];
+    const int size = itact_count[i * 2 + 1];
+    for (int r = offset; r < offset + size; ++r) {
+      const int item_id = itact_data[r * 2];
+      const int user_id = itact_data[r * 2 + 1];
+      TypeParam expected = 0.25;
+      for (int k = 0; k < dim; ++k) {
+        expected += user[user_id * dim + k] *
+            (0.5 * img[i * dim + k] + item[item_id * dim + k]);
+      }
+      EXPECT_NEAR(pred[r], expected, 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(MatrixFactorizeLayerTest, TestMultiThread) {
+  // enough ratings for every thread to get a range of items and users
+  const int num_items = 40;
+  const int ratings_per_item = 100;
+  vector<int> item_ids(num_items);
+  vector<vector<int> > users(num_items);
+  for (int i = 0; i < num_items; ++i) {
+    item_ids[i] = i % this->kNumItem;
+    for (int j = 0; j < ratings_per_item; ++j) {
+      users[i].push_back((i + j) % this->kNumUser);
+    }
+  }
+  this->FillBatch(item_ids, users);
+  LayerParameter layer_param;
+  this->SetLayerParam(&layer_param, false);
+  layer_param.mutable_matrix_fact_param()->set_itact_size(ratings_per_item);
+  vector<bool> propagate_down(3, false);
+  propagate_down[0] = true;
+  MatrixFactorizeLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Blob<TypeParam> pred;
+  pred.CopyFrom(*this->blob_top_pred_, false, true);
+  this->FillTopDiff();
+  Blob<TypeParam> top_diff;
+  top_diff.CopyFrom(*this->blob_top_pred_, true, true);
+  layer.Backward(this->blob_top_vec_, propagate_down,
+      &(this->blob_bottom_vec_));
+  Blob<TypeParam> bottom_diff, user_diff, item_diff;
+  bottom_diff.CopyFrom(*this->blob_bottom_item_, true, true);
+  user_diff.CopyFrom(*layer.blobs()[0], true, true);
+  item_diff.CopyFrom(*layer.blobs()[1], true, true);
+
+  layer_param.mutable_matrix_fact_param()->set_num_threads(3);
+  MatrixFactorizeLayer<TypeParam> threaded_layer(layer_param);
+  threaded_layer.blobs().resize(layer.blobs().size());
+  for (int i = 0; i < layer.blobs().size(); ++i) {
+    threaded_layer.blobs()[i] = layer.blobs()[i];
+  }
+  threaded_layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  threaded_layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  for (int i = 0; i < pred.count(); ++i) {
+    EXPECT_NEAR(this->blob_top_pred_->cpu_data()[i], pred.cpu_data()[i],
+        1e-4);
+  }
+  caffe_copy(this->blob_top_pred_->count(), top_diff.cpu_diff(),
+      this->blob_top_pred_->mutable_cpu_diff());
+  threaded_layer.Backward(this->blob_top_vec_, propagate_down,
+      &(this->blob_bottom_vec_));
+  // every diff row is owned by one thread, so the result is exactly the same
+  for (int i = 0; i < bottom_diff.count(); ++i) {
+    EXPECT_EQ(this->blob_bottom_item_->cpu_diff()[i],
+        bottom_diff.cpu_diff()[i]);
+  }
+  for (int i = 0; i < user_diff.count(); ++i) {
+    EXPECT_EQ(layer.blobs()[0]->cpu_diff()[i], user_diff.cpu_diff()[i]);
+  }
+  for (int i = 0; i < item_diff.count(); ++i) {
+    EXPECT_EQ(layer.blobs()[1]->cpu_diff()[i], item_diff.cpu_diff()[i]);
+  }
+}
+
+TYPED_TEST(MatrixFactorizeLayerTest, TestBackwardUser) {
+  LayerParameter layer_param;
+  this->SetLayerParam(&layer_param, false);
+  // user 2 rates two items, so its diff sums over both
+  this->FillDefaultBatch();
+  MatrixFactorizeLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  this->FillTopDiff();
+  vector<bool> propagate_down(3, false);
+  layer.Backward(this->blob_top_vec_, propagate_down,
+      &(this->blob_bottom_vec_));
+  const int dim = this->kNumLatent;
+  vector<TypeParam> expected(this->kNumUser * dim, 0);
+  const TypeParam* item = layer.blobs()[1]->cpu_data();
+  const TypeParam* img = this->blob_bottom_item_->cpu_data();
+  const int* itact_data = this->blob_bottom_itact_data_->cpu_index();
+  const int* itact_count = this->blob_bottom_itact_count_->cpu_index();
+  const TypeParam* pred_diff = this->blob_top_pred_->cpu_diff();
+  for (int i = 0; i < this->blob_bottom_item_->num(); ++i) {
+    const int offset = itact_count[i * 2];
+    const int size = itact_count[i * 2 + 1];
+    for (int r = offset; r < offset + size; ++r) {
+      const int item_id = itact_data[r * 2];
+      const int user_id = itact_data[r * 2 + 1];
+      for (int k = 0; k < dim; ++k) {
+        expected[user_id * dim + k] += pred_diff[r] *
+            (0.5 * img[i * dim + k] + item[item_id * dim + k]);
+      }
+    }
+  }
+  const TypeParam* user_diff = layer.blobs()[0]->cpu_diff();
+  for (int j = 0; j < expected.size(); ++j) {
+    EXPECT_NEAR(user_diff[j], expected[j], 1e-4);
+  }
+}
+
+TYPED_TEST(MatrixFactorizeLayerTest, TestSparseGradMatchesDense) {
+  LayerParameter dense_param;
+  this->SetLayerParam(&dense_param, false);
+  LayerParameter sparse_param;
+  this->SetLayerParam(&sparse_param, true);
+  this->FillDefaultBatch();
+  MatrixFactorizeLayer<TypeParam> dense_layer(dense_param);
+  dense_layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  MatrixFactorizeLayer<TypeParam> sparse_layer(sparse_param);
+  sparse_layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  for (int i = 0; i < 2; ++i) {
+    sparse_layer.blobs()[i]->CopyFrom(*dense_layer.blobs()[i]);
+  }
+  vector<bool> propagate_down(3, false);
+  propagate_down[0] = true;
+  // Two batches touching different rows; stale rows must not leak through.
+  for (int batch = 0; batch < 2; ++batch) {
+    if (batch == 1) {
+      // emulate a solver writing momentum into the touched rows
+      for (int i = 0; i < 2; ++i) {
+        Blob<TypeParam>* param = sparse_layer.blobs()[i].get();
+        for (int r = 0; r < param->diff_rows().size(); ++r) {
+          param->mutable_cpu_diff()[param->diff_rows()[r] * this->kNumLatent]
+              = 10;
+        }
+      }
+      this->FillOtherBatch();
+    }
+    dense_layer.Reshape(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    dense_layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    this->FillTopDiff();
+    dense_layer.Backward(this->blob_top_vec_, propagate_down,
+        &(this->blob_bottom_vec_));
+    Blob<TypeParam> dense_bottom_diff;
+    dense_bottom_diff.CopyFrom(*this->blob_bottom_item_, true, true);
+    sparse_layer.Reshape(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    sparse_layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    sparse_layer.Backward(this->blob_top_vec_, propagate_down,
+        &(this->blob_bottom_vec_));
+    for (int i = 0; i < 2; ++i) {
+      const Blob<TypeParam>& dense = *dense_layer.blobs()[i];
+      const Blob<TypeParam>& sparse = *sparse_layer.blobs()[i];
+      EXPECT_FALSE(dense.has_diff_rows());
+      EXPECT_TRUE(sparse.has_diff_rows());
+      for (int j = 0; j < dense.count(); ++j) {
+        EXPECT_NEAR(dense.cpu_diff()[j], sparse.cpu_diff()[j], 1e-4);
+      }
+    }
+    EXPECT_EQ(sparse_layer.blobs()[1]->diff_rows().size(),
+        this->blob_bottom_item_->num());
+    for (int j = 0; j < dense_bottom_diff.count(); ++j) {
+      EXPECT_NEAR(dense_bottom_diff.cpu_diff()[j],
+          this->blob_bottom_item_->cpu_diff()[j], 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(MatrixFactorizeLayerTest, TestSparseUpdate) {
+  Blob<TypeParam> param(1, 1, 3, 2);
+  caffe_set(param.count(), TypeParam(1), param.mutable_cpu_data());
+  caffe_set(param.count(), TypeParam(0.5), param.mutable_cpu_diff());
+  vector<int> rows(1, 1);
+  param.set_diff_rows(rows);
+  param.Update();
+  for (int i = 0; i < param.count(); ++i) {
+    EXPECT_EQ(param.cpu_data()[i], (i / 2 == 1) ? 0.5 : 1);
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/mips_index.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class MIPSIndexTest : public ::testing::Test {
+ protected:
+  MIPSIndexTest()
+      : num_item_(3000), num_query_(200), num_latent_(8), num_list_(32),
+        k_(10) {}
+
+  virtual void SetUp() {
+    Caffe::set_random_seed(1701);
+    Caffe::set_mode(Caffe::CPU);
+    item_.Reshape(1, 1, num_item_, num_latent_);
+    query_.Reshape(1, 1, num_query_, num_latent_);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(&item_);
+    filler.Fill(&query_);
+  }
+
+  Dtype Score(const int queryid, const int itemid) {
+    return caffe_cpu_dot(num_latent_,
+        query_.cpu_data() + queryid * num_latent_,
+        item_.cpu_data() + itemid * num_latent_) + 0.5;
+  }
+
+  // Probing every list has to give the exact top k.
+  void CheckExact(const vector<int>& top_items,
+      const vector<Dtype>& top_scores) {
+    const Dtype kErrorBound = 1e-4;
+    ASSERT_EQ(num_query_ * k_, top_items.size());
+    vector<Dtype> scores(num_item_);
+    for (int q = 0; q < num_query_; ++q) {
+      for (int i = 0; i < num_item_; ++i) {
+        scores[i] = Score(q, i);
+      }
+      std::partial_sort(scores.begin(), scores.begin() + k_, scores.end(),
+          std::greater<Dtype>());
+      for (int i = 0; i < k_; ++i) {
+        EXPECT_NEAR(scores[i], top_scores[q * k_ + i], kErrorBound);
+        EXPECT_NEAR(Score(q, top_items[q * k_ + i]), top_scores[q * k_ + i],
+            kErrorBound);
+      }
+    }
+  }
+
+  int num_item_, num_query_, num_latent_, num_list_, k_;
+  Blob<Dtype> item_, query_;
+};
+
+TYPED_TEST_CASE(MIPSIndexTest, TestDtypes);
+
+TYPED_TEST(MIPSIndexTest, TestListsCoverItems) {
+  MIPSIndex<TypeParam> index;
+  index.Build(this->item_, this->num_list_, 5);
+  EXPECT_EQ(this->num_item_, index.num_item());
+  EXPECT_EQ(this->num_list_, index.num_list());
+  MIPSIndexProto proto;
+  index.ToProto(&proto);
+  ASSERT_EQ(this->num_list_ + 1, proto.list_start_size());
+  EXPECT_EQ(0, proto.list_start(0));
+  EXPECT_EQ(this->num_item_, proto.list_start(this->num_list_));
+  vector<int> items(proto.list_item().begin(), proto.list_item().end());
+  std::sort(items.begin(), items.end());
+  for (int i = 0; i < this->num_item_; ++i) {
+    EXPECT_EQ(i, items[i]);
+  }
+}
+
+TYPED_TEST(MIPSIndexTest, TestSearchAllLists) {
+  MIPSIndex<TypeParam> index;
+  index.Build(this->item_, this->num_list_, 5, 0.5);
+  vector<int> top_items;
+  vector<TypeParam> top_scores;
+  index.Search(this->query_.cpu_data(), this->num_query_, this->k_,
+      this->num_list_, &top_items, &top_scores);
+  this->CheckExact(top_items, top_scores);
+}
+
+TYPED_TEST(MIPSIndexTest, TestSearchAllListsMultiThread) {
+  MIPSIndex<TypeParam> index(3);
+  index.Build(this->item_, this->num_list_, 5, 0.5);
+  vector<int> top_items;
+  vector<TypeParam> top_scores;
+  index.Search(this->query_.cpu_data(), this->num_query_, this->k_,
+      this->num_list_, &top_items, &top_scores);
+  this->CheckExact(top_items, top_scores);
+}
+
+TYPED_TEST(MIPSIndexTest, TestSearchFewLists) {
+  MIPSIndex<TypeParam> index;
+  index.Build(this->item_, this->num_list_, 5, 0.5);
+  vector<int> top_items;
+  vector<TypeParam> top_scores;
+  index.Search(this->query_.cpu_data(), this->num_query_, this->k_, 4,
+      &top_items, &top_scores);
+  // the scores found are right, sorted, and no better than the exact ones
+  for (int q = 0; q < this->num_query_; ++q) {
+    for (int i = 0; i < this->k_; ++i) {
+      const int itemid = top_items[q * this->k_ + i];
+      ASSERT_GE(itemid, 0);
+      EXPECT_NEAR(this->Score(q, itemid), top_scores[q * this->k_ + i],
+          1e-4);
+      if (i > 0) {
+        EXPECT_GE(top_scores[q * this->k_ + i - 1],
+            top_scores[q * this->k_ + i]);
+      }
+    }
+  }
+}
+
+TYPED_TEST(MIPSIndexTest, TestProtoRoundTrip) {
+  MIPSIndex<TypeParam> index;
+  index.Build(this->item_, this->num_list_, 5, 0.5);
+  MIPSIndexProto proto;
+  index.ToProto(&proto);
+  MIPSIndex<TypeParam> loaded;
+  loaded.FromProto(proto);
+  EXPECT_EQ(index.num_item(), loaded.num_item());
+  EXPECT_EQ(index.num_list(), loaded.num_list());
+  EXPECT_EQ(index.num_latent(), loaded.num_latent());
+  vector<int> top_items, loaded_items;
+  vector<TypeParam> top_scores, loaded_scores;
+  index.Search(this->query_.cpu_data(), this->num_query_, this->k_,
+      this->num_list_, &top_items, &top_scores);
+  loaded.Search(this->query_.cpu_data(), this->num_query_, this->k_,
+      this->num_list_, &loaded_items, &loaded_scores);
+  for (int i = 0; i < top_scores.size(); ++i) {
+    EXPECT_NEAR(top_scores[i], loaded_scores[i], 1e-4);
+  }
+}
+
+}  // namespace caffe
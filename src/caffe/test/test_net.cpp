@@ -534,7 +534,8 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
-  virtual void InitReshapableNet() {
+  // net_options are NetParameter fields added to the net, e.g. memory_plan.
+  virtual void InitReshapableNet(const string& net_options = "") {
     const string& proto =
         "name: 'ReshapableNetwork' "
         "input: 'data' "
@@ -593,6 +594,150 @@ class NetTest : public MultiDeviceTest<TypeParam> {
         "  bottom: 'norm1' "
         "  top: 'softmax' "
         "} ";
+    InitNetFromProtoString(proto + net_options);
+  }
+
+  // A chain of INNER_PRODUCT and in-place RELU layers, whose first and last
+  // hidden blobs are never needed at the same time.
+  virtual void InitChainNet(const string& net_options) {
+    const string& proto =
+        "name: 'ChainNetwork' "
+        "layers: { "
+        "  name: 'data' "
+        "  type: DUMMY_DATA "
+        "  dummy_data_param { "
+        "    num: 4 "
+        "    channels: 6 "
+        "    height: 1 "
+        "    width: 1 "
+        "    num: 4 "
+        "    channels: 3 "
+        "    height: 1 "
+        "    width: 1 "
+        "    data_filler { "
+        "      type: 'gaussian' "
+        "      std: 1 "
+        "    } "
+        "  } "
+        "  top: 'data' "
+        "  top: 'label' "
+        "} "
+        "layers: { "
+        "  name: 'ip1' "
+        "  type: INNER_PRODUCT "
+        "  inner_product_param { "
+        "    num_output: 8 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.5 "
+        "    } "
+        "  } "
+        "  bottom: 'data' "
+        "  top: 'ip1' "
+        "} "
+        "layers: { "
+        "  name: 'relu1' "
+        "  type: RELU "
+        "  bottom: 'ip1' "
+        "  top: 'ip1' "
+        "} "
+        "layers: { "
+        "  name: 'ip2' "
+        "  type: INNER_PRODUCT "
+        "  inner_product_param { "
+        "    num_output: 8 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.5 "
+        "    } "
+        "  } "
+        "  bottom: 'ip1' "
+        "  top: 'ip2' "
+        "} "
+        "layers: { "
+        "  name: 'relu2' "
+        "  type: RELU "
+        "  bottom: 'ip2' "
+        "  top: 'ip2' "
+        "} "
+        "layers: { "
+        "  name: 'ip3' "
+        "  type: INNER_PRODUCT "
+        "  inner_product_param { "
+        "    num_output: 8 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.5 "
+        "    } "
+        "  } "
+        "  bottom: 'ip2' "
+        "  top: 'ip3' "
+        "} "
+        "layers: { "
+        "  name: 'relu3' "
+        "  type: RELU "
+        "  bottom: 'ip3' "
+        "  top: 'ip3' "
+        "} "
+        "layers: { "
+        "  name: 'ip4' "
+        "  type: INNER_PRODUCT "
+        "  inner_product_param { "
+        "    num_output: 3 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.5 "
+        "    } "
+        "  } "
+        "  bottom: 'ip3' "
+        "  top: 'ip4' "
+        "} "
+        "layers: { "
+        "  name: 'loss' "
+        "  type: EUCLIDEAN_LOSS "
+        "  bottom: 'ip4' "
+        "  bottom: 'label' "
+        "} ";
+    InitNetFromProtoString(proto + net_options);
+  }
+
+  // A MATRIX_FACT layer on net inputs: two items, rated by three users.
+  virtual void InitMatrixFactorizeNet() {
+    const string& proto =
+        "name: 'MatrixFactorizeNetwork' "
+        "input: 'item' "
+        "input_dim: 2 "
+        "input_dim: 3 "
+        "input_dim: 1 "
+        "input_dim: 1 "
+        "input: 'itact' "
+        "input_dim: 3 "
+        "input_dim: 2 "
+        "input_dim: 1 "
+        "input_dim: 1 "
+        "input: 'count' "
+        "input_dim: 2 "
+        "input_dim: 2 "
+        "input_dim: 1 "
+        "input_dim: 1 "
+        "layers: { "
+        "  name: 'mf' "
+        "  type: MATRIX_FACT "
+        "  matrix_fact_param { "
+        "    num_user: 5 "
+        "    num_item: 3 "
+        "    itact_size: 2 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 1 "
+        "    } "
+        "  } "
+        "  bottom: 'item' "
+        "  bottom: 'itact' "
+        "  bottom: 'count' "
+        "  top: 'pred' "
+        "  top: 'num_rating' "
+        "} ";
     InitNetFromProtoString(proto);
   }
 
@@ -2149,4 +2294,223 @@ TYPED_TEST(NetTest, TestReshape) {
   }
 }
 
+TYPED_TEST(NetTest, TestMemoryPlanInference) {
+  typedef typename TypeParam::Dtype Dtype;
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> input(1, 3, 100, 100);
+  filler.Fill(&input);
+
+  Caffe::set_random_seed(this->seed_);
+  this->InitReshapableNet("memory_plan: NONE ");
+  caffe_copy(input.count(), input.cpu_data(),
+      this->net_->input_blobs()[0]->mutable_cpu_data());
+  this->net_->ForwardPrefilled();
+  Blob<Dtype> expected_output;
+  expected_output.CopyFrom(*this->net_->output_blobs()[0], false, true);
+  EXPECT_NE(this->net_->blob_by_name("conv1")->data(),
+      this->net_->blob_by_name("norm1")->data());
+
+  // conv1 is last read by pool1, before norm1 is written
+  Caffe::set_random_seed(this->seed_);
+  this->InitReshapableNet();
+  EXPECT_EQ(this->net_->blob_by_name("conv1")->data(),
+      this->net_->blob_by_name("norm1")->data());
+  EXPECT_NE(this->net_->blob_by_name("pool1")->data(),
+      this->net_->blob_by_name("norm1")->data());
+  EXPECT_NE(this->net_->blob_by_name("data")->data(),
+      this->net_->blob_by_name("norm1")->data());
+  caffe_copy(input.count(), input.cpu_data(),
+      this->net_->input_blobs()[0]->mutable_cpu_data());
+  this->net_->ForwardPrefilled();
+  const Blob<Dtype>& output = *this->net_->output_blobs()[0];
+  ASSERT_EQ(expected_output.count(), output.count());
+  for (int i = 0; i < output.count(); ++i) {
+    EXPECT_EQ(expected_output.cpu_data()[i], output.cpu_data()[i]);
+  }
+
+  Caffe::set_random_seed(this->seed_);
+  this->InitReshapableNet("keep_blob: 'conv1' ");
+  EXPECT_NE(this->net_->blob_by_name("conv1")->data(),
+      this->net_->blob_by_name("norm1")->data());
+}
+
+TYPED_TEST(NetTest, TestMemoryPlanDiff) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitChainNet("memory_plan: NONE ");
+  this->net_->ForwardPrefilled();
+  this->net_->Backward();
+  vector<shared_ptr<Blob<Dtype> > > expected_params;
+  const bool kCopyDiff = true;
+  this->CopyNetParams(kCopyDiff, &expected_params);
+
+  Caffe::set_random_seed(this->seed_);
+  this->InitChainNet("memory_plan: DIFF ");
+  // ip1 gets its diff from ip2, after ip3 passed its diff to ip2
+  EXPECT_EQ(this->net_->blob_by_name("ip1")->diff(),
+      this->net_->blob_by_name("ip3")->diff());
+  EXPECT_NE(this->net_->blob_by_name("ip1")->data(),
+      this->net_->blob_by_name("ip3")->data());
+  // the loss layer may write the diff of ip4 in Forward, when ip2 still
+  // holds the diff planned for it
+  EXPECT_NE(this->net_->blob_by_name("ip2")->diff(),
+      this->net_->blob_by_name("ip4")->diff());
+  this->net_->ForwardPrefilled();
+  this->net_->Backward();
+  const vector<shared_ptr<Blob<Dtype> > >& params = this->net_->params();
+  ASSERT_EQ(expected_params.size(), params.size());
+  for (int i = 0; i < params.size(); ++i) {
+    ASSERT_EQ(expected_params[i]->count(), params[i]->count());
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_EQ(expected_params[i]->cpu_diff()[j], params[i]->cpu_diff()[j]);
+    }
+  }
+
+  // with backward, the default plan shares nothing
+  this->InitChainNet("");
+  EXPECT_NE(this->net_->blob_by_name("ip1")->diff(),
+      this->net_->blob_by_name("ip3")->diff());
+}
+
+TYPED_TEST(NetTest, TestInferenceMode) {
+  typedef typename TypeParam::Dtype Dtype;
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> input(1, 3, 100, 100);
+  filler.Fill(&input);
+  // norm1 feeds two layers, so it is split when the net has diffs
+  const string& second_softmax =
+      "layers: { "
+      "  name: 'softmax2' "
+      "  type: SOFTMAX "
+      "  bottom: 'norm1' "
+      "  top: 'softmax2' "
+      "} ";
+
+  Caffe::set_random_seed(this->seed_);
+  this->InitReshapableNet(second_softmax);
+  EXPECT_EQ(7, this->net_->layers().size());
+  caffe_copy(input.count(), input.cpu_data(),
+      this->net_->input_blobs()[0]->mutable_cpu_data());
+  this->net_->ForwardPrefilled();
+  vector<shared_ptr<Blob<Dtype> > > expected_outputs;
+  for (int i = 0; i < this->net_->output_blobs().size(); ++i) {
+    expected_outputs.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    expected_outputs.back()->CopyFrom(*this->net_->output_blobs()[i], false,
+        true);
+  }
+
+  // relu1 is fused into conv1, and norm1 is not split
+  Caffe::set_random_seed(this->seed_);
+  this->InitReshapableNet(second_softmax + "state: { inference: true } ");
+  EXPECT_TRUE(this->net_->inference());
+  EXPECT_EQ(5, this->net_->layers().size());
+  EXPECT_FALSE(this->net_->has_layer("relu1"));
+  EXPECT_TRUE(
+      this->net_->layer_by_name("conv1")->layer_param().has_fused_relu());
+  const vector<shared_ptr<Blob<Dtype> > >& blobs = this->net_->blobs();
+  for (int i = 0; i < blobs.size(); ++i) {
+    EXPECT_TRUE(blobs[i]->diff_dropped());
+  }
+  const vector<shared_ptr<Blob<Dtype> > >& params = this->net_->params();
+  for (int i = 0; i < params.size(); ++i) {
+    EXPECT_TRUE(params[i]->diff_dropped());
+  }
+  caffe_copy(input.count(), input.cpu_data(),
+      this->net_->input_blobs()[0]->mutable_cpu_data());
+  this->net_->ForwardPrefilled();
+  // the diffs stay dropped as the blobs are reshaped
+  EXPECT_TRUE(this->net_->blob_by_name("conv1")->diff_dropped());
+  ASSERT_EQ(expected_outputs.size(), this->net_->output_blobs().size());
+  for (int i = 0; i < expected_outputs.size(); ++i) {
+    const Blob<Dtype>& output = *this->net_->output_blobs()[i];
+    ASSERT_EQ(expected_outputs[i]->count(), output.count());
+    for (int j = 0; j < output.count(); ++j) {
+      EXPECT_EQ(expected_outputs[i]->cpu_data()[j], output.cpu_data()[j]);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestInferenceModeLoss) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitChainNet("memory_plan: NONE ");
+  Dtype expected_loss;
+  this->net_->ForwardPrefilled(&expected_loss);
+
+  Caffe::set_random_seed(this->seed_);
+  this->InitChainNet("state: { inference: true } ");
+  EXPECT_EQ(6, this->net_->layers().size());
+  // the loss layer keeps the diffs it reads in Forward
+  EXPECT_FALSE(this->net_->blob_by_name("ip4")->diff_dropped());
+  EXPECT_TRUE(this->net_->blob_by_name("ip1")->diff_dropped());
+  EXPECT_TRUE(this->net_->blob_by_name("ip3")->diff_dropped());
+  Dtype loss;
+  this->net_->ForwardPrefilled(&loss);
+  EXPECT_EQ(expected_loss, loss);
+}
+
+TYPED_TEST(NetTest, TestForwardIndex) {
+  typedef typename TypeParam::Dtype Dtype;
+  // the ids of the interaction inputs live in the blob index only
+  Blob<Dtype> item(2, 3, 1, 1);
+  Blob<Dtype> itact(3, 2, 1, 1);
+  Blob<Dtype> count(2, 2, 1, 1);
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&item);
+  // item 2 is rated by users 4 and 1, item 1 by user 3
+  const int itact_ids[] = {2, 4, 2, 1, 1, 3};
+  const int count_ids[] = {0, 2, 2, 1};
+  std::copy(itact_ids, itact_ids + 6, itact.mutable_cpu_index());
+  std::copy(count_ids, count_ids + 4, count.mutable_cpu_index());
+  vector<Blob<Dtype>*> bottom;
+  bottom.push_back(&item);
+  bottom.push_back(&itact);
+  bottom.push_back(&count);
+
+  Caffe::set_random_seed(this->seed_);
+  this->InitMatrixFactorizeNet();
+  for (int i = 0; i < bottom.size(); ++i) {
+    Blob<Dtype>* input = this->net_->input_blobs()[i];
+    caffe_copy(input->count(), bottom[i]->cpu_data(),
+        input->mutable_cpu_data());
+    std::copy(bottom[i]->cpu_index(), bottom[i]->cpu_index() + input->count(),
+        input->mutable_cpu_index());
+  }
+  this->net_->ForwardPrefilled();
+  Blob<Dtype> expected_pred;
+  expected_pred.CopyFrom(*this->net_->blob_by_name("pred"), false, true);
+
+  // through Forward(bottom), which copies the inputs
+  Caffe::set_random_seed(this->seed_);
+  this->InitMatrixFactorizeNet();
+  this->net_->Forward(bottom);
+  const Blob<Dtype>& pred = *this->net_->blob_by_name("pred");
+  ASSERT_EQ(expected_pred.count(), pred.count());
+  for (int i = 0; i < pred.count(); ++i) {
+    EXPECT_EQ(expected_pred.cpu_data()[i], pred.cpu_data()[i]);
+  }
+
+  // and through Forward(string), which parses them from BlobProtos
+  Caffe::set_random_seed(this->seed_);
+  this->InitMatrixFactorizeNet();
+  BlobProtoVector bottom_protos;
+  for (int i = 0; i < bottom.size(); ++i) {
+    bottom[i]->ToProto(bottom_protos.add_blobs());
+  }
+  string bottom_string;
+  bottom_protos.SerializeToString(&bottom_string);
+  this->net_->Forward(bottom_string);
+  // (the item features go through the float data of the proto)
+  for (int i = 0; i < pred.count(); ++i) {
+    EXPECT_NEAR(expected_pred.cpu_data()[i],
+        this->net_->blob_by_name("pred")->cpu_data()[i], 1e-4);
+  }
+}
+
 }  // namespace caffe
@@ -0,0 +1,85 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/parallel.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class WorkerPoolTest : public ::testing::Test {
+ public:
+  // Records the thread of every task, and marks the items of every slice.
+  void Task(const int t) {
+    thread_[t] = boost::this_thread::get_id();
+  }
+  void Slice(const int begin, const int end, const int slice) {
+    thread_[slice] = boost::this_thread::get_id();
+    for (int i = begin; i < end; ++i) {
+      item_slice_[i] = slice;
+    }
+  }
+
+ protected:
+  vector<boost::thread::id> thread_;
+  vector<int> item_slice_;
+};
+
+TEST_F(WorkerPoolTest, TestWorkersAreReused) {
+  WorkerPool pool;
+  pool.Reserve(4);
+  EXPECT_EQ(4, pool.capacity());
+  thread_.resize(4);
+  pool.Run(4, boost::bind(&WorkerPoolTest::Task, this, _1));
+  const vector<boost::thread::id> first_thread(thread_);
+  EXPECT_EQ(boost::this_thread::get_id(), first_thread[0]);
+  for (int t = 1; t < 4; ++t) {
+    EXPECT_NE(boost::this_thread::get_id(), first_thread[t]);
+    for (int u = 1; u < t; ++u) {
+      EXPECT_NE(first_thread[u], first_thread[t]);
+    }
+  }
+  // later runs, of as many tasks or fewer, go to the same threads
+  for (int run = 0; run < 20; ++run) {
+    const int num_task = 1 + run % 4;
+    thread_.assign(4, boost::thread::id());
+    pool.Run(num_task, boost::bind(&WorkerPoolTest::Task, this, _1));
+    for (int t = 0; t < 4; ++t) {
+      EXPECT_EQ(t < num_task ? first_thread[t] : boost::thread::id(),
+          thread_[t]);
+    }
+  }
+  // reserving no more than there are starts no workers
+  pool.Reserve(2);
+  EXPECT_EQ(4, pool.capacity());
+}
+
+TEST_F(WorkerPoolTest, TestRunSlices) {
+  WorkerPool pool;
+  pool.Reserve(3);
+  const int n = 10;
+  thread_.resize(3);
+  item_slice_.assign(n, -1);
+  pool.RunSlices(n, 3, boost::bind(&WorkerPoolTest::Slice, this, _1, _2,
+      _3));
+  // slice t covers [n * t / 3, n * (t + 1) / 3)
+  for (int i = 0; i < n; ++i) {
+    EXPECT_EQ(i < 3 ? 0 : (i < 6 ? 1 : 2), item_slice_[i]) << "item " << i;
+  }
+  // a single slice runs on the calling thread, without workers
+  WorkerPool empty;
+  item_slice_.assign(n, -1);
+  empty.RunSlices(n, 1, boost::bind(&WorkerPoolTest::Slice, this, _1, _2,
+      _3));
+  EXPECT_EQ(boost::this_thread::get_id(), thread_[0]);
+  for (int i = 0; i < n; ++i) {
+    EXPECT_EQ(0, item_slice_[i]);
+  }
+}
+
+}  // namespace caffe
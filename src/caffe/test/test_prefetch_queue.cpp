@@ -0,0 +1,94 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/prefetch_queue.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class PrefetchQueueTest : public ::testing::Test {
+ protected:
+  PrefetchQueueTest() : working_(new Blob<Dtype>(2, 3, 1, 1)) {
+    working_vec_.push_back(working_);
+  }
+  virtual ~PrefetchQueueTest() { delete working_; }
+
+ public:
+  // Fills batch i with i and i + 2 rows, until the queue is stopped.
+  void Produce() {
+    for (int i = 0; ; ++i) {
+      working_->Reshape(i + 2, 3, 1, 1);
+      caffe_set(working_->count(), Dtype(i), working_->mutable_cpu_data());
+      if (!queue_.Push(working_vec_)) {
+        break;
+      }
+    }
+  }
+
+ protected:
+  Blob<Dtype>* const working_;
+  vector<Blob<Dtype>*> working_vec_;
+  PrefetchQueue<Dtype> queue_;
+};
+
+TYPED_TEST_CASE(PrefetchQueueTest, TestDtypes);
+
+TYPED_TEST(PrefetchQueueTest, TestBatchesInOrder) {
+  this->queue_.Init(this->working_vec_, 3);
+  EXPECT_EQ(3, this->queue_.num_batch());
+  boost::thread producer(
+      boost::bind(&PrefetchQueueTest<TypeParam>::Produce, this));
+  Blob<TypeParam> top;
+  vector<Blob<TypeParam>*> top_vec(1, &top);
+  const int num_pop = 10;
+  for (int i = 0; i < num_pop; ++i) {
+    this->queue_.Pop(top_vec);
+    ASSERT_EQ(i + 2, top.num());
+    for (int k = 0; k < top.count(); ++k) {
+      EXPECT_EQ(i, top.cpu_data()[k]);
+    }
+  }
+  this->queue_.Stop();
+  producer.join();
+  EXPECT_EQ(num_pop, this->queue_.num_pop());
+  EXPECT_LE(this->queue_.num_stall(), num_pop);
+  EXPECT_GE(this->queue_.stall_time(), 0);
+}
+
+TYPED_TEST(PrefetchQueueTest, TestDroppedDiffStaysDropped) {
+  // as in inference, where the working blobs and the tops have no diff
+  this->working_->DropDiff();
+  this->queue_.Init(this->working_vec_, 2);
+  boost::thread producer(
+      boost::bind(&PrefetchQueueTest<TypeParam>::Produce, this));
+  Blob<TypeParam> top;
+  top.DropDiff();
+  vector<Blob<TypeParam>*> top_vec(1, &top);
+  for (int i = 0; i < 5; ++i) {
+    this->queue_.Pop(top_vec);
+    EXPECT_TRUE(top.diff_dropped());
+  }
+  this->queue_.Stop();
+  producer.join();
+  EXPECT_TRUE(this->working_->diff_dropped());
+}
+
+TYPED_TEST(PrefetchQueueTest, TestStopWakesProducer) {
+  // with a single batch and no Pop the second Push blocks until Stop
+  this->queue_.Init(this->working_vec_, 1);
+  boost::thread producer(
+      boost::bind(&PrefetchQueueTest<TypeParam>::Produce, this));
+  this->queue_.Stop();
+  producer.join();
+}
+
+}  // namespace caffe
@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/topk.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class TopKRecommenderTest : public ::testing::Test {
+ protected:
+  TopKRecommenderTest()
+      : num_user_(150), num_item_(5000), num_latent_(8), k_(10) {}
+
+  virtual void SetUp() {
+    Caffe::set_random_seed(1701);
+    Caffe::set_mode(Caffe::CPU);
+    // more items than one item block, more users than one user block
+    user_.Reshape(1, 1, num_user_, num_latent_);
+    item_.Reshape(1, 1, num_item_, num_latent_);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(&user_);
+    filler.Fill(&item_);
+    for (int i = 0; i < num_user_ * 2; ++i) {
+      users_.push_back((i * 7) % num_user_);
+    }
+  }
+
+  void InitRecommender(TopKRecommender<Dtype>* recommender) {
+    recommender->user_factor()->CopyFrom(user_, false, true);
+    recommender->item_factor()->CopyFrom(item_, false, true);
+    recommender->set_bias(0.5);
+  }
+
+  Dtype Score(const int userid, const int itemid) {
+    return caffe_cpu_dot(num_latent_, user_.cpu_data() + userid * num_latent_,
+        item_.cpu_data() + itemid * num_latent_) + 0.5;
+  }
+
+  void CheckTopK(const vector<int>& top_items,
+      const vector<Dtype>& top_scores) {
+    const Dtype kErrorBound = 1e-4;
+    ASSERT_EQ(users_.size() * k_, top_items.size());
+    ASSERT_EQ(users_.size() * k_, top_scores.size());
+    vector<Dtype> scores(num_item_);
+    for (int u = 0; u < users_.size(); ++u) {
+      for (int i = 0; i < num_item_; ++i) {
+        scores[i] = Score(users_[u], i);
+      }
+      std::partial_sort(scores.begin(), scores.begin() + k_, scores.end(),
+          std::greater<Dtype>());
+      for (int i = 0; i < k_; ++i) {
+        const int itemid = top_items[u * k_ + i];
+        EXPECT_NEAR(scores[i], top_scores[u * k_ + i], kErrorBound);
+        EXPECT_NEAR(Score(users_[u], itemid), top_scores[u * k_ + i],
+            kErrorBound);
+      }
+    }
+  }
+
+  int num_user_, num_item_, num_latent_, k_;
+  Blob<Dtype> user_, item_;
+  vector<int> users_;
+};
+
+TYPED_TEST_CASE(TopKRecommenderTest, TestDtypes);
+
+TYPED_TEST(TopKRecommenderTest, TestRecommend) {
+  TopKRecommender<TypeParam> recommender;
+  this->InitRecommender(&recommender);
+  vector<int> top_items;
+  vector<TypeParam> top_scores;
+  recommender.Recommend(&this->users_[0], this->users_.size(), this->k_,
+      &top_items, &top_scores);
+  this->CheckTopK(top_items, top_scores);
+}
+
+TYPED_TEST(TopKRecommenderTest, TestRecommendMultiThread) {
+  TopKRecommender<TypeParam> recommender(3);
+  this->InitRecommender(&recommender);
+  vector<int> top_items;
+  vector<TypeParam> top_scores;
+  recommender.Recommend(&this->users_[0], this->users_.size(), this->k_,
+      &top_items, &top_scores);
+  this->CheckTopK(top_items, top_scores);
+}
+
+TYPED_TEST(TopKRecommenderTest, TestCopyFrom) {
+  NetParameter net_param;
+  LayerParameter* layer = net_param.add_layers();
+  layer->set_name("mf");
+  layer->set_type(LayerParameter_LayerType_MATRIX_FACT);
+  layer->mutable_matrix_fact_param()->set_feature_weight(2);
+  this->user_.ToProto(layer->add_blobs());
+  this->item_.ToProto(layer->add_blobs());
+  Blob<TypeParam> bias(1, 1, 1, 1);
+  bias.mutable_cpu_data()[0] = 0.5;
+  bias.ToProto(layer->add_blobs());
+  TopKRecommender<TypeParam> recommender;
+  recommender.CopyFrom(net_param, "mf");
+  EXPECT_EQ(this->num_user_, recommender.num_user());
+  EXPECT_EQ(this->num_item_, recommender.num_item());
+  EXPECT_EQ(this->num_latent_, recommender.num_latent());
+  // the factors go through the float BlobProto
+  for (int i = 0; i < this->item_.count(); ++i) {
+    EXPECT_NEAR(2 * this->item_.cpu_data()[i],
+        recommender.item_factor()->cpu_data()[i], 1e-5);
+  }
+  // item features are added with img_weight, which defaults to 1
+  Blob<TypeParam> item_feature;
+  item_feature.ReshapeLike(this->item_);
+  caffe_set(item_feature.count(), TypeParam(1),
+      item_feature.mutable_cpu_data());
+  recommender.AddItemFeature(item_feature);
+  EXPECT_NEAR(2 * this->item_.cpu_data()[0] + 1,
+      recommender.item_factor()->cpu_data()[0], 1e-5);
+  vector<int> top_items;
+  vector<TypeParam> top_scores;
+  const int userid = 3;
+  recommender.Recommend(&userid, 1, 1, &top_items, &top_scores);
+  EXPECT_NEAR(caffe_cpu_dot(this->num_latent_,
+      recommender.user_factor()->cpu_data() + userid * this->num_latent_,
+      recommender.item_factor()->cpu_data() + top_items[0] * this->num_latent_)
+      + 0.5, top_scores[0], 1e-4);
+}
+
+}  // namespace caffe
@@ -0,0 +1,262 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <zlib.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/async_writer.hpp"
+
+namespace caffe {
+
+class AsyncWriter::sync {
+ public:
+  boost::mutex mutex_;
+  // signalled whenever a block is handed off or written
+  boost::condition_variable condition_;
+  boost::thread thread_;
+  FILE* file_;
+  gzFile gz_file_;
+};
+
+static inline size_t Padded(const size_t size) {
+  return (size + 7) / 8 * 8;
+}
+
+AsyncWriter::AsyncWriter(const string& filename, const bool binary,
+    const bool compress, const int block_size)
+    : filename_(filename), binary_(binary), block_size_(block_size),
+      sync_(new sync()), busy_(false), stopped_(false), entry_offset_(0) {
+  CHECK_GT(block_size, 0);
+  sync_->file_ = NULL;
+  sync_->gz_file_ = NULL;
+  if (compress) {
+    sync_->gz_file_ = gzopen(filename.c_str(), "ab");
+    CHECK(sync_->gz_file_) << "Failed to open " << filename;
+  } else {
+    sync_->file_ = fopen(filename.c_str(), "ab");
+    CHECK(sync_->file_) << "Failed to open " << filename;
+  }
+  filling_.reserve(block_size_);
+  pending_.reserve(block_size_);
+  sync_->thread_ = boost::thread(boost::bind(&AsyncWriter::ThreadEntry, this));
+}
+
+AsyncWriter::~AsyncWriter() {
+  Flush();
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    stopped_ = true;
+  }
+  sync_->condition_.notify_all();
+  sync_->thread_.join();
+  if (sync_->gz_file_) {
+    gzclose(sync_->gz_file_);
+  } else {
+    fclose(sync_->file_);
+  }
+}
+
+void AsyncWriter::Append(const void* data, const size_t size) {
+  const size_t offset = filling_.size();
+  filling_.resize(offset + Padded(size), 0);
+  if (size) {
+    memcpy(&filling_[offset], data, size);
+  }
+}
+
+void AsyncWriter::BeginRows(const int num, const char separator,
+    const bool trailing) {
+  if (filling_.size() >= block_size_) {
+    HandOff();
+  }
+  AsyncWriterEntry entry;
+  memset(&entry, 0, sizeof(entry));
+  entry.kind = AsyncWriterEntry::ROWS;
+  entry.num = num;
+  entry.separator = separator;
+  entry.trailing = trailing;
+  entry_offset_ = filling_.size();
+  Append(&entry, sizeof(entry));
+}
+
+void AsyncWriter::AddColumnGroup(const int type, const void* values,
+    const size_t size, const int width) {
+  AsyncWriterEntry* entry =
+      reinterpret_cast<AsyncWriterEntry*>(&filling_[entry_offset_]);
+  CHECK_EQ(entry->kind, AsyncWriterEntry::ROWS) << "AddColumns without rows";
+  ++entry->num_column;
+  AsyncWriterColumn column;
+  column.type = type;
+  column.width = width;
+  Append(&column, sizeof(column));
+  Append(values, entry->num * width * size);
+}
+
+void AsyncWriter::AddColumns(const int* values, const int width) {
+  AddColumnGroup(AsyncWriterColumn::INT32, values, sizeof(int), width);
+}
+
+void AsyncWriter::AddColumns(const float* values, const int width) {
+  AddColumnGroup(AsyncWriterColumn::FLOAT, values, sizeof(float), width);
+}
+
+void AsyncWriter::AddColumns(const double* values, const int width) {
+  AddColumnGroup(AsyncWriterColumn::DOUBLE, values, sizeof(double), width);
+}
+
+void AsyncWriter::WriteLine(const string& line) {
+  if (filling_.size() >= block_size_) {
+    HandOff();
+  }
+  AsyncWriterEntry entry;
+  memset(&entry, 0, sizeof(entry));
+  entry.kind = AsyncWriterEntry::LINE;
+  entry.num = line.size();
+  Append(&entry, sizeof(entry));
+  Append(line.data(), line.size());
+}
+
+void AsyncWriter::HandOff() {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  while (busy_) {
+    sync_->condition_.wait(lock);
+  }
+  filling_.swap(pending_);
+  busy_ = true;
+  sync_->condition_.notify_all();
+}
+
+void AsyncWriter::Flush() {
+  if (filling_.size()) {
+    HandOff();
+  }
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  while (busy_) {
+    sync_->condition_.wait(lock);
+  }
+  // the thread is idle until the next hand off
+  if (sync_->gz_file_) {
+    gzflush(sync_->gz_file_, Z_SYNC_FLUSH);
+  } else {
+    fflush(sync_->file_);
+  }
+}
+
+void AsyncWriter::ThreadEntry() {
+  while (true) {
+    {
+      boost::mutex::scoped_lock lock(sync_->mutex_);
+      while (!busy_ && !stopped_) {
+        sync_->condition_.wait(lock);
+      }
+      if (!busy_) {
+        return;
+      }
+    }
+    // pending_ belongs to this thread until busy_ is cleared
+    WriteBlock(pending_);
+    pending_.clear();
+    {
+      boost::mutex::scoped_lock lock(sync_->mutex_);
+      busy_ = false;
+    }
+    sync_->condition_.notify_all();
+  }
+}
+
+// Formats value as std::ostream does by default, and returns its length.
+static inline int Format(char* out, const int value) {
+  return snprintf(out, 32, "%d", value);
+}
+static inline int Format(char* out, const double value) {
+  return snprintf(out, 32, "%g", value);
+}
+
+template <typename T>
+static void FormatRow(const char* values, const int row, const int width,
+    const char separator, bool* first, vector<char>* text) {
+  char buffer[32];
+  for (int j = 0; j < width; ++j) {
+    if (!*first) {
+      text->push_back(separator);
+    }
+    *first = false;
+    T value;
+    memcpy(&value, values + (row * width + j) * sizeof(T), sizeof(T));
+    const int length = Format(buffer, value);
+    text->insert(text->end(), buffer, buffer + length);
+  }
+}
+
+void AsyncWriter::WriteBlock(const vector<char>& block) {
+  const char* data = block.empty() ? NULL : &block[0];
+  size_t size = block.size();
+  if (!binary_) {
+    text_.clear();
+    size_t offset = 0;
+    while (offset < block.size()) {
+      AsyncWriterEntry entry;
+      memcpy(&entry, data + offset, sizeof(entry));
+      offset += Padded(sizeof(entry));
+      if (entry.kind == AsyncWriterEntry::LINE) {
+        text_.insert(text_.end(), data + offset, data + offset + entry.num);
+        text_.push_back('\n');
+        offset += Padded(entry.num);
+        continue;
+      }
+      vector<AsyncWriterColumn> columns(entry.num_column);
+      vector<const char*> values(entry.num_column);
+      for (int g = 0; g < entry.num_column; ++g) {
+        memcpy(&columns[g], data + offset, sizeof(columns[g]));
+        offset += Padded(sizeof(columns[g]));
+        values[g] = data + offset;
+        const size_t value_size =
+            columns[g].type == AsyncWriterColumn::DOUBLE ? sizeof(double) : 4;
+        offset += Padded(entry.num * columns[g].width * value_size);
+      }
+      for (int i = 0; i < entry.num; ++i) {
+        bool first = true;
+        for (int g = 0; g < entry.num_column; ++g) {
+          switch (columns[g].type) {
+          case AsyncWriterColumn::INT32:
+            FormatRow<int>(values[g], i, columns[g].width, entry.separator,
+                &first, &text_);
+            break;
+          case AsyncWriterColumn::FLOAT:
+            FormatRow<float>(values[g], i, columns[g].width, entry.separator,
+                &first, &text_);
+            break;
+          case AsyncWriterColumn::DOUBLE:
+            FormatRow<double>(values[g], i, columns[g].width, entry.separator,
+                &first, &text_);
+            break;
+          default:
+            LOG(FATAL) << "Unknown column type " << columns[g].type;
+          }
+        }
+        if (entry.trailing) {
+          text_.push_back(entry.separator);
+        }
+        text_.push_back('\n');
+      }
+    }
+    data = text_.empty() ? NULL : &text_[0];
+    size = text_.size();
+  }
+  if (!size) {
+    return;
+  }
+  if (sync_->gz_file_) {
+    CHECK_EQ(gzwrite(sync_->gz_file_, data, size), size)
+        << "Failed to write " << filename_;
+  } else {
+    CHECK_EQ(fwrite(data, 1, size, sync_->file_), size)
+        << "Failed to write " << filename_;
+  }
+}
+
+}  // namespace caffe
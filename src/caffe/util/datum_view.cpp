@@ -0,0 +1,192 @@
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+#include <stdint.h>
+
+#include <cstring>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/datum_view.hpp"
+
+namespace caffe {
+
+using google::protobuf::io::CodedInputStream;
+using google::protobuf::internal::WireFormatLite;
+
+// Reads the bytes of a length delimited field without copying them.
+static bool ReadBytes(CodedInputStream* input, const char** bytes,
+    int* size) {
+  uint32_t length;
+  if (!input->ReadVarint32(&length)) {
+    return false;
+  }
+  if (length == 0) {
+    *bytes = NULL;
+    *size = 0;
+    return true;
+  }
+  const void* pointer;
+  int available;
+  // the input is an array, so the rest of it is directly available
+  if (!input->GetDirectBufferPointer(&pointer, &available) ||
+      available < static_cast<int>(length)) {
+    return false;
+  }
+  *bytes = static_cast<const char*>(pointer);
+  *size = length;
+  return input->Skip(length);
+}
+
+// Appends a repeated int32 field, packed or not.
+static bool ReadInt32(CodedInputStream* input, const uint32_t tag,
+    vector<int>* values) {
+  uint32_t value;
+  if (WireFormatLite::GetTagWireType(tag) == WireFormatLite::WIRETYPE_VARINT) {
+    if (!input->ReadVarint32(&value)) {
+      return false;
+    }
+    values->push_back(static_cast<int32_t>(value));
+    return true;
+  }
+  uint32_t length;
+  if (WireFormatLite::GetTagWireType(tag) !=
+      WireFormatLite::WIRETYPE_LENGTH_DELIMITED ||
+      !input->ReadVarint32(&length)) {
+    return false;
+  }
+  const CodedInputStream::Limit limit = input->PushLimit(length);
+  while (input->BytesUntilLimit() > 0) {
+    if (!input->ReadVarint32(&value)) {
+      return false;
+    }
+    values->push_back(static_cast<int32_t>(value));
+  }
+  input->PopLimit(limit);
+  return true;
+}
+
+// Appends a repeated float field, packed or not.
+static bool ReadFloat(CodedInputStream* input, const uint32_t tag,
+    vector<float>* values) {
+  uint32_t bits;
+  float value;
+  if (WireFormatLite::GetTagWireType(tag) == WireFormatLite::WIRETYPE_FIXED32) {
+    if (!input->ReadLittleEndian32(&bits)) {
+      return false;
+    }
+    memcpy(&value, &bits, sizeof(value));
+    values->push_back(value);
+    return true;
+  }
+  uint32_t length;
+  if (WireFormatLite::GetTagWireType(tag) !=
+      WireFormatLite::WIRETYPE_LENGTH_DELIMITED ||
+      !input->ReadVarint32(&length)) {
+    return false;
+  }
+  const CodedInputStream::Limit limit = input->PushLimit(length);
+  while (input->BytesUntilLimit() > 0) {
+    if (!input->ReadLittleEndian32(&bits)) {
+      return false;
+    }
+    memcpy(&value, &bits, sizeof(value));
+    values->push_back(value);
+  }
+  input->PopLimit(limit);
+  return true;
+}
+
+void DatumView::Clear() {
+  channels = 0;
+  height = 0;
+  width = 0;
+  label = 0;
+  data = NULL;
+  data_size = 0;
+  buffer = NULL;
+  size = 0;
+}
+
+bool DatumView::Parse(const char* buffer, const int size) {
+  Clear();
+  this->buffer = buffer;
+  this->size = size;
+  CodedInputStream input(reinterpret_cast<const uint8_t*>(buffer), size);
+  uint32_t tag, value;
+  const char* bytes;
+  int length;
+  // the field numbers of Datum in caffe.proto
+  while ((tag = input.ReadTag()) != 0) {
+    switch (WireFormatLite::GetTagFieldNumber(tag)) {
+    case 1:
+    case 2:
+    case 3:
+    case 5:
+      if (WireFormatLite::GetTagWireType(tag) !=
+          WireFormatLite::WIRETYPE_VARINT || !input.ReadVarint32(&value)) {
+        return false;
+      }
+      switch (WireFormatLite::GetTagFieldNumber(tag)) {
+      case 1: channels = static_cast<int32_t>(value); break;
+      case 2: height = static_cast<int32_t>(value); break;
+      case 3: width = static_cast<int32_t>(value); break;
+      default: label = static_cast<int32_t>(value); break;
+      }
+      break;
+    case 4:
+      if (WireFormatLite::GetTagWireType(tag) !=
+          WireFormatLite::WIRETYPE_LENGTH_DELIMITED ||
+          !ReadBytes(&input, &bytes, &length)) {
+        return false;
+      }
+      data = length ? reinterpret_cast<const uint8_t*>(bytes) : NULL;
+      data_size = length;
+      break;
+    default:
+      // float_data, and any field caffe.proto may add later
+      if (!WireFormatLite::SkipField(&input, tag)) {
+        return false;
+      }
+    }
+  }
+  return input.ConsumedEntireMessage();
+}
+
+bool DatumInteractionView::Parse(const char* buffer, const int size) {
+  datum.Clear();
+  itemid.clear();
+  userid.clear();
+  rating.clear();
+  CodedInputStream input(reinterpret_cast<const uint8_t*>(buffer), size);
+  uint32_t tag;
+  const char* bytes;
+  int length;
+  // the field numbers of DatumInteraction in caffe.proto
+  while ((tag = input.ReadTag()) != 0) {
+    bool ok;
+    switch (WireFormatLite::GetTagFieldNumber(tag)) {
+    case 1:
+      ok = WireFormatLite::GetTagWireType(tag) ==
+          WireFormatLite::WIRETYPE_LENGTH_DELIMITED &&
+          ReadBytes(&input, &bytes, &length) && datum.Parse(bytes, length);
+      break;
+    case 7:
+      ok = ReadInt32(&input, tag, &itemid);
+      break;
+    case 8:
+      ok = ReadInt32(&input, tag, &userid);
+      break;
+    case 9:
+      ok = ReadFloat(&input, tag, &rating);
+      break;
+    default:
+      ok = WireFormatLite::SkipField(&input, tag);
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+  return input.ConsumedEntireMessage();
+}
+
+}  // namespace caffe
@@ -0,0 +1,138 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/interaction_file.hpp"
+
+namespace caffe {
+
+static const char kMagic[8] = {'C', 'A', 'F', 'F', 'E', 'I', 'T', 'A'};
+static const int32_t kVersion = 1;
+
+// The images end at an arbitrary byte; the columns after them start at the
+// next multiple of 8.
+static int64_t RatingStartOffset(const InteractionFileHeader& header) {
+  const int64_t image_end = sizeof(header) + header.num_record *
+      header.channels * header.height * header.width;
+  return (image_end + 7) / 8 * 8;
+}
+
+InteractionFile::InteractionFile(const string& filename)
+    : size_(0), map_(NULL) {
+  const int fd = open(filename.c_str(), O_RDONLY);
+  CHECK_NE(fd, -1) << "Failed to open " << filename;
+  struct stat file_stat;
+  CHECK_EQ(fstat(fd, &file_stat), 0) << "Failed to stat " << filename;
+  size_ = file_stat.st_size;
+  CHECK_GE(size_, sizeof(InteractionFileHeader))
+      << filename << " is not an interaction file";
+  map_ = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  CHECK(map_ != MAP_FAILED) << "Failed to map " << filename;
+
+  header_ = static_cast<const InteractionFileHeader*>(map_);
+  CHECK_EQ(memcmp(header_->magic, kMagic, sizeof(kMagic)), 0)
+      << filename << " is not an interaction file";
+  CHECK_EQ(header_->version, kVersion)
+      << "Unsupported interaction file version " << header_->version;
+  const char* base = static_cast<const char*>(map_);
+  image_ = reinterpret_cast<const uint8_t*>(base + sizeof(*header_));
+  int64_t offset = RatingStartOffset(*header_);
+  rating_start_ = reinterpret_cast<const int64_t*>(base + offset);
+  offset += (num_record() + 1) * sizeof(int64_t);
+  label_ = reinterpret_cast<const int*>(base + offset);
+  offset += num_record() * sizeof(int);
+  itemid_ = reinterpret_cast<const int*>(base + offset);
+  offset += num_rating() * sizeof(int);
+  userid_ = reinterpret_cast<const int*>(base + offset);
+  offset += num_rating() * sizeof(int);
+  rating_ = reinterpret_cast<const float*>(base + offset);
+  offset += num_rating() * sizeof(float);
+  CHECK_EQ(offset, static_cast<int64_t>(size_))
+      << filename << " has the wrong size";
+  CHECK_EQ(rating_start_[num_record()], num_rating());
+}
+
+InteractionFile::~InteractionFile() {
+  munmap(map_, size_);
+}
+
+template <typename T>
+static void WriteColumn(const vector<T>& column, std::ofstream* file) {
+  if (column.size()) {
+    file->write(reinterpret_cast<const char*>(&column[0]),
+        column.size() * sizeof(T));
+  }
+}
+
+InteractionFileWriter::InteractionFileWriter(const string& filename)
+    : file_(filename.c_str(),
+        std::ios::out | std::ios::binary | std::ios::trunc) {
+  CHECK(file_.good()) << "Failed to open " << filename;
+  memset(&header_, 0, sizeof(header_));
+  memcpy(header_.magic, kMagic, sizeof(kMagic));
+  header_.version = kVersion;
+  // written again by Close() once the counts are known
+  file_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+  rating_start_.push_back(0);
+}
+
+InteractionFileWriter::~InteractionFileWriter() {
+  if (file_.is_open()) {
+    Close();
+  }
+}
+
+void InteractionFileWriter::Add(const DatumInteraction& record) {
+  const Datum& datum = record.datum();
+  if (label_.empty()) {
+    header_.channels = datum.channels();
+    header_.height = datum.height();
+    header_.width = datum.width();
+  } else {
+    CHECK_EQ(datum.channels(), header_.channels) << "Image shape changed";
+    CHECK_EQ(datum.height(), header_.height) << "Image shape changed";
+    CHECK_EQ(datum.width(), header_.width) << "Image shape changed";
+  }
+  const int image_size = header_.channels * header_.height * header_.width;
+  CHECK_EQ(datum.data().size(), image_size)
+      << "Only uint8 images are supported";
+  CHECK_EQ(record.userid_size(), record.itemid_size())
+      << "userid and itemid have different length";
+  CHECK_EQ(record.userid_size(), record.rating_size())
+      << "userid and rating have different length";
+  file_.write(datum.data().data(), image_size);
+  label_.push_back(datum.label());
+  itemid_.insert(itemid_.end(), record.itemid().begin(),
+      record.itemid().end());
+  userid_.insert(userid_.end(), record.userid().begin(),
+      record.userid().end());
+  rating_.insert(rating_.end(), record.rating().begin(),
+      record.rating().end());
+  rating_start_.push_back(rating_.size());
+}
+
+void InteractionFileWriter::Close() {
+  header_.num_record = num_record();
+  header_.num_rating = num_rating();
+  const int64_t image_end = file_.tellp();
+  const vector<char> padding(RatingStartOffset(header_) - image_end, 0);
+  WriteColumn(padding, &file_);
+  WriteColumn(rating_start_, &file_);
+  WriteColumn(label_, &file_);
+  WriteColumn(itemid_, &file_);
+  WriteColumn(userid_, &file_);
+  WriteColumn(rating_, &file_);
+  file_.seekp(0);
+  file_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+  file_.close();
+  CHECK(!file_.fail()) << "Failed to write the interaction file";
+}
+
+}  // namespace caffe
@@ -9,8 +9,12 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include <stdint.h>
 
+#include <boost/thread.hpp>
+#include <boost/weak_ptr.hpp>
+
 #include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
+#include <map>
 #include <string>
 #include <vector>
 #include <iostream>
@@ -193,6 +197,25 @@ leveldb::Options GetLevelDBOptions() {
   return options;
 }
 
+shared_ptr<leveldb::DB> OpenSharedLevelDB(const string& source) {
+  static boost::mutex mutex;
+  static std::map<string, boost::weak_ptr<leveldb::DB> > open_dbs;
+  boost::mutex::scoped_lock lock(mutex);
+  shared_ptr<leveldb::DB> db = open_dbs[source].lock();
+  if (!db) {
+    leveldb::DB* db_temp;
+    leveldb::Options options = GetLevelDBOptions();
+    options.create_if_missing = false;
+    LOG(INFO) << "Opening leveldb " << source;
+    leveldb::Status status = leveldb::DB::Open(options, source, &db_temp);
+    CHECK(status.ok()) << "Failed to open leveldb " << source << std::endl
+                       << status.ToString();
+    db.reset(db_temp);
+    open_dbs[source] = db;
+  }
+  return db;
+}
+
 // Verifies format of data stored in HDF5 file and reshapes blob accordingly.
 template <typename Dtype>
 void hdf5_load_nd_dataset_helper(
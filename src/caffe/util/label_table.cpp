@@ -0,0 +1,125 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/label_table.hpp"
+
+namespace caffe {
+
+static const char kMagic[8] = {'C', 'A', 'F', 'F', 'E', 'L', 'B', 'L'};
+static const int32_t kVersion = 1;
+
+// The ids end at a multiple of 4; the labels start at the next multiple of 8.
+static int64_t LabelOffset(const LabelTableHeader& header) {
+  const int64_t id_end = sizeof(header) + header.num_row * sizeof(int32_t);
+  return (id_end + 7) / 8 * 8;
+}
+
+LabelTable::LabelTable(const string& filename)
+    : size_(0), map_(NULL), dense_(false) {
+  const int fd = open(filename.c_str(), O_RDONLY);
+  CHECK_NE(fd, -1) << "Failed to open " << filename;
+  struct stat file_stat;
+  CHECK_EQ(fstat(fd, &file_stat), 0) << "Failed to stat " << filename;
+  size_ = file_stat.st_size;
+  CHECK_GE(size_, sizeof(LabelTableHeader))
+      << filename << " is not a label table";
+  map_ = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  CHECK(map_ != MAP_FAILED) << "Failed to map " << filename;
+
+  header_ = static_cast<const LabelTableHeader*>(map_);
+  CHECK_EQ(memcmp(header_->magic, kMagic, sizeof(kMagic)), 0)
+      << filename << " is not a label table";
+  CHECK_EQ(header_->version, kVersion)
+      << "Unsupported label table version " << header_->version;
+  CHECK_GT(header_->label_dim, 0);
+  const char* base = static_cast<const char*>(map_);
+  id_ = reinterpret_cast<const int*>(base + sizeof(*header_));
+  const int64_t offset = LabelOffset(*header_);
+  label_ = reinterpret_cast<const float*>(base + offset);
+  CHECK_EQ(offset + num_row() * label_dim() * sizeof(float),
+      static_cast<int64_t>(size_)) << filename << " has the wrong size";
+  // the ids are strictly increasing, so the first and last decide
+  dense_ = num_row() > 0 &&
+      static_cast<int64_t>(id_[num_row() - 1]) - id_[0] == num_row() - 1;
+}
+
+LabelTable::~LabelTable() {
+  munmap(map_, size_);
+}
+
+LabelTableWriter::LabelTableWriter(const string& filename,
+    const int label_dim)
+    : filename_(filename), label_dim_(label_dim), closed_(false) {
+  CHECK_GT(label_dim, 0);
+}
+
+LabelTableWriter::~LabelTableWriter() {
+  if (!closed_) {
+    Close();
+  }
+}
+
+void LabelTableWriter::Add(const int id, const float* label) {
+  id_.push_back(id);
+  label_.insert(label_.end(), label, label + label_dim_);
+}
+
+// Orders row indices by the id of the row.
+class IdLess {
+ public:
+  explicit IdLess(const vector<int>& id) : id_(id) {}
+  bool operator()(const int64_t a, const int64_t b) const {
+    return id_[a] < id_[b];
+  }
+
+ private:
+  const vector<int>& id_;
+};
+
+void LabelTableWriter::Close() {
+  closed_ = true;
+  vector<int64_t> order(num_row());
+  for (int64_t i = 0; i < num_row(); ++i) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), IdLess(id_));
+
+  std::ofstream file(filename_.c_str(),
+      std::ios::out | std::ios::binary | std::ios::trunc);
+  CHECK(file.good()) << "Failed to open " << filename_;
+  LabelTableHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.label_dim = label_dim_;
+  header.num_row = num_row();
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (int64_t i = 0; i < num_row(); ++i) {
+    const int id = id_[order[i]];
+    CHECK(i == 0 || id != id_[order[i - 1]]) << "Duplicate label id " << id;
+    file.write(reinterpret_cast<const char*>(&id), sizeof(id));
+  }
+  const vector<char> padding(
+      LabelOffset(header) - static_cast<int64_t>(file.tellp()), 0);
+  if (padding.size()) {
+    file.write(&padding[0], padding.size());
+  }
+  for (int64_t i = 0; i < num_row(); ++i) {
+    file.write(reinterpret_cast<const char*>(&label_[order[i] * label_dim_]),
+        label_dim_ * sizeof(float));
+  }
+  file.close();
+  CHECK(!file.fail()) << "Failed to write the label table";
+}
+
+}  // namespace caffe
@@ -1,6 +1,7 @@
 #include <boost/math/special_functions/next.hpp>
 #include <boost/random.hpp>
 
+#include <algorithm>
 #include <limits>
 
 #include "caffe/common.hpp"
@@ -216,6 +217,18 @@ void caffe_abs<double>(const int n, const double* a, double* y) {
     vdAbs(n, a, y);
 }
 
+template <typename Dtype>
+void caffe_relu(const int n, const Dtype negative_slope, Dtype* x) {
+  for (int i = 0; i < n; ++i) {
+    x[i] = std::max(x[i], Dtype(0)) + negative_slope * std::min(x[i], Dtype(0));
+  }
+}
+
+template void caffe_relu<float>(const int n, const float negative_slope,
+    float* x);
+template void caffe_relu<double>(const int n, const double negative_slope,
+    double* x);
+
 unsigned int caffe_rng_rand() {
   return (*caffe_rng())();
 }
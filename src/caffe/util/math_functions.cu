@@ -302,6 +302,30 @@ void caffe_gpu_abs<double>(const int N, const double* a, double* y) {
       N, a, y);
 }
 
+template <typename Dtype>
+__global__ void relu_kernel(const int n, const Dtype negative_slope,
+    Dtype* x) {
+  CUDA_KERNEL_LOOP(index, n) {
+    x[index] = x[index] > 0 ? x[index] : x[index] * negative_slope;
+  }
+}
+
+template <>
+void caffe_gpu_relu<float>(const int N, const float negative_slope,
+    float* x) {
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  relu_kernel<float><<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS>>>(
+      N, negative_slope, x);
+}
+
+template <>
+void caffe_gpu_relu<double>(const int N, const double negative_slope,
+    double* x) {
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  relu_kernel<double><<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS>>>(
+      N, negative_slope, x);
+}
+
 
 template <typename Dtype>
 __global__ void powx_kernel(const int n, const Dtype* a,
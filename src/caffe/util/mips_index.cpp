@@ -0,0 +1,282 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/mips_index.hpp"
+#include "caffe/util/rng.hpp"
+
+namespace caffe {
+
+// Items assigned to centroids per gemm while clustering, and queries scored
+// against the centroids per gemm while searching.
+static const int kItemBlock = 1024;
+static const int kQueryBlock = 64;
+
+template <typename Dtype>
+MIPSIndex<Dtype>::MIPSIndex(const int num_threads)
+    : num_threads_(num_threads), bias_(0) {
+  CHECK_GE(num_threads_, 1) << "num_threads should be at least 1";
+}
+
+template <typename Dtype>
+void MIPSIndex<Dtype>::Build(const Blob<Dtype>& item, const int num_list,
+    const int num_iter, const Dtype bias) {
+  const int num_item = item.count() / item.width();
+  const int dim = item.width();
+  const int mapped_dim = dim + 1;
+  CHECK_GT(num_list, 0);
+  CHECK_LE(num_list, num_item) << "More lists than items";
+  CHECK_GE(num_iter, 0);
+  bias_ = bias;
+
+  // map every item to [x, sqrt(M^2 - |x|^2)]
+  const Dtype* item_data = item.cpu_data();
+  vector<Dtype> mapped(num_item * mapped_dim);
+  Dtype max_norm2 = 0;
+  for (int i = 0; i < num_item; ++i) {
+    const Dtype* x = item_data + i * dim;
+    mapped[i * mapped_dim + dim] = caffe_cpu_dot(dim, x, x);
+    max_norm2 = std::max(max_norm2, mapped[i * mapped_dim + dim]);
+  }
+  for (int i = 0; i < num_item; ++i) {
+    Dtype* x = &mapped[i * mapped_dim];
+    const Dtype norm2 = x[dim];
+    caffe_copy(dim, item_data + i * dim, x);
+    x[dim] = sqrt(std::max(Dtype(0), max_norm2 - norm2));
+  }
+
+  // k-means, seeded with distinct random items. All mapped items have the
+  // same norm, so the nearest centroid c maximizes x.c - |c|^2 / 2.
+  vector<int> order(num_item);
+  for (int i = 0; i < num_item; ++i) {
+    order[i] = i;
+  }
+  shuffle(order.begin(), order.end());
+  vector<Dtype> center(num_list * mapped_dim);
+  for (int l = 0; l < num_list; ++l) {
+    caffe_copy(mapped_dim, &mapped[order[l] * mapped_dim],
+        &center[l * mapped_dim]);
+  }
+  vector<Dtype> half_norm(num_list);
+  vector<Dtype> score(kItemBlock * num_list);
+  vector<int> assign(num_item);
+  vector<int> list_size(num_list);
+  for (int iter = 0; ; ++iter) {
+    for (int l = 0; l < num_list; ++l) {
+      const Dtype* c = &center[l * mapped_dim];
+      half_norm[l] = caffe_cpu_dot(mapped_dim, c, c) / 2;
+    }
+    for (int begin = 0; begin < num_item; begin += kItemBlock) {
+      const int block_size = std::min(kItemBlock, num_item - begin);
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, block_size, num_list,
+          mapped_dim, (Dtype)1., &mapped[begin * mapped_dim], &center[0],
+          (Dtype)0., &score[0]);
+      for (int i = 0; i < block_size; ++i) {
+        const Dtype* item_score = &score[i * num_list];
+        int best = 0;
+        for (int l = 1; l < num_list; ++l) {
+          if (item_score[l] - half_norm[l] >
+              item_score[best] - half_norm[best]) {
+            best = l;
+          }
+        }
+        assign[begin + i] = best;
+      }
+    }
+    if (iter == num_iter) {
+      break;
+    }
+    caffe_set(num_list * mapped_dim, Dtype(0), &center[0]);
+    std::fill(list_size.begin(), list_size.end(), 0);
+    for (int i = 0; i < num_item; ++i) {
+      caffe_axpy(mapped_dim, Dtype(1), &mapped[i * mapped_dim],
+          &center[assign[i] * mapped_dim]);
+      ++list_size[assign[i]];
+    }
+    for (int l = 0; l < num_list; ++l) {
+      if (list_size[l]) {
+        caffe_scal(mapped_dim, Dtype(1) / list_size[l],
+            &center[l * mapped_dim]);
+      } else {
+        // reseed an empty list with a random item
+        caffe_copy(mapped_dim,
+            &mapped[(caffe_rng_rand() % num_item) * mapped_dim],
+            &center[l * mapped_dim]);
+      }
+    }
+    DLOG(INFO) << "k-means iteration " << iter << " done";
+  }
+
+  // lay the items out list by list
+  list_start_.assign(num_list + 1, 0);
+  for (int i = 0; i < num_item; ++i) {
+    ++list_start_[assign[i] + 1];
+  }
+  for (int l = 0; l < num_list; ++l) {
+    list_start_[l + 1] += list_start_[l];
+  }
+  list_item_.resize(num_item);
+  vector<int> cursor(list_start_.begin(), list_start_.end() - 1);
+  for (int i = 0; i < num_item; ++i) {
+    list_item_[cursor[assign[i]]++] = i;
+  }
+  item_.Reshape(1, 1, num_item, dim);
+  Dtype* list_item_data = item_.mutable_cpu_data();
+  for (int i = 0; i < num_item; ++i) {
+    caffe_copy(dim, item_data + list_item_[i] * dim, list_item_data + i * dim);
+  }
+  centroid_.Reshape(1, 1, num_list, dim);
+  Dtype* centroid_data = centroid_.mutable_cpu_data();
+  for (int l = 0; l < num_list; ++l) {
+    caffe_copy(dim, &center[l * mapped_dim], centroid_data + l * dim);
+  }
+  centroid_half_norm_ = half_norm;
+  int max_list_size = 0;
+  for (int l = 0; l < num_list; ++l) {
+    max_list_size = std::max(max_list_size, list_start_[l+1] - list_start_[l]);
+  }
+  LOG(INFO) << "Indexed " << num_item << " items in " << num_list
+            << " lists, largest list " << max_list_size;
+}
+
+template <typename Dtype>
+void MIPSIndex<Dtype>::FromProto(const MIPSIndexProto& proto) {
+  centroid_.FromProto(proto.centroid());
+  item_.FromProto(proto.item());
+  CHECK_EQ(centroid_.width(), item_.width());
+  CHECK_EQ(proto.centroid_half_norm_size(), num_list());
+  CHECK_EQ(proto.list_start_size(), num_list() + 1);
+  CHECK_EQ(proto.list_item_size(), num_item());
+  centroid_half_norm_.assign(proto.centroid_half_norm().begin(),
+      proto.centroid_half_norm().end());
+  list_start_.assign(proto.list_start().begin(), proto.list_start().end());
+  list_item_.assign(proto.list_item().begin(), proto.list_item().end());
+  bias_ = proto.bias();
+}
+
+template <typename Dtype>
+void MIPSIndex<Dtype>::ToProto(MIPSIndexProto* proto) const {
+  proto->Clear();
+  centroid_.ToProto(proto->mutable_centroid());
+  item_.ToProto(proto->mutable_item());
+  for (int l = 0; l < num_list(); ++l) {
+    proto->add_centroid_half_norm(centroid_half_norm_[l]);
+  }
+  for (int l = 0; l <= num_list(); ++l) {
+    proto->add_list_start(list_start_[l]);
+  }
+  for (int i = 0; i < num_item(); ++i) {
+    proto->add_list_item(list_item_[i]);
+  }
+  proto->set_bias(bias_);
+}
+
+template <typename Dtype>
+void MIPSIndex<Dtype>::Search(const Dtype* queries, const int num_query,
+    const int k, const int nprobe, vector<int>* top_items,
+    vector<Dtype>* top_scores) const {
+  CHECK_GT(k, 0);
+  CHECK_GT(nprobe, 0);
+  top_items->resize(num_query * k);
+  top_scores->resize(num_query * k);
+  if (num_query == 0) {
+    return;
+  }
+  const int thread_queries = (num_query + num_threads_ - 1) / num_threads_;
+  if (num_threads_ == 1 || num_query < 2 * kQueryBlock) {
+    SearchRange(queries, k, nprobe, &(*top_items)[0], &(*top_scores)[0],
+        0, num_query);
+    return;
+  }
+  boost::thread_group threads;
+  for (int begin = thread_queries; begin < num_query;
+      begin += thread_queries) {
+    threads.create_thread(boost::bind(&MIPSIndex<Dtype>::SearchRange, this,
+        queries, k, nprobe, &(*top_items)[0], &(*top_scores)[0], begin,
+        std::min(num_query, begin + thread_queries)));
+  }
+  SearchRange(queries, k, nprobe, &(*top_items)[0], &(*top_scores)[0],
+      0, thread_queries);
+  threads.join_all();
+}
+
+template <typename Dtype>
+void MIPSIndex<Dtype>::SearchRange(const Dtype* queries, const int k,
+    const int nprobe, int* top_items, Dtype* top_scores,
+    const int query_begin, const int query_end) const {
+  typedef std::pair<Dtype, int> ScoredItem;
+  typedef std::greater<ScoredItem> MinFirst;
+  const int dim = num_latent();
+  const int num_probe = std::min(nprobe, num_list());
+  const Dtype* centroid = centroid_.cpu_data();
+  const Dtype* item = item_.cpu_data();
+  int max_list_size = 0;
+  for (int l = 0; l < num_list(); ++l) {
+    max_list_size = std::max(max_list_size, list_start_[l+1] - list_start_[l]);
+  }
+  vector<Dtype> list_score(kQueryBlock * num_list());
+  vector<ScoredItem> nearest(num_list());
+  vector<Dtype> item_score(max_list_size);
+  vector<ScoredItem> heap;
+  heap.reserve(k);
+  for (int block = query_begin; block < query_end; block += kQueryBlock) {
+    const int block_size = std::min(kQueryBlock, query_end - block);
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, block_size, num_list(),
+        dim, (Dtype)1., queries + block * dim, centroid, (Dtype)0.,
+        &list_score[0]);
+    for (int q = 0; q < block_size; ++q) {
+      const Dtype* query = queries + (block + q) * dim;
+      for (int l = 0; l < num_list(); ++l) {
+        nearest[l] = ScoredItem(
+            list_score[q * num_list() + l] - centroid_half_norm_[l], l);
+      }
+      std::partial_sort(nearest.begin(), nearest.begin() + num_probe,
+          nearest.end(), MinFirst());
+      heap.clear();
+      for (int p = 0; p < num_probe; ++p) {
+        const int list = nearest[p].second;
+        const int start = list_start_[list];
+        const int size = list_start_[list + 1] - start;
+        if (size == 0) {
+          continue;
+        }
+        caffe_cpu_gemv<Dtype>(CblasNoTrans, size, dim, (Dtype)1.,
+            item + start * dim, query, (Dtype)0., &item_score[0]);
+        for (int i = 0; i < size; ++i) {
+          if (static_cast<int>(heap.size()) < k) {
+            heap.push_back(ScoredItem(item_score[i], list_item_[start + i]));
+            std::push_heap(heap.begin(), heap.end(), MinFirst());
+          } else if (item_score[i] > heap.front().first) {
+            std::pop_heap(heap.begin(), heap.end(), MinFirst());
+            heap.back() = ScoredItem(item_score[i], list_item_[start + i]);
+            std::push_heap(heap.begin(), heap.end(), MinFirst());
+          }
+        }
+      }
+      // sorting by MinFirst leaves the best item first
+      std::sort_heap(heap.begin(), heap.end(), MinFirst());
+      const int offset = (block + q) * k;
+      for (int i = 0; i < k; ++i) {
+        if (i < static_cast<int>(heap.size())) {
+          top_items[offset + i] = heap[i].second;
+          top_scores[offset + i] = heap[i].first + bias_;
+        } else {
+          top_items[offset + i] = -1;
+          top_scores[offset + i] = -std::numeric_limits<Dtype>::max();
+        }
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(MIPSIndex);
+
+}  // namespace caffe
@@ -0,0 +1,98 @@
+#include <boost/bind.hpp>
+#include <stdint.h>
+
+#include "caffe/common.hpp"
+#include "caffe/util/parallel.hpp"
+
+namespace caffe {
+
+WorkerPool::WorkerPool()
+    : task_(NULL), num_task_(0), generation_(0), pending_(0),
+      stopped_(false) {
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stopped_ = true;
+  }
+  start_.notify_all();
+  for (int i = 0; i < workers_.size(); ++i) {
+    workers_[i]->join();
+  }
+}
+
+void WorkerPool::Reserve(const int num_task) {
+  // between runs, so generation_ is stable
+  while (capacity() < num_task) {
+    workers_.push_back(shared_ptr<boost::thread>(new boost::thread(
+        boost::bind(&WorkerPool::WorkerLoop, this, capacity(),
+        generation_))));
+  }
+}
+
+void WorkerPool::WorkerLoop(const int task_id, int generation) {
+  while (true) {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while (generation_ == generation && !stopped_) {
+        start_.wait(lock);
+      }
+      if (stopped_) {
+        return;
+      }
+      generation = generation_;
+      if (task_id >= num_task_) {
+        continue;  // not needed by this run
+      }
+    }
+    (*task_)(task_id);
+    boost::mutex::scoped_lock lock(mutex_);
+    if (--pending_ == 0) {
+      done_.notify_one();
+    }
+  }
+}
+
+void WorkerPool::Run(const int num_task,
+    const boost::function<void(int)>& task) {
+  CHECK_LE(num_task, capacity()) << "Reserve the workers of the run first";
+  if (num_task <= 1) {
+    if (num_task == 1) {
+      task(0);
+    }
+    return;
+  }
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    task_ = &task;
+    num_task_ = num_task;
+    pending_ = num_task - 1;
+    ++generation_;
+  }
+  start_.notify_all();
+  task(0);
+  boost::mutex::scoped_lock lock(mutex_);
+  while (pending_ > 0) {
+    done_.wait(lock);
+  }
+  task_ = NULL;
+}
+
+static void RunSlice(const boost::function<void(int, int, int)>& func,
+    const int n, const int num_slice, const int slice) {
+  func(static_cast<int>(static_cast<int64_t>(n) * slice / num_slice),
+      static_cast<int>(static_cast<int64_t>(n) * (slice + 1) / num_slice),
+      slice);
+}
+
+void WorkerPool::RunSlices(const int n, const int num_slice,
+    const boost::function<void(int, int, int)>& func) {
+  if (num_slice <= 1) {
+    func(0, n, 0);
+    return;
+  }
+  Run(num_slice, boost::bind(&RunSlice, boost::cref(func), n, num_slice, _1));
+}
+
+}  // namespace caffe
@@ -0,0 +1,131 @@
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/syncedmem.hpp"
+#include "caffe/util/prefetch_queue.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class PrefetchQueue<Dtype>::sync {
+ public:
+  boost::mutex mutex_;
+  // signalled whenever a batch is queued or the queue is stopped
+  boost::condition_variable condition_;
+};
+
+template <typename Dtype>
+PrefetchQueue<Dtype>::PrefetchQueue()
+    : sync_(new sync()), current_(-1), stopped_(false), num_pop_(0),
+      depth_(0), num_stall_(0), stall_time_(0) {
+}
+
+template <typename Dtype>
+void PrefetchQueue<Dtype>::Init(const vector<Blob<Dtype>*>& working,
+    const int num_batch) {
+  CHECK_GT(num_batch, 0) << "At least one prefetch batch is needed";
+  batch_.resize(num_batch);
+  free_ = std::queue<int>();
+  full_ = std::queue<int>();
+  for (int i = 0; i < num_batch; ++i) {
+    batch_[i].resize(working.size());
+    for (int j = 0; j < working.size(); ++j) {
+      batch_[i][j].reset(new Blob<Dtype>());
+      batch_[i][j]->ReshapeLike(*working[j]);
+      // Allocate from this thread, so the prefetch thread does not make
+      // cudaMallocHost calls while the main thread is running.
+      batch_[i][j]->mutable_cpu_data();
+      if (working[j]->index() &&
+          working[j]->index()->head() != SyncedMemory::UNINITIALIZED) {
+        batch_[i][j]->mutable_cpu_index();
+      }
+      if (working[j]->diff_dropped()) {
+        batch_[i][j]->DropDiff();
+      }
+    }
+    free_.push(i);
+  }
+  current_ = -1;
+  stopped_ = false;
+}
+
+template <typename Dtype>
+void PrefetchQueue<Dtype>::SwapBatch(const vector<Blob<Dtype>*>& blobs,
+    const int batch) {
+  const int num_blob = std::min(blobs.size(), batch_[batch].size());
+  for (int i = 0; i < num_blob; ++i) {
+    blobs[i]->Swap(*batch_[batch][i]);
+  }
+}
+
+template <typename Dtype>
+bool PrefetchQueue<Dtype>::Push(const vector<Blob<Dtype>*>& working) {
+  int batch;
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    while (free_.empty() && !stopped_) {
+      sync_->condition_.wait(lock);
+    }
+    if (stopped_) {
+      return false;
+    }
+    batch = free_.front();
+    free_.pop();
+  }
+  // the batch is in neither queue, so it belongs to this thread
+  SwapBatch(working, batch);
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    full_.push(batch);
+  }
+  sync_->condition_.notify_all();
+  return true;
+}
+
+template <typename Dtype>
+void PrefetchQueue<Dtype>::Pop(const vector<Blob<Dtype>*>& top) {
+  const int previous = current_;
+  if (previous >= 0) {
+    // swapping again gives the batch its storage back
+    SwapBatch(top, previous);
+  }
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    if (previous >= 0) {
+      free_.push(previous);
+    }
+    ++num_pop_;
+    depth_ = full_.size();
+    if (full_.empty()) {
+      ++num_stall_;
+      const boost::posix_time::ptime start =
+          boost::posix_time::microsec_clock::local_time();
+      while (full_.empty()) {
+        sync_->condition_.wait(lock);
+      }
+      stall_time_ += (boost::posix_time::microsec_clock::local_time() -
+          start).total_microseconds() / 1000.;
+    }
+    current_ = full_.front();
+    full_.pop();
+  }
+  sync_->condition_.notify_all();
+  SwapBatch(top, current_);
+}
+
+template <typename Dtype>
+void PrefetchQueue<Dtype>::Stop() {
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    stopped_ = true;
+  }
+  sync_->condition_.notify_all();
+}
+
+INSTANTIATE_CLASS(PrefetchQueue);
+
+}  // namespace caffe
@@ -0,0 +1,150 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/topk.hpp"
+
+namespace caffe {
+
+// Users scored by one gemm, and items per gemm. A block of scores fits in L2.
+static const int kUserBlock = 64;
+static const int kItemBlock = 2048;
+
+template <typename Dtype>
+TopKRecommender<Dtype>::TopKRecommender(const int num_threads)
+    : num_threads_(num_threads), bias_(0), img_weight_(1) {
+  CHECK_GE(num_threads_, 1) << "num_threads should be at least 1";
+}
+
+template <typename Dtype>
+void TopKRecommender<Dtype>::CopyFrom(const NetParameter& param,
+    const string& layer_name) {
+  int layer_id = 0;
+  while (layer_id < param.layers_size() &&
+      (param.layers(layer_id).type() != LayerParameter_LayerType_MATRIX_FACT ||
+      (!layer_name.empty() && param.layers(layer_id).name() != layer_name))) {
+    ++layer_id;
+  }
+  CHECK_LT(layer_id, param.layers_size()) << "No MATRIX_FACT layer "
+      << layer_name << " in net " << param.name();
+  const LayerParameter& layer = param.layers(layer_id);
+  CHECK_GE(layer.blobs_size(), 2) << "Layer " << layer.name()
+      << " has no learned factors";
+  user_factor_.FromProto(layer.blobs(0));
+  item_factor_.FromProto(layer.blobs(1));
+  CHECK_EQ(user_factor_.width(), item_factor_.width())
+      << "User and item factors have different dimensions";
+  const MatrixFactorizeParameter& mf_param = layer.matrix_fact_param();
+  caffe_scal(item_factor_.count(), Dtype(mf_param.feature_weight()),
+      item_factor_.mutable_cpu_data());
+  img_weight_ = mf_param.img_weight();
+  bias_ = (layer.blobs_size() > 2) ? layer.blobs(2).data(0) : Dtype(0);
+  LOG(INFO) << "Loaded " << num_user() << " users and " << num_item()
+            << " items with " << num_latent() << " factors from layer "
+            << layer.name();
+}
+
+template <typename Dtype>
+void TopKRecommender<Dtype>::AddItemFeature(const Blob<Dtype>& item_feature) {
+  CHECK_EQ(item_feature.count(), item_factor_.count())
+      << "Item feature should have one row of num_latent for each item";
+  caffe_axpy(item_factor_.count(), img_weight_, item_feature.cpu_data(),
+      item_factor_.mutable_cpu_data());
+}
+
+template <typename Dtype>
+void TopKRecommender<Dtype>::Recommend(const int* users, const int num_users,
+    const int k, vector<int>* top_items, vector<Dtype>* top_scores) {
+  CHECK_GT(k, 0);
+  CHECK_LE(k, num_item()) << "Cannot recommend more items than there are";
+  top_items->resize(num_users * k);
+  top_scores->resize(num_users * k);
+  // whole blocks of users per thread
+  const int num_block = (num_users + kUserBlock - 1) / kUserBlock;
+  const int thread_users =
+      (num_block + num_threads_ - 1) / num_threads_ * kUserBlock;
+  if (num_block <= 1 || num_threads_ == 1) {
+    RecommendRange(users, k, top_items->data(), top_scores->data(),
+        0, num_users);
+    return;
+  }
+  boost::thread_group threads;
+  for (int begin = thread_users; begin < num_users; begin += thread_users) {
+    threads.create_thread(boost::bind(
+        &TopKRecommender<Dtype>::RecommendRange, this, users, k,
+        top_items->data(), top_scores->data(), begin,
+        std::min(num_users, begin + thread_users)));
+  }
+  RecommendRange(users, k, top_items->data(), top_scores->data(),
+      0, thread_users);
+  threads.join_all();
+}
+
+template <typename Dtype>
+void TopKRecommender<Dtype>::RecommendRange(const int* users, const int k,
+    int* top_items, Dtype* top_scores, const int user_begin,
+    const int user_end) {
+  typedef std::pair<Dtype, int> ScoredItem;
+  typedef std::greater<ScoredItem> MinFirst;
+  const int num_latent_ = num_latent();
+  const int num_item_ = num_item();
+  const Dtype* user_factor = user_factor_.cpu_data();
+  const Dtype* item_factor = item_factor_.cpu_data();
+  vector<Dtype> user_buf(kUserBlock * num_latent_);
+  vector<Dtype> score(kUserBlock * std::min(kItemBlock, num_item_));
+  // min-heap of the best k items so far of each user of the block
+  vector<vector<ScoredItem> > heaps(kUserBlock);
+  for (int block = user_begin; block < user_end; block += kUserBlock) {
+    const int block_size = std::min(kUserBlock, user_end - block);
+    for (int u = 0; u < block_size; ++u) {
+      const int userid = users[block + u];
+      CHECK_GE(userid, 0);
+      CHECK_LT(userid, num_user()) << "userid out of range";
+      caffe_copy(num_latent_, user_factor + userid * num_latent_,
+          user_buf.data() + u * num_latent_);
+      heaps[u].clear();
+      heaps[u].reserve(k);
+    }
+    for (int item_begin = 0; item_begin < num_item_;
+        item_begin += kItemBlock) {
+      const int item_size = std::min(kItemBlock, num_item_ - item_begin);
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, block_size, item_size,
+          num_latent_, (Dtype)1., user_buf.data(),
+          item_factor + item_begin * num_latent_, (Dtype)0., score.data());
+      for (int u = 0; u < block_size; ++u) {
+        vector<ScoredItem>& heap = heaps[u];
+        const Dtype* user_score = score.data() + u * item_size;
+        for (int i = 0; i < item_size; ++i) {
+          if (static_cast<int>(heap.size()) < k) {
+            heap.push_back(ScoredItem(user_score[i], item_begin + i));
+            std::push_heap(heap.begin(), heap.end(), MinFirst());
+          } else if (user_score[i] > heap.front().first) {
+            std::pop_heap(heap.begin(), heap.end(), MinFirst());
+            heap.back() = ScoredItem(user_score[i], item_begin + i);
+            std::push_heap(heap.begin(), heap.end(), MinFirst());
+          }
+        }
+      }
+    }
+    for (int u = 0; u < block_size; ++u) {
+      // sorting by MinFirst leaves the best item first
+      std::sort_heap(heaps[u].begin(), heaps[u].end(), MinFirst());
+      const int offset = (block + u) * k;
+      for (int i = 0; i < k; ++i) {
+        top_items[offset + i] = heaps[u][i].second;
+        top_scores[offset + i] = heaps[u][i].first + bias_;
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(TopKRecommender);
+
+}  // namespace caffe
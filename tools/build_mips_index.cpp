@@ -0,0 +1,69 @@
+// Builds the approximate maximum inner product index (MIPSIndex) over the item
+// factors of a trained MatrixFactorizeLayer, and saves it beside the model.
+// Usage:
+//    build_mips_index --model=net.caffemodel [--layer=mf] [--num_list=1024]
+//        [--item_feature=items.binaryproto] [--output=net.caffemodel.mipsindex]
+#include <glog/logging.h>
+
+#include <string>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using caffe::Blob;
+using caffe::BlobProto;
+using caffe::Caffe;
+using caffe::MIPSIndex;
+using caffe::MIPSIndexProto;
+using caffe::NetParameter;
+using caffe::Timer;
+using caffe::TopKRecommender;
+
+DEFINE_string(model, "", "The trained net, as a binary NetParameter.");
+DEFINE_string(layer, "",
+    "Optional; the MATRIX_FACT layer to use, the first one by default.");
+DEFINE_string(item_feature, "",
+    "Optional; binary BlobProto of the image feature of every item, "
+    "added with the layer's img_weight.");
+DEFINE_string(output, "",
+    "Optional; the index file, the model file plus .mipsindex by default.");
+DEFINE_int32(num_list, 1024, "Number of inverted lists.");
+DEFINE_int32(iterations, 10, "Number of k-means iterations.");
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = 1;
+  gflags::SetUsageMessage("Build the item index of a MATRIX_FACT layer.\n"
+      "Usage:\n    build_mips_index --model=net.caffemodel [FLAGS]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a trained model to index.";
+  Caffe::set_mode(Caffe::CPU);
+
+  NetParameter net_param;
+  caffe::ReadNetParamsFromBinaryFileOrDie(FLAGS_model, &net_param);
+  // the recommender applies feature_weight, img_weight and the bias as the
+  // layer does
+  TopKRecommender<float> recommender;
+  recommender.CopyFrom(net_param, FLAGS_layer);
+  if (FLAGS_item_feature.size()) {
+    BlobProto blob_proto;
+    caffe::ReadProtoFromBinaryFileOrDie(FLAGS_item_feature, &blob_proto);
+    Blob<float> item_feature;
+    item_feature.FromProto(blob_proto);
+    recommender.AddItemFeature(item_feature);
+  }
+
+  MIPSIndex<float> index;
+  Timer timer;
+  timer.Start();
+  index.Build(*recommender.item_factor(), FLAGS_num_list, FLAGS_iterations,
+      recommender.bias());
+  LOG(INFO) << "Built the index in " << timer.Seconds() << " s";
+  const std::string output = FLAGS_output.size() ? FLAGS_output :
+      FLAGS_model + ".mipsindex";
+  MIPSIndexProto index_proto;
+  index.ToProto(&index_proto);
+  LOG(INFO) << "Writing the index to " << output;
+  caffe::WriteProtoToBinaryFile(index_proto, output);
+  return 0;
+}
@@ -1,11 +1,21 @@
+#include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 #include <glog/logging.h>
+#include <leveldb/db.h>
+#include <lmdb.h>
 
+#include <cstdio>
 #include <cstring>
 #include <map>
+#include <sstream>
 #include <string>
 #include <vector>
 
 #include "caffe/caffe.hpp"
+#include "caffe/util/async_writer.hpp"
+#include "caffe/util/interaction_file.hpp"
+#include "caffe/util/upgrade_proto.hpp"
 
 using caffe::Blob;
 using caffe::Caffe;
@@ -29,6 +39,14 @@ DEFINE_string(weights, "",
     "Cannot be set simultaneously with snapshot.");
 DEFINE_int32(iterations, 50,
     "The number of iterations to run.");
+DEFINE_int32(shards, 1,
+    "score: the number of key ranges the data source is split into.");
+DEFINE_int32(threads, 1,
+    "score: the number of shards scored at once, each by its own net.");
+DEFINE_string(output, "",
+    "score: the output prefix; shard i is written to <output>.<i>.");
+DEFINE_string(blobs, "",
+    "score: comma separated blobs to write; the net outputs by default.");
 
 // A simple registry for caffe commands.
 typedef int (*BrewFunction)();
@@ -138,9 +156,13 @@ int test() {
     LOG(INFO) << "Use CPU.";
     Caffe::set_mode(Caffe::CPU);
   }
-  // Instantiate the caffe net.
+  // Instantiate the caffe net; testing only runs Forward.
   Caffe::set_phase(Caffe::TEST);
-  Net<float> caffe_net(FLAGS_model);
+  caffe::NetParameter param;
+  caffe::ReadNetParamsFromTextFileOrDie(FLAGS_model, &param);
+  // a model that forces backward keeps its diffs
+  param.mutable_state()->set_inference(!param.force_backward());
+  Net<float> caffe_net(param);
   caffe_net.CopyTrainedLayersFrom(FLAGS_weights);
   LOG(INFO) << "Running for " << FLAGS_iterations << " iterations.";
 
@@ -191,6 +213,280 @@ int test() {
 RegisterBrewFunction(test);
 
 
+// Score: run a trained model once over its data source and write the blobs.
+//
+// The source of the DATA_ITACT layer is split into --shards key ranges,
+// read with single_pass so every record is scored exactly once. --threads
+// shards are scored at once, each by its own net sharing the trained
+// weights of the net of the last shard. A LevelDB source is opened once,
+// and the nets iterate over it on their own. Shard i writes the rows of the
+// blobs of every batch to <output>.<i> in the binary format of AsyncWriter;
+// the shard files are merged by concatenating them in order.
+
+// The records of the data source, and the keys of the records at the given
+// sorted positions, from one scan of the keys.
+static int64_t ScanKeys(const caffe::DataParameter& param,
+    const vector<int64_t>& positions, vector<caffe::string>* keys) {
+  int64_t num_record = 0;
+  int p = 0;
+  switch (param.backend()) {
+  case caffe::DataParameter_DB_LEVELDB:
+    {
+    shared_ptr<leveldb::DB> db = caffe::OpenSharedLevelDB(param.source());
+    leveldb::ReadOptions read_options;
+    read_options.fill_cache = false;
+    leveldb::Iterator* it = db->NewIterator(read_options);
+    for (it->SeekToFirst(); it->Valid(); it->Next(), ++num_record) {
+      for (; p < positions.size() && positions[p] == num_record; ++p) {
+        keys->push_back(it->key().ToString());
+      }
+    }
+    delete it;
+    }
+    break;
+  case caffe::DataParameter_DB_LMDB:
+    {
+    MDB_env* mdb_env;
+    MDB_dbi mdb_dbi;
+    MDB_val mdb_key, mdb_value;
+    MDB_txn* mdb_txn;
+    MDB_cursor* mdb_cursor;
+    CHECK_EQ(mdb_env_create(&mdb_env), MDB_SUCCESS) << "mdb_env_create failed";
+    CHECK_EQ(mdb_env_set_mapsize(mdb_env, 1099511627776), MDB_SUCCESS);  // 1TB
+    CHECK_EQ(mdb_env_open(mdb_env, param.source().c_str(), MDB_RDONLY, 0664),
+        MDB_SUCCESS) << "mdb_env_open failed";
+    CHECK_EQ(mdb_txn_begin(mdb_env, NULL, MDB_RDONLY, &mdb_txn), MDB_SUCCESS)
+        << "mdb_txn_begin failed";
+    CHECK_EQ(mdb_open(mdb_txn, NULL, 0, &mdb_dbi), MDB_SUCCESS)
+        << "mdb_open failed";
+    CHECK_EQ(mdb_cursor_open(mdb_txn, mdb_dbi, &mdb_cursor), MDB_SUCCESS)
+        << "mdb_cursor_open failed";
+    // only the keys are read, the values stay in the map
+    int rc = mdb_cursor_get(mdb_cursor, &mdb_key, &mdb_value, MDB_FIRST);
+    for (; rc == MDB_SUCCESS; ++num_record) {
+      for (; p < positions.size() && positions[p] == num_record; ++p) {
+        keys->push_back(caffe::string(
+            static_cast<const char*>(mdb_key.mv_data), mdb_key.mv_size));
+      }
+      rc = mdb_cursor_get(mdb_cursor, &mdb_key, &mdb_value, MDB_NEXT);
+    }
+    mdb_cursor_close(mdb_cursor);
+    mdb_close(mdb_env, mdb_dbi);
+    mdb_txn_abort(mdb_txn);
+    mdb_env_close(mdb_env);
+    }
+    break;
+  case caffe::DataParameter_DB_COLUMNAR:
+    {
+    // the keys are the record numbers
+    caffe::InteractionFile file(param.source());
+    num_record = file.num_record();
+    for (; p < positions.size() && positions[p] < num_record; ++p) {
+      std::ostringstream key;
+      key << positions[p];
+      keys->push_back(key.str());
+    }
+    }
+    break;
+  default:
+    LOG(FATAL) << "Unknown database backend";
+  }
+  return num_record;
+}
+
+// The net parameter reading the keys [begin_keys[shard], begin_keys[shard + 1])
+// once.
+static caffe::NetParameter ShardParam(const caffe::NetParameter& param,
+    const int data_layer, const vector<caffe::string>& begin_keys,
+    const int shard) {
+  caffe::NetParameter shard_param(param);
+  caffe::DataParameter* data_param =
+      shard_param.mutable_layers(data_layer)->mutable_data_param();
+  data_param->set_begin_key(begin_keys[shard]);
+  if (shard + 1 < begin_keys.size()) {
+    data_param->set_end_key(begin_keys[shard + 1]);
+  }
+  data_param->set_single_pass(true);
+  // every record is scored once
+  data_param->set_rand_skip(0);
+  data_param->set_rand_jump(0);
+  return shard_param;
+}
+
+// Hands the shards out to the threads, and scores them.
+class ShardScorer {
+ public:
+  // trained_net is the net of the last shard, holding the trained weights.
+  ShardScorer(const caffe::NetParameter& param, const int data_layer,
+      Net<float>* trained_net, const vector<caffe::string>& begin_keys,
+      const vector<int64_t>& begin_records, const vector<caffe::string>& blobs)
+      : param_(param), data_layer_(data_layer), trained_net_(trained_net),
+        begin_keys_(begin_keys), begin_records_(begin_records),
+        blobs_(blobs), next_shard_(0) {}
+
+  void Run() {
+    while (true) {
+      int shard;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        shard = next_shard_++;
+      }
+      if (shard >= FLAGS_shards) {
+        return;
+      }
+      ScoreShard(shard);
+    }
+  }
+
+ protected:
+  void ScoreShard(const int shard) {
+    char filename[32];
+    snprintf(filename, sizeof(filename), ".%05d", shard);
+    const caffe::string output = FLAGS_output + filename;
+    // AsyncWriter appends, so nothing of an earlier run is kept
+    std::remove(output.c_str());
+    caffe::AsyncWriter writer(output, true, false, 4 << 20);
+    const int64_t num_record =
+        begin_records_[shard + 1] - begin_records_[shard];
+    if (num_record == 0) {
+      return;  // more shards than records
+    }
+    shared_ptr<Net<float> > shard_net;
+    Net<float>* net = trained_net_;
+    if (shard + 1 < FLAGS_shards) {
+      {
+        // the fillers of the new net share the random generator
+        boost::mutex::scoped_lock lock(mutex_);
+        shard_net.reset(new Net<float>(
+            ShardParam(param_, data_layer_, begin_keys_, shard)));
+      }
+      shard_net->ShareTrainedLayersWith(trained_net_);
+      net = shard_net.get();
+    }
+    vector<Blob<float>*> blobs;
+    for (int i = 0; i < blobs_.size(); ++i) {
+      CHECK(net->has_blob(blobs_[i])) << "Unknown blob " << blobs_[i];
+      blobs.push_back(net->blob_by_name(blobs_[i]).get());
+    }
+    if (blobs.empty()) {
+      blobs = net->output_blobs();
+    }
+    const int batch_size = param_.layers(data_layer_).data_param().batch_size();
+    const int64_t num_batch = (num_record + batch_size - 1) / batch_size;
+    for (int64_t batch = 0; batch < num_batch; ++batch) {
+      net->ForwardPrefilled();
+      for (int i = 0; i < blobs.size(); ++i) {
+        const Blob<float>* blob = blobs[i];
+        const int width = blob->num() ? blob->count() / blob->num() : 0;
+        writer.BeginRows(blob->num(), ' ', false);
+        // ids are kept in the index
+        if (blob->index()->head() != caffe::SyncedMemory::UNINITIALIZED) {
+          writer.AddColumns(blob->cpu_index(), width);
+        } else {
+          writer.AddColumns(blob->cpu_data(), width);
+        }
+      }
+    }
+    LOG(INFO) << "Shard " << shard << ": scored " << num_record
+              << " records to " << output;
+  }
+
+  const caffe::NetParameter& param_;
+  int data_layer_;
+  Net<float>* trained_net_;
+  const vector<caffe::string>& begin_keys_;
+  const vector<int64_t>& begin_records_;
+  const vector<caffe::string>& blobs_;
+  boost::mutex mutex_;
+  int next_shard_;
+};
+
+int score() {
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to score.";
+  CHECK_GT(FLAGS_weights.size(), 0) << "Need model weights to score.";
+  CHECK_GT(FLAGS_output.size(), 0) << "Need an output prefix to score to.";
+  CHECK_GT(FLAGS_shards, 0);
+  CHECK_GT(FLAGS_threads, 0);
+
+  // Set device id and mode
+  if (FLAGS_gpu >= 0) {
+    // the nets of the threads would share the device handles
+    CHECK_EQ(FLAGS_threads, 1) << "Scoring on the GPU runs one thread.";
+    LOG(INFO) << "Use GPU with device ID " << FLAGS_gpu;
+    Caffe::SetDevice(FLAGS_gpu);
+    Caffe::set_mode(Caffe::GPU);
+  } else {
+    LOG(INFO) << "Use CPU.";
+    Caffe::set_mode(Caffe::CPU);
+  }
+  Caffe::set_phase(Caffe::TEST);
+  caffe::NetParameter model_param, param;
+  caffe::ReadNetParamsFromTextFileOrDie(FLAGS_model, &model_param);
+  Net<float>::FilterNet(model_param, &param);
+  int data_layer = -1;
+  for (int i = 0; i < param.layers_size(); ++i) {
+    if (param.layers(i).type() == caffe::LayerParameter_LayerType_DATA_ITACT) {
+      CHECK_LT(data_layer, 0) << "Only nets with one DATA_ITACT layer score.";
+      data_layer = i;
+    }
+  }
+  CHECK_GE(data_layer, 0) << "Need a DATA_ITACT layer to score.";
+  const caffe::DataParameter& data_param =
+      param.layers(data_layer).data_param();
+  CHECK(!data_param.has_begin_key() && !data_param.has_end_key())
+      << "score splits the whole source into key ranges.";
+
+  // LevelDB locks a database to one handle: the scan and the nets of all
+  // the shards share this one, open until every shard is scored.
+  shared_ptr<leveldb::DB> source_db;
+  if (data_param.backend() == caffe::DataParameter_DB_LEVELDB) {
+    source_db = caffe::OpenSharedLevelDB(data_param.source());
+  }
+  // Shard i holds the records [begin_records[i], begin_records[i + 1]).
+  LOG(INFO) << "Splitting " << data_param.source() << " into "
+            << FLAGS_shards << " shards.";
+  vector<caffe::string> begin_keys;
+  const int64_t num_record =
+      ScanKeys(data_param, vector<int64_t>(), &begin_keys);
+  vector<int64_t> begin_records;
+  for (int i = 0; i <= FLAGS_shards; ++i) {
+    begin_records.push_back(num_record * i / FLAGS_shards);
+  }
+  CHECK_GT(num_record, 0) << "Empty data source";
+  ScanKeys(data_param, vector<int64_t>(begin_records.begin(),
+      begin_records.end() - 1), &begin_keys);
+  LOG(INFO) << "Scoring " << num_record << " records.";
+
+  vector<caffe::string> blobs;
+  if (FLAGS_blobs.size()) {
+    boost::split(blobs, FLAGS_blobs, boost::is_any_of(","));
+  }
+  // the scored blobs must not share their memory with later layers
+  for (int i = 0; i < blobs.size(); ++i) {
+    param.add_keep_blob(blobs[i]);
+  }
+  // scoring only runs Forward, unless the model forces backward
+  param.mutable_state()->set_inference(!param.force_backward());
+  // The trained weights are loaded into the net of the last shard, which
+  // always holds records, and the nets of the other shards share them.
+  Net<float> trained_net(
+      ShardParam(param, data_layer, begin_keys, FLAGS_shards - 1));
+  trained_net.CopyTrainedLayersFrom(FLAGS_weights);
+  ShardScorer shard_scorer(param, data_layer, &trained_net, begin_keys,
+      begin_records, blobs);
+  boost::thread_group threads;
+  for (int i = 1; i < FLAGS_threads; ++i) {
+    threads.create_thread(boost::bind(&ShardScorer::Run, &shard_scorer));
+  }
+  shard_scorer.Run();
+  threads.join_all();
+  LOG(INFO) << "Scored " << FLAGS_shards << " shards to " << FLAGS_output
+            << ".*";
+  return 0;
+}
+RegisterBrewFunction(score);
+
+
 // Time: benchmark the execution time of a model.
 int time() {
   CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to time.";
@@ -275,6 +571,7 @@ int main(int argc, char** argv) {
       "commands:\n"
       "  train           train or finetune a model\n"
       "  test            score a model\n"
+      "  score           score a data source once, sharded over threads\n"
       "  device_query    show GPU diagnostic information\n"
       "  time            benchmark model execution time");
   // Run tool or show usage.
@@ -0,0 +1,129 @@
+// Times the forward and backward passes of the CaffeNet convolution layers
+// on the CPU as the batch is split over more threads (cpu_threads), and
+// reports the speedup over one thread. Link a single threaded BLAS, or the
+// BLAS threads compete with the batch slices. --engine=winograd times the
+// WINOGRAD engine, which covers conv3 to conv5, against the same baseline.
+// Usage:
+//    conv_benchmark [--batch_size=64] [--max_threads=32] [--iterations=5]
+//        [--col_buffer_mb=32] [--engine=caffe]
+#include <glog/logging.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/math_functions.hpp"
+
+using caffe::Blob;
+using caffe::Caffe;
+using caffe::ConvolutionLayer;
+using caffe::ConvolutionParameter;
+using caffe::LayerParameter;
+using caffe::shared_ptr;
+using caffe::string;
+using caffe::Timer;
+using caffe::vector;
+
+DEFINE_int32(batch_size, 64, "Number of images in a batch.");
+DEFINE_int32(max_threads, 32, "Time 1, 2, 4... up to this many threads.");
+DEFINE_int32(iterations, 5, "The number of passes timed per setting.");
+DEFINE_int32(col_buffer_mb, 32, "Memory per thread to lower several images "
+    "at once; 0 lowers one image at a time.");
+DEFINE_string(engine, "caffe", "The convolution engine: caffe or winograd.");
+
+// The convolutions of CaffeNet: the bottom shape and the layer parameters.
+struct ConvShape {
+  const char* name;
+  int channels, size, num_output, kernel_size, stride, pad, group;
+};
+
+const ConvShape kCaffeNetConvs[] = {
+  {"conv1", 3, 227, 96, 11, 4, 0, 1},
+  {"conv2", 96, 27, 256, 5, 1, 2, 2},
+  {"conv3", 256, 13, 384, 3, 1, 1, 1},
+  {"conv4", 384, 13, 384, 3, 1, 1, 2},
+  {"conv5", 384, 13, 256, 3, 1, 1, 2},
+};
+
+// Milliseconds of a forward and a backward pass with the given threads.
+void TimeConv(const ConvShape& shape, const int threads, float* forward_ms,
+    float* backward_ms) {
+  Blob<float> bottom(FLAGS_batch_size, shape.channels, shape.size,
+      shape.size);
+  Blob<float> top;
+  caffe::caffe_rng_gaussian<float>(bottom.count(), 0, 1,
+      bottom.mutable_cpu_data());
+  vector<Blob<float>*> bottom_vec(1, &bottom);
+  vector<Blob<float>*> top_vec(1, &top);
+
+  LayerParameter layer_param;
+  ConvolutionParameter* conv_param = layer_param.mutable_convolution_param();
+  conv_param->set_num_output(shape.num_output);
+  conv_param->set_kernel_size(shape.kernel_size);
+  conv_param->set_stride(shape.stride);
+  conv_param->set_pad(shape.pad);
+  conv_param->set_group(shape.group);
+  conv_param->set_cpu_threads(threads);
+  conv_param->set_col_buffer_mb(FLAGS_col_buffer_mb);
+  conv_param->mutable_weight_filler()->set_type("gaussian");
+  conv_param->mutable_weight_filler()->set_std(0.01);
+  shared_ptr<ConvolutionLayer<float> > engine_layer;
+  if (FLAGS_engine == "winograd") {
+    conv_param->set_engine(ConvolutionParameter::WINOGRAD);
+    engine_layer.reset(new caffe::WinogradConvolutionLayer<float>(
+        layer_param));
+  } else {
+    CHECK_EQ(FLAGS_engine, "caffe") << "Unknown engine " << FLAGS_engine;
+    engine_layer.reset(new ConvolutionLayer<float>(layer_param));
+  }
+  ConvolutionLayer<float>& layer = *engine_layer;
+  layer.SetUp(bottom_vec, &top_vec);
+  caffe::caffe_rng_gaussian<float>(top.count(), 0, 1,
+      top.mutable_cpu_diff());
+  vector<bool> propagate_down(1, true);
+  // one untimed pass to allocate the buffers
+  layer.Forward(bottom_vec, &top_vec);
+  layer.Backward(top_vec, propagate_down, &bottom_vec);
+
+  Timer timer;
+  timer.Start();
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    layer.Forward(bottom_vec, &top_vec);
+  }
+  *forward_ms = timer.MilliSeconds() / FLAGS_iterations;
+  timer.Start();
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    layer.Backward(top_vec, propagate_down, &bottom_vec);
+  }
+  *backward_ms = timer.MilliSeconds() / FLAGS_iterations;
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = 1;
+  gflags::SetUsageMessage("Time the CaffeNet convolutions on 1 to "
+      "max_threads CPU threads.\n"
+      "Usage:\n    conv_benchmark [FLAGS]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TRAIN);
+  const int num_conv = sizeof(kCaffeNetConvs) / sizeof(kCaffeNetConvs[0]);
+  for (int c = 0; c < num_conv; ++c) {
+    const ConvShape& shape = kCaffeNetConvs[c];
+    float base_forward_ms = 0, base_backward_ms = 0;
+    for (int threads = 1; threads <= FLAGS_max_threads; threads *= 2) {
+      float forward_ms, backward_ms;
+      TimeConv(shape, threads, &forward_ms, &backward_ms);
+      if (threads == 1) {
+        base_forward_ms = forward_ms;
+        base_backward_ms = backward_ms;
+      }
+      LOG(INFO) << shape.name << "\tthreads " << threads
+                << "\tforward: " << forward_ms << " ms ("
+                << base_forward_ms / forward_ms << "x)"
+                << "\tbackward: " << backward_ms << " ms ("
+                << base_backward_ms / backward_ms << "x)";
+    }
+  }
+  return 0;
+}
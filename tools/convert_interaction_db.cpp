@@ -0,0 +1,93 @@
+// This program converts a leveldb or lmdb of DatumInteraction records to a
+// columnar interaction file, which InteractionDataLayer reads with
+// backend: COLUMNAR without parsing any protobuf.
+// Usage:
+//   convert_interaction_db input_db output_file [db_backend]
+// where db_backend is leveldb (default) or lmdb. The records are written in
+// the order the database iterates over them.
+
+#include <glog/logging.h>
+#include <leveldb/db.h>
+#include <lmdb.h>
+
+#include <string>
+
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/interaction_file.hpp"
+
+using caffe::DatumInteraction;
+using caffe::InteractionFileWriter;
+using std::string;
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc < 3 || argc > 4) {
+    LOG(ERROR) << "Usage: convert_interaction_db input_db output_file"
+               << " db_backend[leveldb or lmdb]";
+    return 1;
+  }
+
+  string db_backend = "leveldb";
+  if (argc == 4) {
+    db_backend = string(argv[3]);
+  }
+
+  InteractionFileWriter writer(argv[2]);
+  DatumInteraction record;
+  if (db_backend == "leveldb") {  // leveldb
+    LOG(INFO) << "Opening leveldb " << argv[1];
+    leveldb::DB* db;
+    leveldb::Options options;
+    options.create_if_missing = false;
+    leveldb::Status status = leveldb::DB::Open(options, argv[1], &db);
+    CHECK(status.ok()) << "Failed to open leveldb " << argv[1];
+    leveldb::ReadOptions read_options;
+    read_options.fill_cache = false;
+    leveldb::Iterator* it = db->NewIterator(read_options);
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+      CHECK(record.ParseFromArray(it->value().data(), it->value().size()));
+      writer.Add(record);
+      if (writer.num_record() % 10000 == 0) {
+        LOG(INFO) << "Processed " << writer.num_record() << " records.";
+      }
+    }
+    delete it;
+    delete db;
+  } else if (db_backend == "lmdb") {  // lmdb
+    LOG(INFO) << "Opening lmdb " << argv[1];
+    MDB_env* mdb_env;
+    MDB_dbi mdb_dbi;
+    MDB_val mdb_key, mdb_value;
+    MDB_txn* mdb_txn;
+    MDB_cursor* mdb_cursor;
+    CHECK_EQ(mdb_env_create(&mdb_env), MDB_SUCCESS) << "mdb_env_create failed";
+    CHECK_EQ(mdb_env_set_mapsize(mdb_env, 1099511627776), MDB_SUCCESS);  // 1TB
+    CHECK_EQ(mdb_env_open(mdb_env, argv[1], MDB_RDONLY, 0664),
+        MDB_SUCCESS) << "mdb_env_open failed";
+    CHECK_EQ(mdb_txn_begin(mdb_env, NULL, MDB_RDONLY, &mdb_txn), MDB_SUCCESS)
+        << "mdb_txn_begin failed";
+    CHECK_EQ(mdb_open(mdb_txn, NULL, 0, &mdb_dbi), MDB_SUCCESS)
+        << "mdb_open failed";
+    CHECK_EQ(mdb_cursor_open(mdb_txn, mdb_dbi, &mdb_cursor), MDB_SUCCESS)
+        << "mdb_cursor_open failed";
+    int rc = mdb_cursor_get(mdb_cursor, &mdb_key, &mdb_value, MDB_FIRST);
+    while (rc == MDB_SUCCESS) {
+      CHECK(record.ParseFromArray(mdb_value.mv_data, mdb_value.mv_size));
+      writer.Add(record);
+      if (writer.num_record() % 10000 == 0) {
+        LOG(INFO) << "Processed " << writer.num_record() << " records.";
+      }
+      rc = mdb_cursor_get(mdb_cursor, &mdb_key, &mdb_value, MDB_NEXT);
+    }
+    mdb_cursor_close(mdb_cursor);
+    mdb_close(mdb_env, mdb_dbi);
+    mdb_txn_abort(mdb_txn);
+    mdb_env_close(mdb_env);
+  } else {
+    LOG(FATAL) << "Unknown db backend " << db_backend;
+  }
+  writer.Close();
+  LOG(INFO) << "Wrote " << writer.num_record() << " records with "
+            << writer.num_rating() << " ratings to " << argv[2];
+  return 0;
+}
@@ -0,0 +1,72 @@
+// This program compiles the text label files of LabelDataLayer and
+// MemoryMappingDataLayer into a binary label table, which the layers map
+// with data_param.label_table instead of parsing the text at every start.
+// Usage:
+//   convert_label_table label_source label_id output_table
+// where line i of label_source holds the comma separated label vector of
+// the id on line i of label_id.
+
+#include <glog/logging.h>
+
+#include <cstdlib>
+#include <fstream>  // NOLINT(readability/streams)
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "caffe/util/label_table.hpp"
+
+using caffe::LabelTableWriter;
+using std::string;
+using std::vector;
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 4) {
+    LOG(ERROR) << "Usage: convert_label_table label_source label_id"
+               << " output_table";
+    return 1;
+  }
+
+  std::ifstream label_file(argv[1]);
+  CHECK(label_file.good()) << "Failed to open " << argv[1];
+  std::ifstream id_file(argv[2]);
+  CHECK(id_file.good()) << "Failed to open " << argv[2];
+
+  LabelTableWriter* writer = NULL;
+  int label_dim = 0;
+  vector<float> label;
+  string line, field;
+  int id;
+  while (getline(label_file, line)) {
+    label.clear();
+    std::istringstream fields(line);
+    while (getline(fields, field, ',')) {
+      label.push_back(atof(field.c_str()));
+    }
+    if (!writer) {
+      // the first line gives the label dimension
+      label_dim = label.size();
+      CHECK_GT(label_dim, 0) << "Empty label vector";
+      writer = new LabelTableWriter(argv[3], label_dim);
+      LOG(INFO) << "Label dimension " << label_dim;
+    }
+    CHECK_EQ(label.size(), label_dim) << "Label file dimension changes on "
+        << "line " << writer->num_row() + 1;
+    CHECK(getline(id_file, line)) << "#ID and #label dismatch: more label "
+        << "vectors than ids";
+    std::istringstream id_line(line);
+    CHECK(id_line >> id) << "Bad id on line " << writer->num_row() + 1;
+    writer->Add(id, &label[0]);
+    if (writer->num_row() % 100000 == 0) {
+      LOG(INFO) << "Processed " << writer->num_row() << " labels.";
+    }
+  }
+  CHECK(writer) << "No labels in " << argv[1];
+  CHECK(!getline(id_file, line)) << "#ID and #label dismatch: more ids than "
+      << "label vectors";
+  LOG(INFO) << "Writing " << writer->num_row() << " labels to " << argv[3];
+  writer->Close();
+  delete writer;
+  return 0;
+}
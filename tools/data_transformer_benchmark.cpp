@@ -0,0 +1,101 @@
+// Times DataTransformer on uint8 images against the former per-pixel loop,
+// with the crop, mirror, mean and scale settings of an ImageNet data layer.
+// Usage:
+//    data_transformer_benchmark [--crop_size=227] [--iterations=1000]
+#include <glog/logging.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "caffe/caffe.hpp"
+#include "caffe/data_transformer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+using caffe::Caffe;
+using caffe::DataTransformer;
+using caffe::Timer;
+using caffe::TransformationParameter;
+using caffe::vector;
+
+DEFINE_int32(channels, 3, "Channels of an image.");
+DEFINE_int32(size, 256, "Height and width of an image.");
+DEFINE_int32(crop_size, 227, "Size of the crop.");
+DEFINE_bool(mirror, true, "Randomly mirror the crops.");
+DEFINE_int32(num_image, 64, "Number of distinct images to cycle through.");
+DEFINE_int32(iterations, 1000, "The number of images to transform.");
+
+// The crop loop as it was: index arithmetic and a cast for every pixel.
+void PixelLoopTransform(const uint8_t* data, const float* mean,
+    const int h_off, const int w_off, const bool mirror, const float scale,
+    float* transformed_data) {
+  const int channels = FLAGS_channels;
+  const int height = FLAGS_size;
+  const int width = FLAGS_size;
+  const int crop_size = FLAGS_crop_size;
+  for (int c = 0; c < channels; ++c) {
+    for (int h = 0; h < crop_size; ++h) {
+      for (int w = 0; w < crop_size; ++w) {
+        int data_index = (c * height + h + h_off) * width + w + w_off;
+        int top_index = (c * crop_size + h) * crop_size +
+            (mirror ? crop_size - 1 - w : w);
+        float datum_element = static_cast<float>(data[data_index]);
+        transformed_data[top_index] = (datum_element - mean[data_index]) *
+            scale;
+      }
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = 1;
+  gflags::SetUsageMessage("Time DataTransformer on uint8 crops.\n"
+      "Usage:\n    data_transformer_benchmark [FLAGS]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TRAIN);
+
+  const int image_size = FLAGS_channels * FLAGS_size * FLAGS_size;
+  const int crop_count = FLAGS_channels * FLAGS_crop_size * FLAGS_crop_size;
+  vector<uint8_t> images(FLAGS_num_image * image_size);
+  for (int i = 0; i < images.size(); ++i) {
+    images[i] = caffe::caffe_rng_rand() % 256;
+  }
+  vector<float> mean(image_size);
+  for (int i = 0; i < image_size; ++i) {
+    mean[i] = (caffe::caffe_rng_rand() % 25600) / 100.f;
+  }
+  vector<float> output(crop_count);
+
+  TransformationParameter param;
+  param.set_crop_size(FLAGS_crop_size);
+  param.set_mirror(FLAGS_mirror);
+  param.set_scale(1. / 255);
+  DataTransformer<float> transformer(param);
+  transformer.InitRand();
+
+  Timer timer;
+  timer.Start();
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    // the same random offsets the transformer draws
+    const int h_off = caffe::caffe_rng_rand() % (FLAGS_size - FLAGS_crop_size);
+    const int w_off = caffe::caffe_rng_rand() % (FLAGS_size - FLAGS_crop_size);
+    const bool mirror = FLAGS_mirror && caffe::caffe_rng_rand() % 2;
+    PixelLoopTransform(&images[(i % FLAGS_num_image) * image_size], &mean[0],
+        h_off, w_off, mirror, param.scale(), &output[0]);
+  }
+  const float loop_seconds = timer.Seconds();
+  timer.Start();
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    transformer.Transform(0, &images[(i % FLAGS_num_image) * image_size],
+        FLAGS_channels, FLAGS_size, FLAGS_size, &mean[0], &output[0]);
+  }
+  const float row_seconds = timer.Seconds();
+  LOG(INFO) << FLAGS_size << "x" << FLAGS_size << " -> " << FLAGS_crop_size
+            << (FLAGS_mirror ? " mirrored" : "") << " crops on one core"
+            << "\tper pixel: " << FLAGS_iterations / loop_seconds
+            << " images/s"
+            << "\trow kernel: " << FLAGS_iterations / row_seconds
+            << " images/s";
+  return 0;
+}
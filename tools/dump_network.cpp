@@ -21,6 +21,7 @@
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/solver.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
 
 using namespace caffe;  // NOLINT(build/namespaces)
 
@@ -28,13 +29,16 @@ int main(int argc, char** argv) {
   Caffe::set_mode(Caffe::GPU);
   Caffe::set_phase(Caffe::TEST);
 
-  shared_ptr<Net<float> > caffe_net;
+  NetParameter net_param;
   if (strcmp(argv[1], "none") == 0) {
     // We directly load the net param from trained file
-    caffe_net.reset(new Net<float>(argv[2]));
+    ReadNetParamsFromTextFileOrDie(argv[2], &net_param);
   } else {
-    caffe_net.reset(new Net<float>(argv[1]));
+    ReadNetParamsFromTextFileOrDie(argv[1], &net_param);
   }
+  // every blob is dumped, so none may share its memory
+  net_param.set_memory_plan(NetParameter_MemoryPlan_NONE);
+  shared_ptr<Net<float> > caffe_net(new Net<float>(net_param));
   caffe_net->CopyTrainedLayersFrom(argv[2]);
 
   vector<Blob<float>* > input_vec;
@@ -0,0 +1,200 @@
+// Times the scoring pass of MatrixFactorizeLayer against the former
+// copy-then-gemv path, on random batches with several latent sizes, and the
+// top-K recommendation of TopKRecommender against one gemv and partial sort
+// per user.
+// Usage:
+//    matrix_factorize_benchmark [--num_threads=1] [--iterations=20]
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/math_functions.hpp"
+
+using caffe::Blob;
+using caffe::Caffe;
+using caffe::LayerParameter;
+using caffe::MatrixFactorizeLayer;
+using caffe::MatrixFactorizeParameter;
+using caffe::Timer;
+using caffe::TopKRecommender;
+using caffe::vector;
+
+DEFINE_int32(num_user, 1000000, "Number of users in the factor table.");
+DEFINE_int32(num_item, 100000, "Number of items in the factor table.");
+DEFINE_int32(batch_items, 256, "Number of items in a batch.");
+DEFINE_int32(ratings_per_item, 400, "Number of ratings of each item.");
+DEFINE_int32(num_threads, 1, "Threads used by the layer forward.");
+DEFINE_int32(iterations, 20, "The number of iterations to run.");
+DEFINE_int32(topk, 10, "Number of items recommended to each user.");
+DEFINE_int32(topk_users, 4096, "Number of users to recommend items to.");
+
+// The scoring loop as it was: gather the user rows of an item into a buffer,
+// then one gemv per item.
+void GemvForward(const Blob<float>& user, const Blob<float>& item_mixed,
+    const Blob<float>& itact_data, const Blob<float>& itact_count,
+    Blob<float>* user_buffer, Blob<float>* pred) {
+  const int num_latent = user.width();
+  const float* user_feature = user.cpu_data();
+  const int* itact_data_ = itact_data.cpu_index();
+  const int* itact_count_ = itact_count.cpu_index();
+  float* user_feature_buf = user_buffer->mutable_cpu_data();
+  float* itact_pred_ = pred->mutable_cpu_data();
+  for (int itemid = 0; itemid < itact_count.num(); ++itemid) {
+    const int item_offset = itact_count_[itemid*2];
+    const int rating_size = itact_count_[itemid*2+1];
+    for (int rating_cnt = 0; rating_cnt < rating_size; ++rating_cnt) {
+      const int userid = itact_data_[(item_offset + rating_cnt)*2+1];
+      caffe::caffe_copy(num_latent, user_feature + userid*num_latent,
+          user_feature_buf + rating_cnt*num_latent);
+    }
+    caffe::caffe_cpu_gemv<float>(CblasNoTrans, rating_size, num_latent,
+        1., user_feature_buf, item_mixed.cpu_data() + itemid*num_latent, 0.,
+        itact_pred_ + item_offset);
+  }
+}
+
+void Benchmark(const int num_latent) {
+  const int num_rating = FLAGS_batch_items * FLAGS_ratings_per_item;
+  Blob<float> item_img(FLAGS_batch_items, num_latent, 1, 1);
+  Blob<float> itact_data(num_rating, 2, 1, 1);
+  Blob<float> itact_count(FLAGS_batch_items, 2, 1, 1);
+  Blob<float> pred, num;
+  caffe::caffe_rng_gaussian<float>(item_img.count(), 0, 1,
+      item_img.mutable_cpu_data());
+  int* data = itact_data.mutable_cpu_index();
+  int* count = itact_count.mutable_cpu_index();
+  for (int i = 0; i < FLAGS_batch_items; ++i) {
+    const int item_real_id = caffe::caffe_rng_rand() % FLAGS_num_item;
+    count[i*2] = i * FLAGS_ratings_per_item;
+    count[i*2+1] = FLAGS_ratings_per_item;
+    for (int j = 0; j < FLAGS_ratings_per_item; ++j) {
+      const int rating_idx = i * FLAGS_ratings_per_item + j;
+      data[rating_idx*2] = item_real_id;
+      data[rating_idx*2+1] = caffe::caffe_rng_rand() % FLAGS_num_user;
+    }
+  }
+  vector<Blob<float>*> bottom;
+  bottom.push_back(&item_img);
+  bottom.push_back(&itact_data);
+  bottom.push_back(&itact_count);
+  vector<Blob<float>*> top;
+  top.push_back(&pred);
+  top.push_back(&num);
+
+  LayerParameter layer_param;
+  MatrixFactorizeParameter* mf_param = layer_param.mutable_matrix_fact_param();
+  mf_param->set_num_user(FLAGS_num_user);
+  mf_param->set_num_item(FLAGS_num_item);
+  mf_param->set_itact_size(FLAGS_ratings_per_item);
+  mf_param->set_num_threads(FLAGS_num_threads);
+  mf_param->mutable_weight_filler()->set_type("gaussian");
+  MatrixFactorizeLayer<float> layer(layer_param);
+  layer.SetUp(bottom, &top);
+  layer.Forward(bottom, &top);
+
+  // mixed item features as computed by the layer
+  Blob<float> item_mixed(1, 1, FLAGS_batch_items, num_latent);
+  for (int i = 0; i < FLAGS_batch_items; ++i) {
+    const int item_real_id = data[static_cast<int>(count[i*2])*2];
+    caffe::caffe_copy(num_latent,
+        layer.blobs()[1]->cpu_data() + item_real_id*num_latent,
+        item_mixed.mutable_cpu_data() + i*num_latent);
+    caffe::caffe_axpy<float>(num_latent, 1.,
+        item_img.cpu_data() + i*num_latent,
+        item_mixed.mutable_cpu_data() + i*num_latent);
+  }
+  Blob<float> user_buffer(1, 1, FLAGS_ratings_per_item, num_latent);
+  Blob<float> gemv_pred(num_rating, 1, 1, 1);
+
+  Timer timer;
+  timer.Start();
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    GemvForward(*layer.blobs()[0], item_mixed, itact_data, itact_count,
+        &user_buffer, &gemv_pred);
+  }
+  const float gemv_ms = timer.MilliSeconds() / FLAGS_iterations;
+  timer.Start();
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    layer.Forward(bottom, &top);
+  }
+  const float fused_ms = timer.MilliSeconds() / FLAGS_iterations;
+  LOG(INFO) << "num_latent " << num_latent
+            << "\tcopy+gemv: " << gemv_ms << " ms"
+            << "\tfused: " << fused_ms << " ms"
+            << "\t(" << num_rating / fused_ms * 1000 << " ratings/s)";
+}
+
+// Top-K items of every user by scoring all the items with one gemv, then
+// partially sorting the scores.
+void GemvTopK(const Blob<float>& user, const Blob<float>& item,
+    vector<float>* score, vector<float>* top_scores) {
+  const int num_user = user.height();
+  const int num_item = item.height();
+  const int num_latent = user.width();
+  for (int u = 0; u < num_user; ++u) {
+    caffe::caffe_cpu_gemv<float>(CblasNoTrans, num_item, num_latent, 1.,
+        item.cpu_data(), user.cpu_data() + u*num_latent, 0., &(*score)[0]);
+    std::partial_sort(score->begin(), score->begin() + FLAGS_topk,
+        score->end(), std::greater<float>());
+    std::copy(score->begin(), score->begin() + FLAGS_topk,
+        top_scores->begin() + u*FLAGS_topk);
+  }
+}
+
+void BenchmarkTopK(const int num_latent) {
+  TopKRecommender<float> recommender(FLAGS_num_threads);
+  Blob<float>* user = recommender.user_factor();
+  Blob<float>* item = recommender.item_factor();
+  user->Reshape(1, 1, FLAGS_topk_users, num_latent);
+  item->Reshape(1, 1, FLAGS_num_item, num_latent);
+  caffe::caffe_rng_gaussian<float>(user->count(), 0, 1,
+      user->mutable_cpu_data());
+  caffe::caffe_rng_gaussian<float>(item->count(), 0, 1,
+      item->mutable_cpu_data());
+  vector<int> users(FLAGS_topk_users);
+  for (int u = 0; u < FLAGS_topk_users; ++u) {
+    users[u] = u;
+  }
+  vector<int> top_items;
+  vector<float> top_scores;
+  vector<float> score(FLAGS_num_item);
+  vector<float> gemv_scores(FLAGS_topk_users * FLAGS_topk);
+
+  Timer timer;
+  timer.Start();
+  GemvTopK(*user, *item, &score, &gemv_scores);
+  const float gemv_seconds = timer.Seconds();
+  timer.Start();
+  recommender.Recommend(&users[0], FLAGS_topk_users, FLAGS_topk, &top_items,
+      &top_scores);
+  const float blocked_seconds = timer.Seconds();
+  for (int i = 0; i < top_scores.size(); ++i) {
+    CHECK_LT(fabs(top_scores[i] - gemv_scores[i]),
+        1e-3 * std::max(1.f, fabs(gemv_scores[i])))
+        << "Top-K mismatch at " << i;
+  }
+  LOG(INFO) << "num_latent " << num_latent << "\ttop-" << FLAGS_topk
+            << " gemv: " << FLAGS_topk_users / gemv_seconds << " users/s"
+            << "\tblocked gemm: " << FLAGS_topk_users / blocked_seconds
+            << " users/s";
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = 1;
+  gflags::SetUsageMessage("Time the MatrixFactorizeLayer scoring pass and "
+      "top-K recommendation.\n"
+      "Usage:\n    matrix_factorize_benchmark [FLAGS]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  Caffe::set_mode(Caffe::CPU);
+  for (int num_latent = 16; num_latent <= 256; num_latent *= 2) {
+    Benchmark(num_latent);
+  }
+  for (int num_latent = 16; num_latent <= 256; num_latent *= 2) {
+    BenchmarkTopK(num_latent);
+  }
+  return 0;
+}
@@ -0,0 +1,104 @@
+// Recommends the K best items of each user from the factors learned by a
+// MatrixFactorizeLayer, and reports the throughput in users/s.
+// Usage:
+//    mf_topk --model=net.caffemodel [--layer=mf] [--users=users.txt]
+//        [--item_feature=items.binaryproto] [--k=10] [--num_threads=1]
+//        [--output=topk.txt]
+// Each output line is "userid item:score item:score ...", best item first.
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <fstream>  // NOLINT(readability/streams)
+#include <iostream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using caffe::Blob;
+using caffe::BlobProto;
+using caffe::Caffe;
+using caffe::NetParameter;
+using caffe::Timer;
+using caffe::TopKRecommender;
+using caffe::vector;
+
+DEFINE_string(model, "", "The trained net, as a binary NetParameter.");
+DEFINE_string(layer, "",
+    "Optional; the MATRIX_FACT layer to use, the first one by default.");
+DEFINE_string(users, "",
+    "Optional; text file of userids, one per line. All users by default.");
+DEFINE_string(item_feature, "",
+    "Optional; binary BlobProto of the image feature of every item, "
+    "added with the layer's img_weight.");
+DEFINE_string(output, "", "Optional; output text file, stdout by default.");
+DEFINE_int32(k, 10, "Number of items to recommend to each user.");
+DEFINE_int32(num_threads, 1, "Number of scoring threads.");
+DEFINE_int32(batch_size, 4096, "Number of users scored per call.");
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = 1;
+  gflags::SetUsageMessage("Recommend the top K items of each user.\n"
+      "Usage:\n    mf_topk --model=net.caffemodel [FLAGS]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a trained model to score with.";
+  Caffe::set_mode(Caffe::CPU);
+
+  NetParameter net_param;
+  caffe::ReadNetParamsFromBinaryFileOrDie(FLAGS_model, &net_param);
+  TopKRecommender<float> recommender(FLAGS_num_threads);
+  recommender.CopyFrom(net_param, FLAGS_layer);
+  if (FLAGS_item_feature.size()) {
+    BlobProto blob_proto;
+    caffe::ReadProtoFromBinaryFileOrDie(FLAGS_item_feature, &blob_proto);
+    Blob<float> item_feature;
+    item_feature.FromProto(blob_proto);
+    recommender.AddItemFeature(item_feature);
+  }
+
+  vector<int> users;
+  if (FLAGS_users.size()) {
+    std::ifstream infile(FLAGS_users.c_str());
+    CHECK(infile.good()) << "Failed to open " << FLAGS_users;
+    int userid;
+    while (infile >> userid) {
+      users.push_back(userid);
+    }
+  } else {
+    for (int userid = 0; userid < recommender.num_user(); ++userid) {
+      users.push_back(userid);
+    }
+  }
+  std::ofstream outfile;
+  if (FLAGS_output.size()) {
+    outfile.open(FLAGS_output.c_str());
+    CHECK(outfile.good()) << "Failed to open " << FLAGS_output;
+  }
+  std::ostream& out = FLAGS_output.size() ? outfile : std::cout;
+
+  vector<int> top_items;
+  vector<float> top_scores;
+  float scoring_seconds = 0;
+  Timer timer;
+  for (int begin = 0; begin < users.size(); begin += FLAGS_batch_size) {
+    const int batch = std::min<int>(FLAGS_batch_size, users.size() - begin);
+    timer.Start();
+    recommender.Recommend(&users[begin], batch, FLAGS_k, &top_items,
+        &top_scores);
+    scoring_seconds += timer.Seconds();
+    for (int u = 0; u < batch; ++u) {
+      out << users[begin + u];
+      for (int i = 0; i < FLAGS_k; ++i) {
+        out << " " << top_items[u * FLAGS_k + i] << ":"
+            << top_scores[u * FLAGS_k + i];
+      }
+      out << "\n";
+    }
+  }
+  LOG(INFO) << "Scored " << users.size() << " users against "
+            << recommender.num_item() << " items in " << scoring_seconds
+            << " s (" << users.size() / scoring_seconds << " users/s)";
+  return 0;
+}
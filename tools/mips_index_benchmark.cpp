@@ -0,0 +1,109 @@
+// Measures recall@K against queries per second of MIPSIndex for a range of
+// nprobe, with exact scoring by TopKRecommender as the reference. Uses the
+// user and item factors of a trained model, or random ones without --model.
+// Usage:
+//    mips_index_benchmark [--model=net.caffemodel] [--index=net.mipsindex]
+//        [--num_query=1000] [--k=10] [--num_threads=1]
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using caffe::Caffe;
+using caffe::MIPSIndex;
+using caffe::MIPSIndexProto;
+using caffe::NetParameter;
+using caffe::Timer;
+using caffe::TopKRecommender;
+using caffe::vector;
+
+DEFINE_string(model, "",
+    "Optional; the trained net, random factors are used without it.");
+DEFINE_string(layer, "",
+    "Optional; the MATRIX_FACT layer to use, the first one by default.");
+DEFINE_string(index, "",
+    "Optional; a saved index of the model, built here without it.");
+DEFINE_int32(num_user, 10000, "Number of random users.");
+DEFINE_int32(num_item, 1000000, "Number of random items.");
+DEFINE_int32(num_latent, 64, "Dimension of the random factors.");
+DEFINE_int32(num_list, 1024, "Number of inverted lists of a built index.");
+DEFINE_int32(num_query, 1000, "Number of users to query.");
+DEFINE_int32(k, 10, "Number of items to retrieve.");
+DEFINE_int32(num_threads, 1, "Number of search threads.");
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = 1;
+  gflags::SetUsageMessage("Measure recall@K against QPS of MIPSIndex.\n"
+      "Usage:\n    mips_index_benchmark [FLAGS]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  Caffe::set_mode(Caffe::CPU);
+
+  TopKRecommender<float> recommender(FLAGS_num_threads);
+  if (FLAGS_model.size()) {
+    NetParameter net_param;
+    caffe::ReadNetParamsFromBinaryFileOrDie(FLAGS_model, &net_param);
+    recommender.CopyFrom(net_param, FLAGS_layer);
+  } else {
+    caffe::Blob<float>* user = recommender.user_factor();
+    caffe::Blob<float>* item = recommender.item_factor();
+    user->Reshape(1, 1, FLAGS_num_user, FLAGS_num_latent);
+    item->Reshape(1, 1, FLAGS_num_item, FLAGS_num_latent);
+    caffe::caffe_rng_gaussian<float>(user->count(), 0, 1,
+        user->mutable_cpu_data());
+    caffe::caffe_rng_gaussian<float>(item->count(), 0, 1,
+        item->mutable_cpu_data());
+  }
+  MIPSIndex<float> index(FLAGS_num_threads);
+  if (FLAGS_index.size()) {
+    MIPSIndexProto index_proto;
+    caffe::ReadProtoFromBinaryFileOrDie(FLAGS_index, &index_proto);
+    index.FromProto(index_proto);
+  } else {
+    index.Build(*recommender.item_factor(), FLAGS_num_list, 10,
+        recommender.bias());
+  }
+  CHECK_EQ(index.num_item(), recommender.num_item());
+  CHECK_EQ(index.num_latent(), recommender.num_latent());
+
+  const int num_query = std::min(FLAGS_num_query, recommender.num_user());
+  vector<int> users(num_query);
+  for (int u = 0; u < num_query; ++u) {
+    users[u] = u;
+  }
+  vector<int> exact_items;
+  vector<float> exact_scores;
+  Timer timer;
+  timer.Start();
+  recommender.Recommend(&users[0], num_query, FLAGS_k, &exact_items,
+      &exact_scores);
+  LOG(INFO) << "exact: " << num_query / timer.Seconds() << " queries/s";
+
+  const float* queries = recommender.user_factor()->cpu_data();
+  vector<int> top_items;
+  vector<float> top_scores;
+  for (int nprobe = 1; ; nprobe = std::min(2 * nprobe, index.num_list())) {
+    timer.Start();
+    index.Search(queries, num_query, FLAGS_k, nprobe, &top_items,
+        &top_scores);
+    const float seconds = timer.Seconds();
+    int hits = 0;
+    for (int q = 0; q < num_query; ++q) {
+      vector<int>::iterator exact_begin = exact_items.begin() + q * FLAGS_k;
+      for (int i = 0; i < FLAGS_k; ++i) {
+        hits += std::count(exact_begin, exact_begin + FLAGS_k,
+            top_items[q * FLAGS_k + i]);
+      }
+    }
+    LOG(INFO) << "nprobe " << nprobe << "\trecall@" << FLAGS_k << ": "
+              << static_cast<float>(hits) / (num_query * FLAGS_k)
+              << "\t" << num_query / seconds << " queries/s";
+    if (nprobe == index.num_list()) {
+      break;
+    }
+  }
+  return 0;
+}